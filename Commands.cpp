@@ -1,1855 +1,9014 @@
-#include <unistd.h>
-#include <string.h>
-#include <iostream>
-#include <vector>
-#include <sstream>
-#include <sched.h>
-#include <sys/wait.h>
-#include <sys/stat.h>
-#include <iomanip>
-#include "Commands.h"
-#include <signal.h>
-#include <sys/types.h>
-#include <memory>
-#include <thread>
-#include <errno.h>
-
-using namespace std;
-
-const std::string WHITESPACE = " \n\r\t\f\v";
-
-//<---------------------------staff and aux functions--------------------------->
-
-#if 0
-#define FUNC_ENTRY() \
-    cout << __PRETTY_FUNCTION__ << " --> " << endl;
-
-#define FUNC_EXIT() \
-    cout << __PRETTY_FUNCTION__ << " <-- " << endl;
-#else
-#define FUNC_ENTRY()
-#define FUNC_EXIT()
-#endif
-
-string _ltrim(const std::string &s)
-{
-    size_t start = s.find_first_not_of(WHITESPACE);
-    return (start == std::string::npos) ? "" : s.substr(start);
-}
-
-string _rtrim(const std::string &s)
-{
-    size_t end = s.find_last_not_of(WHITESPACE);
-    return (end == std::string::npos) ? "" : s.substr(0, end + 1);
-}
-
-string _trim(const std::string &s)
-{
-    return _rtrim(_ltrim(s));
-}
-
-void _reformatArgsVec(char **args, vector<string> vec)
-{
-    for (int i = 0; i < int(vec.size()); i++)
-    {
-        args[i] = new char[vec[i].size() + 1];
-        memset(args[i], 0, vec[i].size() + 1);
-        strcpy(args[i], vec[i].c_str());
-    }
-    args[vec.size()] = NULL;
-}
-
-int _parseCommandLine(const char *cmd_line, char **args)
-{
-    FUNC_ENTRY()
-    int i = 0;
-    std::istringstream iss(_trim(string(cmd_line)).c_str());
-    for (std::string s; iss >> s;)
-    {
-        args[i] = (char *)malloc(s.length() + 1);
-        memset(args[i], 0, s.length() + 1);
-        strcpy(args[i], s.c_str());
-        args[++i] = NULL;
-    }
-    return i;
-
-    FUNC_EXIT()
-}
-
-bool _isBackgroundCommand(const char *cmd_line)
-{
-    const string str(cmd_line);
-    return str[str.find_last_not_of(WHITESPACE)] == '&';
-}
-
-void _removeBackgroundSign(char *cmd_line)
-{
-    const string str(cmd_line);
-    // find last character other than spaces
-    unsigned int idx = str.find_last_not_of(WHITESPACE);
-    // if all characters are spaces then return
-    if (idx == string::npos)
-    {
-        return;
-    }
-    // if the command line does not end with & then return
-    if (cmd_line[idx] != '&')
-    {
-        return;
-    }
-    // replace the & (background sign) with space and then remove all tailing spaces.
-    cmd_line[idx] = ' ';
-    // truncate the command line string up to the last non-space character
-    cmd_line[str.find_last_not_of(WHITESPACE, idx) + 1] = 0;
-}
-
-void removeBackgroundSignString(string &str)
-{
-    if (str.back() == '&')
-        str.erase(str.size() - 1, 1);
-}
-
-void try_catch(Command(*cmd))
-{
-    try
-    {
-        cmd->execute();
-    }
-    catch (SystemCallFailed &e)
-    {
-        perror(e.what());
-    }
-    catch (std::exception &e)
-    {
-        std::cerr << e.what() << std::endl;
-    }
-}
-
-
-std::vector<std::string> get_args_in_vec(const char *cmd_line)
-{
-    std::vector<std::string> res;
-    std::istringstream iss(_trim(string(cmd_line)).c_str());
-    for (std::string s; iss >> s;)
-        res.push_back(s);
-    return res;
-}
-
-bool _isSimpleExternal(std::string str)
-{
-    return str.find_first_of("*?") == std::string::npos;
-}
-
-// Checks if a given string is made of digits only
-bool isStringNumber(std::string str)
-{
-    if (str[0] == '-')
-        str.erase(0, 1);
-
-    if (int(str.size()) == 0)
-        return false;
-
-    for (int i = 0; i < int(str.size()); i++)
-    {
-        if (!isdigit(str[i]))
-            return false;
-    }
-    return true;
-}
-
-//<---------------------------staff and aux functions - end --------------------------->
-
-//<---------------------------C'tors and D'tors--------------------------->
-
-// Small Shell
-SmallShell::SmallShell() : prompt("smash> "), last_wd(""), current_command(nullptr), jobs_list(new JobsList()), timeOutList(new TimeOutList())
-{
-}
-
-SmallShell::~SmallShell()
-{
-    delete jobs_list;
-}
-
-// Command
-
-Command::Command(const char *cmd_line) : job_id(-1), process_id(getpid()), cmd_l(new char[strlen(cmd_line) + 1]),
-                                         external(false), time_out(false), args_vec()
-{
-
-    strcpy(cmd_l, cmd_line);
-    args_vec = get_args_in_vec(cmd_l);
-};
-
-Command::~Command()
-{
-    delete[] cmd_l;
-}
-
-BuiltInCommand::BuiltInCommand(const char *cmd_line) : Command(cmd_line)
-{
-    if (_isBackgroundCommand(args_vec.back().c_str()))
-    {
-        removeBackgroundSignString(args_vec.back());
-        if (args_vec.back() == "")
-            args_vec.pop_back();
-    }
-};
-
-RedirectionCommand::RedirectionCommand(const char *cmd_line, string sign) : Command(cmd_line),
-                                                                            base_command(nullptr), dest(), out_pd()
-{
-    SmallShell &smash = SmallShell::getInstance();
-
-    // finding the > / >> sign and validating arguments
-    string cmd_str = string(cmd_l);
-    int sign_index = cmd_str.find(sign);
-    if (sign_index == 0 || sign_index == int(cmd_str.size()) + 1)
-    {
-        InvaildArgument e(sign);
-        throw e;
-    }
-
-    // calculating the base command to be redirected (e.g., ls, showPid, ...) and the destination input file
-    int sign_size = sign.size();
-    string base_cmd = cmd_str.substr(0, sign_index);
-    dest = get_args_in_vec(cmd_str.substr(sign_index + sign_size, cmd_str.size() + 1).c_str())[0];
-    base_command = smash.CreateCommand(base_cmd.c_str());
-
-    // out_pd = the index of a new FD that points to the standard output
-    out_pd = dup(1);
-}
-
-void RedirectionCommand::execute()
-{
-    // changing the standard output to dest for smash itself
-    // external cmd routine:
-    if (base_command->isExternal())
-    {
-        int pid = fork();
-        if (pid == -1)
-        {
-            SystemCallFailed e("fork");
-            throw e;
-        }
-        // ------------------------------child-------------------------//
-        else if (pid == 0)
-        {
-            int res = setpgrp();
-            if (res < 0)
-                perror("smash error: setpgrp failed");
-
-            // prepare changes the stdout
-            prepare();
-            base_command->execute();
-        }
-
-        // ------------father----------//
-        else
-        {
-            waitpid(pid, nullptr, WUNTRACED);
-        }
-    }
-
-    // in case the cmd isn't external
-    else
-    {
-        // prepare changes the stdout
-        prepare();
-        try_catch(base_command.get());
-        // restores the correct stdout for smash
-        cleanup();
-    }
-}
-
-void RedirectionNormalCommand::prepare()
-{
-    bool write_with_append = false;
-    RedirectionCommand::prepareGeneral(write_with_append);
-}
-
-void RedirectionAppendCommand::prepare()
-{
-    bool write_with_append = true;
-    RedirectionCommand::prepareGeneral(write_with_append);
-}
-
-void RedirectionCommand::prepareGeneral(bool write_with_append)
-{
-    // permissions
-    int new_fd;
-    if (write_with_append)
-        new_fd = open(dest.c_str(), O_RDWR | O_APPEND | O_CREAT, S_IRWXU);
-    else
-        new_fd = open(dest.c_str(), O_RDWR | O_TRUNC | O_CREAT, S_IRWXU);
-    if (new_fd < 0)
-    {
-        SystemCallFailed e("open");
-        throw e;
-    }
-
-    // replacing stdout with dest
-    int res = dup2(new_fd, 1);
-
-    if (res < 0)
-    {
-        SystemCallFailed e("dup2");
-        throw e;
-    }
-
-    res = close(new_fd);
-    if (res < 0)
-    {
-        SystemCallFailed e("close");
-        throw e;
-    }
-}
-
-void RedirectionCommand::cleanup()
-{
-    int res = dup2(out_pd, 1);
-    if (res < 0)
-    {
-        SystemCallFailed e("dup2");
-        throw e;
-    }
-
-    // closing the new pd so the FDT won't get full
-    res = close(out_pd);
-    if (res < 0)
-    {
-        SystemCallFailed e("close");
-        throw e;
-    }
-}
-
-PipeCommand::PipeCommand(const char *cmd_line, string sign) : Command(cmd_line),
-                                                              write_command(nullptr), read_command(nullptr), standard_in_pd(0), standard_out_pd(0), standard_error_pd(0), fd()
-{
-    SmallShell &smash = SmallShell::getInstance();
-    string cmd_str = string(cmd_line);
-    int sign_index = cmd_str.find(sign);
-    if (sign_index == 0 || sign_index == int(cmd_str.size()) + 1)
-    {
-        InvaildArgument e(sign);
-        throw e;
-    }
-    // calculating the commands for the pipe
-    int sign_size = sign.size();
-    string first_cmd = cmd_str.substr(0, sign_index);
-    string second_cmd = cmd_str.substr(sign_index + sign_size, cmd_str.size() - sign_index - 1);
-    write_command = smash.CreateCommand(first_cmd.c_str());
-    read_command = smash.CreateCommand(second_cmd.c_str());
-    pipe(fd);
-
-    // allocating new FD for the stdin(0) stdout(1)  and stderr(2)
-    standard_in_pd = dup(0);
-    standard_out_pd = dup(1);
-    standard_error_pd = dup(2);
-}
-
-void PipeCommand::prepareWrite(int out_pid_num)
-{
-    dup2(fd[1], out_pid_num);
-    close(fd[0]);
-    close(fd[1]);
-}
-
-void PipeCommand::prepareRead()
-{
-    dup2(fd[0], 0);
-    close(fd[0]);
-    close(fd[1]);
-}
-
-void supress_out(int pid_num)
-{
-    int dev_null = open("/dev/null", O_WRONLY);
-    if (dev_null < 0)
-    {
-        SystemCallFailed e("open");
-        throw e;
-    }
-
-    // replacing stdout with dev_null
-    int res = dup2(dev_null, pid_num);
-
-    if (res < 0)
-    {
-        SystemCallFailed e("dup2");
-        throw e;
-    }
-
-    res = close(dev_null);
-    if (res < 0)
-    {
-        SystemCallFailed e("close");
-        throw e;
-    }
-}
-
-void PipeNormalCommand::execute()
-{
-    PipeCommand::execute(1);
-}
-
-void PipeSterrCommand::execute()
-{
-    PipeCommand::execute(2);
-}
-
-void PipeCommand::execute(int pid_num)
-{
-    if (!read_command->isExternal())
-    {
-        if (write_command->isExternal())
-        {
-            int pid3 = fork();
-            if (!pid3) // son
-            {
-                // redirect (stdout or stderr) to devNull
-                supress_out(pid_num);
-                int res = setpgrp();
-                if (res < 0)
-                    perror("smash error: setpgrp failed");
-                write_command->execute();
-            }
-            else
-            {
-                try_catch(read_command.get());
-                waitpid(pid3, nullptr, 0);
-            }
-        }
-        else
-        {
-            try_catch(read_command.get());
-
-            // redirect (stdout or stderr) to devNull
-            supress_out(pid_num);
-            try_catch(write_command.get());
-        }
-        cleanUp();
-    }
-    else
-    {
-        // fork the second process - for the read end of the pipe
-        int pid1 = fork();
-        if (!pid1)
-        {
-            int res = setpgrp();
-            if (res < 0)
-                perror("smash error: setpgrp failed");
-            prepareRead();
-            read_command->execute();
-        }
-
-        // write end of the pipe
-        if (write_command->isExternal())
-        {
-            int pid2 = fork();
-            if (!pid2)
-            {
-                prepareWrite(pid_num);
-                int res = setpgrp();
-                if (res < 0)
-                    perror("smash error: setpgrp failed");
-                write_command->execute();
-            }
-            else
-            {
-                // wait for the "write-son" to finish writing
-                close(fd[0]);
-                close(fd[1]);
-                waitpid(pid2, nullptr, 0);
-            }
-        }
-        else
-        {
-            prepareWrite(pid_num);
-            try_catch(write_command.get());
-
-            // restoring the FDT for smash
-            cleanUp();
-        }
-
-        // wait for the "read-son" to finish reading
-        waitpid(pid1, nullptr, 0);
-    }
-}
-
-void PipeCommand::cleanUp()
-{
-    int res1 = dup2(standard_in_pd, 0);
-    int res2 = dup2(standard_out_pd, 1);
-    int res3 = dup2(standard_error_pd, 2);
-    if (res1 == -1 || res2 == -1 || res3 == -1)
-    {
-        SystemCallFailed e("dup2");
-        throw e;
-    }
-
-    res1 = close(standard_out_pd);
-    res2 = close(standard_in_pd);
-    res3 = close(standard_error_pd);
-    if (res1 == -1 || res2 == -1 || res3 == -1)
-    {
-        SystemCallFailed e("close");
-        throw e;
-    }
-}
-
-//<---------------------------C'tors and D'tors - end--------------------------->
-
-//<---------------------------getters--------------------------->
-
-int TimeoutCommand::getTime() const
-{
-    return dest_time;
-}
-std::string SmallShell::get_last_wd() const
-{
-    return last_wd;
-}
-
-const char *Command::getCmdL() const
-{
-    return cmd_l;
-}
-
-int Command::getJobId() const
-{
-    return job_id;
-}
-
-int Command::getProcessId() const
-{
-    return process_id;
-}
-
-bool JobsList::JobEntry::getStopped() const
-{
-    return is_stopped;
-};
-
-int JobsList::JobEntry::getJobId() const
-{
-    return command->getJobId();
-};
-
-shared_ptr<Command> JobsList::JobEntry::getCommand() const
-{
-    return command;
-};
-
-shared_ptr<Command> SmallShell::getCurrentCommand() const
-{
-    return current_command;
-}
-
-//<---------------------------getters - end--------------------------->
-
-//<---------------------------setters--------------------------->
-
-void SmallShell::set_last_wd(std::string str)
-{
-    last_wd = str;
-}
-
-void Command::setJobId(int id)
-{
-    job_id = id;
-}
-
-void Command::setProcessId(int id)
-{
-    process_id = id;
-}
-
-void JobsList::JobEntry::setTime()
-{
-    init_time = time(NULL);
-};
-
-void JobsList::JobEntry::setStopped(bool is_stopped)
-{
-    this->is_stopped = is_stopped;
-};
-
-void SmallShell::setCurrentCommand(shared_ptr<Command> command)
-{
-    current_command = command;
-}
-
-//<---------------------------setters - end--------------------------->
-
-//<---------------------------execute functions--------------------------->
-
-void SmallShell::executeCommand(const char *cmd_line)
-{
-
-    string cmd_s = _trim(string(cmd_line));
-    string firstWord = cmd_s.substr(0, cmd_s.find_first_of(" \n"));
-
-    if (firstWord.compare("chprompt") == 0 || firstWord.compare("chprompt&") == 0)
-    {
-        changeChprompt(cmd_line);
-        return;
-    }
-
-    shared_ptr<Command> cmd = CreateCommand(cmd_line);
-
-    if (!cmd->isExternal() && !cmd->isTimeout())
-    {
-        cmd->execute();
-    }
-
-    else if (cmd->isTimeout())
-    {
-        this->addTimeOutCommand(dynamic_pointer_cast<TimeoutCommand>(cmd));
-        this->addJob(cmd);
-        if (!(_isBackgroundCommand(cmd_line)))
-        {
-            current_command = cmd;
-        }
-        cmd->execute();
-    }
-
-    else
-    {
-        int pid = fork();
-        if (pid == -1)
-        {
-            SystemCallFailed e("fork");
-            throw e;
-        }
-        // ------------------------------child-------------------------//
-        else if (pid == 0)
-        {
-            if (setpgrp() == -1)
-            {
-                SystemCallFailed e("setpgrp");
-                throw e;
-            }
-            cmd->execute();
-        }
-
-        //------------------------ father--------------------//
-        else
-        {
-            cmd->setProcessId(pid);
-            if (!(_isBackgroundCommand(cmd_line)))
-            {
-                current_command = cmd;
-                waitpid(pid, nullptr, WUNTRACED);
-                current_command = (nullptr);
-            }
-
-            // add background Command to Joblist
-            else
-            {
-                this->addJob(cmd, false);
-            }
-        }
-    }
-}
-
-void ShowPidCommand::execute()
-{
-    int process_id = getpid();
-    std::cout << "smash pid is " << process_id << std::endl;
-}
-
-void GetCurrDirCommand::execute()
-{
-    char cwd[256];
-
-    // get the current working directory
-    if (getcwd(cwd, sizeof(cwd)) != NULL)
-    {
-        std::cout << cwd << std::endl;
-    }
-    else
-    {
-        SystemCallFailed e("getcwd");
-        throw e;
-    }
-}
-
-void ChangeDirCommand::execute()
-{
-    SmallShell &smash = SmallShell::getInstance();
-    std::string new_dir;
-
-    //  Check amount of arguments
-    if (int(args_vec.size()) > 2)
-    {
-        TooManyArguments e("cd");
-        throw e;
-    }
-    // check if no arguement has given
-    if (int(args_vec.size()) == 1)
-        return;
-
-    //  Check if going to last working directory or a new one
-    if (args_vec[1] == "-")
-    {
-        //  if the last working directory doesn't exist
-        if (smash.get_last_wd().empty())
-        {
-            OldPWDNotSet e;
-            throw e;
-        }
-        else
-        {
-            new_dir = smash.get_last_wd();
-        }
-    }
-    else
-    {
-        new_dir = args_vec[1];
-    }
-
-    //  Save current directory
-    char buffer[256];
-    if (getcwd(buffer, sizeof(buffer)) == NULL)
-    {
-        SystemCallFailed e("getcwd");
-        throw e;
-    }
-
-    //  Change directory
-    int res = chdir(new_dir.c_str());
-    if (res == -1)
-    {
-        SystemCallFailed e("chdir");
-        throw e;
-    }
-    else
-    {
-        //  Save last working directory
-        smash.set_last_wd(string(buffer));
-    }
-}
-
-void ExternalCommand::execute()
-{
-    // removing & sign
-    if (_isBackgroundCommand(cmd_l))
-    {
-        removeBackgroundSignString(args_vec.back());
-        if (args_vec.back() == "")
-        {
-            args_vec.pop_back();
-        }
-    }
-    // parse path depending on Command type (Simple or Complex)
-    // inserting "-c" for Complex Command
-    bool simple_plag = _isSimpleExternal(cmd_l);
-    if (!simple_plag)
-    {
-      for (int i = 1; i < int(args_vec.size()); i++)
-            args_vec[0] += " " + args_vec[i];
-
-        for (int i = 1; i < int(args_vec.size()); i++)
-            args_vec.pop_back();
-
-        args_vec.insert(args_vec.begin(), "/bin/bash");
-        args_vec.insert(args_vec.begin() + 1, "-c");
-    }
-
-    // reforming args_vec
-    char **args = new char *[args_vec.size() + 1];
-    _reformatArgsVec(args, args_vec);
-
-    // executing Command
-    if (execv(args[0], args) == -1)
-    {
-        if (simple_plag)
-        {
-           args_vec[0] = "/bin/" + args_vec[0];
-            _reformatArgsVec(args, args_vec);
-            execv(args[0], args);
-
-            // if will continue it means the exec failed - let's try the /usr/bin folder
-            args_vec[0] = "/usr" + args_vec[0];
-            _reformatArgsVec(args, args_vec);
-            execv(args[0], args);
-        }
-        perror("smash error: execv failed");
-
-        // kill forked process
-        exit(1);
-    }
-}
-
-void JobsCommand::execute()
-{
-    //  Remove finised jobs
-    jobs->removeFinishedJobs();
-
-    //  Print jobs list
-    jobs->printJobsList();
-}
-
-void BackgroundCommand::execute()
-{
-    if (int(args_vec.size()) >= 3)
-    {
-        if (isStringNumber(args_vec[1]))
-        {
-            int job_id_to_find = stoi(args_vec[1]);
-            if (jobs->getJobById(job_id_to_find) == nullptr)
-            {
-                JobIdDoesntExist e("bg", job_id_to_find);
-                throw e;
-            }
-        }
-        InvaildArgument e("bg");
-        throw e;
-    }
-
-    // if a specific job was given
-    if (int(args_vec.size()) == 2)
-    {
-        int job_id_to_find;
-
-        //  checking if valid argument(a number)
-        if (isStringNumber(args_vec[1]))
-        {
-            job_id_to_find = stoi(args_vec[1]);
-        }
-        else
-        {
-            InvaildArgument e("bg");
-            throw e;
-        }
-
-        //  getting the job from the list - if doesn't exist, a nullptr will return
-        JobsList::JobEntry *job = this->jobs->getJobById(job_id_to_find);
-        if (job != nullptr)
-        {
-            if (job->getStopped())
-            {
-
-                int pid = job->getCommand()->getProcessId();
-
-                //  updating the command's status
-                job->setStopped(false);
-
-                //  printing the cmd_line of the command
-                std::cout << job->getCommand()->getCmdL() << " : " << pid << std::endl;
-
-                // continue cammand without wating for it
-                if (kill(pid, SIGCONT) == -1)
-                {
-                    SystemCallFailed e("kill");
-                    throw e;
-                }
-            }
-            else
-            {
-                JobAlreadyRunning e(job_id_to_find);
-                throw e;
-            }
-        }
-        else
-        {
-            JobIdDoesntExist e("bg", job_id_to_find);
-            throw e;
-        }
-    }
-    //  if no specific job was given
-    else
-    {
-        JobsList::JobEntry *job = this->jobs->getLastStoppedJob(nullptr);
-        if (job != nullptr)
-        {
-            int pid = job->getCommand()->getProcessId();
-
-            //  updating the command's status
-            job->setStopped(false);
-
-            //  printig the cmd_line of the command
-            std::cout << job->getCommand()->getCmdL() << " : " << pid << std::endl;
-
-            // continue cammand without wating for it
-            if (kill(pid, SIGCONT) == -1)
-            {
-                SystemCallFailed e("kill");
-                throw e;
-            }
-        }
-        else
-        {
-            NoStoppedJobs e;
-            throw e;
-        }
-    }
-}
-
-/*
-The function brings the job required to the foreground
-input:
-    job_id - the id of the job we need to continue - if it's 0, bring the last job in the jobs list to the foreground
-    jobs - pointer to the jobs list variable in the smash
-
-*/
-void bringCommandToForegound(int job_id, JobsList *jobs)
-{
-    if (job_id == 0 && jobs->isEmpty())
-    {
-        JobsListEmpty e;
-        throw e;
-    }
-
-    //  get the job required - if the job_id doesn't exist, nullptr will be returned
-    JobsList::JobEntry *job_to_cont = job_id == 0 ? jobs->getLastJob(nullptr) : jobs->getJobById(job_id);
-
-    //
-    if (job_to_cont != nullptr)
-    {
-        int pid = job_to_cont->getCommand()->getProcessId();
-
-        //  print the cmd_line of the command
-        std::cout << job_to_cont->getCommand()->getCmdL() << " : " << pid << std::endl;
-
-        //  send a continue signal to the process
-        if (kill(pid, SIGCONT) == -1)
-        {
-            SystemCallFailed e("kill");
-            throw e;
-        }
-
-        //  update the job's status
-        job_to_cont->setStopped(false);
-
-        //  save current command running in the foreground
-        SmallShell &smash = SmallShell::getInstance();
-        smash.setCurrentCommand(job_to_cont->getCommand());
-
-        //  wait for process to finish
-        waitpid(pid, nullptr, WUNTRACED);
-
-        //  remove job from jobsList if finished properly
-        if (smash.getCurrentCommand() != nullptr)
-            smash.removeJob(job_to_cont->getJobId());
-
-        //  delete current process from current command
-        smash.setCurrentCommand(nullptr);
-    }
-    else
-    {
-        JobIdDoesntExist e("fg", job_id);
-        throw e;
-    }
-}
-
-void ForegroundCommand::execute()
-{
-    //  no specific job required
-    if (int(args_vec.size()) == 1)
-    {
-        bringCommandToForegound(0, jobs);
-    }
-    //    specific job required
-    else if (int(args_vec.size()) == 2)
-    {
-        int job_id_to_find;
-
-        // check if valid
-        if (isStringNumber(args_vec[1]))
-        {
-            job_id_to_find = stoi(args_vec[1]);
-        }
-        else
-        {
-            InvaildArgument e("fg");
-            throw e;
-        }
-        if (job_id_to_find <= 0)
-        {
-            JobIdDoesntExist e("fg", job_id_to_find);
-            throw e;
-        }
-        else
-        {
-            bringCommandToForegound(job_id_to_find, jobs);
-        }
-    }
-    else
-    {
-        if (isStringNumber(args_vec[1]))
-        {
-            int job_id_to_find = stoi(args_vec[1]);
-            if (jobs->getJobById(job_id_to_find) == nullptr)
-            {
-                JobIdDoesntExist e("fg", job_id_to_find);
-                throw e;
-            }
-        }
-
-        InvaildArgument e("fg");
-        throw e;
-    }
-}
-
-void QuitCommand::execute()
-{
-    bool flag_kill = false;
-
-    //  check if 'kill' was given as an argument
-    for (int i = 1; i < int(args_vec.size()); i++)
-    {
-        if (args_vec[i] == "kill")
-        {
-            flag_kill = true;
-            break;
-        }
-    }
-
-    //  kill all jobs in the jobs list
-    if (flag_kill)
-    {
-        jobs->killAllJobs();
-    }
-    exit(0);
-}
-
-/* checks :
-    -if the first char is '-'
-    -if the string given is a number
-    returns: the number if the string was given correctly. if Not, returns -1.
-*/
-int getSignalNumber(std::string str)
-{
-    if (str[0] != '-')
-    {
-        return -1;
-    }
-
-    //  remove the '-' from the string
-    str.erase(0, 1);
-
-    //  convert to integer
-    int num;
-    if (isStringNumber(str))
-    {
-        num = stoi(str);
-        if (num >= 0)
-            return num;
-    }
-    return -1;
-}
-
-void KillCommand::execute()
-{
-    //  check amount of arguments
-    if (int(args_vec.size()) != 3)
-    {
-        if (int(args_vec.size()) > 3)
-        {
-            if (isStringNumber(args_vec[2]))
-            {
-                int job_id_to_find = stoi(args_vec[2]);
-                if (jobs->getJobById(job_id_to_find) == nullptr)
-                {
-                    JobIdDoesntExist e("kill", job_id_to_find);
-                    throw e;
-                }
-            }
-        }
-        InvaildArgument e("kill");
-        throw e;
-    }
-
-    //  get the number of the signal
-    std::string signal_requested = args_vec[1];
-    std::string job_id_requested = args_vec[2];
-
-    int signal_num = getSignalNumber(signal_requested); // return -1 if the format is wrong
-    int job_id;
-
-    if (isStringNumber(job_id_requested))
-    {
-        job_id = stoi(job_id_requested);
-    }
-    else
-    {
-        InvaildArgument e("kill");
-        throw e;
-    }
-    if (signal_num == -1)
-    {
-        InvaildArgument e("kill");
-        throw e;
-    }
-
-    //  get the job - if does not exist, nullptr will be returned
-    JobsList::JobEntry *job = jobs->getJobById(job_id);
-    if (job == nullptr)
-    {
-        JobIdDoesntExist e("kill", job_id);
-        throw e;
-    }
-    else
-    {
-        int pid = job->getCommand()->getProcessId();
-
-        //  kill signals
-        if (signal_num == 9 || signal_num == 15 || signal_num == 6 || signal_num == 2)
-        {
-            if (kill(pid, signal_num) == -1)
-            {
-                SystemCallFailed e("kill");
-                throw e;
-            }
-            else
-            {
-                //  remove the job from the jobs list for good
-                jobs->removeJobById(job->getJobId());
-            }
-        }
-
-        //  stop signals
-        else if (signal_num == 19)
-        {
-            if (kill(pid, signal_num) == -1)
-            {
-                SystemCallFailed e("kill");
-                throw e;
-            }
-            else
-            {
-                //  update the jobs status
-                job->setStopped(true);
-            }
-        }
-
-        // continute job signals
-        else if (signal_num == 18)
-        {
-            if (kill(pid, signal_num) == -1)
-            {
-                SystemCallFailed e("kill");
-                throw e;
-            }
-            else
-            {
-                //  update the jobs status
-                job->setStopped(false);
-            }
-        }
-
-        // ordinary signals
-        else
-        {
-            if (kill(pid, signal_num) == -1)
-            {
-                SystemCallFailed e("kill");
-                throw e;
-            }
-        }
-        std::cout << "signal number " << signal_num << " was sent to pid " << pid << std::endl;
-    }
-}
-
-void SetcoreCommand::execute()
-{
-    //  checks amount of arguments
-    if (int(args_vec.size()) != 3)
-    {
-        if (int(args_vec.size()) == 2)
-        {
-        }
-        if (int(args_vec.size()) > 3)
-        {
-            if (isStringNumber(args_vec[2]))
-            {
-                int job_id_to_find = stoi(args_vec[2]);
-                if (jobs->getJobById(job_id_to_find) == nullptr)
-                {
-                    JobIdDoesntExist e("setcore", job_id_to_find);
-                    throw e;
-                }
-            }
-            if (isStringNumber(args_vec[1]))
-            {
-                int core_number = stoi(args_vec[1]);
-                int cores_in_cpu = std::thread::hardware_concurrency();
-                if (core_number < 0 || core_number >= cores_in_cpu)
-                {
-                    InvaildCoreNumber e;
-                    throw e;
-                }
-            }
-        }
-
-        InvaildArgument e("setcore");
-        throw e;
-    }
-
-    //  check if the given core and the job id is indeed a number
-    bool valid_arg1 = isStringNumber(args_vec[1]);
-    bool valid_arg2 = isStringNumber(args_vec[2]);
-
-    if (valid_arg1 && valid_arg2)
-    {
-        //  convert to integers
-        int job_id = stoi(args_vec[1]);
-        int core_number = stoi(args_vec[2]);
-
-        //  get job required
-        JobsList::JobEntry *job = jobs->getJobById(job_id);
-
-        if (job == nullptr)
-        {
-            JobIdDoesntExist e("setcore", job_id);
-            throw e;
-        }
-        else
-        {
-
-            //  get amount of cores in the cpu
-            int cores_in_cpu = std::thread::hardware_concurrency();
-
-            //  check if the core that was given is in range
-            if (cores_in_cpu <= core_number || core_number < 0)
-            {
-                InvaildCoreNumber e;
-                throw e;
-            }
-
-            //  checking if the command is 'sleep'
-            string cmd_s = _trim(string(job->getCommand()->getCmdL()));
-            string firstWord = cmd_s.substr(0, cmd_s.find_first_of(" \n"));
-            if (firstWord.compare("sleep") == 0)
-                return;
-
-            int pid = job->getCommand()->getProcessId();
-
-            //  set the job's core
-            cpu_set_t set;
-            CPU_ZERO(&set);
-            CPU_SET(core_number, &set);
-            if (sched_setaffinity(pid, sizeof(cpu_set_t), &set) == -1)
-            {
-                SystemCallFailed e("sched_setaffinity");
-                throw e;
-            }
-        }
-    }
-    else
-    {
-        InvaildArgument e("setcore");
-        throw e;
-    }
-}
-
-void GetFileTypeCommand::execute()
-{
-
-    // check amount of arguments
-    if (int(args_vec.size()) != 2)
-    {
-        InvaildArgument e("getfiletype");
-        throw e;
-    }
-    //  get info on path
-
-    std::string path = args_vec[1];
-    struct stat stats;
-
-    if (stat(path.c_str(), &stats) == -1)
-    {
-        SystemCallFailed e("stat");
-        throw e;
-    }
-
-    int file_size = stats.st_size;
-
-    //  get file's type
-    std::string file_type;
-    switch (stats.st_mode & S_IFMT)
-    {
-    case S_IFBLK:
-        file_type = "block device";
-        break;
-    case S_IFCHR:
-        file_type = "character device";
-        break;
-    case S_IFDIR:
-        file_type = "directory";
-        break;
-    case S_IFIFO:
-        file_type = "FIFO";
-        break;
-    case S_IFLNK:
-        file_type = "symlink";
-        break;
-    case S_IFREG:
-        file_type = "regular file";
-        break;
-    case S_IFSOCK:
-        file_type = "socket";
-        break;
-    default:
-        file_type = "unknown";
-        break;
-    }
-
-    //  print info
-    std::cout << path << "'s type is \"" << file_type << "\" and takes up " << file_size << " bytes" << std::endl;
-}
-
-// assume chmod takes up to 4 args
-bool isChmodArgsValid(const string args)
-{
-    int count = 0;
-    for (const char c : args)
-    {
-        count++;
-        int i = c - '0';
-        if (count > 4 || i > 7 || i < 0)
-            return false;
-    }
-    return true;
-}
-
-void ChmodCommand::execute()
-{
-    if (int(args_vec.size()) != 3 || !isChmodArgsValid(args_vec[1]))
-    {
-        InvaildArgument e("chmod");
-        throw e;
-    }
-    {
-        int i;
-        i = strtol(args_vec[1].c_str(), 0, 8);
-        if (chmod(args_vec[2].c_str(), i) < 0)
-        {
-            SystemCallFailed e("chmod");
-            throw e;
-        }
-    }
-}
-//<--------------------------- execute functions - end--------------------------->
-
-//<--------------------------- Jobs List functions--------------------------->
-
-bool JobsList::isEmpty() const
-{
-    return int(this->jobs.size()) == 0;
-}
-
-void JobsList::JobEntry::printInfo() const
-{
-    //  calculate the time passed
-    int current_time = time(NULL);
-    int time_diff = difftime(current_time, init_time);
-
-    // get status of job
-    string stopped_str = is_stopped ? " (stopped)" : "";
-    string cmd_l(command->getCmdL());
-
-    // get pid
-    int pid = command->getProcessId();
-
-    //  print info
-    std::cout << "[" << command->getJobId() << "] " << cmd_l << " : " << pid << " " << time_diff << " secs" << stopped_str << std::endl;
-};
-
-//  returns the max id that is currently in the jobs list
-int JobsList::getMaxId() const
-{
-    int max_id = 0;
-    for (int i = 0; i < int(jobs.size()); i++)
-    {
-        if (jobs[i]->getJobId() > max_id)
-        {
-            max_id = jobs[i]->getJobId();
-        }
-    }
-    return max_id;
-}
-
-void JobsList::addJob(shared_ptr<Command> command, bool is_stopped)
-{
-    //  remove finished job before checking max id
-    this->removeFinishedJobs();
-    if (command->getJobId() == -1)
-    {
-        //<----------- command was Not in the jobs list before ----------->
-
-        // get job id for new command
-        int job_id = getMaxId() + 1;
-
-        //  update the command's job id
-        command->setJobId(job_id);
-
-        //  add job
-        std::shared_ptr<JobEntry> new_job(new JobEntry(command, is_stopped));
-        jobs.push_back(new_job);
-    }
-    else
-    {
-        //<----------- command was in the jobs list before ----------->
-
-        //  find the job in the jobs list
-        for (int i = 0; i < int(jobs.size()); i++)
-        {
-            if (jobs[i]->getJobId() == command->getJobId())
-            {
-                //  reset time to current time
-                jobs[i]->setTime();
-                jobs[i]->setStopped(is_stopped);
-                break;
-            }
-        }
-    }
-}
-
-void JobsList::removeJobById(int jobId)
-{
-    //  find job and remove it from the jobs list's vector
-    for (int i = 0; i < int(jobs.size()); i++)
-    {
-        if (jobs[i]->getJobId() == jobId)
-        {
-            if (jobs[i]->getCommand()->isTimeout())
-            {
-                shared_ptr<TimeoutCommand> cmd = dynamic_pointer_cast<TimeoutCommand>(jobs[i]->getCommand());
-                SmallShell &smash = SmallShell::getInstance();
-                smash.removeTimeOutCommand(cmd);
-            }
-            jobs.erase(jobs.begin() + i);
-            break;
-        }
-    }
-}
-
-JobsList::JobEntry *JobsList::getJobById(int jobId)
-{
-    this->removeFinishedJobs();
-    for (int i = 0; i < int(jobs.size()); i++)
-    {
-        if (jobs[i]->getJobId() == jobId)
-        {
-            return jobs[i].get();
-        }
-    }
-    return nullptr;
-}
-
-JobsList::JobEntry *JobsList::getLastJob(int *lastJobId)
-{
-    this->removeFinishedJobs();
-    if (int(jobs.size()) == 0)
-        return nullptr;
-    return jobs.back().get();
-}
-
-JobsList::JobEntry *JobsList::getLastStoppedJob(int *jobId)
-{
-    this->removeFinishedJobs();
-    int i = jobs.size() - 1;
-
-    //  goes from back to start in order to get the biggest one
-    while (i >= 0)
-    {
-        if (jobs[i]->getStopped())
-        {
-            return jobs[i].get();
-        }
-        i--;
-    }
-    return nullptr;
-}
-
-void JobsList::printJobsList()
-{
-    for (int i = 0; i < int(jobs.size()); i++)
-    {
-        jobs[i]->printInfo();
-    }
-}
-
-void JobsList::killAllJobs()
-{
-    // remove finished jobs in order to prevent a signal from sending
-    this->removeFinishedJobs();
-
-    // print info according to assignment
-    std::cout << "smash: sending SIGKILL signal to " << jobs.size() << " jobs:" << std::endl;
-    for (int i = 0; i < int(jobs.size()); i++)
-    {
-        std::cout << jobs[i]->getCommand()->getProcessId() << ": " << jobs[i]->getCommand()->getCmdL() << std::endl;
-    }
-
-    //  send kill signals to all processes
-
-    for (int i = int(jobs.size()) - 1; i >= 0; i--)
-    {
-
-        int pid = jobs[i]->getCommand()->getProcessId();
-        int job_id = jobs[i]->getJobId();
-
-        //  send kill signal
-        if (kill(pid, SIGKILL) == -1)
-            perror("smash error: kill failed");
-
-        //  remove from jobs list
-        this->removeJobById(job_id);
-    }
-}
-void JobsList::removeFinishedJobs()
-{
-    std::vector<int> jobs_to_delete;
-    for (int i = 0; i < int(jobs.size()); i++)
-    {
-        //  check if a process is finished
-
-        if (jobs[i]->getCommand()->isTimeout())
-        {
-            shared_ptr<TimeoutCommand> cmd = dynamic_pointer_cast<TimeoutCommand>(jobs[i]->getCommand());
-            if (cmd->getTime() <= time(nullptr))
-                jobs_to_delete.push_back(jobs[i]->getJobId());
-            continue;
-        }
-
-        int pid = jobs[i]->getCommand()->getProcessId();
-        int res = waitpid(pid, nullptr, WNOHANG);
-        if (res > 0)
-        {
-            jobs_to_delete.push_back(jobs[i]->getJobId());
-        }
-    }
-
-    //  remove the finished jobs
-    for (int i = 0; i < int(jobs_to_delete.size()); i++)
-    {
-        this->removeJobById(jobs_to_delete[i]);
-    }
-}
-
-//<--------------------------- Jobs List functions - end--------------------------->
-
-//<--------------------------- Smash List functions--------------------------->
-
-/**
- * Creates and returns a pointer to Command class which matches the given command line (cmd_line)
- */
-
-bool isAppendRedirect(string cmd_str)
-{
-    return cmd_str.find(">>") != string::npos;
-}
-bool isSterrPipe(string cmd_str)
-{
-    return cmd_str.find("|&") != string::npos;
-}
-
-bool isRedirect(string cmd_str)
-{
-    return cmd_str.find(">") != string::npos;
-}
-bool isPipe(string cmd_str)
-{
-    return cmd_str.find("|") != string::npos;
-}
-
-shared_ptr<Command> SmallShell::CreateCommand(const char *cmd_line)
-{
-
-    string cmd_s = _trim(string(cmd_line));
-    string firstWord = cmd_s.substr(0, cmd_s.find_first_of(" \n"));
-    if (_isBackgroundCommand(firstWord.c_str()))
-    {
-        removeBackgroundSignString(firstWord);
-    }
-
-    if (isAppendRedirect(string(cmd_line)))
-    {
-        return shared_ptr<Command>(new RedirectionAppendCommand(cmd_line));
-    }
-    else if (isSterrPipe(string(cmd_line)))
-    {
-        return shared_ptr<Command>(new PipeSterrCommand(cmd_line));
-    }
-    if (isRedirect(string(cmd_line)))
-    {
-        return shared_ptr<Command>(new RedirectionNormalCommand(cmd_line));
-    }
-    else if (isPipe(string(cmd_line)))
-    {
-        return shared_ptr<Command>(new PipeNormalCommand(cmd_line));
-    }
-    else if (firstWord.compare("pwd") == 0)
-    {
-        return shared_ptr<Command>(new GetCurrDirCommand(cmd_line));
-    }
-    else if (firstWord.compare("showpid") == 0)
-    {
-        return shared_ptr<Command>(new ShowPidCommand(cmd_line));
-    }
-    else if (firstWord.compare("cd") == 0)
-    {
-        return shared_ptr<Command>(new ChangeDirCommand(cmd_line));
-    }
-    else if (firstWord.compare("jobs") == 0)
-    {
-        return shared_ptr<Command>(new JobsCommand(cmd_line, this->jobs_list));
-    }
-    else if (firstWord.compare("bg") == 0)
-    {
-        return shared_ptr<Command>(new BackgroundCommand(cmd_line, this->jobs_list));
-    }
-    else if (firstWord.compare("fg") == 0)
-    {
-        return shared_ptr<Command>(new ForegroundCommand(cmd_line, this->jobs_list));
-    }
-    else if (firstWord.compare("kill") == 0)
-    {
-        return shared_ptr<Command>(new KillCommand(cmd_line, this->jobs_list));
-    }
-    else if (firstWord.compare("quit") == 0)
-    {
-        return shared_ptr<Command>(new QuitCommand(cmd_line, this->jobs_list));
-    }
-    else if (firstWord.compare("setcore") == 0)
-    {
-        return shared_ptr<Command>(new SetcoreCommand(cmd_line, this->jobs_list));
-    }
-    else if (firstWord.compare("getfiletype") == 0)
-    {
-        return shared_ptr<Command>(new GetFileTypeCommand(cmd_line));
-    }
-    else if (firstWord.compare("chmod") == 0)
-    {
-        return shared_ptr<Command>(new ChmodCommand(cmd_line));
-    }
-    else if (firstWord.compare("timeout") == 0)
-    {
-        return shared_ptr<Command>(new TimeoutCommand(cmd_line));
-    }
-    else
-    {
-        return shared_ptr<Command>(new ExternalCommand(cmd_line));
-    }
-
-    return nullptr;
-}
-
-void SmallShell::changeChprompt(const char *cmd_line)
-{
-    std::string cmd_line_string(cmd_line);
-    if (_isBackgroundCommand(cmd_line))
-    {
-        removeBackgroundSignString(cmd_line_string);
-    }
-
-    vector<string> args = get_args_in_vec(cmd_line_string.c_str());
-    string new_prompt = int(args.size()) == 1 ? "smash> " : (args[1] + "> ");
-    prompt = new_prompt;
-}
-
-void SmallShell::printPrompt() const
-{
-    std::cout << prompt;
-}
-
-void SmallShell::addJob(shared_ptr<Command> cmd, bool is_stopped)
-{
-    jobs_list->addJob(cmd, is_stopped);
-};
-
-void SmallShell::removeJob(int job_id)
-{
-    jobs_list->removeJobById(job_id);
-};
-
-//<--------------------------- Smash functions - end--------------------------->
-
-//// bonus
-
-void SmallShell::addTimeOutCommand(std::shared_ptr<TimeoutCommand> cmd)
-{
-    timeOutList->addToList(cmd);
-}
-
-void SmallShell::removeTimeOutCommand(std::shared_ptr<TimeoutCommand> cmd)
-{
-    timeOutList->removeCommand(cmd);
-}
-
-void SmallShell::handleAlarm()
-{
-    timeOutList->handleSignal();
-}
-
-TimeoutCommand::TimeoutCommand(const char *cmd_line) : BuiltInCommand(cmd_line)
-{
-
-    // check if time given is a positive number
-    if (args_vec.size() < 3 || !isStringNumber(args_vec[1]) || stoi(args_vec[1]) < 0)
-    {
-        InvaildArgument e("timeout");
-        throw e;
-    }
-
-    SmallShell &smash = SmallShell::getInstance();
-
-    // in BuiltInCommand C'tor we delete the '&' from the args vec so we need to return it here
-    if (_isBackgroundCommand(cmd_line))
-        args_vec = get_args_in_vec(cmd_line);
-
-    string target_cmd_str = "";
-    for (int i = 2; i < int(args_vec.size()); i++)
-        target_cmd_str += args_vec[i] += " ";
-
-    target_cmd = smash.CreateCommand(target_cmd_str.c_str());
-
-    int time_to_alarm = stoi(args_vec[1]);
-    dest_time = time(nullptr) + time_to_alarm;
-    m_pid = getProcessId();
-    time_out = true;
-};
-
-void TimeoutCommand::execute()
-{
-    SmallShell &smash = SmallShell::getInstance();
-
-    // we assume all the commands are External, because a built-in command will end very quick...
-    if (!target_cmd->isExternal())
-    {
-        target_cmd->execute();
-        return;
-    }
-
-    int pid = fork();
-
-    if (pid == -1)
-    {
-        SystemCallFailed e("fork");
-        throw e;
-    }
-    // ------------------------------child-------------------------//
-    else if (pid == 0)
-    {
-        int res = setpgrp();
-        if (res < 0)
-            perror("smash error: setpgrp failed");
-        target_cmd->execute();
-    }
-
-    //------------------------ father--------------------//
-    else
-    {
-
-        // store the pid of the child in the list
-        m_pid = pid;
-        process_id = pid;
-        target_cmd->setProcessId(pid);
-        if (!(_isBackgroundCommand(target_cmd->getCmdL())))
-        {
-            // smash.setCurrentCommand(target_cmd);
-            waitpid(pid, nullptr, WUNTRACED);
-            smash.setCurrentCommand(nullptr);
-        }
-    }
-}
-
-void TimeOutList::removeNext()
-{
-    time_out_list.pop_front();
-    if (time_out_list.empty())
-    {
-        next_cmd = nullptr;
-        return;
-    }
-    next_cmd = time_out_list.front();
-    makeAlarm();
-}
-
-void TimeOutList::removedFinished()
-{
-    auto it = time_out_list.begin();
-    while (it != time_out_list.end())
-    {
-        //  check if a process is finished
-        int pid = (*it)->getTimeoutTargetPid();
-        int res = waitpid(pid, nullptr, WNOHANG);
-        if (res > 0)
-        {
-            it = time_out_list.erase(it);
-        }
-        else
-            it++;
-    }
-}
-void TimeOutList::makeAlarm()
-{
-    int cmd_time = next_cmd->getTime();
-    time_to_next = cmd_time - time(nullptr);
-    alarm(time_to_next);
-}
-
-int TimeoutCommand::getTimeoutTargetPid()
-{
-    return m_pid;
-}
-void TimeOutList::handleSignal()
-{
-    if (next_cmd == nullptr)
-        return;
-    int target_pid = next_cmd->getTimeoutTargetPid();
-    // check if the command already stopped before killing it
-    int is_terminated = waitpid(target_pid, nullptr, WNOHANG);
-
-    if (!is_terminated && target_pid != getpid())
-    {
-        if (kill(target_pid, SIGKILL) == -1)
-        {
-            SystemCallFailed e("kill");
-            throw e;
-        }
-        std::cout << "smash: " + string(next_cmd->getCmdL()) + " timed out!" << std::endl;
-    }
-    removeNext();
-}
-
-void TimeOutList::removeCommand(std::shared_ptr<TimeoutCommand> cmd_to_del)
-{
-    if (cmd_to_del == next_cmd)
-    {
-        removeNext();
-        return;
-    }
-    for (auto it = time_out_list.begin(); it != time_out_list.end(); it++)
-    {
-        if ((*it) == cmd_to_del)
-        {
-            time_out_list.erase(it);
-            return;
-        }
-    }
-}
-
-void TimeOutList::addToList(std::shared_ptr<TimeoutCommand> new_cmd)
-{
-    // removedFinished();
-    int new_cmd_time = new_cmd->getTime();
-    if (new_cmd_time < time_to_next + time(nullptr) || time_out_list.empty())
-    {
-        next_cmd = new_cmd;
-        makeAlarm();
-    }
-    for (auto it = time_out_list.begin(); it != time_out_list.end(); it++)
-    {
-        if ((*it)->getTime() > new_cmd_time)
-        {
-            time_out_list.insert(it, new_cmd);
-            return;
-        }
-    }
-    time_out_list.push_back(new_cmd);
-};
+#include <unistd.h>
+#include <string.h>
+#include <iostream>
+#include <vector>
+#include <sstream>
+#include <sched.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <iomanip>
+#include "Commands.h"
+#include <signal.h>
+#include <sys/types.h>
+#include <memory>
+#include <thread>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+#include <limits.h>
+#include <math.h>
+#include <algorithm>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/prctl.h>
+#include <spawn.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <glob.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <linux/futex.h>
+#include <regex.h>
+
+using namespace std;
+
+const std::string WHITESPACE = " \n\r\t\f\v";
+
+//<---------------------------staff and aux functions--------------------------->
+
+#if 0
+#define FUNC_ENTRY() \
+    cout << __PRETTY_FUNCTION__ << " --> " << endl;
+
+#define FUNC_EXIT() \
+    cout << __PRETTY_FUNCTION__ << " <-- " << endl;
+#else
+#define FUNC_ENTRY()
+#define FUNC_EXIT()
+#endif
+
+string _ltrim(const std::string &s)
+{
+    size_t start = s.find_first_not_of(WHITESPACE);
+    return (start == std::string::npos) ? "" : s.substr(start);
+}
+
+string _rtrim(const std::string &s)
+{
+    size_t end = s.find_last_not_of(WHITESPACE);
+    return (end == std::string::npos) ? "" : s.substr(0, end + 1);
+}
+
+string _trim(const std::string &s)
+{
+    return _rtrim(_ltrim(s));
+}
+
+void _reformatArgsVec(char **args, vector<string> vec)
+{
+    for (int i = 0; i < int(vec.size()); i++)
+    {
+        args[i] = new char[vec[i].size() + 1];
+        memset(args[i], 0, vec[i].size() + 1);
+        strcpy(args[i], vec[i].c_str());
+    }
+    args[vec.size()] = NULL;
+}
+
+int _parseCommandLine(const char *cmd_line, char **args)
+{
+    FUNC_ENTRY()
+    int i = 0;
+    std::istringstream iss(_trim(string(cmd_line)).c_str());
+    for (std::string s; iss >> s;)
+    {
+        args[i] = (char *)malloc(s.length() + 1);
+        memset(args[i], 0, s.length() + 1);
+        strcpy(args[i], s.c_str());
+        args[++i] = NULL;
+    }
+    return i;
+
+    FUNC_EXIT()
+}
+
+bool _isBackgroundCommand(const char *cmd_line)
+{
+    const string str(cmd_line);
+    return str[str.find_last_not_of(WHITESPACE)] == '&';
+}
+
+void _removeBackgroundSign(char *cmd_line)
+{
+    const string str(cmd_line);
+    // find last character other than spaces
+    unsigned int idx = str.find_last_not_of(WHITESPACE);
+    // if all characters are spaces then return
+    if (idx == string::npos)
+    {
+        return;
+    }
+    // if the command line does not end with & then return
+    if (cmd_line[idx] != '&')
+    {
+        return;
+    }
+    // replace the & (background sign) with space and then remove all tailing spaces.
+    cmd_line[idx] = ' ';
+    // truncate the command line string up to the last non-space character
+    cmd_line[str.find_last_not_of(WHITESPACE, idx) + 1] = 0;
+}
+
+void removeBackgroundSignString(string &str)
+{
+    if (str.back() == '&')
+        str.erase(str.size() - 1, 1);
+}
+
+void try_catch(Command(*cmd))
+{
+    OutputOwner owner(SmallShell::getInstance().getOutput(), cmd);
+    try
+    {
+        cmd->execute();
+    }
+    catch (SystemCallFailed &e)
+    {
+        // keep the order of stdout and stderr
+        SmallShell::getInstance().getOutput().flush();
+        perror(e.what());
+    }
+    catch (std::exception &e)
+    {
+        SmallShell::getInstance().getOutput().flush();
+        std::cerr << e.what() << std::endl;
+    }
+}
+
+
+std::vector<std::string> get_args_in_vec(const char *cmd_line)
+{
+    std::vector<std::string> res;
+    std::istringstream iss(_trim(string(cmd_line)).c_str());
+    for (std::string s; iss >> s;)
+        res.push_back(s);
+    return res;
+}
+
+bool _isSimpleExternal(std::string str)
+{
+    return str.find_first_of("*?'\"") == std::string::npos;
+}
+
+/*
+Executes an external command's argv - a simple command that is not found as given is looked up in /bin and /usr/bin.
+returns: only if every exec failed (errno is set)
+*/
+void _execExternal(const vector<string> &args, bool simple, char **envp)
+{
+    vector<string> path_args = args;
+    char **c_args = new char *[path_args.size() + 1];
+    _reformatArgsVec(c_args, path_args);
+    execve(c_args[0], c_args, envp);
+    if (!simple)
+        return;
+
+    path_args[0] = "/bin/" + args[0];
+    _reformatArgsVec(c_args, path_args);
+    execve(c_args[0], c_args, envp);
+
+    // if will continue it means the exec failed - let's try the /usr/bin folder
+    path_args[0] = "/usr/bin/" + args[0];
+    _reformatArgsVec(c_args, path_args);
+    execve(c_args[0], c_args, envp);
+}
+
+long long monotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// parses a non-negative finite number, -1 if invalid
+double parseRate(const std::string &str)
+{
+    char *end = nullptr;
+    double res = strtod(str.c_str(), &end);
+    if (str.empty() || *end != 0 || !isfinite(res) || res < 0)
+        return -1;
+    return res;
+}
+
+// Checks if a given string is made of digits only
+bool isStringNumber(std::string str)
+{
+    if (str[0] == '-')
+        str.erase(0, 1);
+
+    if (int(str.size()) == 0)
+        return false;
+
+    for (int i = 0; i < int(str.size()); i++)
+    {
+        if (!isdigit(str[i]))
+            return false;
+    }
+    return true;
+}
+
+// Checks if a given string is a number that fits an int
+bool isIntNumber(const std::string &str)
+{
+    if (!isStringNumber(str) || str.size() > 11)
+        return false;
+    long long num = stoll(str);
+    return num >= INT_MIN && num <= INT_MAX;
+}
+
+// parses a non-negative number that fits an int, -1 if invalid
+int parseCount(const std::string &str)
+{
+    if (!isStringNumber(str) || str[0] == '-' || str.size() > 10)
+        return -1;
+    long long res = stoll(str);
+    return res > INT_MAX ? -1 : int(res);
+}
+
+// parses "<number>[s|m|h]" into seconds, -1 if invalid or past INT_MAX seconds
+int parseInterval(std::string str)
+{
+    int unit = 1;
+    if (!str.empty() && (str.back() == 's' || str.back() == 'm' || str.back() == 'h'))
+    {
+        unit = str.back() == 'h' ? 3600 : (str.back() == 'm' ? 60 : 1);
+        str.erase(str.size() - 1);
+    }
+    if (!isStringNumber(str) || str[0] == '-' || str.size() > 18)
+        return -1;
+    long long res = stoll(str);
+    return res > INT_MAX / unit ? -1 : int(res * unit);
+}
+
+// a worker thread running a background builtin writes to the job's own buffer
+static thread_local OutputBuffer *task_output = nullptr;
+
+// and resolves relative paths against the directory the job was started in
+static thread_local int task_cwd = -1;
+static thread_local const string *task_cwd_path = nullptr;
+
+// a builtin stage of a pipeline reads and writes its stage's rings and fds instead of 0, 1 and 2
+static thread_local const PipeStage *task_stage = nullptr;
+
+// a builtin whose stdin was redirected from a file or inline data may read it in place
+static thread_local const InputSpan *task_input = nullptr;
+
+/*
+Waits until fd is ready for events. A pipeline's thread wakes up every 100ms to see if it was cancelled.
+returns: false if it was
+*/
+static bool waitFd(int fd, short events)
+{
+    AsyncTask *task = AsyncTask::current();
+    struct pollfd pfd = {fd, events, 0};
+    while (true)
+    {
+        int res = poll(&pfd, 1, task != nullptr ? 100 : -1);
+        if (res > 0)
+            return true;
+        if (task != nullptr && task->isCancelled())
+            return false;
+        if (res == -1 && errno != EINTR)
+            return true;
+    }
+}
+
+//<---------------------------staff and aux functions - end --------------------------->
+
+//<---------------------------C'tors and D'tors--------------------------->
+
+// Small Shell
+SmallShell::SmallShell() : prompt("smash> "), working_dir(), current_command(nullptr), jobs_list(new JobsList()), timeOutList(new TimeOutList()),
+                           history(new CommandHistory()), output(1), parse_cache(PARSE_CACHE_MAX_BYTES), output_capture(), metrics(), zygote(), worker_pool(new WorkerPool()), environment(), control(), recorder(), last_status(0),
+                           metrics_path(), metrics_interval(0), next_metrics_export(0), exec_report_fd(-1), fork_samples(nullptr), interrupted(0),
+                           event_fd{-1, -1}, child_event(0), alarm_event(0), foreground_signal(0), shell_pid(getpid()), awaited(), reaped(), input(), input_open(true),
+                           group_pgid(0), group_cmd(nullptr), group_leader(false), group_failed(false)
+{
+    // the main thread's shard is created here and never inside a signal handler
+    metrics.add(METRIC_JOBS_STARTED, 0);
+    if (pipe2(event_fd, O_NONBLOCK | O_CLOEXEC) == -1)
+        perror("smash error: pipe failed");
+}
+
+SmallShell::~SmallShell()
+{
+    delete jobs_list;
+    delete history;
+}
+
+// Command
+
+Command::Command(const char *cmd_line, bool keep_quotes) : job_id(-1), process_id(getpid()), cmd_l(new char[strlen(cmd_line) + 1]),
+                                         external(false), time_out(false), schedule(false), deferred(false), group(false), members(), args_vec(), log(nullptr), task(nullptr)
+{
+
+    strcpy(cmd_l, cmd_line);
+    shared_ptr<const ParsedCommand> parsed = SmallShell::getInstance().parseLine(cmd_l, false);
+    args_vec = keep_quotes ? parsed->raw_args : parsed->args;
+};
+
+Command::~Command()
+{
+    delete[] cmd_l;
+}
+
+BuiltInCommand::BuiltInCommand(const char *cmd_line, bool keep_quotes) : Command(cmd_line, keep_quotes)
+{
+    if (_isBackgroundCommand(args_vec.back().c_str()))
+    {
+        removeBackgroundSignString(args_vec.back());
+        if (args_vec.back() == "")
+            args_vec.pop_back();
+    }
+};
+
+RedirectionCommand::RedirectionCommand(const char *cmd_line, string sign) : Command(cmd_line),
+                                                                            base_command(nullptr), dest(), out_pd()
+{
+    SmallShell &smash = SmallShell::getInstance();
+
+    // the line was split around the > / >> sign by the parser - validating arguments
+    shared_ptr<const ParsedCommand> parsed = smash.parseLine(cmd_l, false);
+    if (parsed->left.empty() || parsed->right.empty())
+    {
+        InvaildArgument e(sign);
+        throw e;
+    }
+
+    // the base command to be redirected (e.g., ls, showPid, ...) and the destination input file, unquoted
+    dest = parsed->right;
+    if (_isBackgroundCommand(dest.c_str()))
+        removeBackgroundSignString(dest);
+    base_command = smash.CreateCommand(parsed->left.c_str());
+    group = true;
+
+    // out_pd = the index of a new FD that points to the standard output
+    out_pd = dup(1);
+}
+
+void RedirectionCommand::execute()
+{
+    // changing the standard output to dest for smash itself
+    // external cmd routine:
+    SmallShell &smash = SmallShell::getInstance();
+    if (base_command->isExternal())
+    {
+        int pid = smash.forkChild();
+        if (pid == -1)
+        {
+            SystemCallFailed e("fork");
+            throw e;
+        }
+        // ------------------------------child-------------------------//
+        else if (pid == 0)
+        {
+            smash.joinGroup();
+
+            // prepare changes the stdout - a child that cannot open dest exits, it never returns to the input loop
+            try
+            {
+                prepare();
+                base_command->execute();
+            }
+            catch (SystemCallFailed &e)
+            {
+                perror(e.what());
+            }
+            catch (std::exception &e)
+            {
+                std::cerr << e.what() << std::endl;
+            }
+            exit(1);
+        }
+
+        // ------------father----------//
+        else
+        {
+            smash.addGroupMember(pid);
+            smash.waitStage(pid);
+        }
+    }
+
+    // in case the cmd isn't external
+    else
+    {
+        // prepare changes the stdout - nothing buffered so far may reach dest
+        SmallShell::getInstance().getOutput().flush();
+        prepare();
+        try_catch(base_command.get());
+        // restores the correct stdout for smash
+        cleanup();
+    }
+}
+
+void RedirectionNormalCommand::prepare()
+{
+    bool write_with_append = false;
+    RedirectionCommand::prepareGeneral(write_with_append);
+}
+
+void RedirectionAppendCommand::prepare()
+{
+    bool write_with_append = true;
+    RedirectionCommand::prepareGeneral(write_with_append);
+}
+
+void RedirectionCommand::prepareGeneral(bool write_with_append)
+{
+    // permissions
+    int new_fd;
+    if (write_with_append)
+        new_fd = openat(SmallShell::getInstance().getCwdFd(), dest.c_str(), O_RDWR | O_APPEND | O_CREAT, S_IRWXU);
+    else
+        new_fd = openat(SmallShell::getInstance().getCwdFd(), dest.c_str(), O_RDWR | O_TRUNC | O_CREAT, S_IRWXU);
+    if (new_fd < 0)
+    {
+        SystemCallFailed e("open");
+        throw e;
+    }
+
+    // replacing stdout with dest
+    int res = dup2(new_fd, 1);
+
+    if (res < 0)
+    {
+        SystemCallFailed e("dup2");
+        throw e;
+    }
+
+    res = close(new_fd);
+    if (res < 0)
+    {
+        SystemCallFailed e("close");
+        throw e;
+    }
+}
+
+void RedirectionCommand::cleanup()
+{
+    // the base command's output belongs to dest
+    SmallShell::getInstance().getOutput().flush();
+
+    int res = dup2(out_pd, 1);
+    if (res < 0)
+    {
+        SystemCallFailed e("dup2");
+        throw e;
+    }
+
+    // closing the new pd so the FDT won't get full
+    res = close(out_pd);
+    if (res < 0)
+    {
+        SystemCallFailed e("close");
+        throw e;
+    }
+}
+
+InputRedirectionCommand::InputRedirectionCommand(const char *cmd_line) : Command(cmd_line),
+                                                                           base_command(nullptr), sign(), source(), mem_fd(-1), delimiter()
+{
+    SmallShell &smash = SmallShell::getInstance();
+
+    // the parser picked the sign ("<", "<<" or "<<<") and split the line around it
+    shared_ptr<const ParsedCommand> parsed = smash.parseLine(cmd_l, false);
+    sign = parsed->sign;
+    string rest = _trim(parsed->right);
+    if (parsed->left.empty() || rest.empty())
+    {
+        InvaildArgument e(sign);
+        throw e;
+    }
+    string base_cmd = parsed->left;
+
+    // the parser took the quotes off
+    if (sign == "<")
+    {
+        source = rest;
+    }
+    else if (sign == "<<<")
+    {
+        // here-string - the rest of the line and a newline
+        createMemfd(rest + "\n");
+    }
+    else
+    {
+        // here-document - its body is the following input lines, read when the line runs
+        delimiter = rest;
+    }
+
+    base_command = smash.CreateCommand(base_cmd.c_str());
+    group = true;
+}
+
+InputRedirectionCommand::~InputRedirectionCommand()
+{
+    if (mem_fd >= 0)
+        close(mem_fd);
+}
+
+// reads a here-document's body, the input lines up to the delimiter - once, through the shell's own input
+void InputRedirectionCommand::readHereDocs()
+{
+    if (sign == "<<" && mem_fd < 0)
+    {
+        string data;
+        string line;
+        while (SmallShell::getInstance().readLine(&line) && line != delimiter)
+            data += line + "\n";
+        createMemfd(data);
+    }
+    base_command->readHereDocs();
+}
+
+// stores inline data in a sealed memfd, so a child reads it as a file and not through a pipe
+void InputRedirectionCommand::createMemfd(const std::string &data)
+{
+    mem_fd = memfd_create("smash-heredoc", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (mem_fd < 0)
+    {
+        SystemCallFailed e("memfd_create");
+        throw e;
+    }
+
+    size_t written = 0;
+    while (written < data.size())
+    {
+        ssize_t res = write(mem_fd, data.c_str() + written, data.size() - written);
+        if (res < 0)
+        {
+            SystemCallFailed e("write");
+            throw e;
+        }
+        written += res;
+    }
+
+    if (fcntl(mem_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0)
+    {
+        SystemCallFailed e("fcntl");
+        throw e;
+    }
+}
+
+// returns a descriptor positioned at the start of the input
+int InputRedirectionCommand::openInput()
+{
+    if (mem_fd >= 0)
+    {
+        if (lseek(mem_fd, 0, SEEK_SET) < 0)
+        {
+            SystemCallFailed e("lseek");
+            throw e;
+        }
+        return mem_fd;
+    }
+
+    int new_fd = openat(SmallShell::getInstance().getCwdFd(), source.c_str(), O_RDONLY | O_CLOEXEC);
+    if (new_fd < 0)
+    {
+        SystemCallFailed e("open");
+        throw e;
+    }
+    return new_fd;
+}
+
+void InputRedirectionCommand::execute()
+{
+    SmallShell &smash = SmallShell::getInstance();
+    readHereDocs();
+    int in_fd = openInput();
+
+    // external cmd routine: the input becomes the child's stdin
+    if (base_command->isExternal())
+    {
+        int pid = smash.forkChild();
+        if (pid == -1)
+        {
+            SystemCallFailed e("fork");
+            throw e;
+        }
+        // ------------------------------child-------------------------//
+        else if (pid == 0)
+        {
+            smash.joinGroup();
+            if (dup2(in_fd, 0) < 0)
+            {
+                perror("smash error: dup2 failed");
+                exit(1);
+            }
+            base_command->execute();
+        }
+
+        // ------------father----------//
+        else
+        {
+            smash.addGroupMember(pid);
+            smash.waitStage(pid);
+        }
+    }
+
+    // in case the cmd isn't external - the input is its stdin, and mapped for a builtin that reads it
+    else
+    {
+        int in_pd = dup(0);
+        if (in_pd < 0 || dup2(in_fd, 0) < 0)
+        {
+            SystemCallFailed e("dup2");
+            throw e;
+        }
+        InputSpan span = {nullptr, 0};
+        struct stat stats;
+        if (base_command->readsInput() && fstat(in_fd, &stats) == 0 && S_ISREG(stats.st_mode) && stats.st_size > 0)
+        {
+            void *base = mmap(nullptr, stats.st_size, PROT_READ, MAP_PRIVATE, in_fd, 0);
+            if (base != MAP_FAILED)
+                span = {static_cast<const char *>(base), size_t(stats.st_size)};
+        }
+        task_input = span.data != nullptr ? &span : nullptr;
+        try_catch(base_command.get());
+        task_input = nullptr;
+        if (span.data != nullptr)
+            munmap(const_cast<char *>(span.data), span.size);
+
+        // restores the correct stdin for smash
+        int res = dup2(in_pd, 0);
+        close(in_pd);
+        if (res < 0)
+        {
+            SystemCallFailed e("dup2");
+            throw e;
+        }
+    }
+
+    if (in_fd != mem_fd)
+        close(in_fd);
+}
+
+PipeCommand::PipeCommand(const char *cmd_line, string sign) : Command(cmd_line),
+                                                              write_command(nullptr), read_command(nullptr), out_num(sign == "|&" ? 2 : 1)
+{
+    SmallShell &smash = SmallShell::getInstance();
+    shared_ptr<const ParsedCommand> parsed = smash.parseLine(cmd_line, false);
+    if (parsed->left.empty())
+    {
+        InvaildArgument e(sign);
+        throw e;
+    }
+    // the commands for the pipe
+    write_command = smash.CreateCommand(parsed->left.c_str());
+    read_command = smash.CreateCommand(parsed->right.c_str());
+    group = true;
+}
+
+ListCommand::ListCommand(const char *cmd_line) : Command(cmd_line), tree(nullptr)
+{
+    tree = SmallShell::getInstance().parseLine(cmd_l, false)->tree;
+    group = true;
+}
+
+void ListCommand::execute()
+{
+    SmallShell::getInstance().runChain(*tree);
+}
+
+// closes the ends of a stage that smash ran - its neighbours see EOF, or that nobody reads any more
+static void closeStage(PipeStage &stage)
+{
+    if (stage.in != nullptr)
+        stage.in->closeRead();
+    else if (stage.in_fd != 0)
+        close(stage.in_fd);
+    if (stage.out != nullptr)
+        stage.out->closeWrite();
+    else if (stage.out_fd != 1)
+        close(stage.out_fd);
+    if (stage.err != nullptr)
+        stage.err->closeWrite();
+    else if (stage.err_fd != 2)
+        close(stage.err_fd);
+}
+
+/*
+Runs a builtin stage of a pipeline on the calling thread - its output goes to the stage's ring or fd
+through out, and an error where its stderr does. A reader that went away, or a cancelled stage, is not reported.
+*/
+static void runPipeStage(PipeStage *stage, OutputBuffer &out)
+{
+    unique_ptr<OutputBuffer> err(stage->err != nullptr ? new OutputBuffer(stage->err.get()) : new OutputBuffer(stage->err_fd));
+    task_stage = stage;
+    try
+    {
+        OutputOwner owner(out, stage->cmd);
+        stage->cmd->execute();
+    }
+    catch (SystemCallFailed &e)
+    {
+        int error = errno;
+        if (error != EPIPE && (stage->task == nullptr || !stage->task->isCancelled()))
+            *err << e.what() << ": " << strerror(error) << "\n";
+        stage->failed = true;
+    }
+    catch (std::exception &e)
+    {
+        *err << e.what() << "\n";
+        stage->failed = true;
+    }
+    out.flush();
+    err->flush();
+    task_stage = nullptr;
+}
+
+// the body of a stage's thread
+static void runPipeThread(PipeStage *stage, int cwd_fd, string cwd_path)
+{
+    OutputBuffer out(stage->out_fd);
+    if (stage->out != nullptr)
+        out.redirect(-1, stage->out.get());
+    AsyncTask::setCurrent(stage->task.get());
+    task_output = &out;
+    task_cwd = cwd_fd;
+    task_cwd_path = &cwd_path;
+    runPipeStage(stage, out);
+    closeStage(*stage);
+    stage->counters = out.getCounters();
+    task_output = nullptr;
+    task_cwd = -1;
+    task_cwd_path = nullptr;
+    close(cwd_fd);
+    AsyncTask::setCurrent(nullptr);
+    stage->task->finish(W_EXITCODE(stage->failed ? 1 : 0, 0));
+}
+
+/*
+Runs a stage that touches shell state on the shell's thread, through the shell's own buffer pointed at the
+stage's output - a write nobody reads fails instead of killing smash.
+*/
+static void runPipeStageHere(PipeStage *stage)
+{
+    OutputBuffer &out = SmallShell::getInstance().getOutput();
+    int prev_fd = out.getFd();
+    ByteRing *prev_ring = out.getRing();
+    out.redirect(stage->out_fd, stage->out.get());
+
+    sigset_t pipe_set, old_set;
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_set, &old_set);
+    runPipeStage(stage, out);
+    out.redirect(prev_fd, prev_ring);
+    closeStage(*stage);
+    struct timespec zero = {0, 0};
+    while (sigtimedwait(&pipe_set, nullptr, &zero) > 0)
+    {
+    }
+    pthread_sigmask(SIG_SETMASK, &old_set, nullptr);
+}
+
+// stops the stages on threads - they poll for it, and a ring wakes its sides once closed
+static void cancelPipeStages(vector<PipeStage> &stages)
+{
+    for (PipeStage &stage : stages)
+    {
+        if (stage.task != nullptr)
+            stage.task->cancel();
+        if (stage.in != nullptr)
+        {
+            stage.in->closeRead();
+            stage.in->closeWrite();
+        }
+    }
+}
+
+// connects a writer to a reader - a pipe, or a ring if smash runs both of them
+static void connectStages(PipeStage &writer, PipeStage &reader, int out_num, vector<int> &fds)
+{
+    int &writer_fd = out_num == 2 ? writer.err_fd : writer.out_fd;
+
+    //  a builtin that does not read its input gets nothing, and the writer still runs to its end
+    if (reader.in_smash && !reader.cmd->readsInput())
+    {
+        writer_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+        if (writer_fd == -1)
+        {
+            writer_fd = out_num;
+            SystemCallFailed e("open");
+            throw e;
+        }
+        fds.push_back(writer_fd);
+        return;
+    }
+    if (writer.in_smash && reader.in_smash)
+    {
+        shared_ptr<ByteRing> ring(new ByteRing(PIPE_RING_SIZE));
+        (out_num == 2 ? writer.err : writer.out) = ring;
+        reader.in = ring;
+        return;
+    }
+
+    //  the end used by a thread of smash does not block, so a cancelled thread is never stuck in it
+    int ends[2];
+    if (pipe2(ends, O_CLOEXEC) == -1)
+    {
+        SystemCallFailed e("pipe");
+        throw e;
+    }
+    if (writer.in_smash)
+        fcntl(ends[1], F_SETFL, O_NONBLOCK);
+    if (reader.in_smash)
+        fcntl(ends[0], F_SETFL, O_NONBLOCK);
+    writer_fd = ends[1];
+    reader.in_fd = ends[0];
+    fds.push_back(ends[0]);
+    fds.push_back(ends[1]);
+}
+
+/*
+Runs a pipeline. The external commands and the groups (a redirection, a list) are forked into the
+pipeline's process group. A builtin that reads its input or touches no shell state runs on a thread,
+the other builtins on the shell's thread, after everything else was started - so no builtin costs a fork.
+*/
+void PipeCommand::execute()
+{
+    SmallShell &smash = SmallShell::getInstance();
+
+    //  a pipe on the read side is flattened - edges[i] is what stage i sends to stage i + 1
+    vector<PipeStage> stages;
+    vector<int> edges;
+    PipeCommand *pipe = this;
+    while (true)
+    {
+        stages.push_back(PipeStage(pipe->write_command.get()));
+        edges.push_back(pipe->out_num);
+        PipeCommand *next = dynamic_cast<PipeCommand *>(pipe->read_command.get());
+        if (next == nullptr)
+        {
+            stages.push_back(PipeStage(pipe->read_command.get()));
+            break;
+        }
+        pipe = next;
+    }
+    for (PipeStage &stage : stages)
+    {
+        BuiltInCommand *builtin = dynamic_cast<BuiltInCommand *>(stage.cmd);
+        stage.in_smash = builtin != nullptr;
+        stage.on_thread = builtin != nullptr && (builtin->isAsyncSafe() || builtin->readsInput());
+    }
+
+    vector<int> fds;
+    try
+    {
+        for (int i = 0; i + 1 < int(stages.size()); i++)
+            connectStages(stages[i], stages[i + 1], edges[i], fds);
+    }
+    catch (SystemCallFailed &e)
+    {
+        int error = errno;
+        for (int fd : fds)
+            close(fd);
+        errno = error;
+        throw;
+    }
+
+    //  forked first, before the threads exist
+    bool fork_failed = false;
+    for (PipeStage &stage : stages)
+    {
+        if (stage.in_smash)
+            continue;
+        int pid = smash.forkChild();
+        if (pid == -1)
+        {
+            fork_failed = true;
+            break;
+        }
+        else if (pid == 0)
+        {
+            smash.joinGroup();
+            if (stage.in_fd != 0)
+                dup2(stage.in_fd, 0);
+            if (stage.out_fd != 1)
+                dup2(stage.out_fd, 1);
+            if (stage.err_fd != 2)
+                dup2(stage.err_fd, 2);
+            for (int fd : fds)
+                close(fd);
+            if (stage.cmd->isExternal())
+                stage.cmd->execute();
+
+            //  a group runs in this stage
+            smash.runStage(stage.cmd);
+        }
+        smash.addGroupMember(pid);
+        stage.pid = pid;
+    }
+    for (PipeStage &stage : stages)
+    {
+        if (!stage.in_smash)
+            closeStage(stage);
+    }
+
+    //  an earlier ctrl-C is not this pipeline's
+    smash.takeInterrupt();
+    smash.getOutput().flush();
+    vector<std::thread> threads;
+    sigset_t all_signals, old_set;
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_SETMASK, &all_signals, &old_set);
+    for (PipeStage &stage : stages)
+    {
+        if (!stage.on_thread)
+            continue;
+        stage.task = make_shared<AsyncTask>();
+        threads.push_back(std::thread(runPipeThread, &stage, fcntl(smash.getCwdFd(), F_DUPFD_CLOEXEC, 0), smash.getCwdPath()));
+    }
+    pthread_sigmask(SIG_SETMASK, &old_set, nullptr);
+
+    for (PipeStage &stage : stages)
+    {
+        if (stage.in_smash && !stage.on_thread)
+            runPipeStageHere(&stage);
+    }
+
+    //  once ctrl-Z stopped the forked stages, or ctrl-C was pressed, the threads are cancelled
+    bool stopped = false;
+    for (PipeStage &stage : stages)
+    {
+        if (stage.pid != -1)
+            stopped = WIFSTOPPED(smash.waitStage(stage.pid)) || stopped;
+    }
+    for (PipeStage &stage : stages)
+    {
+        while (stage.task != nullptr && !stage.task->waitFor(50))
+        {
+            if (stopped || smash.isInterrupted())
+                cancelPipeStages(stages);
+        }
+    }
+    for (std::thread &thread : threads)
+        thread.join();
+    for (PipeStage &stage : stages)
+        smash.getOutput().addCounters(stage.counters);
+
+    if (fork_failed)
+    {
+        SystemCallFailed e("fork");
+        throw e;
+    }
+}
+
+//<---------------------------C'tors and D'tors - end--------------------------->
+
+//<---------------------------getters--------------------------->
+
+int TimeoutCommand::getTime() const
+{
+    return dest_time;
+}
+WorkingDir &SmallShell::getWorkingDir()
+{
+    return working_dir;
+}
+
+const char *Command::getCmdL() const
+{
+    return cmd_l;
+}
+
+std::string Command::getName() const
+{
+    if (args_vec.empty())
+        return "";
+    string name = args_vec[0];
+    removeBackgroundSignString(name);
+    return name;
+}
+
+int Command::getJobId() const
+{
+    return job_id;
+}
+
+int Command::getProcessId() const
+{
+    return process_id;
+}
+
+bool JobsList::JobEntry::getStopped() const
+{
+    return is_stopped;
+};
+
+int JobsList::JobEntry::getJobId() const
+{
+    return command->getJobId();
+};
+
+shared_ptr<Command> JobsList::JobEntry::getCommand() const
+{
+    return command;
+};
+
+shared_ptr<Command> SmallShell::getCurrentCommand() const
+{
+    return current_command;
+}
+
+//<---------------------------getters - end--------------------------->
+
+//<---------------------------setters--------------------------->
+
+void Command::setJobId(int id)
+{
+    job_id = id;
+}
+
+void Command::setProcessId(int id)
+{
+    process_id = id;
+}
+
+void Command::setLog(std::shared_ptr<JobLog> log)
+{
+    this->log = log;
+}
+
+std::shared_ptr<JobLog> Command::getLog() const
+{
+    return log;
+}
+
+void Command::setTask(std::shared_ptr<AsyncTask> task)
+{
+    this->task = task;
+}
+
+std::shared_ptr<AsyncTask> Command::getTask() const
+{
+    return task;
+}
+
+void Command::addMember(int pid)
+{
+    members.push_back(pid);
+}
+
+const std::vector<int> &Command::getMembers() const
+{
+    return members;
+}
+
+void JobsList::JobEntry::setTime()
+{
+    init_time = time(NULL);
+};
+
+void JobsList::JobEntry::setStopped(bool is_stopped)
+{
+    this->is_stopped = is_stopped;
+};
+
+// a ctrl-C or ctrl-Z the event loop did not handle yet was meant for the previous command
+void SmallShell::setCurrentCommand(shared_ptr<Command> command)
+{
+    current_command = command;
+    foreground_signal = 0;
+}
+
+//<---------------------------setters - end--------------------------->
+
+//<---------------------------execute functions--------------------------->
+
+// records a line and its outcome - a line that throws ends with status 1, as the input loop sets it
+class RecordedLine
+{
+    Recorder &recorder;
+
+public:
+    RecordedLine(Recorder &recorder, const char *cmd_line) : recorder(recorder)
+    {
+        recorder.beginLine(cmd_line);
+    }
+    ~RecordedLine()
+    {
+        recorder.endLine(std::uncaught_exception() ? 1 : SmallShell::getInstance().getLastStatus());
+    }
+};
+
+void SmallShell::executeCommand(const char *raw_line, bool expand)
+{
+    RecordedLine record(recorder, raw_line);
+
+    //  a list is split before expansion, so a command sees what the ones before it exported
+    shared_ptr<const ParsedCommand> parsed = parseLine(raw_line);
+    if (parsed->kind == KIND_LIST && !parsed->tree->background)
+    {
+        runList(parsed->tree, expand);
+        return;
+    }
+    runLine(raw_line, parsed, expand);
+}
+
+// runs a line that is not a foreground list - the line's lookup in the parse cache was made and counted already
+void SmallShell::runLine(const char *raw_line, shared_ptr<const ParsedCommand> parsed, bool expand)
+{
+    string expanded = expand ? expandVariables(raw_line) : string(raw_line);
+    const char *cmd_line = expanded.c_str();
+
+    //  a value is quoted into its word, so the expanded line has the shape the raw one was run by -
+    //  one that does not would run as a list that was never split
+    if (expanded != raw_line && parsed->tree != nullptr)
+    {
+        shared_ptr<const SyntaxNode> tree = parseLine(cmd_line, false)->tree;
+        if (tree == nullptr || tree->type != parsed->tree->type)
+        {
+            SyntaxError e(tree == nullptr || tree->op.empty() ? ";" : tree->op);
+            throw e;
+        }
+    }
+
+    string cmd_s = _trim(string(cmd_line));
+    string firstWord = cmd_s.substr(0, cmd_s.find_first_of(" \n"));
+
+    if (firstWord.compare("chprompt") == 0 || firstWord.compare("chprompt&") == 0)
+    {
+        changeChprompt(cmd_line);
+        return;
+    }
+
+    shared_ptr<Command> cmd = CreateCommand(cmd_line);
+
+    //  the here-documents follow the line in the input - read now, before a job or a stage forks
+    cmd->readHereDocs();
+
+    if (cmd->isSchedule())
+    {
+        // registered only - the timer launches it
+        this->addJob(cmd);
+        this->addSchedule(dynamic_pointer_cast<ScheduleCommand>(cmd));
+    }
+
+    else if (cmd->isDeferred())
+    {
+        // registered only - the exit of its last prerequisite launches it
+        dynamic_pointer_cast<AfterCommand>(cmd)->registerJob(cmd);
+    }
+
+    // a background pipe or redirection is one job - a forked copy of smash runs all of its stages
+    else if (cmd->isGroup() && _isBackgroundCommand(cmd_line))
+    {
+        jobs_list->submit(cmd);
+    }
+
+    else if (cmd->isGroup())
+    {
+        runGroup(cmd);
+    }
+
+    // a background builtin that touches no shell state is a job on the worker pool
+    else if (!cmd->isExternal() && !cmd->isTimeout() && _isBackgroundCommand(cmd_line) &&
+             static_cast<BuiltInCommand *>(cmd.get())->isAsyncSafe())
+    {
+        cmd->setTask(make_shared<AsyncTask>());
+        jobs_list->submit(cmd);
+    }
+
+    else if (!cmd->isExternal() && !cmd->isTimeout())
+    {
+        OutputOwner owner(output, cmd.get());
+        cmd->execute();
+        last_status = 0;
+    }
+
+    else if (cmd->isTimeout())
+    {
+        this->addTimeOutCommand(dynamic_pointer_cast<TimeoutCommand>(cmd));
+        this->addJob(cmd);
+        if (!(_isBackgroundCommand(cmd_line)))
+        {
+            setCurrentCommand(cmd);
+        }
+        cmd->execute();
+    }
+
+    // add background Command to Joblist - it is launched once admission control allows
+    else if (_isBackgroundCommand(cmd_line))
+    {
+        jobs_list->submit(cmd);
+    }
+
+    else
+    {
+        int pid = spawn(cmd);
+        setCurrentCommand(cmd);
+        long long start = monotonicNs();
+        int status = 0;
+        if (waitForeground(pid, &status) == pid)
+            setLastStatus(status);
+        metrics.observe(METRIC_WAIT_LATENCY, monotonicNs() - start);
+        setCurrentCommand(nullptr);
+    }
+}
+
+// forks a child that runs cmd in its own process group - a background job's output may be captured
+int SmallShell::spawn(shared_ptr<Command> cmd, bool background)
+{
+    int write_fd = -1;
+    shared_ptr<JobLog> log = nullptr;
+    if (background && output_capture.isEnabled())
+        log = output_capture.open(&write_fd);
+
+    if (cmd->getTask() != nullptr)
+        return runTask(cmd, log, write_fd);
+
+    //  an external command starts from the zygote's small image when it runs
+    if (cmd->isExternal() && zygote.isRunning())
+    {
+        bool simple;
+        vector<string> args = static_cast<ExternalCommand *>(cmd.get())->getExecArgs(&simple);
+        int fds[3] = {0, write_fd == -1 ? 1 : write_fd, write_fd == -1 ? 2 : write_fd};
+        int error = 0;
+        output.flush();
+        long long start = monotonicNs();
+        int pid = zygote.launch(args, simple, 0, fds, &error);
+        if (pid > 0)
+        {
+            long long spent = monotonicNs() - start;
+            metrics.observe(METRIC_FORK_LATENCY, spent);
+            if (fork_samples != nullptr)
+                fork_samples->push_back(spent);
+            if (error != 0)
+                metrics.add(METRIC_EXEC_FAILURES);
+            else
+                metrics.observe(METRIC_EXEC_LATENCY, spent);
+            if (write_fd != -1)
+                close(write_fd);
+            cmd->setLog(log);
+            cmd->setProcessId(pid);
+            return pid;
+        }
+    }
+
+    //  a close-on-exec pipe - it closes on a successful exec, a failed one writes errno into it
+    int report[2] = {-1, -1};
+    if (cmd->isExternal() && pipe2(report, O_CLOEXEC) == -1)
+        report[0] = report[1] = -1;
+
+    //  rebuilt here if it changed, so the child only reads it
+    environment.getEnvp();
+
+    long long start = monotonicNs();
+    int pid = forkChild();
+    if (pid == -1)
+    {
+        if (write_fd != -1)
+            close(write_fd);
+        if (report[0] != -1)
+        {
+            close(report[0]);
+            close(report[1]);
+        }
+        SystemCallFailed e("fork");
+        throw e;
+    }
+    // ------------------------------child-------------------------//
+    else if (pid == 0)
+    {
+        if (setpgrp() == -1)
+        {
+            SystemCallFailed e("setpgrp");
+            throw e;
+        }
+        leadGroup();
+        if (report[0] != -1)
+        {
+            close(report[0]);
+            exec_report_fd = report[1];
+        }
+        if (write_fd != -1)
+        {
+            dup2(write_fd, 1);
+            dup2(write_fd, 2);
+            close(write_fd);
+        }
+        if (cmd->isExternal())
+            cmd->execute();
+
+        //  the stages of a pipe or a redirection are forked into this group and waited here
+        try_catch(cmd.get());
+        output.flush();
+        exit(group_failed ? 1 : 0);
+    }
+
+    //------------------------ father--------------------//
+    if (write_fd != -1)
+        close(write_fd);
+    if (report[0] != -1)
+    {
+        close(report[1]);
+        int error;
+        ssize_t res;
+        do
+        {
+            res = read(report[0], &error, sizeof(error));
+        } while (res == -1 && errno == EINTR);
+        close(report[0]);
+        if (res == sizeof(error))
+            metrics.add(METRIC_EXEC_FAILURES);
+        else
+            metrics.observe(METRIC_EXEC_LATENCY, monotonicNs() - start);
+    }
+    cmd->setLog(log);
+    cmd->setProcessId(pid);
+    return pid;
+}
+
+OutputCapture &SmallShell::getOutputCapture()
+{
+    return output_capture;
+}
+
+Zygote &SmallShell::getZygote()
+{
+    return zygote;
+}
+
+WorkerPool &SmallShell::getWorkerPool()
+{
+    return *worker_pool;
+}
+
+Environment &SmallShell::getEnvironment()
+{
+    return environment;
+}
+
+ControlServer &SmallShell::getControl()
+{
+    return control;
+}
+
+Recorder &SmallShell::getRecorder()
+{
+    return recorder;
+}
+
+JobsList &SmallShell::getJobsList()
+{
+    return *jobs_list;
+}
+
+// the input is read with read(2) and poll(2) - not std::cin - so the events are handled while the shell waits
+bool SmallShell::readLine(std::string *line)
+{
+    if (control.isRunning())
+    {
+        control.readLine(line);
+        return true;
+    }
+    while (true)
+    {
+        processEvents();
+        size_t newline = input.find('\n');
+        if (newline != string::npos)
+        {
+            *line = input.substr(0, newline);
+            input.erase(0, newline + 1);
+            return true;
+        }
+
+        //  the last line may have no newline - after it every read is an empty line, as from std::getline
+        if (!input_open)
+        {
+            *line = input;
+            input.clear();
+            return !line->empty();
+        }
+
+        struct pollfd fds[2] = {{0, POLLIN, 0}, {event_fd[0], POLLIN, 0}};
+        if (poll(fds, 2, -1) == -1 && errno != EINTR)
+        {
+            SystemCallFailed e("poll");
+            throw e;
+        }
+        if (fds[0].revents == 0)
+            continue;
+        char buf[4096];
+        ssize_t bytes = read(0, buf, sizeof(buf));
+        if (bytes > 0)
+            input.append(buf, bytes);
+        else if (bytes == 0 || (errno != EINTR && errno != EAGAIN))
+            input_open = false;
+    }
+}
+
+// a wait status as $? shows it - 128 + the signal for a killed or stopped command, like bash
+static int shellStatus(int status)
+{
+    if (WIFSIGNALED(status))
+        return 128 + WTERMSIG(status);
+    if (WIFSTOPPED(status))
+        return 128 + WSTOPSIG(status);
+    return WEXITSTATUS(status);
+}
+
+void SmallShell::setLastStatus(int status)
+{
+    last_status = shellStatus(status);
+}
+
+int SmallShell::getLastStatus() const
+{
+    return last_status;
+}
+
+int SmallShell::getCwdFd() const
+{
+    return task_cwd != -1 ? task_cwd : working_dir.getFd();
+}
+
+std::string SmallShell::getCwdPath() const
+{
+    return task_cwd_path != nullptr ? *task_cwd_path : working_dir.getPath();
+}
+
+// the body of a background builtin's job, on a worker thread
+static void runBackgroundBuiltin(shared_ptr<Command> cmd, int write_fd, int cwd_fd, string cwd_path)
+{
+    shared_ptr<AsyncTask> task = cmd->getTask();
+
+    //  held until the builtin is done, so jobs running together never interleave
+    OutputBuffer out(write_fd == -1 ? 1 : write_fd, true);
+    OutputBuffer err(write_fd == -1 ? 2 : write_fd, true);
+    int status = 0;
+    task_output = &out;
+    task_cwd = cwd_fd;
+    task_cwd_path = &cwd_path;
+    AsyncTask::setCurrent(task.get());
+    if (!task->isCancelled())
+    {
+        try
+        {
+            OutputOwner owner(out, cmd.get());
+            cmd->execute();
+        }
+        catch (SystemCallFailed &e)
+        {
+            int error = errno;
+            err << e.what() << ": " << strerror(error) << "\n";
+            status = 1;
+        }
+        catch (std::exception &e)
+        {
+            err << e.what() << "\n";
+            status = 1;
+        }
+    }
+    AsyncTask::setCurrent(nullptr);
+    task_output = nullptr;
+    task_cwd = -1;
+    task_cwd_path = nullptr;
+    close(cwd_fd);
+
+    //  a cancelled job's output is dropped
+    if (!task->isCancelled())
+    {
+        out.flush();
+        err.flush();
+    }
+    if (write_fd != -1)
+        SmallShell::getInstance().getOutputCapture().releaseWriter(write_fd);
+    task->finish(W_EXITCODE(status, 0));
+
+    //  the event loop marks the job finished on the main thread, as it does for a process
+    kill(getpid(), SIGCHLD);
+}
+
+int SmallShell::runTask(shared_ptr<Command> cmd, shared_ptr<JobLog> log, int write_fd)
+{
+    cmd->setLog(log);
+    cmd->setProcessId(getpid());
+    //  a cd typed while the job runs does not move it
+    int cwd_fd = fcntl(working_dir.getFd(), F_DUPFD_CLOEXEC, 0);
+    if (cwd_fd == -1)
+    {
+        if (write_fd != -1)
+            close(write_fd);
+        SystemCallFailed e("fcntl");
+        throw e;
+    }
+    if (write_fd != -1)
+        output_capture.holdWriter(write_fd);
+    worker_pool->submit(std::bind(runBackgroundBuiltin, cmd, write_fd, cwd_fd, working_dir.getPath()));
+    return getpid();
+}
+
+//<--------------------------- Process group functions--------------------------->
+
+/*
+Runs a pipe or a redirection in the foreground. Its stages join one process group,
+so ctrl-C and ctrl-Z reach all of them - a stopped group becomes a single job.
+*/
+void SmallShell::runGroup(shared_ptr<Command> cmd)
+{
+    group_pgid = 0;
+    group_cmd = cmd.get();
+    group_failed = false;
+
+    // no pid until the first stage is forked - builtin-only groups have none
+    cmd->setProcessId(-1);
+    setCurrentCommand(cmd);
+    long long start = monotonicNs();
+    try
+    {
+        OutputOwner owner(output, cmd.get());
+        cmd->execute();
+    }
+    catch (...)
+    {
+        group_pgid = 0;
+        group_cmd = nullptr;
+        setCurrentCommand(nullptr);
+        throw;
+    }
+    metrics.observe(METRIC_WAIT_LATENCY, monotonicNs() - start);
+    last_status = group_failed ? 1 : 0;
+    group_pgid = 0;
+    group_cmd = nullptr;
+    setCurrentCommand(nullptr);
+}
+
+/*
+Runs a foreground list. Each command of it runs as if it was a line of its own - a '&' one is a job,
+the others run in the foreground and set $? for the '&&' and '||' after them. ctrl-C stops the list.
+*/
+void SmallShell::runList(shared_ptr<const SyntaxNode> node, bool expand)
+{
+    if (node->type == SyntaxNode::NODE_LIST)
+    {
+        takeInterrupt();
+        for (const shared_ptr<const SyntaxNode> &child : node->children)
+        {
+            runList(child, expand);
+            if (takeInterrupt())
+                break;
+        }
+        return;
+    }
+    if ((node->type == SyntaxNode::NODE_AND || node->type == SyntaxNode::NODE_OR) && !node->background)
+    {
+        runList(node->children[0], expand);
+        if ((last_status == 0) == (node->type == SyntaxNode::NODE_AND))
+            runList(node->children[1], expand);
+        return;
+    }
+
+    //  a background and/or chain is a single job - ListCommand runs it in the forked copy of smash
+    try
+    {
+        string line = node->text + (node->background ? "&" : "");
+        runLine(line.c_str(), parseNode(line, node), expand);
+        if (node->background)
+            last_status = 0;
+    }
+    catch (SystemCallFailed &e)
+    {
+        output.flush();
+        perror(e.what());
+        last_status = 1;
+    }
+    catch (std::exception &e)
+    {
+        output.flush();
+        std::cerr << e.what() << std::endl;
+        last_status = 1;
+    }
+}
+
+/*
+Runs an and/or chain as the stages of the current group - its external commands are forked
+into the group and waited, the others run here. returns: the chain's status
+*/
+int SmallShell::runChain(const SyntaxNode &node)
+{
+    if (node.type == SyntaxNode::NODE_LIST)
+    {
+        int status = 0;
+        for (const shared_ptr<const SyntaxNode> &child : node.children)
+            status = runChain(*child);
+        return status;
+    }
+    if (node.type == SyntaxNode::NODE_AND || node.type == SyntaxNode::NODE_OR)
+    {
+        int status = runChain(*node.children[0]);
+        if ((status == 0) == (node.type == SyntaxNode::NODE_AND))
+            status = runChain(*node.children[1]);
+        return status;
+    }
+
+    int status = 0;
+    try
+    {
+        shared_ptr<Command> cmd = CreateCommand(node.text.c_str());
+        if (cmd->isExternal())
+        {
+            int pid = forkChild();
+            if (pid == -1)
+            {
+                SystemCallFailed e("fork");
+                throw e;
+            }
+            else if (pid == 0)
+            {
+                joinGroup();
+                cmd->execute();
+            }
+            addGroupMember(pid);
+            status = shellStatus(waitStage(pid));
+        }
+        else
+        {
+            group_failed = false;
+            OutputOwner owner(output, cmd.get());
+            cmd->execute();
+            status = group_failed ? 1 : 0;
+        }
+    }
+    catch (SystemCallFailed &e)
+    {
+        output.flush();
+        perror(e.what());
+        status = 1;
+    }
+    catch (std::exception &e)
+    {
+        output.flush();
+        std::cerr << e.what() << std::endl;
+        status = 1;
+    }
+
+    //  the job's exit status is the chain's
+    group_failed = status != 0;
+    return status;
+}
+
+// called in a forked job - the stages it forks join the job's own group
+void SmallShell::leadGroup()
+{
+    group_pgid = getpid();
+    group_cmd = nullptr;
+    group_leader = true;
+    group_failed = false;
+
+    //  the stages are waited for explicitly, and only the interactive smash handles ctrl-C and ctrl-Z
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+}
+
+// called in a forked stage
+void SmallShell::joinGroup()
+{
+    if (setpgid(0, group_pgid) < 0)
+        perror("smash error: setpgid failed");
+}
+
+// called in a forked stage that runs a builtin or a nested pipe - exits with the stage's status
+void SmallShell::runStage(Command *cmd)
+{
+    //  the stage waits for the processes it forks itself, and its group gets ctrl-C and ctrl-Z
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    group_pgid = getpgrp();
+    group_cmd = nullptr;
+    group_failed = false;
+
+    bool failed = false;
+    try
+    {
+        OutputOwner owner(output, cmd);
+        cmd->execute();
+    }
+    catch (SystemCallFailed &e)
+    {
+        output.flush();
+        perror(e.what());
+        failed = true;
+    }
+    catch (std::exception &e)
+    {
+        output.flush();
+        std::cerr << e.what() << std::endl;
+        failed = true;
+    }
+    output.flush();
+    exit(failed || group_failed ? 1 : 0);
+}
+
+// called in the parent right after forking a stage - both sides set the group, whichever runs first
+void SmallShell::addGroupMember(int pid)
+{
+    if (group_pgid == 0)
+        group_pgid = pid;
+    setpgid(pid, group_pgid);
+    awaitChild(pid);
+    if (group_cmd != nullptr)
+    {
+        group_cmd->addMember(pid);
+        if (group_cmd->getProcessId() == -1)
+            group_cmd->setProcessId(group_pgid);
+    }
+}
+
+/*
+Waits for a stage. The interactive shell stops waiting once ctrl-Z stopped the group,
+a forked job keeps waiting until the stage exits.
+*/
+int SmallShell::waitStage(int pid)
+{
+    int status = 0;
+    while (waitForeground(pid, &status) == pid && WIFSTOPPED(status))
+    {
+        if (!group_leader)
+            return status;
+    }
+    if ((WIFEXITED(status) && WEXITSTATUS(status) != 0) || WIFSIGNALED(status))
+        group_failed = true;
+    return status;
+}
+
+// signals the whole process group of a job, or the single process if it leads none
+int signalJob(int pid, int signal_num)
+{
+    SmallShell::getInstance().getMetrics().add(METRIC_SIGNALS_SENT);
+    if (killpg(pid, signal_num) == 0)
+        return 0;
+    return kill(pid, signal_num);
+}
+
+//<--------------------------- Process group functions - end--------------------------->
+
+//<--------------------------- Environment functions--------------------------->
+
+Environment::Environment() : vars(), entries(), envp(), dirty(true)
+{
+    for (char **env = environ; *env != nullptr; env++)
+    {
+        const char *sign = strchr(*env, '=');
+        if (sign != nullptr)
+            vars[string(*env, sign - *env)] = sign + 1;
+    }
+}
+
+bool Environment::get(const std::string &name, std::string *value) const
+{
+    map<string, string>::const_iterator it = vars.find(name);
+    if (it == vars.end())
+        return false;
+    *value = it->second;
+    return true;
+}
+
+void Environment::set(const std::string &name, const std::string &value)
+{
+    vars[name] = value;
+    dirty = true;
+}
+
+void Environment::unset(const std::string &name)
+{
+    dirty = vars.erase(name) > 0 || dirty;
+}
+
+const std::map<std::string, std::string> &Environment::getAll() const
+{
+    return vars;
+}
+
+void Environment::rebuild()
+{
+    entries.clear();
+    envp.clear();
+    for (map<string, string>::const_iterator it = vars.begin(); it != vars.end(); ++it)
+        entries.push_back(it->first + "=" + it->second);
+    for (int i = 0; i < int(entries.size()); i++)
+        envp.push_back(&entries[i][0]);
+    envp.push_back(nullptr);
+    dirty = false;
+}
+
+char **Environment::getEnvp()
+{
+    if (dirty)
+        rebuild();
+    return envp.data();
+}
+
+bool Environment::isValidName(const std::string &name)
+{
+    if (name.empty() || isdigit(name[0]))
+        return false;
+    for (int i = 0; i < int(name.size()); i++)
+    {
+        if (!isalnum(name[i]) && name[i] != '_')
+            return false;
+    }
+    return true;
+}
+
+/*
+export                  - prints the exported variables
+export NAME=value ...   - sets and exports them, a value may be quoted
+*/
+void ExportCommand::execute()
+{
+    Environment &environment = SmallShell::getInstance().getEnvironment();
+    const vector<string> &words = args_vec;
+    if (int(words.size()) == 1)
+    {
+        const map<string, string> &vars = environment.getAll();
+        for (map<string, string>::const_iterator it = vars.begin(); it != vars.end(); ++it)
+            SmallShell::getInstance().getOutput() << "declare -x " << it->first << "=\"" << it->second << "\"\n";
+        return;
+    }
+
+    //  every word is checked first, so a bad one changes nothing
+    for (int i = 1; i < int(words.size()); i++)
+    {
+        if (!Environment::isValidName(words[i].substr(0, words[i].find('='))))
+        {
+            InvaildArgument e("export");
+            throw e;
+        }
+    }
+    for (int i = 1; i < int(words.size()); i++)
+    {
+        size_t sign = words[i].find('=');
+        if (sign != string::npos)
+            environment.set(words[i].substr(0, sign), words[i].substr(sign + 1));
+    }
+}
+
+void UnsetCommand::execute()
+{
+    for (int i = 1; i < int(args_vec.size()); i++)
+    {
+        if (!Environment::isValidName(args_vec[i]))
+        {
+            InvaildArgument e("unset");
+            throw e;
+        }
+    }
+    for (int i = 1; i < int(args_vec.size()); i++)
+        SmallShell::getInstance().getEnvironment().unset(args_vec[i]);
+}
+
+//<--------------------------- Environment functions - end--------------------------->
+
+//<--------------------------- Control socket functions--------------------------->
+
+// a string as a JSON string literal
+static string jsonString(const string &str)
+{
+    string quoted = "\"";
+    for (size_t i = 0; i < str.size(); i++)
+    {
+        unsigned char c = str[i];
+        if (c == '"' || c == '\\')
+            quoted += string("\\") + char(c);
+        else if (c == '\n')
+            quoted += "\\n";
+        else if (c == '\t')
+            quoted += "\\t";
+        else if (c < 0x20)
+        {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            quoted += escaped;
+        }
+        else
+            quoted += char(c);
+    }
+    return quoted + "\"";
+}
+
+// the 4 hex digits of a "\\u" escape at pos, -1 if they are not
+static long parseHex4(const string &line, size_t pos)
+{
+    if (pos + 4 > line.size())
+        return -1;
+    long code = 0;
+    for (size_t i = pos; i < pos + 4; i++)
+    {
+        if (!isxdigit((unsigned char)line[i]))
+            return -1;
+        code = code * 16 + (isdigit((unsigned char)line[i]) ? line[i] - '0' : tolower(line[i]) - 'a' + 10);
+    }
+    return code;
+}
+
+// appends a code point as UTF-8 - a lone surrogate becomes U+FFFD
+static void appendUtf8(string *out, long code)
+{
+    if (code >= 0xD800 && code < 0xE000)
+        code = 0xFFFD;
+    if (code < 0x80)
+        *out += char(code);
+    else if (code < 0x800)
+    {
+        *out += char(0xC0 | (code >> 6));
+        *out += char(0x80 | (code & 0x3F));
+    }
+    else if (code < 0x10000)
+    {
+        *out += char(0xE0 | (code >> 12));
+        *out += char(0x80 | ((code >> 6) & 0x3F));
+        *out += char(0x80 | (code & 0x3F));
+    }
+    else
+    {
+        *out += char(0xF0 | (code >> 18));
+        *out += char(0x80 | ((code >> 12) & 0x3F));
+        *out += char(0x80 | ((code >> 6) & 0x3F));
+        *out += char(0x80 | (code & 0x3F));
+    }
+}
+
+// parses a flat JSON object of strings, numbers and booleans - values are kept as their text
+// returns: false if line is not such an object
+static bool parseFlatJson(const string &line, map<string, string> *fields)
+{
+    size_t i = 0;
+    auto skipSpace = [&]()
+    {
+        while (i < line.size() && isspace((unsigned char)line[i]))
+            i++;
+    };
+    auto parseString = [&](string *value)
+    {
+        if (i >= line.size() || line[i] != '"')
+            return false;
+        for (i++; i < line.size() && line[i] != '"'; i++)
+        {
+            if (line[i] != '\\')
+            {
+                *value += line[i];
+                continue;
+            }
+            if (++i >= line.size())
+                return false;
+            char c = line[i];
+            if (c == 'n')
+                *value += '\n';
+            else if (c == 't')
+                *value += '\t';
+            else if (c == 'r')
+                *value += '\r';
+            else if (c == 'u')
+            {
+                long code = parseHex4(line, i + 1);
+                if (code < 0)
+                    return false;
+                i += 4;
+
+                //  a character beyond the BMP comes as a surrogate pair
+                if (code >= 0xD800 && code < 0xDC00 && line.compare(i + 1, 2, "\\u") == 0)
+                {
+                    long low = parseHex4(line, i + 3);
+                    if (low >= 0xDC00 && low < 0xE000)
+                    {
+                        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                        i += 6;
+                    }
+                }
+                appendUtf8(value, code);
+            }
+            else
+                *value += c;
+        }
+        return i++ < line.size();
+    };
+
+    skipSpace();
+    if (i >= line.size() || line[i++] != '{')
+        return false;
+    skipSpace();
+    if (i < line.size() && line[i] == '}')
+        return true;
+    while (i < line.size())
+    {
+        string key, value;
+        skipSpace();
+        if (!parseString(&key))
+            return false;
+        skipSpace();
+        if (i >= line.size() || line[i++] != ':')
+            return false;
+        skipSpace();
+        if (i < line.size() && line[i] == '"')
+        {
+            if (!parseString(&value))
+                return false;
+        }
+        else
+        {
+            while (i < line.size() && (isalnum((unsigned char)line[i]) || line[i] == '-' || line[i] == '.'))
+                value += line[i++];
+            if (value.empty())
+                return false;
+        }
+        (*fields)[key] = value;
+        skipSpace();
+        if (i < line.size() && line[i] == ',')
+        {
+            i++;
+            continue;
+        }
+        if (i < line.size() && line[i] == '}')
+            return true;
+        return false;
+    }
+    return false;
+}
+
+ControlServer::~ControlServer()
+{
+    //  forked children run this too when they exit - only the shell owns the socket file
+    if (owner_pid == getpid() && !path.empty())
+        unlink(path.c_str());
+}
+
+bool ControlServer::start(const std::string &socket_path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+    strcpy(addr.sun_path, socket_path.c_str());
+
+    //  a socket left behind by an earlier smash is replaced, any other file is not
+    struct stat st;
+    if (lstat(socket_path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(socket_path.c_str());
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (listen_fd == -1 || epoll_fd == -1 || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        listen(listen_fd, 128) == -1 || pipe2(wake_fd, O_NONBLOCK | O_CLOEXEC) == -1)
+        return false;
+    path = socket_path;
+    owner_pid = getpid();
+
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = listen_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+    event.data.fd = wake_fd[0];
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd[0], &event);
+    event.data.fd = 0;
+    stdin_polled = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, 0, &event) == 0;
+    return true;
+}
+
+bool ControlServer::isRunning() const
+{
+    return listen_fd != -1 && owner_pid == getpid();
+}
+
+void ControlServer::wake()
+{
+    if (wake_fd[1] != -1)
+    {
+        char byte = 0;
+        ssize_t res = ::write(wake_fd[1], &byte, 1);
+        (void)res;
+    }
+}
+
+void ControlServer::jobRemoved(const JobsList::JobEntry &job)
+{
+    if (!isRunning())
+        return;
+    shared_ptr<Command> cmd = job.getCommand();
+    string event = "{\"event\":\"" + string(job.isFinished() ? "exit" : "removed") + "\",\"job\":" + to_string(job.getJobId()) +
+                   ",\"pid\":" + to_string(cmd->getProcessId()) + ",\"cmd\":" + jsonString(cmd->getCmdL());
+    if (job.isFinished())
+        event += ",\"status\":" + to_string(shellStatus(job.getExitStatus()));
+
+    //  the next pass of readLine writes it out
+    for (map<int, Client>::iterator it = clients.begin(); it != clients.end(); ++it)
+    {
+        if (it->second.subscribed)
+            it->second.output += event + "}\n";
+    }
+}
+
+void ControlServer::accept()
+{
+    int fd;
+    while ((fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1)
+    {
+        epoll_event event;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.fd = fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+        {
+            close(fd);
+            continue;
+        }
+        Client client = {fd, "", "", false, false};
+        clients[fd] = client;
+    }
+}
+
+void ControlServer::readClient(Client &client)
+{
+    char buf[4096];
+    ssize_t bytes;
+    while ((bytes = read(client.fd, buf, sizeof(buf))) > 0)
+        client.input.append(buf, bytes);
+    if (bytes == 0 || (bytes == -1 && errno != EAGAIN && errno != EINTR))
+        client.closed = true;
+
+    size_t newline;
+    while (!client.closed && (newline = client.input.find('\n')) != string::npos)
+    {
+        string line = client.input.substr(0, newline);
+        client.input.erase(0, newline + 1);
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (!line.empty())
+            handleRequest(client, line);
+    }
+    if (client.input.size() > CONTROL_MAX_LINE)
+        client.closed = true;
+}
+
+void ControlServer::writeClient(Client &client)
+{
+    while (!client.output.empty())
+    {
+        ssize_t bytes = send(client.fd, client.output.data(), client.output.size(), MSG_NOSIGNAL);
+        if (bytes == -1)
+        {
+            //  the rest goes out on the next EPOLLOUT - a client that stops reading is dropped
+            if (errno != EAGAIN && errno != EINTR)
+                client.closed = true;
+            break;
+        }
+        client.output.erase(0, bytes);
+    }
+    if (client.output.size() > CONTROL_MAX_PENDING)
+        client.closed = true;
+}
+
+void ControlServer::handleRequest(Client &client, const std::string &line)
+{
+    SmallShell &smash = SmallShell::getInstance();
+    JobsList &jobs = smash.getJobsList();
+    map<string, string> fields;
+    string reply;
+    if (!parseFlatJson(line, &fields))
+    {
+        client.output += "{\"ok\":false,\"error\":\"malformed request\"}\n";
+        return;
+    }
+
+    string op = fields["op"];
+    try
+    {
+        if (op == "run")
+        {
+            string cmd_line = fields["line"];
+            if (fields["background"] == "true" && !_isBackgroundCommand(cmd_line.c_str()))
+                cmd_line += "&";
+            int last_job = jobs.getMaxId();
+            smash.addToHistory(cmd_line);
+            smash.executeCommand(cmd_line.c_str());
+            smash.getOutput().flush();
+            reply = "{\"ok\":true,\"status\":" + to_string(smash.getLastStatus());
+            if (jobs.getMaxId() > last_job)
+                reply += ",\"job\":" + to_string(jobs.getMaxId());
+            reply += "}";
+        }
+        else if (op == "jobs")
+        {
+            jobs.removeFinishedJobs();
+            reply = "{\"ok\":true,\"jobs\":[";
+            for (int i = 0; i < int(jobs.jobs.size()); i++)
+            {
+                const JobsList::JobEntry &job = *jobs.jobs[i];
+                string state = job.isQueued() ? "queued" : job.isWaiting() ? "waiting"
+                                                       : job.isScheduled() ? "scheduled"
+                                                       : job.getStopped()  ? "stopped"
+                                                                           : "running";
+                bool has_process = !job.isQueued() && !job.isWaiting();
+                reply += string(i > 0 ? "," : "") + "{\"id\":" + to_string(job.getJobId()) +
+                         ",\"pid\":" + to_string(has_process ? job.getCommand()->getProcessId() : 0) +
+                         ",\"cmd\":" + jsonString(job.getCommand()->getCmdL()) + ",\"state\":\"" + state + "\"" +
+                         ",\"builtin\":" + (job.getCommand()->getTask() != nullptr ? "true" : "false") +
+                         ",\"seconds\":" + to_string(has_process ? job.getSeconds() : 0) + "}";
+            }
+            reply += "]}";
+        }
+        else if (op == "kill")
+        {
+            //  the same checks and messages as "kill -<signal> <job>" typed at the prompt
+            string cmd_line = "kill -" + fields["signal"] + " " + fields["job"];
+            KillCommand kill(cmd_line.c_str(), &jobs);
+            kill.execute();
+            smash.getOutput().flush();
+            reply = "{\"ok\":true}";
+        }
+        else if (op == "subscribe")
+        {
+            client.subscribed = true;
+            reply = "{\"ok\":true}";
+        }
+        else
+        {
+            reply = "{\"ok\":false,\"error\":" + jsonString("unknown op " + op) + "}";
+        }
+    }
+    catch (SystemCallFailed &e)
+    {
+        smash.setLastStatus(W_EXITCODE(1, 0));
+        smash.getOutput().flush();
+        reply = "{\"ok\":false,\"error\":" + jsonString(string(e.what()) + ": " + strerror(errno)) + "}";
+    }
+    catch (std::exception &e)
+    {
+        smash.setLastStatus(W_EXITCODE(1, 0));
+        smash.getOutput().flush();
+        reply = "{\"ok\":false,\"error\":" + jsonString(e.what()) + "}";
+    }
+    client.output += reply + "\n";
+
+    //  the command's output went to the terminal after the prompt
+    if (op == "run" && stdin_open)
+        smash.printPrompt();
+}
+
+void ControlServer::readLine(std::string *line)
+{
+    SmallShell &smash = SmallShell::getInstance();
+    while (true)
+    {
+        size_t newline = stdin_input.find('\n');
+        if (newline != string::npos)
+        {
+            *line = stdin_input.substr(0, newline);
+            stdin_input.erase(0, newline + 1);
+            return;
+        }
+
+        epoll_event events[64];
+        int ready = stdin_open && !stdin_polled ? 0 : epoll_wait(epoll_fd, events, 64, -1);
+        if (ready == -1 && errno != EINTR)
+        {
+            SystemCallFailed e("epoll_wait");
+            throw e;
+        }
+
+        bool read_stdin = stdin_open && !stdin_polled;
+        for (int i = 0; i < ready; i++)
+        {
+            int fd = events[i].data.fd;
+            if (fd == 0)
+                read_stdin = true;
+            else if (fd == listen_fd)
+                accept();
+            else if (fd == wake_fd[0])
+            {
+                char buf[256];
+                while (read(wake_fd[0], buf, sizeof(buf)) > 0)
+                    ;
+            }
+            else if (clients.count(fd) != 0)
+                readClient(clients[fd]);
+        }
+
+        //  exited jobs leave the list now, not at the next prompt, so subscribers hear of them
+        smash.processEvents();
+        bool subscribed = false;
+        for (map<int, Client>::iterator it = clients.begin(); it != clients.end(); ++it)
+            subscribed = subscribed || it->second.subscribed;
+        if (subscribed)
+            smash.getJobsList().removeFinishedJobs();
+        for (map<int, Client>::iterator it = clients.begin(); it != clients.end();)
+        {
+            writeClient(it->second);
+            if (it->second.closed)
+            {
+                close(it->first);
+                it = clients.erase(it);
+            }
+            else
+                ++it;
+        }
+
+        if (read_stdin)
+        {
+            char buf[4096];
+            ssize_t bytes = read(0, buf, sizeof(buf));
+            if (bytes > 0)
+                stdin_input.append(buf, bytes);
+            else if (bytes == 0 || errno != EINTR)
+            {
+                //  the last line may have no newline
+                stdin_open = false;
+                if (stdin_polled)
+                    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, 0, nullptr);
+                if (!stdin_input.empty())
+                {
+                    *line = stdin_input;
+                    stdin_input.clear();
+                    return;
+                }
+            }
+        }
+    }
+}
+
+//<--------------------------- Control socket functions - end--------------------------->
+
+//<--------------------------- Recorder functions--------------------------->
+
+// appends n as LEB128 - 7 bits a byte, the high bit set on all but the last one
+static size_t putVarint(char *buf, unsigned long long n)
+{
+    size_t len = 0;
+    while (n >= 0x80)
+    {
+        buf[len++] = char((n & 0x7f) | 0x80);
+        n >>= 7;
+    }
+    buf[len++] = char(n);
+    return len;
+}
+
+// returns: false if the data ends in the middle of the number
+static bool getVarint(const string &data, size_t *pos, unsigned long long *n)
+{
+    *n = 0;
+    for (int shift = 0; *pos < data.size() && shift < 64; shift += 7)
+    {
+        unsigned char byte = data[(*pos)++];
+        *n |= (unsigned long long)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+Recorder::~Recorder()
+{
+    if (fd != -1 && owner_pid == getpid())
+        close(fd);
+}
+
+bool Recorder::start(const std::string &path)
+{
+    fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (fd == -1)
+        return false;
+    owner_pid = getpid();
+    start_ns = monotonicNs();
+    append(RECORD_MAGIC, strlen(RECORD_MAGIC));
+    return true;
+}
+
+bool Recorder::isRecording() const
+{
+    return fd != -1;
+}
+
+// a whole record in one write, so a handler's record never lands inside another one.
+// A forked copy of smash inherits the recorder, it does not record
+void Recorder::append(const char *data, size_t len)
+{
+    if (fd == -1 || getpid() != owner_pid)
+        return;
+    int saved_errno = errno;
+    while (write(fd, data, len) == -1 && errno == EINTR)
+    {
+    }
+    errno = saved_errno;
+}
+
+void Recorder::beginLine(const char *cmd_line)
+{
+    if (depth++ > 0 || fd == -1)
+        return;
+    line_start = monotonicNs();
+    line_max_job = SmallShell::getInstance().getJobsList().getMaxId();
+
+    size_t len = strlen(cmd_line);
+    string record(1 + 2 * 10 + len, 0);
+    record[0] = RECORD_LINE;
+    size_t used = 1;
+    used += putVarint(&record[used], line_start - start_ns);
+    used += putVarint(&record[used], len);
+    memcpy(&record[used], cmd_line, len);
+    append(record.data(), used + len);
+}
+
+void Recorder::endLine(int status)
+{
+    if (--depth > 0 || fd == -1)
+        return;
+    long long now = monotonicNs();
+    int max_job = SmallShell::getInstance().getJobsList().getMaxId();
+
+    char record[64];
+    size_t used = 0;
+    record[used++] = RECORD_DONE;
+    used += putVarint(record + used, now - start_ns);
+    used += putVarint(record + used, now - line_start);
+    used += putVarint(record + used, status);
+    used += putVarint(record + used, max_job > line_max_job ? max_job : 0);
+    append(record, used);
+}
+
+void Recorder::recordSignal(int signal_num)
+{
+    if (fd == -1)
+        return;
+    char record[32];
+    size_t used = 0;
+    record[used++] = RECORD_SIGNAL;
+    used += putVarint(record + used, monotonicNs() - start_ns);
+    used += putVarint(record + used, signal_num);
+    append(record, used);
+}
+
+void Recorder::recordJob(int job_id, int status)
+{
+    if (replaying && job_id >= 0 && job_id < int(replay_jobs.size()))
+        replay_jobs[job_id] = shellStatus(status);
+    if (fd == -1)
+        return;
+    char record[48];
+    size_t used = 0;
+    record[used++] = RECORD_JOB;
+    used += putVarint(record + used, monotonicNs() - start_ns);
+    used += putVarint(record + used, job_id);
+    used += putVarint(record + used, shellStatus(status));
+    append(record, used);
+}
+
+// a recording cut by a crash ends at its last whole record
+std::vector<Recorder::Record> Recorder::load(const std::string &path)
+{
+    int in_fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in_fd == -1)
+    {
+        SystemCallFailed e("open");
+        throw e;
+    }
+    string data;
+    char buf[65536];
+    ssize_t bytes;
+    while ((bytes = read(in_fd, buf, sizeof(buf))) != 0)
+    {
+        if (bytes == -1 && errno == EINTR)
+            continue;
+        if (bytes == -1)
+        {
+            close(in_fd);
+            SystemCallFailed e("read");
+            throw e;
+        }
+        data.append(buf, bytes);
+    }
+    close(in_fd);
+
+    size_t pos = strlen(RECORD_MAGIC);
+    if (data.compare(0, pos, RECORD_MAGIC) != 0)
+    {
+        BadRecording e(path);
+        throw e;
+    }
+
+    vector<Record> records;
+    while (pos < data.size())
+    {
+        Record record = {data[pos++], 0, 0, 0, 0, 0, ""};
+        unsigned long long time, a = 0, b = 0, c = 0;
+        bool whole = getVarint(data, &pos, &time);
+        switch (record.type)
+        {
+        case RECORD_LINE:
+            whole = whole && getVarint(data, &pos, &a) && a <= data.size() - pos;
+            if (whole)
+                record.text = data.substr(pos, a);
+            pos += whole ? a : 0;
+            break;
+        case RECORD_DONE:
+            whole = whole && getVarint(data, &pos, &a) && getVarint(data, &pos, &b) && getVarint(data, &pos, &c);
+            record.duration = a;
+            record.status = b;
+            record.job_id = c;
+            break;
+        case RECORD_SIGNAL:
+            whole = whole && getVarint(data, &pos, &a);
+            record.signal_num = a;
+            break;
+        case RECORD_JOB:
+            whole = whole && getVarint(data, &pos, &a) && getVarint(data, &pos, &b);
+            record.job_id = a;
+            record.status = b;
+            break;
+        default:
+            BadRecording e(path);
+            throw e;
+        }
+        if (!whole)
+            break;
+        record.time = time;
+        records.push_back(record);
+    }
+    return records;
+}
+
+// Sends the recorded ctrl-C and ctrl-Z to the shell at their offsets into the replayed line.
+// Its thread blocks every signal, so they are handled where the user's would be.
+class SignalInjector
+{
+    std::mutex lock;
+    std::condition_variable changed;
+    std::vector<std::pair<long long, int>> pending;
+    size_t next;
+    bool stopping;
+    std::thread thread;
+
+    void run()
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        while (!stopping)
+        {
+            if (next >= pending.size())
+            {
+                changed.wait(guard);
+                continue;
+            }
+            long long now = monotonicNs();
+            if (pending[next].first > now)
+            {
+                changed.wait_for(guard, std::chrono::nanoseconds(pending[next].first - now));
+                continue;
+            }
+            kill(getpid(), pending[next].second);
+            next++;
+        }
+    }
+
+public:
+    SignalInjector() : lock(), changed(), pending(), next(0), stopping(false), thread()
+    {
+        sigset_t all_signals, old_set;
+        sigfillset(&all_signals);
+        pthread_sigmask(SIG_SETMASK, &all_signals, &old_set);
+        thread = std::thread(&SignalInjector::run, this);
+        pthread_sigmask(SIG_SETMASK, &old_set, nullptr);
+    }
+
+    ~SignalInjector()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        changed.notify_one();
+        thread.join();
+    }
+
+    void arm(long long line_start, const vector<Recorder::Record> &signals, long long line_time)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        pending.clear();
+        next = 0;
+        for (int i = 0; i < int(signals.size()); i++)
+            pending.push_back(std::make_pair(line_start + signals[i].time - line_time, signals[i].signal_num));
+        changed.notify_one();
+    }
+
+    // returns: the signals that were sent
+    int disarm()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        int sent = next;
+        pending.clear();
+        next = 0;
+        return sent;
+    }
+};
+
+// a line of a recording, its outcome, and the ctrl-C and ctrl-Z that arrived while it ran
+struct ReplayLine
+{
+    Recorder::Record line;
+    Recorder::Record done;
+    bool has_done;
+    vector<Recorder::Record> signals;
+};
+
+static void sleepUntil(long long ns)
+{
+    struct timespec ts;
+    ts.tv_sec = ns / 1000000000LL;
+    ts.tv_nsec = ns % 1000000000LL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR)
+    {
+    }
+}
+
+static string quoteLine(const string &text)
+{
+    return "\"" + (text.size() > 40 ? text.substr(0, 37) + "..." : text) + "\"";
+}
+
+int Recorder::replay(const std::string &path, double speed)
+{
+    SmallShell &smash = SmallShell::getInstance();
+    JobsList &jobs = smash.getJobsList();
+    vector<Record> records = load(path);
+
+    //  a signal belongs to the line that was running - the ones at the prompt and the alarms are only counted
+    vector<ReplayLine> lines;
+    map<int, int> recorded_jobs;
+    int max_job = 0;
+    for (int i = 0; i < int(records.size()); i++)
+    {
+        const Record &record = records[i];
+        bool running = !lines.empty() && !lines.back().has_done;
+        if (record.type == RECORD_LINE)
+        {
+            ReplayLine line = {record, record, false, vector<Record>()};
+            lines.push_back(line);
+        }
+        else if (record.type == RECORD_DONE && running)
+        {
+            lines.back().done = record;
+            lines.back().has_done = true;
+            max_job = std::max(max_job, record.job_id);
+        }
+        else if (record.type == RECORD_SIGNAL && running && (record.signal_num == SIGINT || record.signal_num == SIGTSTP))
+            lines.back().signals.push_back(record);
+        else if (record.type == RECORD_JOB)
+        {
+            recorded_jobs[record.job_id] = record.status;
+            max_job = std::max(max_job, record.job_id);
+        }
+    }
+
+    //  sized before, so recordJob never allocates
+    replay_jobs.assign(max_job + 1, -1);
+    replaying = true;
+
+    vector<string> divergences;
+    SignalInjector injector;
+    long long base = monotonicNs();
+    int replayed = 0;
+    for (int i = 0; i < int(lines.size()); i++)
+    {
+        const ReplayLine &line = lines[i];
+        string cmd_s = _trim(line.line.text);
+        if (cmd_s.substr(0, cmd_s.find_first_of(" \t")) == "quit")
+            break;
+        if (speed > 0)
+            sleepUntil(base + (long long)(line.line.time / speed));
+
+        int before = jobs.getMaxId();
+        long long start = monotonicNs();
+        injector.arm(start, line.signals, line.line.time);
+        try
+        {
+            smash.addToHistory(line.line.text);
+            smash.executeCommand(line.line.text.c_str());
+        }
+        catch (SystemCallFailed &e)
+        {
+            smash.setLastStatus(W_EXITCODE(1, 0));
+            smash.getOutput().flush();
+            perror(e.what());
+        }
+        catch (std::exception &e)
+        {
+            smash.setLastStatus(W_EXITCODE(1, 0));
+            smash.getOutput().flush();
+            std::cerr << e.what() << std::endl;
+        }
+        double took_ms = (monotonicNs() - start) / 1e6;
+        int sent = injector.disarm();
+        smash.getOutput().flush();
+        replayed++;
+
+        //  the recording ended while the line ran - there is nothing to compare to
+        if (!line.has_done)
+            continue;
+        string prefix = "line " + to_string(i + 1) + " " + quoteLine(line.line.text) + ": ";
+        char text[128];
+        int status = smash.getLastStatus();
+        if (status != line.done.status)
+            divergences.push_back(prefix + "status " + to_string(status) + ", recorded " + to_string(line.done.status));
+
+        double recorded_ms = line.done.duration / 1e6;
+        if (took_ms > recorded_ms * REPLAY_LATENCY_RATIO + REPLAY_LATENCY_SLACK_MS ||
+            recorded_ms > took_ms * REPLAY_LATENCY_RATIO + REPLAY_LATENCY_SLACK_MS)
+        {
+            snprintf(text, sizeof(text), "took %.1f ms, recorded %.1f ms", took_ms, recorded_ms);
+            divergences.push_back(prefix + text);
+        }
+
+        int job = jobs.getMaxId() > before ? jobs.getMaxId() : 0;
+        if (job != line.done.job_id)
+            divergences.push_back(prefix + "started job " + to_string(job) + ", recorded job " + to_string(line.done.job_id));
+        if (sent < int(line.signals.size()))
+            divergences.push_back(prefix + to_string(line.signals.size() - sent) + " of its signals were not sent, it ended first");
+    }
+
+    //  the jobs run in real time at any speed - they get as long as they had in the recording
+    long long wait_ns = REPLAY_GRACE_MS * 1000000LL;
+    if (!records.empty() && !lines.empty() && lines.back().has_done)
+        wait_ns += std::max(0LL, records.back().time - lines.back().done.time);
+    long long deadline = monotonicNs() + wait_ns;
+    while (true)
+    {
+        smash.processEvents();
+        bool all_ended = true;
+        for (auto it = recorded_jobs.begin(); it != recorded_jobs.end(); it++)
+            all_ended = all_ended && replay_jobs[it->first] != -1;
+        if (all_ended || monotonicNs() >= deadline)
+            break;
+        sleepUntil(std::min(deadline, monotonicNs() + 10000000LL));
+    }
+    for (auto it = recorded_jobs.begin(); it != recorded_jobs.end(); it++)
+    {
+        int status = replay_jobs[it->first];
+        string prefix = "job " + to_string(it->first) + ": ";
+        if (status == -1)
+            divergences.push_back(prefix + "still running, recorded status " + to_string(it->second));
+        else if (status != it->second)
+            divergences.push_back(prefix + "status " + to_string(status) + ", recorded " + to_string(it->second));
+    }
+    replaying = false;
+
+    OutputBuffer &output = smash.getOutput();
+    for (int i = 0; i < int(divergences.size()); i++)
+        output << "smash: replay: " << divergences[i] << "\n";
+    char summary[128];
+    snprintf(summary, sizeof(summary), "smash: replayed %d of %d lines, %d divergences\n", replayed, int(lines.size()), int(divergences.size()));
+    output << summary;
+    output.flush();
+
+    jobs.removeFinishedJobs();
+    if (jobs.getMaxId() > 0)
+        jobs.killAllJobs();
+    output.flush();
+    return divergences.empty() ? 0 : 1;
+}
+
+//<--------------------------- Recorder functions - end--------------------------->
+
+//<--------------------------- Working directory functions--------------------------->
+
+// the physical path of the directory fd is in - getcwd may fail on a deep path, then it is joined lexically
+static string directoryPath(const string &base, const string &dir)
+{
+    char *cwd = getcwd(nullptr, 0);
+    if (cwd != nullptr)
+    {
+        string path(cwd);
+        free(cwd);
+        return path;
+    }
+
+    vector<string> parts;
+    stringstream joined(dir[0] == '/' ? dir : base + "/" + dir);
+    for (string part; getline(joined, part, '/');)
+    {
+        if (part.empty() || part == ".")
+            continue;
+        if (part == "..")
+        {
+            if (!parts.empty())
+                parts.pop_back();
+            continue;
+        }
+        parts.push_back(part);
+    }
+    string path;
+    for (int i = 0; i < int(parts.size()); i++)
+        path += "/" + parts[i];
+    return path.empty() ? "/" : path;
+}
+
+WorkingDir::WorkingDir() : current_fd(open(".", O_PATH | O_DIRECTORY | O_CLOEXEC)), previous_fd(-1), current_path(), previous_path(), lock()
+{
+    char *cwd = getcwd(nullptr, 0);
+    if (cwd != nullptr)
+    {
+        current_path = cwd;
+        free(cwd);
+    }
+}
+
+WorkingDir::~WorkingDir()
+{
+    if (current_fd != -1)
+        close(current_fd);
+    if (previous_fd != -1)
+        close(previous_fd);
+}
+
+int WorkingDir::getFd() const
+{
+    return current_fd != -1 ? current_fd : AT_FDCWD;
+}
+
+std::string WorkingDir::getPath() const
+{
+    lock_guard<mutex> guard(lock);
+    return current_path;
+}
+
+bool WorkingDir::hasPrevious() const
+{
+    return previous_fd != -1;
+}
+
+// the current directory becomes the previous one
+void WorkingDir::moveTo(int fd, const std::string &path)
+{
+    lock_guard<mutex> guard(lock);
+    if (previous_fd != -1)
+        close(previous_fd);
+    previous_fd = current_fd;
+    previous_path = current_path;
+    current_fd = fd;
+    current_path = path;
+}
+
+void WorkingDir::change(const std::string &dir)
+{
+    //  opened relative to the cached fd, then entered - the shell's cwd follows for the externals
+    int fd = openat(getFd(), dir.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1 || fchdir(fd) == -1)
+    {
+        int error = errno;
+        if (fd != -1)
+            close(fd);
+        errno = error;
+        SystemCallFailed e("chdir");
+        throw e;
+    }
+    moveTo(fd, directoryPath(current_path, dir));
+}
+
+void WorkingDir::changeToPrevious()
+{
+    if (fchdir(previous_fd) == -1)
+    {
+        SystemCallFailed e("chdir");
+        throw e;
+    }
+    lock_guard<mutex> guard(lock);
+    swap(current_fd, previous_fd);
+    swap(current_path, previous_path);
+}
+
+//<--------------------------- Working directory functions - end--------------------------->
+
+//<--------------------------- Zygote functions--------------------------->
+
+// a spawn request - argc then envc NUL terminated strings follow it, the stdin, stdout, stderr and cwd fds ride along
+struct ZygoteRequest
+{
+    int pgid;
+    int argc;
+    int envc;
+    int simple;
+    int has_affinity;
+    cpu_set_t affinity;
+};
+
+struct ZygoteReply
+{
+    int pid;
+    int error;
+};
+
+#define ZYGOTE_REQUEST_FDS 4
+
+// forks the zygote - it serves spawn requests until the shell goes away
+bool Zygote::start()
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) == -1)
+        return false;
+    int parent = getpid();
+    pid = fork();
+    if (pid == -1)
+    {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (pid == 0)
+    {
+        close(fds[0]);
+        //  its own group keeps ctrl-C and ctrl-Z typed at the shell away from it
+        setpgid(0, 0);
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        if (getppid() != parent)
+            _exit(0);
+        int reset[] = {SIGINT, SIGTSTP, SIGALRM, SIGCHLD};
+        for (int i = 0; i < int(sizeof(reset) / sizeof(reset[0])); i++)
+            signal(reset[i], SIG_DFL);
+        sigset_t empty_set;
+        sigemptyset(&empty_set);
+        sigprocmask(SIG_SETMASK, &empty_set, nullptr);
+        serve(fds[1]);
+    }
+    close(fds[1]);
+    sock = fds[0];
+    return true;
+}
+
+bool Zygote::isRunning() const
+{
+    return sock != -1;
+}
+
+int Zygote::getPid() const
+{
+    return pid;
+}
+
+// runs in the zygote - clones a child of the shell for every request and replies with its pid
+void Zygote::serve(int sock)
+{
+    vector<char> buf(ZYGOTE_MAX_REQUEST + 1);
+    char control[CMSG_SPACE(sizeof(int) * ZYGOTE_REQUEST_FDS)];
+    while (true)
+    {
+        struct iovec iov = {buf.data(), ZYGOTE_MAX_REQUEST};
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        ssize_t len = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+        if (len == -1 && errno == EINTR)
+            continue;
+        if (len <= 0)
+            _exit(0);
+
+        int fds[ZYGOTE_REQUEST_FDS];
+        int fd_count = 0;
+        for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c != nullptr; c = CMSG_NXTHDR(&msg, c))
+        {
+            if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS)
+                continue;
+            int count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (int i = 0; i < count; i++)
+            {
+                int fd;
+                memcpy(&fd, CMSG_DATA(c) + i * sizeof(int), sizeof(int));
+                if (fd_count < ZYGOTE_REQUEST_FDS)
+                    fds[fd_count++] = fd;
+                else
+                    close(fd);
+            }
+        }
+
+        // splitting the strings - argv first, then the environment
+        ZygoteRequest req;
+        vector<string> args;
+        vector<char *> envp;
+        bool valid = len >= ssize_t(sizeof(req)) && fd_count == ZYGOTE_REQUEST_FDS && (msg.msg_flags & MSG_TRUNC) == 0;
+        if (valid)
+        {
+            memcpy(&req, buf.data(), sizeof(req));
+            buf[len] = '\0';
+            char *str = buf.data() + sizeof(req);
+            char *end = buf.data() + len;
+            for (int i = 0; i < req.argc + req.envc && str < end; i++)
+            {
+                if (i < req.argc)
+                    args.push_back(str);
+                else
+                    envp.push_back(str);
+                str += strlen(str) + 1;
+            }
+            valid = int(args.size()) == req.argc && int(envp.size()) == req.envc && req.argc > 0;
+        }
+        envp.push_back(nullptr);
+
+        ZygoteReply reply = {-1, EINVAL};
+        int report[2];
+        if (valid && pipe2(report, O_CLOEXEC) == 0)
+        {
+            //  a plain fork whose parent is the shell, not the zygote
+            reply.pid = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, 0, 0, 0, 0);
+            reply.error = reply.pid == -1 ? errno : 0;
+            if (reply.pid == 0)
+            {
+                close(report[0]);
+                dup2(fds[0], 0);
+                dup2(fds[1], 1);
+                dup2(fds[2], 2);
+                if (fchdir(fds[3]) == -1)
+                    perror("smash error: fchdir failed");
+                setpgid(0, req.pgid);
+                if (req.has_affinity)
+                    sched_setaffinity(0, sizeof(req.affinity), &req.affinity);
+                _execExternal(args, req.simple, envp.data());
+                int error = errno;
+                perror("smash error: execv failed");
+                ssize_t res = write(report[1], &error, sizeof(error));
+                (void)res;
+                _exit(1);
+            }
+            close(report[1]);
+            if (reply.pid > 0)
+            {
+                //  the pipe closes on a successful exec, a failed one writes errno into it
+                ssize_t res;
+                int error;
+                do
+                {
+                    res = read(report[0], &error, sizeof(error));
+                } while (res == -1 && errno == EINTR);
+                if (res == sizeof(error))
+                    reply.error = error;
+            }
+            close(report[0]);
+        }
+        for (int i = 0; i < fd_count; i++)
+            close(fds[i]);
+        send(sock, &reply, sizeof(reply), MSG_NOSIGNAL);
+    }
+}
+
+int Zygote::launch(const std::vector<std::string> &args, bool simple, int pgid, const int fds[3], int *exec_error)
+{
+    if (sock == -1)
+        return -1;
+
+    ZygoteRequest req;
+    memset(&req, 0, sizeof(req));
+    req.pgid = pgid;
+    req.simple = simple;
+    //  the shell's own affinity, as a fork of it would inherit
+    req.has_affinity = sched_getaffinity(0, sizeof(req.affinity), &req.affinity) == 0;
+    req.argc = args.size();
+    string payload(reinterpret_cast<const char *>(&req), sizeof(req));
+    for (int i = 0; i < int(args.size()); i++)
+        payload.append(args[i].c_str(), args[i].size() + 1);
+    for (char **env = SmallShell::getInstance().getEnvironment().getEnvp(); *env != nullptr; env++)
+    {
+        payload.append(*env, strlen(*env) + 1);
+        reinterpret_cast<ZygoteRequest *>(&payload[0])->envc++;
+    }
+    if (payload.size() > ZYGOTE_MAX_REQUEST)
+        return -1;
+
+    //  the zygote's cwd is the one the shell started in
+    int cwd = SmallShell::getInstance().getCwdFd();
+    int sent_fds[ZYGOTE_REQUEST_FDS] = {fds[0], fds[1], fds[2], cwd};
+    char control[CMSG_SPACE(sizeof(sent_fds))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = {&payload[0], payload.size()};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(sent_fds));
+    memcpy(CMSG_DATA(c), sent_fds, sizeof(sent_fds));
+
+    ssize_t res;
+    do
+    {
+        res = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while (res == -1 && errno == EINTR);
+
+    ZygoteReply reply = {-1, 0};
+    if (res != -1)
+    {
+        do
+        {
+            res = recv(sock, &reply, sizeof(reply), 0);
+        } while (res == -1 && errno == EINTR);
+    }
+    if (res != sizeof(reply))
+    {
+        //  the zygote is gone - the shell forks by itself from now on
+        close(sock);
+        sock = -1;
+        return -1;
+    }
+    if (reply.pid <= 0)
+        return -1;
+    *exec_error = reply.error;
+    return reply.pid;
+}
+
+//<--------------------------- Zygote functions - end--------------------------->
+
+//<--------------------------- Worker pool functions--------------------------->
+
+static thread_local AsyncTask *current_task = nullptr;
+
+// the worker the calling thread is, -1 off the pool
+static thread_local int worker_index = -1;
+
+void AsyncTask::cancel()
+{
+    cancelled = true;
+}
+
+bool AsyncTask::isCancelled() const
+{
+    return cancelled;
+}
+
+bool AsyncTask::isDone() const
+{
+    return done;
+}
+
+int AsyncTask::getStatus() const
+{
+    return status;
+}
+
+void AsyncTask::finish(int status)
+{
+    lock_guard<mutex> guard(lock);
+    this->status = status;
+    done = true;
+    finished.notify_all();
+}
+
+bool AsyncTask::waitFor(int ms)
+{
+    unique_lock<mutex> guard(lock);
+    return finished.wait_for(guard, chrono::milliseconds(ms), [this]()
+                             { return bool(done); });
+}
+
+AsyncTask *AsyncTask::current()
+{
+    return current_task;
+}
+
+void AsyncTask::setCurrent(AsyncTask *task)
+{
+    current_task = task;
+}
+
+// the workers start with the first task - signals stay with the main thread
+void WorkerPool::start()
+{
+    if (workers.empty())
+    {
+        int count = max(2, min(8, int(std::thread::hardware_concurrency())));
+        for (int i = 0; i < count; i++)
+            workers.push_back(unique_ptr<Worker>(new Worker()));
+        sigset_t all_signals, old_set;
+        sigfillset(&all_signals);
+        pthread_sigmask(SIG_SETMASK, &all_signals, &old_set);
+        for (int i = 0; i < count; i++)
+            std::thread(&WorkerPool::run, this, i).detach();
+        pthread_sigmask(SIG_SETMASK, &old_set, nullptr);
+    }
+}
+
+void WorkerPool::submit(std::function<void()> task, const void *group)
+{
+    start();
+    int index = worker_index != -1 ? worker_index : int(next++ % workers.size());
+    {
+        lock_guard<mutex> guard(workers[index]->lock);
+        workers[index]->tasks.push_back(make_pair(group, task));
+    }
+    lock_guard<mutex> guard(idle_lock);
+    pending++;
+    idle.notify_one();
+}
+
+int WorkerPool::getSize()
+{
+    start();
+    return workers.size();
+}
+
+int WorkerPool::currentSlot()
+{
+    return worker_index + 1;
+}
+
+// the worker's newest task, or else the oldest task of another worker - off the pool (-1) it only steals.
+// A group other than nullptr restricts it to the tasks of that group
+bool WorkerPool::take(int index, std::function<void()> &task, const void *group)
+{
+    bool found = false;
+    for (int i = 0; i < int(workers.size()) && !found; i++)
+    {
+        Worker &worker = *workers[index == -1 ? i : (index + i) % workers.size()];
+        lock_guard<mutex> guard(worker.lock);
+        bool newest = i == 0 && index != -1;
+        for (int j = 0; j < int(worker.tasks.size()) && !found; j++)
+        {
+            int at = newest ? int(worker.tasks.size()) - 1 - j : j;
+            if (group != nullptr && worker.tasks[at].first != group)
+                continue;
+            task = worker.tasks[at].second;
+            worker.tasks.erase(worker.tasks.begin() + at);
+            found = true;
+        }
+    }
+    if (found)
+    {
+        lock_guard<mutex> guard(idle_lock);
+        pending--;
+    }
+    return found;
+}
+
+void WorkerPool::run(int index)
+{
+    worker_index = index;
+    while (true)
+    {
+        std::function<void()> task;
+        if (take(index, task, nullptr))
+        {
+            task();
+            continue;
+        }
+        unique_lock<mutex> guard(idle_lock);
+        idle.wait(guard, [this]()
+                  { return pending > 0; });
+    }
+}
+
+void WorkerPool::helpUntil(const void *group, const std::function<bool()> &done)
+{
+    while (!done())
+    {
+        std::function<void()> task;
+        if (take(worker_index, task, group))
+        {
+            task();
+            continue;
+        }
+
+        //  the last tasks are running on other threads - done() is polled every millisecond.
+        //  Not on the idle condition: a wakeup meant for a worker must not be taken here
+        std::this_thread::sleep_for(chrono::milliseconds(1));
+    }
+}
+
+//<--------------------------- Worker pool functions - end--------------------------->
+
+//<--------------------------- Directory walker functions--------------------------->
+
+// an entry as getdents64 returns it
+struct linux_dirent64
+{
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+#define DIR_READ_SIZE (32 * 1024)
+
+DirWalker::DirHandle::~DirHandle()
+{
+    close(fd);
+}
+
+bool DirWalker::walk(const std::string &root)
+{
+    int cwd = SmallShell::getInstance().getCwdFd();
+    struct statx stx;
+    if (statx(cwd, root.c_str(), AT_SYMLINK_NOFOLLOW, statx_mask | STATX_TYPE, &stx) == -1)
+        return false;
+    visited++;
+    visitor(cwd, root.c_str(), stx, -1);
+    if (!S_ISDIR(stx.stx_mode))
+        return true;
+    int fd = openat(cwd, root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+
+    //  the root is read on this thread - its subdirectories fan out to the pool
+    readDir(fd, -1);
+    WorkerPool &pool = SmallShell::getInstance().getWorkerPool();
+    AsyncTask *owner = AsyncTask::current();
+    pool.helpUntil(this, [this, owner]()
+                   {
+        if (owner != nullptr ? owner->isCancelled() : SmallShell::getInstance().takeInterrupt())
+            stop = true;
+        return outstanding == 0; });
+    return true;
+}
+
+void DirWalker::walkDir(std::shared_ptr<DirHandle> parent, std::string name, int top)
+{
+    if (!stop)
+    {
+        int fd = openat(parent->fd, name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd == -1)
+            errors++;
+        else
+            readDir(fd, top);
+    }
+    outstanding--;
+}
+
+// visits the entries of a directory, subdirectories become tasks - entries of the root (top -1) open a top each
+void DirWalker::readDir(int dir_fd, int top)
+{
+    shared_ptr<DirHandle> handle(new DirHandle(dir_fd));
+    WorkerPool &pool = SmallShell::getInstance().getWorkerPool();
+    vector<char> buf(DIR_READ_SIZE);
+    while (!stop)
+    {
+        long len = syscall(SYS_getdents64, dir_fd, buf.data(), buf.size());
+        if (len <= 0)
+        {
+            if (len == -1)
+                errors++;
+            break;
+        }
+        for (long offset = 0; offset < len;)
+        {
+            struct linux_dirent64 *entry = reinterpret_cast<struct linux_dirent64 *>(buf.data() + offset);
+            offset += entry->d_reclen;
+            const char *name = entry->d_name;
+            if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+                continue;
+
+            struct statx stx;
+            if (statx(dir_fd, name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, statx_mask | STATX_TYPE, &stx) == -1)
+            {
+                errors++;
+                continue;
+            }
+            visited++;
+            int entry_top = top;
+            if (top == -1 && S_ISDIR(stx.stx_mode))
+            {
+                entry_top = tops.size();
+                tops.push_back(name);
+            }
+
+            //  visited before its contents, so a visitor may make a directory readable first
+            visitor(dir_fd, name, stx, entry_top);
+            if (S_ISDIR(stx.stx_mode))
+            {
+                outstanding++;
+                pool.submit(std::bind(&DirWalker::walkDir, this, handle, string(name), entry_top), this);
+            }
+        }
+    }
+}
+
+const std::vector<std::string> &DirWalker::getTops() const
+{
+    return tops;
+}
+
+unsigned long long DirWalker::getVisited() const
+{
+    return visited;
+}
+
+unsigned long long DirWalker::getErrors() const
+{
+    return errors;
+}
+
+bool DirWalker::isStopped() const
+{
+    return stop;
+}
+
+//<--------------------------- Directory walker functions - end--------------------------->
+
+void SmallShell::requestInterrupt()
+{
+    interrupted = 1;
+}
+
+// returns whether ctrl-C was pressed since the last call
+bool SmallShell::takeInterrupt()
+{
+    bool res = interrupted != 0;
+    interrupted = 0;
+    return res;
+}
+
+bool SmallShell::isInterrupted() const
+{
+    return interrupted != 0;
+}
+
+void ShowPidCommand::execute()
+{
+    int process_id = getpid();
+    SmallShell::getInstance().getOutput() << "smash pid is " << process_id << "\n";
+}
+
+void GetCurrDirCommand::execute()
+{
+    // the path cached by cd - no getcwd. A background pwd prints the directory it was started in
+    string cwd = SmallShell::getInstance().getCwdPath();
+    if (cwd.empty())
+    {
+        errno = ENOENT;
+        SystemCallFailed e("getcwd");
+        throw e;
+    }
+    SmallShell::getInstance().getOutput() << cwd << "\n";
+}
+
+void ChangeDirCommand::execute()
+{
+    WorkingDir &working_dir = SmallShell::getInstance().getWorkingDir();
+
+    //  Check amount of arguments
+    if (int(args_vec.size()) > 2)
+    {
+        TooManyArguments e("cd");
+        throw e;
+    }
+    // check if no arguement has given
+    if (int(args_vec.size()) == 1)
+        return;
+
+    //  Check if going to last working directory or a new one
+    if (args_vec[1] == "-")
+    {
+        //  if the last working directory doesn't exist
+        if (!working_dir.hasPrevious())
+        {
+            OldPWDNotSet e;
+            throw e;
+        }
+        working_dir.changeToPrevious();
+    }
+    else
+    {
+        working_dir.change(args_vec[1]);
+    }
+}
+
+std::vector<std::string> ExternalCommand::getExecArgs(bool *simple) const
+{
+    vector<string> args = args_vec;
+    // removing & sign
+    if (_isBackgroundCommand(cmd_l))
+    {
+        removeBackgroundSignString(args.back());
+        if (args.back() == "")
+        {
+            args.pop_back();
+        }
+    }
+    // parse path depending on Command type (Simple or Complex)
+    // inserting "-c" for Complex Command
+    *simple = _isSimpleExternal(cmd_l);
+    if (!*simple)
+    {
+        //  bash gets the line as it was typed, quotes and all
+        string line = _trim(string(cmd_l));
+        removeBackgroundSignString(line);
+        args = {"/bin/bash", "-c", line};
+    }
+    return args;
+}
+
+void ExternalCommand::execute()
+{
+    bool simple_plag;
+    vector<string> args = getExecArgs(&simple_plag);
+
+    // executing Command
+    _execExternal(args, simple_plag, SmallShell::getInstance().getEnvironment().getEnvp());
+    int error = errno;
+    perror("smash error: execv failed");
+    SmallShell::getInstance().reportExecFailure(error);
+
+    // kill forked process
+    exit(1);
+}
+
+void JobsCommand::execute()
+{
+    //  Remove finised jobs
+    jobs->removeFinishedJobs();
+
+    //  "jobs -g" prints the dependency graph instead
+    if (int(args_vec.size()) >= 2 && args_vec[1] == "-g")
+    {
+        jobs->printDependencyGraph();
+        return;
+    }
+
+    //  Print jobs list
+    jobs->printJobsList();
+}
+
+// a job selector starts with '%' - see JobsList::selectJobs
+static bool isJobSelector(const std::string &arg)
+{
+    return arg.size() >= 2 && arg[0] == '%';
+}
+
+/*
+bg [job-id | selector]  - a selector resumes every stopped job it picks, in one batch with a summary.
+*/
+void BackgroundCommand::execute()
+{
+    if (int(args_vec.size()) == 2 && isJobSelector(args_vec[1]))
+    {
+        vector<shared_ptr<JobsList::JobEntry>> selected = jobs->selectJobs(args_vec[1], "bg");
+        int resumed = 0;
+        for (int i = 0; i < int(selected.size()); i++)
+        {
+            JobsList::JobEntry *job = selected[i].get();
+            if (!job->getStopped() || job->isScheduled() || job->isQueued() || job->isWaiting())
+                continue;
+            if (signalJob(job->getCommand()->getProcessId(), SIGCONT) == -1)
+            {
+                SystemCallFailed e("kill");
+                throw e;
+            }
+            job->setStopped(false);
+            resumed++;
+        }
+        if (resumed == 0)
+        {
+            NoStoppedJobs e;
+            throw e;
+        }
+        SmallShell::getInstance().getOutput() << "smash: " << resumed << " jobs were resumed\n";
+        return;
+    }
+
+    if (int(args_vec.size()) >= 3)
+    {
+        if (isStringNumber(args_vec[1]))
+        {
+            int job_id_to_find = stoi(args_vec[1]);
+            if (jobs->getJobById(job_id_to_find) == nullptr)
+            {
+                JobIdDoesntExist e("bg", job_id_to_find);
+                throw e;
+            }
+        }
+        InvaildArgument e("bg");
+        throw e;
+    }
+
+    // if a specific job was given
+    if (int(args_vec.size()) == 2)
+    {
+        int job_id_to_find;
+
+        //  checking if valid argument(a number)
+        if (isStringNumber(args_vec[1]))
+        {
+            job_id_to_find = stoi(args_vec[1]);
+        }
+        else
+        {
+            InvaildArgument e("bg");
+            throw e;
+        }
+
+        //  getting the job from the list - if doesn't exist, a nullptr will return
+        JobsList::JobEntry *job = this->jobs->getJobById(job_id_to_find);
+        if (job != nullptr && job->isScheduled())
+        {
+            JobIsScheduled e("bg", job_id_to_find);
+            throw e;
+        }
+        if (job != nullptr && job->isQueued())
+        {
+            JobIsQueued e("bg", job_id_to_find);
+            throw e;
+        }
+        if (job != nullptr && job->isWaiting())
+        {
+            JobIsWaiting e("bg", job_id_to_find);
+            throw e;
+        }
+        if (job != nullptr)
+        {
+            if (job->getStopped())
+            {
+
+                int pid = job->getCommand()->getProcessId();
+
+                //  updating the command's status
+                job->setStopped(false);
+
+                //  printing the cmd_line of the command
+                SmallShell::getInstance().getOutput() << job->getCommand()->getCmdL() << " : " << pid << "\n";
+
+                // continue cammand without wating for it
+                if (signalJob(pid, SIGCONT) == -1)
+                {
+                    SystemCallFailed e("kill");
+                    throw e;
+                }
+            }
+            else
+            {
+                JobAlreadyRunning e(job_id_to_find);
+                throw e;
+            }
+        }
+        else
+        {
+            JobIdDoesntExist e("bg", job_id_to_find);
+            throw e;
+        }
+    }
+    //  if no specific job was given
+    else
+    {
+        JobsList::JobEntry *job = this->jobs->getLastStoppedJob(nullptr);
+        if (job != nullptr)
+        {
+            int pid = job->getCommand()->getProcessId();
+
+            //  updating the command's status
+            job->setStopped(false);
+
+            //  printig the cmd_line of the command
+            SmallShell::getInstance().getOutput() << job->getCommand()->getCmdL() << " : " << pid << "\n";
+
+            // continue cammand without wating for it
+            if (signalJob(pid, SIGCONT) == -1)
+            {
+                SystemCallFailed e("kill");
+                throw e;
+            }
+        }
+        else
+        {
+            NoStoppedJobs e;
+            throw e;
+        }
+    }
+}
+
+/*
+Waits for every process of a job - returns true if the job was stopped.
+status is the first non-zero status of its processes.
+*/
+bool waitForJob(shared_ptr<Command> cmd, int *status)
+{
+    vector<int> pids = cmd->getMembers();
+    if (pids.empty())
+        pids.push_back(cmd->getProcessId());
+
+    SmallShell &smash = SmallShell::getInstance();
+    for (int i = 0; i < int(pids.size()); i++)
+        smash.awaitChild(pids[i]);
+
+    bool stopped = false;
+    *status = 0;
+    for (int i = 0; i < int(pids.size()); i++)
+    {
+        int member_status;
+        if (smash.waitForeground(pids[i], &member_status) != pids[i])
+            continue;
+        if (WIFSTOPPED(member_status))
+            stopped = true;
+        else if (*status == 0)
+            *status = member_status;
+    }
+    return stopped;
+}
+
+/*
+The function brings the job required to the foreground
+input:
+    job_id - the id of the job we need to continue - if it's 0, bring the last job in the jobs list to the foreground
+    jobs - pointer to the jobs list variable in the smash
+
+*/
+void bringCommandToForegound(int job_id, JobsList *jobs)
+{
+    if (job_id == 0 && jobs->isEmpty())
+    {
+        JobsListEmpty e;
+        throw e;
+    }
+
+    //  get the job required - if the job_id doesn't exist, nullptr will be returned
+    JobsList::JobEntry *job_to_cont = job_id == 0 ? jobs->getLastJob(nullptr) : jobs->getJobById(job_id);
+
+    //  a pending schedule has no process to wait for
+    if (job_to_cont != nullptr && job_to_cont->isScheduled())
+    {
+        JobIsScheduled e("fg", job_to_cont->getJobId());
+        throw e;
+    }
+
+    //  only its prerequisites can start a waiting job
+    if (job_to_cont != nullptr && job_to_cont->isWaiting())
+    {
+        JobIsWaiting e("fg", job_to_cont->getJobId());
+        throw e;
+    }
+
+    //  a queued job skips the admission limits and starts right away
+    if (job_to_cont != nullptr && job_to_cont->isQueued())
+    {
+        jobs->startNow(job_to_cont);
+    }
+
+    //  a background builtin is waited for on its task - ctrl-C cancels it
+    if (job_to_cont != nullptr && job_to_cont->getCommand()->getTask() != nullptr)
+    {
+        SmallShell &smash = SmallShell::getInstance();
+        shared_ptr<AsyncTask> task = job_to_cont->getCommand()->getTask();
+        int pid = job_to_cont->getCommand()->getProcessId();
+        smash.getOutput() << job_to_cont->getCommand()->getCmdL() << " : " << pid << "\n";
+        smash.getOutput().flush();
+        smash.takeInterrupt();
+        smash.setCurrentCommand(job_to_cont->getCommand());
+        while (!task->waitFor(50))
+        {
+            if (smash.takeInterrupt() && !task->isCancelled())
+            {
+                task->cancel();
+                smash.getOutput() << "smash: process " << pid << " was killed\n";
+            }
+        }
+        smash.setCurrentCommand(nullptr);
+        jobs->markTaskFinished(job_to_cont);
+        smash.removeJob(job_to_cont->getJobId());
+        return;
+    }
+
+    if (job_to_cont != nullptr)
+    {
+        int pid = job_to_cont->getCommand()->getProcessId();
+
+        //  print the cmd_line of the command
+        SmallShell::getInstance().getOutput() << job_to_cont->getCommand()->getCmdL() << " : " << pid << "\n";
+        SmallShell::getInstance().getOutput().flush();
+
+        //  send a continue signal to the process group
+        if (signalJob(pid, SIGCONT) == -1)
+        {
+            SystemCallFailed e("kill");
+            throw e;
+        }
+
+        //  update the job's status
+        job_to_cont->setStopped(false);
+
+        //  save current command running in the foreground
+        SmallShell &smash = SmallShell::getInstance();
+        smash.setCurrentCommand(job_to_cont->getCommand());
+
+        //  wait for process to finish - its exit status may start dependent jobs
+        int status;
+        long long start = monotonicNs();
+        bool stopped = waitForJob(job_to_cont->getCommand(), &status);
+        smash.getMetrics().observe(METRIC_WAIT_LATENCY, monotonicNs() - start);
+        if (!stopped)
+            jobs->markFinished(pid, status);
+
+        //  remove job from jobsList if finished properly
+        if (smash.getCurrentCommand() != nullptr)
+            smash.removeJob(job_to_cont->getJobId());
+
+        //  delete current process from current command
+        smash.setCurrentCommand(nullptr);
+    }
+    else
+    {
+        JobIdDoesntExist e("fg", job_id);
+        throw e;
+    }
+}
+
+/*
+fg [job-id | selector]  - a selector brings the jobs it picks to the foreground one after the other,
+until ctrl-C or ctrl-Z.
+*/
+void ForegroundCommand::execute()
+{
+    if (int(args_vec.size()) == 2 && isJobSelector(args_vec[1]))
+    {
+        SmallShell &smash = SmallShell::getInstance();
+        vector<shared_ptr<JobsList::JobEntry>> selected = jobs->selectJobs(args_vec[1], "fg");
+        smash.takeInterrupt();
+        for (int i = 0; i < int(selected.size()); i++)
+        {
+            //  a job may have ended while an earlier one was in the foreground
+            JobsList::JobEntry *job = jobs->getJobById(selected[i]->getJobId());
+            if (job == nullptr || job != selected[i].get() || job->isScheduled() || job->isWaiting())
+                continue;
+            int job_id = job->getJobId();
+            bringCommandToForegound(job_id, jobs);
+            job = jobs->getJobById(job_id);
+            if (smash.isInterrupted() || (job != nullptr && job->getStopped()))
+                break;
+        }
+        return;
+    }
+
+    //  no specific job required
+    if (int(args_vec.size()) == 1)
+    {
+        bringCommandToForegound(0, jobs);
+    }
+    //    specific job required
+    else if (int(args_vec.size()) == 2)
+    {
+        int job_id_to_find;
+
+        // check if valid
+        if (isStringNumber(args_vec[1]))
+        {
+            job_id_to_find = stoi(args_vec[1]);
+        }
+        else
+        {
+            InvaildArgument e("fg");
+            throw e;
+        }
+        if (job_id_to_find <= 0)
+        {
+            JobIdDoesntExist e("fg", job_id_to_find);
+            throw e;
+        }
+        else
+        {
+            bringCommandToForegound(job_id_to_find, jobs);
+        }
+    }
+    else
+    {
+        if (isStringNumber(args_vec[1]))
+        {
+            int job_id_to_find = stoi(args_vec[1]);
+            if (jobs->getJobById(job_id_to_find) == nullptr)
+            {
+                JobIdDoesntExist e("fg", job_id_to_find);
+                throw e;
+            }
+        }
+
+        InvaildArgument e("fg");
+        throw e;
+    }
+}
+
+void QuitCommand::execute()
+{
+    bool flag_kill = false;
+    double grace = -1;
+
+    //  check if 'kill' was given as an argument
+    for (int i = 1; i < int(args_vec.size()); i++)
+    {
+        if (args_vec[i] == "kill")
+        {
+            flag_kill = true;
+        }
+        else if (args_vec[i] == "--grace")
+        {
+            grace = i + 1 < int(args_vec.size()) ? parseRate(args_vec[i + 1]) : -1;
+            if (grace < 0)
+            {
+                InvaildArgument e("quit");
+                throw e;
+            }
+            i++;
+        }
+    }
+
+    //  kill all jobs in the jobs list - gracefully when a grace period was given
+    if (flag_kill && grace >= 0)
+    {
+        jobs->shutdownJobs(grace);
+    }
+    else if (flag_kill)
+    {
+        jobs->killAllJobs();
+    }
+    SmallShell::getInstance().getOutput().flush();
+    exit(0);
+}
+
+/* checks :
+    -if the first char is '-'
+    -if the string given is a number
+    returns: the number if the string was given correctly. if Not, returns -1.
+*/
+int getSignalNumber(std::string str)
+{
+    if (str[0] != '-')
+    {
+        return -1;
+    }
+
+    //  remove the '-' from the string
+    str.erase(0, 1);
+
+    //  convert to integer
+    return parseCount(str);
+}
+
+/*
+Sends a signal to a single job. A queued, waiting or scheduled job is dropped, a background builtin is cancelled.
+returns: the line kill prints for it
+*/
+static string signalJobEntry(JobsList *jobs, JobsList::JobEntry *job, int signal_num)
+{
+    int job_id = job->getJobId();
+    if (job->isQueued() || job->isWaiting())
+    {
+        //  a queued or waiting job has no process yet - any signal drops it
+        string state = job->isQueued() ? "queued" : "waiting";
+        jobs->removeJobById(job_id);
+        return "smash: " + state + " job " + to_string(job_id) + " was removed\n";
+    }
+    else if (job->isScheduled())
+    {
+        //  any signal cancels a schedule - a running instance gets the signal too
+        dynamic_pointer_cast<ScheduleCommand>(job->getCommand())->cancel(signal_num);
+        jobs->removeJobById(job_id);
+        return "smash: scheduled job " + to_string(job_id) + " was cancelled\n";
+    }
+
+    int pid = job->getCommand()->getProcessId();
+    if (job->getCommand()->getTask() != nullptr)
+    {
+        //  a background builtin is cancelled by the kill signals - it cannot be stopped
+        if (signal_num == 9 || signal_num == 15 || signal_num == 6 || signal_num == 2)
+        {
+            job->getCommand()->getTask()->cancel();
+            jobs->killJob(job, signal_num);
+        }
+        else if (signal_num == 19 || signal_num == 20)
+        {
+            JobIsBuiltin e("kill", job_id);
+            throw e;
+        }
+    }
+    else
+    {
+        if (signalJob(pid, signal_num) == -1)
+        {
+            SystemCallFailed e("kill");
+            throw e;
+        }
+
+        //  kill signals remove the job from the jobs list for good, stop and continue signals update its status
+        if (signal_num == 9 || signal_num == 15 || signal_num == 6 || signal_num == 2)
+            jobs->killJob(job, signal_num);
+        else if (signal_num == 19)
+            job->setStopped(true);
+        else if (signal_num == 18)
+            job->setStopped(false);
+    }
+    return "signal number " + to_string(signal_num) + " was sent to pid " + to_string(pid) + "\n";
+}
+
+/*
+kill -<signal> <job-id | selector>  - a selector ("%1-50", "%stopped", "%running", "%all", "%/regex/") is resolved
+once and the signal is sent to all of its jobs in one batch, with a summary instead of a line per job.
+*/
+void KillCommand::execute()
+{
+    //  check amount of arguments
+    if (int(args_vec.size()) != 3)
+    {
+        if (int(args_vec.size()) > 3)
+        {
+            if (isIntNumber(args_vec[2]))
+            {
+                int job_id_to_find = stoi(args_vec[2]);
+                if (jobs->getJobById(job_id_to_find) == nullptr)
+                {
+                    JobIdDoesntExist e("kill", job_id_to_find);
+                    throw e;
+                }
+            }
+        }
+        InvaildArgument e("kill");
+        throw e;
+    }
+
+    //  get the number of the signal
+    std::string signal_requested = args_vec[1];
+    std::string job_id_requested = args_vec[2];
+
+    int signal_num = getSignalNumber(signal_requested); // return -1 if the format is wrong
+    int job_id = 0;
+
+    if (isIntNumber(job_id_requested))
+    {
+        job_id = stoi(job_id_requested);
+    }
+    else if (!isJobSelector(job_id_requested))
+    {
+        InvaildArgument e("kill");
+        throw e;
+    }
+    if (signal_num == -1)
+    {
+        InvaildArgument e("kill");
+        throw e;
+    }
+
+    OutputBuffer &output = SmallShell::getInstance().getOutput();
+    if (isJobSelector(job_id_requested))
+    {
+        vector<shared_ptr<JobsList::JobEntry>> selected = jobs->selectJobs(job_id_requested, "kill");
+        int sent = 0;
+        string error;
+        for (int i = 0; i < int(selected.size()); i++)
+        {
+            try
+            {
+                signalJobEntry(jobs, selected[i].get(), signal_num);
+                sent++;
+            }
+            catch (SystemCallFailed &e)
+            {
+                error = string(e.what()) + ": " + strerror(errno);
+            }
+            catch (std::exception &e)
+            {
+                error = e.what();
+            }
+        }
+        output << "smash: signal number " << signal_num << " was sent to " << sent;
+        if (sent < int(selected.size()))
+            output << " of " << int(selected.size());
+        output << " jobs\n";
+        if (!error.empty())
+        {
+            output.flush();
+            std::cerr << error << std::endl;
+        }
+        return;
+    }
+
+    //  get the job - if does not exist, nullptr will be returned
+    JobsList::JobEntry *job = jobs->getJobById(job_id);
+    if (job == nullptr)
+    {
+        JobIdDoesntExist e("kill", job_id);
+        throw e;
+    }
+    output << signalJobEntry(jobs, job, signal_num);
+}
+
+/*
+setcore <job-id | selector> <core>  - a selector moves every process of the jobs it picks to core, in one batch.
+*/
+void SetcoreCommand::execute()
+{
+    if (int(args_vec.size()) == 3 && isJobSelector(args_vec[1]))
+    {
+        if (!isStringNumber(args_vec[2]))
+        {
+            InvaildArgument e("setcore");
+            throw e;
+        }
+        int core_number = stoi(args_vec[2]);
+        if (core_number < 0 || core_number >= int(std::thread::hardware_concurrency()))
+        {
+            InvaildCoreNumber e;
+            throw e;
+        }
+        vector<shared_ptr<JobsList::JobEntry>> selected = jobs->selectJobs(args_vec[1], "setcore");
+
+        //  a job without a process of its own (a schedule, a queued or waiting job, a background builtin) is skipped
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(core_number, &set);
+        int moved = 0;
+        for (int i = 0; i < int(selected.size()); i++)
+        {
+            JobsList::JobEntry *job = selected[i].get();
+            if (job->isScheduled() || job->isQueued() || job->isWaiting() || job->getCommand()->getTask() != nullptr)
+                continue;
+            vector<int> pids = job->getCommand()->getMembers();
+            if (pids.empty())
+                pids.push_back(job->getCommand()->getProcessId());
+            for (int j = 0; j < int(pids.size()); j++)
+            {
+                if (sched_setaffinity(pids[j], sizeof(cpu_set_t), &set) == -1 && errno != ESRCH)
+                {
+                    SystemCallFailed e("sched_setaffinity");
+                    throw e;
+                }
+            }
+            moved++;
+        }
+        SmallShell::getInstance().getOutput() << "smash: " << moved << " jobs were moved to core " << core_number << "\n";
+        return;
+    }
+
+    //  checks amount of arguments
+    if (int(args_vec.size()) != 3)
+    {
+        if (int(args_vec.size()) == 2)
+        {
+        }
+        if (int(args_vec.size()) > 3)
+        {
+            if (isIntNumber(args_vec[2]))
+            {
+                int job_id_to_find = stoi(args_vec[2]);
+                if (jobs->getJobById(job_id_to_find) == nullptr)
+                {
+                    JobIdDoesntExist e("setcore", job_id_to_find);
+                    throw e;
+                }
+            }
+            if (isStringNumber(args_vec[1]))
+            {
+                int core_number = stoi(args_vec[1]);
+                int cores_in_cpu = std::thread::hardware_concurrency();
+                if (core_number < 0 || core_number >= cores_in_cpu)
+                {
+                    InvaildCoreNumber e;
+                    throw e;
+                }
+            }
+        }
+
+        InvaildArgument e("setcore");
+        throw e;
+    }
+
+    //  check if the given core and the job id is indeed a number
+    bool valid_arg1 = isStringNumber(args_vec[1]);
+    bool valid_arg2 = isStringNumber(args_vec[2]);
+
+    if (valid_arg1 && valid_arg2)
+    {
+        //  convert to integers
+        int job_id = stoi(args_vec[1]);
+        int core_number = stoi(args_vec[2]);
+
+        //  get job required
+        JobsList::JobEntry *job = jobs->getJobById(job_id);
+
+        if (job == nullptr)
+        {
+            JobIdDoesntExist e("setcore", job_id);
+            throw e;
+        }
+        else if (job->isScheduled())
+        {
+            JobIsScheduled e("setcore", job_id);
+            throw e;
+        }
+        else if (job->isQueued())
+        {
+            JobIsQueued e("setcore", job_id);
+            throw e;
+        }
+        else if (job->isWaiting())
+        {
+            JobIsWaiting e("setcore", job_id);
+            throw e;
+        }
+        else
+        {
+
+            //  get amount of cores in the cpu
+            int cores_in_cpu = std::thread::hardware_concurrency();
+
+            //  check if the core that was given is in range
+            if (cores_in_cpu <= core_number || core_number < 0)
+            {
+                InvaildCoreNumber e;
+                throw e;
+            }
+
+            //  checking if the command is 'sleep'
+            string cmd_s = _trim(string(job->getCommand()->getCmdL()));
+            string firstWord = cmd_s.substr(0, cmd_s.find_first_of(" \n"));
+            if (firstWord.compare("sleep") == 0)
+                return;
+
+            int pid = job->getCommand()->getProcessId();
+
+            //  set the job's core
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(core_number, &set);
+            if (sched_setaffinity(pid, sizeof(cpu_set_t), &set) == -1)
+            {
+                SystemCallFailed e("sched_setaffinity");
+                throw e;
+            }
+        }
+    }
+    else
+    {
+        InvaildArgument e("setcore");
+        throw e;
+    }
+}
+
+#define FILE_TYPES 8
+
+// the getfiletype names of the file types, in fileTypeIndex order
+static const char *const file_type_names[FILE_TYPES] = {
+    "block device", "character device", "directory", "FIFO", "symlink", "regular file", "socket", "unknown"};
+
+// the -type letters, in the same order
+static const char file_type_letters[] = "bcdplfs";
+
+static int fileTypeIndex(mode_t mode)
+{
+    switch (mode & S_IFMT)
+    {
+    case S_IFBLK:
+        return 0;
+    case S_IFCHR:
+        return 1;
+    case S_IFDIR:
+        return 2;
+    case S_IFIFO:
+        return 3;
+    case S_IFLNK:
+        return 4;
+    case S_IFREG:
+        return 5;
+    case S_IFSOCK:
+        return 6;
+    default:
+        return 7;
+    }
+}
+
+void GetFileTypeCommand::execute()
+{
+    if (int(args_vec.size()) > 1 && args_vec[1] == "-r")
+    {
+        executeRecursive();
+        return;
+    }
+
+    // check amount of arguments
+    if (int(args_vec.size()) != 2)
+    {
+        InvaildArgument e("getfiletype");
+        throw e;
+    }
+    //  get info on path
+
+    std::string path = args_vec[1];
+    struct stat stats;
+
+    if (fstatat(SmallShell::getInstance().getCwdFd(), path.c_str(), &stats, 0) == -1)
+    {
+        SystemCallFailed e("stat");
+        throw e;
+    }
+
+    int file_size = stats.st_size;
+
+    //  get file's type
+    std::string file_type = file_type_names[fileTypeIndex(stats.st_mode)];
+
+    //  print info
+    SmallShell::getInstance().getOutput() << path << "'s type is \"" << file_type << "\" and takes up " << file_size << " bytes\n";
+}
+
+// entries and bytes of one file type or one subdirectory
+struct TreeTotals
+{
+    unsigned long long entries;
+    unsigned long long bytes;
+    TreeTotals() : entries(0), bytes(0){};
+};
+
+// what one thread counted - merged once the walk is done, so the walk shares no counter
+struct TreePartial
+{
+    TreeTotals by_type[FILE_TYPES];
+    std::vector<TreeTotals> by_top;
+    TreeTotals outside_tops;
+};
+
+// parses a size with an optional k, M or G suffix, -1 if invalid or too large
+static long long parseSize(string str)
+{
+    long long unit = 1;
+    if (!str.empty() && (str.back() == 'k' || str.back() == 'K' || str.back() == 'M' || str.back() == 'G'))
+    {
+        unit = str.back() == 'G' ? 1LL << 30 : (str.back() == 'M' ? 1LL << 20 : 1LL << 10);
+        str.erase(str.size() - 1);
+    }
+    if (!isStringNumber(str) || str[0] == '-' || str.size() > 18)
+        return -1;
+    long long res = stoll(str);
+    return res > LLONG_MAX / unit ? -1 : res * unit;
+}
+
+static void printTreeTotals(const string &title, const TreeTotals &totals)
+{
+    SmallShell::getInstance().getOutput() << "  " << title << ": " << to_string(totals.entries) << " entries, " << to_string(totals.bytes) << " bytes\n";
+}
+
+/*
+getfiletype -r [-name <glob>] [-size <min>[k|M|G]] [-type b|c|d|p|l|f|s] <path>
+Counts the entries and bytes below path by file type and by top-level subdirectory, the way du and find would.
+Only the entries that pass the filters are counted - the walk always covers the whole tree.
+*/
+void GetFileTypeCommand::executeRecursive()
+{
+    string name_glob;
+    long long min_size = 0;
+    int type_filter = -1;
+    int i = 2;
+    for (; i + 1 < int(args_vec.size()); i += 2)
+    {
+        if (args_vec[i] == "-name")
+            name_glob = args_vec[i + 1];
+        else if (args_vec[i] == "-size" && parseSize(args_vec[i + 1]) != -1)
+            min_size = parseSize(args_vec[i + 1]);
+        else if (args_vec[i] == "-type" && args_vec[i + 1].size() == 1 && strchr(file_type_letters, args_vec[i + 1][0]) != nullptr)
+            type_filter = strchr(file_type_letters, args_vec[i + 1][0]) - file_type_letters;
+        else
+            break;
+    }
+    if (i + 1 != int(args_vec.size()))
+    {
+        InvaildArgument e("getfiletype");
+        throw e;
+    }
+    string root = args_vec[i];
+
+    WorkerPool &pool = SmallShell::getInstance().getWorkerPool();
+    vector<TreePartial> partials(pool.getSize() + 1);
+    DirWalker walker([&](int dir_fd, const char *name, const struct statx &stx, int top)
+                     {
+        (void)dir_fd;
+        int type = fileTypeIndex(stx.stx_mode);
+        if ((type_filter != -1 && type != type_filter) || (long long)stx.stx_size < min_size ||
+            (!name_glob.empty() && fnmatch(name_glob.c_str(), name, 0) != 0))
+            return;
+        TreePartial &partial = partials[WorkerPool::currentSlot()];
+        partial.by_type[type].entries++;
+        partial.by_type[type].bytes += stx.stx_size;
+        if (top == -1)
+        {
+            partial.outside_tops.entries++;
+            partial.outside_tops.bytes += stx.stx_size;
+            return;
+        }
+        if (top >= int(partial.by_top.size()))
+            partial.by_top.resize(top + 1);
+        partial.by_top[top].entries++;
+        partial.by_top[top].bytes += stx.stx_size; },
+                     STATX_TYPE | STATX_SIZE);
+
+    long long start = monotonicNs();
+    if (!walker.walk(root))
+    {
+        SystemCallFailed e("stat");
+        throw e;
+    }
+    double secs = (monotonicNs() - start) / 1e9;
+
+    //  merging what every thread counted
+    TreeTotals total;
+    TreeTotals by_type[FILE_TYPES];
+    TreeTotals outside_tops;
+    vector<TreeTotals> by_top(walker.getTops().size());
+    for (int p = 0; p < int(partials.size()); p++)
+    {
+        for (int type = 0; type < FILE_TYPES; type++)
+        {
+            by_type[type].entries += partials[p].by_type[type].entries;
+            by_type[type].bytes += partials[p].by_type[type].bytes;
+            total.entries += partials[p].by_type[type].entries;
+            total.bytes += partials[p].by_type[type].bytes;
+        }
+        for (int top = 0; top < int(partials[p].by_top.size()); top++)
+        {
+            by_top[top].entries += partials[p].by_top[top].entries;
+            by_top[top].bytes += partials[p].by_top[top].bytes;
+        }
+        outside_tops.entries += partials[p].outside_tops.entries;
+        outside_tops.bytes += partials[p].outside_tops.bytes;
+    }
+
+    OutputBuffer &output = SmallShell::getInstance().getOutput();
+    output << root << ": " << to_string(total.entries) << " entries, " << to_string(total.bytes) << " bytes\n";
+    output << "by type:\n";
+    for (int type = 0; type < FILE_TYPES; type++)
+    {
+        if (by_type[type].entries > 0)
+            printTreeTotals(file_type_names[type], by_type[type]);
+    }
+
+    //  the biggest subdirectories first, like du | sort -rn
+    vector<int> order;
+    for (int top = 0; top < int(by_top.size()); top++)
+        order.push_back(top);
+    sort(order.begin(), order.end(), [&by_top](int a, int b)
+         { return by_top[a].bytes > by_top[b].bytes; });
+    if (!order.empty() || outside_tops.entries > 0)
+        output << "by subdirectory:\n";
+    for (int j = 0; j < int(order.size()); j++)
+        printTreeTotals(walker.getTops()[order[j]], by_top[order[j]]);
+    if (outside_tops.entries > 0)
+        printTreeTotals(".", outside_tops);
+
+    char line[256];
+    snprintf(line, sizeof(line), "walked %llu entries in %.3f secs (%.0f files/sec), %llu unreadable%s\n", walker.getVisited(), secs,
+             secs > 0 ? walker.getVisited() / secs : 0.0, walker.getErrors(), walker.isStopped() ? ", interrupted" : "");
+    output << line;
+}
+
+// assume chmod takes up to 4 args
+bool isChmodArgsValid(const string args)
+{
+    int count = 0;
+    for (const char c : args)
+    {
+        count++;
+        int i = c - '0';
+        if (count > 4 || i > 7 || i < 0)
+            return false;
+    }
+    return true;
+}
+
+// one clause of a symbolic mode, like u+x
+struct ModeClause
+{
+    mode_t who;
+    char op;
+    string perms;
+};
+
+// an octal or symbolic chmod mode
+struct ModeChange
+{
+    bool octal;
+    mode_t value;
+    vector<ModeClause> clauses;
+
+    // the bits a clause without u, g, o or a may not set
+    mode_t umask_bits;
+};
+
+// parses a mode like 755, u+x,g-w or a=rX
+static bool parseModeChange(const string &str, ModeChange &change)
+{
+    change.octal = !str.empty() && isChmodArgsValid(str);
+    change.umask_bits = 0;
+    if (change.octal)
+    {
+        change.value = strtol(str.c_str(), 0, 8);
+        return true;
+    }
+
+    stringstream clauses(str);
+    string clause;
+    while (getline(clauses, clause, ','))
+    {
+        ModeClause parsed;
+        parsed.who = 0;
+        size_t i = 0;
+        for (; i < clause.size() && strchr("ugoa", clause[i]) != nullptr; i++)
+        {
+            if (clause[i] == 'u')
+                parsed.who |= S_IRWXU | S_ISUID;
+            else if (clause[i] == 'g')
+                parsed.who |= S_IRWXG | S_ISGID;
+            else if (clause[i] == 'o')
+                parsed.who |= S_IRWXO;
+            else
+                parsed.who |= 07777;
+        }
+        if (i == clause.size() || strchr("+-=", clause[i]) == nullptr)
+            return false;
+        parsed.op = clause[i++];
+        parsed.perms = clause.substr(i);
+        if (parsed.perms.find_first_not_of("rwxXst") != string::npos)
+            return false;
+        change.clauses.push_back(parsed);
+    }
+    if (change.clauses.empty())
+        return false;
+
+    mode_t mask = umask(0);
+    umask(mask);
+    change.umask_bits = mask;
+    return true;
+}
+
+// the permission bits of a file with mode after the change
+static mode_t applyModeChange(const ModeChange &change, mode_t mode)
+{
+    mode_t bits_now = mode & 07777;
+    if (change.octal)
+        return change.value;
+
+    for (int c = 0; c < int(change.clauses.size()); c++)
+    {
+        const ModeClause &clause = change.clauses[c];
+        mode_t who = clause.who != 0 ? clause.who : 07777 & ~change.umask_bits;
+        mode_t bits = 0;
+        for (int i = 0; i < int(clause.perms.size()); i++)
+        {
+            switch (clause.perms[i])
+            {
+            case 'r':
+                bits |= 0444;
+                break;
+            case 'w':
+                bits |= 0222;
+                break;
+            case 'x':
+                bits |= 0111;
+                break;
+            case 'X':
+                //  execute only for directories and files someone may execute already
+                if (S_ISDIR(mode) || (bits_now & 0111) != 0)
+                    bits |= 0111;
+                break;
+            case 's':
+                bits |= S_ISUID | S_ISGID;
+                break;
+            case 't':
+                bits |= S_ISVTX;
+                break;
+            }
+        }
+        bits &= who;
+        if (clause.op == '+')
+            bits_now |= bits;
+        else if (clause.op == '-')
+            bits_now &= ~bits;
+        else
+            bits_now = (bits_now & ~(clause.who != 0 ? clause.who : 07777)) | bits;
+    }
+    return bits_now;
+}
+
+// what a chmod did - updated from the walker's threads
+struct ChmodTotals
+{
+    std::atomic<unsigned long long> changed;
+    std::atomic<unsigned long long> unchanged;
+    std::atomic<unsigned long long> failed;
+    std::atomic<int> first_error;
+    ChmodTotals() : changed(0), unchanged(0), failed(0), first_error(0){};
+};
+
+// changes one inode, skipping it if its mode is right already - symlinks have no mode of their own
+static void chmodEntry(const ModeChange &change, ChmodTotals &totals, int dir_fd, const char *name, mode_t mode)
+{
+    if (S_ISLNK(mode))
+        return;
+    mode_t new_mode = applyModeChange(change, mode);
+    if (new_mode == (mode & 07777))
+    {
+        totals.unchanged++;
+        return;
+    }
+    if (fchmodat(dir_fd, name, new_mode, 0) == -1)
+    {
+        int error = errno;
+        int none = 0;
+        totals.first_error.compare_exchange_strong(none, error);
+        totals.failed++;
+        return;
+    }
+    totals.changed++;
+}
+
+/*
+Expands a glob into targets. glob(3) knows only the process cwd, so a relative one is expanded under the
+path of the directory the command runs in, and that path is taken off the matches again.
+*/
+static void globInCwd(const string &pattern, vector<string> &targets)
+{
+    string dir = SmallShell::getInstance().getCwdPath();
+    string prefix;
+    if (pattern[0] != '/' && !dir.empty())
+    {
+        //  the directory's own name is matched literally
+        if (dir != "/")
+            dir += "/";
+        for (size_t i = 0; i < dir.size(); i++)
+            prefix += strchr("*?[\\", dir[i]) != nullptr ? string("\\") + dir[i] : string(1, dir[i]);
+    }
+    else
+        dir.clear();
+
+    glob_t matches;
+    if (glob((prefix + pattern).c_str(), 0, nullptr, &matches) != 0)
+    {
+        targets.push_back(pattern);
+        return;
+    }
+    for (size_t j = 0; j < matches.gl_pathc; j++)
+        targets.push_back(string(matches.gl_pathv[j]).substr(dir.size()));
+    globfree(&matches);
+}
+
+/*
+chmod [-R] [-v] <mode> <target>...
+mode is octal (755) or symbolic (u+x,g-w / a=rX). targets may be globs.
+-R walks every target's tree in parallel, changing entries relative to their directory's fd.
+Inodes whose mode is right already are not written. -v prints what was done.
+*/
+void ChmodCommand::execute()
+{
+    //  the flags may come anywhere, like in coreutils
+    bool recursive = false;
+    bool verbose = false;
+    vector<string> args;
+    for (int i = 1; i < int(args_vec.size()); i++)
+    {
+        if (args_vec[i] == "-R" || args_vec[i] == "-v")
+            (args_vec[i] == "-R" ? recursive : verbose) = true;
+        else
+            args.push_back(args_vec[i]);
+    }
+
+    ModeChange change;
+    if (int(args.size()) < 2 || !parseModeChange(args[0], change))
+    {
+        InvaildArgument e("chmod");
+        throw e;
+    }
+
+    //  globs are expanded here - one that matches nothing stays as it is and fails below
+    vector<string> targets;
+    for (int i = 1; i < int(args.size()); i++)
+        globInCwd(args[i], targets);
+
+    ChmodTotals totals;
+    int cwd = SmallShell::getInstance().getCwdFd();
+    long long start = monotonicNs();
+    for (int t = 0; t < int(targets.size()); t++)
+    {
+        if (!recursive)
+        {
+            struct stat stats;
+            if (fstatat(cwd, targets[t].c_str(), &stats, 0) == -1)
+            {
+                int error = errno, none = 0;
+                totals.first_error.compare_exchange_strong(none, error);
+                totals.failed++;
+                continue;
+            }
+            chmodEntry(change, totals, cwd, targets[t].c_str(), stats.st_mode);
+            continue;
+        }
+
+        DirWalker walker([&change, &totals](int dir_fd, const char *name, const struct statx &stx, int top)
+                         {
+            (void)top;
+            chmodEntry(change, totals, dir_fd, name, stx.stx_mode); },
+                         STATX_TYPE | STATX_MODE);
+        if (!walker.walk(targets[t]))
+        {
+            int error = errno, none = 0;
+            totals.first_error.compare_exchange_strong(none, error);
+            totals.failed++;
+        }
+        totals.failed += walker.getErrors();
+        if (walker.isStopped())
+            break;
+    }
+
+    if (verbose)
+    {
+        char line[256];
+        snprintf(line, sizeof(line), "chmod: %llu changed, %llu unchanged, %llu failed in %.3f secs\n", (unsigned long long)totals.changed,
+                 (unsigned long long)totals.unchanged, (unsigned long long)totals.failed, (monotonicNs() - start) / 1e9);
+        SmallShell::getInstance().getOutput() << line;
+    }
+    if (totals.failed > 0)
+    {
+        errno = totals.first_error != 0 ? int(totals.first_error) : EIO;
+        SystemCallFailed e("chmod");
+        throw e;
+    }
+}
+
+// how much tee moves per splice - the default capacity of a pipe
+#define TEE_CHUNK (64 * 1024)
+
+// writes all of data to fd, restarting after a partial write
+static bool writeAll(int fd, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t bytes = write(fd, data, len);
+        if (bytes == -1 && (errno == EINTR || (errno == EAGAIN && waitFd(fd, POLLOUT))))
+            continue;
+        if (bytes <= 0)
+            return false;
+        data += bytes;
+        len -= bytes;
+    }
+    return true;
+}
+
+// reads the input, from a ring or an fd - a thread of a pipeline waits in poll, so it can be cancelled
+static ssize_t readInput(int fd, ByteRing *ring, char *buf, size_t len)
+{
+    if (ring != nullptr)
+        return ring->read(buf, len);
+    while (true)
+    {
+        if (!waitFd(fd, POLLIN))
+            return 0;
+        ssize_t bytes = read(fd, buf, len);
+        if (bytes == -1 && (errno == EINTR || errno == EAGAIN))
+            continue;
+        return bytes;
+    }
+}
+
+// copies the input to targets through user space - for an input that cannot be spliced, or a ring (target -1)
+static void teeCopy(int in_fd, ByteRing *in_ring, const vector<int> &targets, ByteRing *out_ring)
+{
+    vector<char> buf(TEE_CHUNK);
+    ssize_t bytes;
+    while ((bytes = readInput(in_fd, in_ring, buf.data(), buf.size())) != 0)
+    {
+        if (bytes == -1)
+        {
+            SystemCallFailed e("read");
+            throw e;
+        }
+        for (int i = 0; i < int(targets.size()); i++)
+        {
+            bool written = targets[i] == -1 ? out_ring->write(buf.data(), bytes) : writeAll(targets[i], buf.data(), bytes);
+            if (!written)
+            {
+                if (targets[i] == -1)
+                    errno = EPIPE;
+                SystemCallFailed e("write");
+                throw e;
+            }
+        }
+    }
+}
+
+/*
+Moves the input through a scratch pipe without copying it into user space: a chunk is spliced into
+the scratch pipe, tee(2) hands its pages to every other pipe target, and the consumer (a file
+if there is one - tee(2) cannot write to a file) takes the chunk out with splice(2).
+A target that is neither, or a pipe tee(2) filled partway, gets the chunk by write(2). So does a file
+opened with O_APPEND (tee -a, smash >> log) - splice(2) fails on it with EINVAL.
+returns: false if in_fd cannot be spliced - nothing was read then
+*/
+static bool teeSplice(int in_fd, const vector<int> &targets)
+{
+    int scratch[2];
+    if (pipe2(scratch, O_CLOEXEC) == -1)
+        return false;
+
+    vector<bool> is_pipe(targets.size());
+    int consumer = -1;
+    for (int i = 0; i < int(targets.size()); i++)
+    {
+        struct stat st;
+        is_pipe[i] = fstat(targets[i], &st) == 0 && S_ISFIFO(st.st_mode);
+        if (fstat(targets[i], &st) == 0 && S_ISREG(st.st_mode) && !(fcntl(targets[i], F_GETFL) & O_APPEND) && consumer == -1)
+            consumer = i;
+    }
+    for (int i = int(targets.size()) - 1; i >= 0 && consumer == -1; i--)
+    {
+        if (is_pipe[i])
+            consumer = i;
+    }
+
+    vector<char> buf;
+    vector<ssize_t> done(targets.size());
+    bool first = true;
+    while (true)
+    {
+        if (!waitFd(in_fd, POLLIN))
+            break;
+        ssize_t chunk = splice(in_fd, nullptr, scratch[1], nullptr, TEE_CHUNK, SPLICE_F_MOVE);
+        if (chunk == -1 && (errno == EINTR || errno == EAGAIN))
+            continue;
+        if (chunk == -1 && first && (errno == EINVAL || errno == ESPIPE))
+        {
+            close(scratch[0]);
+            close(scratch[1]);
+            return false;
+        }
+        first = false;
+        if (chunk <= 0)
+            break;
+
+        //  every pipe target but the consumer gets the pages duplicated
+        bool copy = consumer == -1;
+        for (int i = 0; i < int(targets.size()); i++)
+        {
+            done[i] = 0;
+            if (i == consumer)
+                continue;
+            while (is_pipe[i] && done[i] == 0)
+            {
+                done[i] = tee(scratch[0], targets[i], chunk, 0);
+                if (done[i] == -1 && errno != EINTR)
+                    break;
+                done[i] = max<ssize_t>(done[i], 0);
+            }
+            done[i] = max<ssize_t>(done[i], 0);
+            copy = copy || done[i] < chunk;
+        }
+
+        if (copy)
+        {
+            //  the chunk is read out once, for the targets tee(2) could not fill
+            buf.resize(chunk);
+            ssize_t got = 0;
+            while (got < chunk)
+            {
+                ssize_t bytes = read(scratch[0], buf.data() + got, chunk - got);
+                if (bytes <= 0 && errno != EINTR)
+                    break;
+                got += max<ssize_t>(bytes, 0);
+            }
+            for (int i = 0; i < int(targets.size()); i++)
+            {
+                if (!writeAll(targets[i], buf.data() + done[i], got - done[i]))
+                {
+                    SystemCallFailed e("write");
+                    throw e;
+                }
+            }
+            continue;
+        }
+
+        //  the consumer takes the chunk out of the scratch pipe
+        ssize_t moved = 0;
+        while (moved < chunk)
+        {
+            ssize_t bytes = splice(scratch[0], nullptr, targets[consumer], nullptr, chunk - moved, SPLICE_F_MOVE);
+            if (bytes == -1 && (errno == EINTR || (errno == EAGAIN && waitFd(targets[consumer], POLLOUT))))
+                continue;
+            if (bytes == -1 && errno == EINVAL)
+            {
+                //  the consumer cannot be spliced to - it gets the rest of the chunk, and the next ones, by write(2)
+                buf.resize(chunk - moved);
+                ssize_t got = 0;
+                while (got < chunk - moved)
+                {
+                    ssize_t read_bytes = read(scratch[0], buf.data() + got, chunk - moved - got);
+                    if (read_bytes <= 0 && errno != EINTR)
+                        break;
+                    got += max<ssize_t>(read_bytes, 0);
+                }
+                if (!writeAll(targets[consumer], buf.data(), got))
+                {
+                    close(scratch[0]);
+                    close(scratch[1]);
+                    SystemCallFailed e("write");
+                    throw e;
+                }
+                consumer = -1;
+                break;
+            }
+            if (bytes <= 0)
+            {
+                close(scratch[0]);
+                close(scratch[1]);
+                SystemCallFailed e("splice");
+                throw e;
+            }
+            moved += bytes;
+        }
+    }
+    close(scratch[0]);
+    close(scratch[1]);
+    return true;
+}
+
+/*
+tee [-a] [file...]  - copies stdin to stdout and to every file. -a appends to the files, like >>.
+In a pipeline the data moves between the pipes and files by splice(2) and tee(2), or through the
+rings to the builtins next to it. A redirected input is written out of its mapping.
+*/
+void TeeCommand::execute()
+{
+    SmallShell &smash = SmallShell::getInstance();
+    smash.getOutput().flush();
+
+    bool append = false;
+    vector<string> files;
+    for (int i = 1; i < int(args_vec.size()); i++)
+    {
+        if (args_vec[i] == "-a")
+            append = true;
+        else
+            files.push_back(args_vec[i]);
+    }
+
+    //  a stage of a pipeline has its own input and output
+    const PipeStage *stage = task_stage;
+    int in_fd = stage != nullptr ? stage->in_fd : 0;
+    ByteRing *in_ring = stage != nullptr ? stage->in.get() : nullptr;
+    ByteRing *out_ring = stage != nullptr ? stage->out.get() : nullptr;
+    vector<int> targets(1, out_ring != nullptr ? -1 : (stage != nullptr ? stage->out_fd : 1));
+    for (int i = 0; i < int(files.size()); i++)
+    {
+        int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC);
+        int fd = openat(smash.getCwdFd(), files[i].c_str(), flags, S_IRWXU);
+        if (fd < 0)
+        {
+            for (int j = 1; j < int(targets.size()); j++)
+                close(targets[j]);
+            SystemCallFailed e("open");
+            throw e;
+        }
+        targets.push_back(fd);
+    }
+
+    try
+    {
+        //  a mapped input goes to every target straight from its pages
+        if (stage == nullptr && task_input != nullptr)
+        {
+            for (int i = 0; i < int(targets.size()); i++)
+            {
+                if (!writeAll(targets[i], task_input->data, task_input->size))
+                {
+                    SystemCallFailed e("write");
+                    throw e;
+                }
+            }
+        }
+        else if (in_ring != nullptr || out_ring != nullptr || !teeSplice(in_fd, targets))
+            teeCopy(in_fd, in_ring, targets, out_ring);
+    }
+    catch (SystemCallFailed &e)
+    {
+        for (int i = 1; i < int(targets.size()); i++)
+            close(targets[i]);
+        throw;
+    }
+    for (int i = 1; i < int(targets.size()); i++)
+        close(targets[i]);
+}
+
+//<--------------------------- Metrics functions--------------------------->
+
+// the Prometheus label of every command kind, in CommandKind order
+static const char *const kind_names[] = {
+    "external", "pipe", "pipe_stderr", "redirect", "redirect_append", "input_redirect", "pwd", "showpid", "cd",
+    "jobs", "bg", "fg", "kill", "quit", "setcore", "getfiletype", "chmod", "timeout", "stats", "history", "bench",
+    "every", "at", "joblimit", "after", "joblog", "export", "unset", "tee", "list"};
+static_assert(sizeof(kind_names) / sizeof(kind_names[0]) == KIND_COUNT, "a command kind has no metrics name");
+
+static const char *const histogram_names[] = {"fork", "exec", "wait"};
+
+MetricsShard &Metrics::shard()
+{
+    static thread_local MetricsShard *local = nullptr;
+    if (local == nullptr)
+    {
+        //  value-initialized - every atomic starts at zero. Shards live as long as the process
+        local = new MetricsShard();
+        std::lock_guard<std::mutex> guard(lock);
+        int count = shard_count.load(std::memory_order_relaxed);
+
+        //  past the limit threads share the last shard - atomics keep that correct, only slower
+        if (count == METRIC_MAX_SHARDS)
+        {
+            delete local;
+            local = shards[METRIC_MAX_SHARDS - 1];
+            return *local;
+        }
+        shards[count] = local;
+        shard_count.store(count + 1, std::memory_order_release);
+    }
+    return *local;
+}
+
+void Metrics::add(MetricCounter counter, unsigned long long value)
+{
+    shard().counters[counter].fetch_add(value, std::memory_order_relaxed);
+}
+
+void Metrics::countCommand(CommandKind kind)
+{
+    shard().commands[kind].fetch_add(1, std::memory_order_relaxed);
+}
+
+void Metrics::countSignal(int signal_num)
+{
+    if (signal_num > 0 && signal_num < METRIC_SIGNALS)
+        shard().signals[signal_num].fetch_add(1, std::memory_order_relaxed);
+}
+
+void Metrics::observe(MetricHistogram histogram, long long ns)
+{
+    if (ns < 0)
+        ns = 0;
+    MetricsShard &local = shard();
+    local.buckets[histogram][bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+    local.sums[histogram].fetch_add(ns, std::memory_order_relaxed);
+}
+
+/*
+Values below 4 get a bucket each, above that every power of two is split into 4 equal buckets:
+[4,5) [5,6) [6,7) [7,8) [8,10) [10,12) ...
+*/
+int Metrics::bucketOf(unsigned long long ns)
+{
+    if (ns < HISTOGRAM_SUB_BUCKETS)
+        return ns;
+    int exponent = 63 - __builtin_clzll(ns);
+    int sub_bucket = (ns >> (exponent - 2)) & (HISTOGRAM_SUB_BUCKETS - 1);
+    return HISTOGRAM_SUB_BUCKETS + (exponent - 2) * HISTOGRAM_SUB_BUCKETS + sub_bucket;
+}
+
+// the first value past the bucket
+unsigned long long Metrics::bucketUpperBound(int bucket)
+{
+    if (bucket < HISTOGRAM_SUB_BUCKETS)
+        return bucket + 1;
+    int exponent = (bucket - HISTOGRAM_SUB_BUCKETS) / HISTOGRAM_SUB_BUCKETS + 2;
+    int sub_bucket = (bucket - HISTOGRAM_SUB_BUCKETS) % HISTOGRAM_SUB_BUCKETS;
+    return (unsigned long long)(HISTOGRAM_SUB_BUCKETS + sub_bucket + 1) << (exponent - 2);
+}
+
+unsigned long long Metrics::getCounter(MetricCounter counter)
+{
+    unsigned long long res = 0;
+    int count = shard_count.load(std::memory_order_acquire);
+    for (int i = 0; i < count; i++)
+        res += shards[i]->counters[counter].load(std::memory_order_relaxed);
+    return res;
+}
+
+unsigned long long Metrics::getCommands(CommandKind kind)
+{
+    unsigned long long res = 0;
+    int count = shard_count.load(std::memory_order_acquire);
+    for (int i = 0; i < count; i++)
+        res += shards[i]->commands[kind].load(std::memory_order_relaxed);
+    return res;
+}
+
+unsigned long long Metrics::getSignals(int signal_num)
+{
+    unsigned long long res = 0;
+    int count = shard_count.load(std::memory_order_acquire);
+    for (int i = 0; i < count; i++)
+        res += shards[i]->signals[signal_num].load(std::memory_order_relaxed);
+    return res;
+}
+
+HistogramSnapshot Metrics::getHistogram(MetricHistogram histogram)
+{
+    HistogramSnapshot res;
+    res.buckets.assign(HISTOGRAM_BUCKETS, 0);
+    res.count = 0;
+    res.sum = 0;
+    int count = shard_count.load(std::memory_order_acquire);
+    for (int i = 0; i < count; i++)
+    {
+        for (int bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++)
+        {
+            unsigned long long value = shards[i]->buckets[histogram][bucket].load(std::memory_order_relaxed);
+            res.buckets[bucket] += value;
+            res.count += value;
+        }
+        res.sum += shards[i]->sums[histogram].load(std::memory_order_relaxed);
+    }
+    return res;
+}
+
+unsigned long long HistogramSnapshot::quantile(double q) const
+{
+    if (count == 0)
+        return 0;
+    unsigned long long rank = (unsigned long long)ceil(q * count);
+    unsigned long long seen = 0;
+    for (int bucket = 0; bucket < int(buckets.size()); bucket++)
+    {
+        seen += buckets[bucket];
+        if (seen >= rank && buckets[bucket] > 0)
+            return Metrics::bucketUpperBound(bucket);
+    }
+    return Metrics::bucketUpperBound(buckets.size() - 1);
+}
+
+Metrics &SmallShell::getMetrics()
+{
+    return metrics;
+}
+
+// called in a spawned child whose exec failed
+void SmallShell::reportExecFailure(int error)
+{
+    if (exec_report_fd < 0)
+        return;
+    ssize_t res = write(exec_report_fd, &error, sizeof(error));
+    (void)res;
+}
+
+// the metrics in the Prometheus text exposition format
+std::string SmallShell::formatMetrics()
+{
+    string out;
+    char line[256];
+    out += "# HELP smash_commands_total Commands built, by type.\n# TYPE smash_commands_total counter\n";
+    for (int kind = 0; kind < KIND_COUNT; kind++)
+    {
+        snprintf(line, sizeof(line), "smash_commands_total{kind=\"%s\"} %llu\n", kind_names[kind], metrics.getCommands(CommandKind(kind)));
+        out += line;
+    }
+
+    //  exported buckets are the powers of two from 1us to 17s - fine buckets aggregate exactly into them
+    out += "# HELP smash_latency_seconds Fork, fork-to-exec and foreground wait latency.\n# TYPE smash_latency_seconds histogram\n";
+    for (int histogram = 0; histogram < METRIC_HISTOGRAM_COUNT; histogram++)
+    {
+        HistogramSnapshot snapshot = metrics.getHistogram(MetricHistogram(histogram));
+        unsigned long long cumulative = 0;
+        int bucket = 0;
+        for (int exponent = 10; exponent <= 34; exponent++)
+        {
+            unsigned long long bound = 1ULL << exponent;
+            for (; bucket < HISTOGRAM_BUCKETS && Metrics::bucketUpperBound(bucket) <= bound; bucket++)
+                cumulative += snapshot.buckets[bucket];
+            snprintf(line, sizeof(line), "smash_latency_seconds_bucket{op=\"%s\",le=\"%.9g\"} %llu\n", histogram_names[histogram], bound / 1e9, cumulative);
+            out += line;
+        }
+        snprintf(line, sizeof(line), "smash_latency_seconds_bucket{op=\"%s\",le=\"+Inf\"} %llu\n", histogram_names[histogram], snapshot.count);
+        out += line;
+        snprintf(line, sizeof(line), "smash_latency_seconds_sum{op=\"%s\"} %.9f\n", histogram_names[histogram], snapshot.sum / 1e9);
+        out += line;
+        snprintf(line, sizeof(line), "smash_latency_seconds_count{op=\"%s\"} %llu\n", histogram_names[histogram], snapshot.count);
+        out += line;
+    }
+
+    const char *counter_names[][2] = {{"smash_exec_failures_total", "Failed execs of external commands."},
+                                      {"smash_timeouts_fired_total", "Commands killed by timeout."},
+                                      {"smash_jobs_started_total", "Jobs added to the jobs list."},
+                                      {"smash_jobs_ended_total", "Jobs removed from the jobs list."},
+                                      {"smash_signals_sent_total", "Signals sent to jobs."}};
+    for (int counter = 0; counter < METRIC_COUNTER_COUNT; counter++)
+    {
+        snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", counter_names[counter][0], counter_names[counter][1],
+                 counter_names[counter][0], counter_names[counter][0], metrics.getCounter(MetricCounter(counter)));
+        out += line;
+    }
+
+    out += "# HELP smash_signals_received_total Signals handled by smash.\n# TYPE smash_signals_received_total counter\n";
+    int handled[] = {SIGINT, SIGTSTP, SIGALRM, SIGCHLD};
+    for (int i = 0; i < 4; i++)
+    {
+        snprintf(line, sizeof(line), "smash_signals_received_total{signal=\"%s\"} %llu\n", sigabbrev_np(handled[i]), metrics.getSignals(handled[i]));
+        out += line;
+    }
+
+    int running, stopped, queued, waiting;
+    jobs_list->countByState(&running, &stopped, &queued, &waiting);
+    snprintf(line, sizeof(line), "# HELP smash_jobs Jobs in the jobs list, by state.\n# TYPE smash_jobs gauge\n"
+                                 "smash_jobs{state=\"running\"} %d\nsmash_jobs{state=\"stopped\"} %d\n"
+                                 "smash_jobs{state=\"queued\"} %d\nsmash_jobs{state=\"waiting\"} %d\n",
+             running, stopped, queued, waiting);
+    out += line;
+    return out;
+}
+
+void SmallShell::setMetricsExport(const std::string &path, int interval)
+{
+    metrics_path = path;
+    metrics_interval = interval;
+    if (!path.empty())
+        exportMetrics();
+}
+
+const std::string &SmallShell::getMetricsPath() const
+{
+    return metrics_path;
+}
+
+int SmallShell::getMetricsInterval() const
+{
+    return metrics_interval;
+}
+
+// writes a temporary file and renames it over the path, so the textfile collector never reads half a file
+void SmallShell::exportMetrics()
+{
+    next_metrics_export = time(nullptr) + metrics_interval;
+    requestWakeup(next_metrics_export);
+
+    string tmp_path = metrics_path + ".tmp." + to_string(getpid());
+    int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return;
+    string text = formatMetrics();
+    size_t written = 0;
+    while (written < text.size())
+    {
+        ssize_t res = write(fd, text.c_str() + written, text.size() - written);
+        if (res < 0 && errno == EINTR)
+            continue;
+        if (res < 0)
+            break;
+        written += res;
+    }
+    close(fd);
+    if (written == text.size())
+        rename(tmp_path.c_str(), metrics_path.c_str());
+    else
+        unlink(tmp_path.c_str());
+}
+
+//<--------------------------- Metrics functions - end--------------------------->
+
+/*
+stats                             - output counters, parse cache and runtime metrics
+stats --prometheus                - the metrics in the Prometheus text format
+stats --export <file> [secs]      - writes the Prometheus text to file every secs seconds (15 by default)
+stats --export off                - stops the export
+*/
+void StatsCommand::execute()
+{
+    SmallShell &smash = SmallShell::getInstance();
+    if (int(args_vec.size()) == 2 && args_vec[1] == "--prometheus")
+    {
+        smash.getOutput() << smash.formatMetrics();
+        return;
+    }
+    if (int(args_vec.size()) >= 3 && int(args_vec.size()) <= 4 && args_vec[1] == "--export")
+    {
+        if (args_vec[2] == "off")
+        {
+            smash.setMetricsExport("", 0);
+            return;
+        }
+        int interval = int(args_vec.size()) == 4 ? parseInterval(args_vec[3]) : 15;
+        if (interval <= 0)
+        {
+            InvaildArgument e("stats");
+            throw e;
+        }
+        smash.setMetricsExport(args_vec[2], interval);
+        return;
+    }
+    if (int(args_vec.size()) > 1)
+    {
+        InvaildArgument e("stats");
+        throw e;
+    }
+
+    const map<string, OutputCounters> &counters = smash.getOutput().getCounters();
+
+    char line[128];
+    snprintf(line, sizeof(line), "%-16s %12s %10s\n", "builtin", "bytes", "syscalls");
+    smash.getOutput() << line;
+    for (auto it = counters.begin(); it != counters.end(); it++)
+    {
+        snprintf(line, sizeof(line), "%-16s %12lld %10lld\n", it->first.c_str(), it->second.bytes, it->second.syscalls);
+        smash.getOutput() << line;
+    }
+
+    const ParseCache &cache = smash.getParseCache();
+    smash.getOutput() << "parse cache: " << cache.getHits() << " hits, " << cache.getMisses() << " misses, "
+                      << cache.getEvictions() << " evictions, " << cache.getSize() << " lines, "
+                      << (unsigned long)cache.getBytes() << " bytes\n";
+
+    //  runtime metrics
+    Metrics &metrics = smash.getMetrics();
+    smash.getOutput() << "commands:";
+    for (int kind = 0; kind < KIND_COUNT; kind++)
+    {
+        unsigned long long count = metrics.getCommands(CommandKind(kind));
+        if (count > 0)
+            smash.getOutput() << " " << kind_names[kind] << "=" << to_string(count);
+    }
+    smash.getOutput() << "\n";
+    for (int histogram = 0; histogram < METRIC_HISTOGRAM_COUNT; histogram++)
+    {
+        HistogramSnapshot snapshot = metrics.getHistogram(MetricHistogram(histogram));
+        snprintf(line, sizeof(line), "%-5s latency: %llu samples, p50 %.1fus, p99 %.1fus, max %.1fus\n", histogram_names[histogram],
+                 snapshot.count, snapshot.quantile(0.5) / 1e3, snapshot.quantile(0.99) / 1e3, snapshot.quantile(1) / 1e3);
+        smash.getOutput() << line;
+    }
+    snprintf(line, sizeof(line), "exec failures %llu, timeouts fired %llu, jobs started %llu, jobs ended %llu, signals sent %llu\n",
+             metrics.getCounter(METRIC_EXEC_FAILURES), metrics.getCounter(METRIC_TIMEOUTS_FIRED), metrics.getCounter(METRIC_JOBS_STARTED),
+             metrics.getCounter(METRIC_JOBS_ENDED), metrics.getCounter(METRIC_SIGNALS_SENT));
+    smash.getOutput() << line;
+    snprintf(line, sizeof(line), "signals received: SIGINT %llu, SIGTSTP %llu, SIGALRM %llu, SIGCHLD %llu\n",
+             metrics.getSignals(SIGINT), metrics.getSignals(SIGTSTP), metrics.getSignals(SIGALRM), metrics.getSignals(SIGCHLD));
+    smash.getOutput() << line;
+    if (!smash.getMetricsPath().empty())
+        smash.getOutput() << "exporting to " << smash.getMetricsPath() << " every " << smash.getMetricsInterval() << " secs\n";
+}
+
+// summary of a set of samples - percentiles are nearest-rank
+struct BenchSummary
+{
+    double min, median, p95, p99, max, mean, stddev;
+};
+
+static BenchSummary summarize(std::vector<double> samples)
+{
+    BenchSummary res = {0, 0, 0, 0, 0, 0, 0};
+    if (samples.empty())
+        return res;
+    sort(samples.begin(), samples.end());
+    int count = samples.size();
+    double sum = 0;
+    for (int i = 0; i < count; i++)
+        sum += samples[i];
+    res.mean = sum / count;
+    double var = 0;
+    for (int i = 0; i < count; i++)
+        var += (samples[i] - res.mean) * (samples[i] - res.mean);
+    res.stddev = count > 1 ? sqrt(var / (count - 1)) : 0;
+    res.min = samples[0];
+    res.max = samples[count - 1];
+    res.median = samples[(count - 1) / 2];
+    res.p95 = samples[min(count - 1, int(ceil(0.95 * count)) - 1)];
+    res.p99 = samples[min(count - 1, int(ceil(0.99 * count)) - 1)];
+    return res;
+}
+
+static void printSummary(const char *title, const char *unit, const BenchSummary &sum)
+{
+    char line[256];
+    snprintf(line, sizeof(line), "  %-6s %s: min %.3f  median %.3f  p95 %.3f  p99 %.3f  max %.3f  stddev %.3f\n",
+             title, unit, sum.min, sum.median, sum.p95, sum.p99, sum.max, sum.stddev);
+    SmallShell::getInstance().getOutput() << line;
+}
+
+// the measurements of a single benchmarked command line
+struct BenchTarget
+{
+    string cmd_line;
+    vector<double> wall_ms;
+    vector<double> fork_us;
+    double user_ms;
+    double sys_ms;
+};
+
+static double rusageMs(const struct rusage &before, const struct rusage &after, bool user)
+{
+    const struct timeval &b = user ? before.ru_utime : before.ru_stime;
+    const struct timeval &a = user ? after.ru_utime : after.ru_stime;
+    return (a.tv_sec - b.tv_sec) * 1000.0 + (a.tv_usec - b.tv_usec) / 1000.0;
+}
+
+// runs the line once through the normal execution path
+static void benchRun(BenchTarget &target, bool measure)
+{
+    SmallShell &smash = SmallShell::getInstance();
+    vector<long long> forks;
+    struct rusage before, after;
+
+    // reaped children of all kinds (externals, pipe and redirection stages) are charged here
+    getrusage(RUSAGE_CHILDREN, &before);
+    smash.setForkSamples(&forks);
+    long long start = monotonicNs();
+    try
+    {
+        smash.executeCommand(target.cmd_line.c_str());
+    }
+    catch (...)
+    {
+        smash.setForkSamples(nullptr);
+        throw;
+    }
+    long long end = monotonicNs();
+    smash.setForkSamples(nullptr);
+    getrusage(RUSAGE_CHILDREN, &after);
+
+    if (!measure)
+        return;
+    target.wall_ms.push_back((end - start) / 1e6);
+    for (int i = 0; i < int(forks.size()); i++)
+        target.fork_us.push_back(forks[i] / 1e3);
+    target.user_ms += rusageMs(before, after, true);
+    target.sys_ms += rusageMs(before, after, false);
+}
+
+static void benchReport(const BenchTarget &target, int runs, int warmups)
+{
+    SmallShell &smash = SmallShell::getInstance();
+    char line[256];
+    smash.getOutput() << "bench: " << target.cmd_line << " (" << runs << " runs, " << warmups << " warmups)\n";
+    printSummary("wall", "ms", summarize(target.wall_ms));
+    snprintf(line, sizeof(line), "  %-6s ms/run: user %.3f  sys %.3f\n", "cpu", target.user_ms / runs, target.sys_ms / runs);
+    smash.getOutput() << line;
+
+    // the shell's own share of the launch cost, apart from what the command does
+    if (!target.fork_us.empty())
+    {
+        printSummary("fork", "us", summarize(target.fork_us));
+        smash.getOutput() << "  " << (unsigned long)target.fork_us.size() << " forks\n";
+    }
+}
+
+enum SpawnMethod
+{
+    SPAWN_ZYGOTE,
+    SPAWN_FORK,
+    SPAWN_POSIX,
+    SPAWN_METHODS
+};
+
+static const char *const spawn_method_names[SPAWN_METHODS] = {"zygote", "fork", "posix_spawn"};
+
+// launches args once by method, until its exec is done - returns the pid, or -1
+static int benchLaunch(SpawnMethod method, const vector<string> &args, bool simple)
+{
+    SmallShell &smash = SmallShell::getInstance();
+    if (method == SPAWN_ZYGOTE)
+    {
+        int fds[3] = {0, 1, 2};
+        int error = 0;
+        smash.getOutput().flush();
+        return smash.getZygote().launch(args, simple, 0, fds, &error);
+    }
+
+    if (method == SPAWN_POSIX)
+    {
+        //  posix_spawn takes a path, so the /bin and /usr/bin lookup is done here
+        string path = args[0];
+        if (simple && access(path.c_str(), X_OK) != 0)
+            path = access(("/bin/" + args[0]).c_str(), X_OK) == 0 ? "/bin/" + args[0] : "/usr/bin/" + args[0];
+        char **c_args = new char *[args.size() + 1];
+        _reformatArgsVec(c_args, args);
+        posix_spawnattr_t attr;
+        posix_spawnattr_init(&attr);
+        sigset_t empty_set;
+        sigemptyset(&empty_set);
+        posix_spawnattr_setsigmask(&attr, &empty_set);
+        posix_spawnattr_setpgroup(&attr, 0);
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK);
+        smash.getOutput().flush();
+        pid_t pid;
+        int res = posix_spawn(&pid, path.c_str(), nullptr, &attr, c_args, smash.getEnvironment().getEnvp());
+        posix_spawnattr_destroy(&attr);
+        for (int i = 0; i < int(args.size()); i++)
+            delete[] c_args[i];
+        delete[] c_args;
+        return res == 0 ? pid : -1;
+    }
+
+    int report[2];
+    if (pipe2(report, O_CLOEXEC) == -1)
+        return -1;
+    char **envp = smash.getEnvironment().getEnvp();
+    int pid = smash.forkChild();
+    if (pid == 0)
+    {
+        close(report[0]);
+        setpgrp();
+        _execExternal(args, simple, envp);
+        int error = errno;
+        ssize_t res = write(report[1], &error, sizeof(error));
+        (void)res;
+        _exit(1);
+    }
+    close(report[1]);
+    if (pid > 0)
+    {
+        int error;
+        ssize_t res;
+        do
+        {
+            res = read(report[0], &error, sizeof(error));
+        } while (res == -1 && errno == EINTR);
+    }
+    close(report[0]);
+    return pid;
+}
+
+/*
+Compares the ways to launch an external command: the zygote, a fork of the shell and posix_spawn.
+launch is the time until the exec is done, wall until the command exited.
+*/
+static void benchSpawn(const string &cmd_line, int runs, int warmups)
+{
+    SmallShell &smash = SmallShell::getInstance();
+    ExternalCommand cmd(cmd_line.c_str());
+    bool simple;
+    vector<string> args = cmd.getExecArgs(&simple);
+    vector<double> launch_us[SPAWN_METHODS];
+    vector<double> wall_us[SPAWN_METHODS];
+
+    for (int run = 0; run < warmups + runs; run++)
+    {
+        for (int method = 0; method < SPAWN_METHODS; method++)
+        {
+            if (method == SPAWN_ZYGOTE && !smash.getZygote().isRunning())
+                continue;
+            long long start = monotonicNs();
+            int pid = benchLaunch(SpawnMethod(method), args, simple);
+            long long launched = monotonicNs();
+            if (pid <= 0)
+            {
+                SystemCallFailed e(spawn_method_names[method]);
+                throw e;
+            }
+            int res;
+            do
+            {
+                res = waitpid(pid, nullptr, 0);
+            } while (res == -1 && errno == EINTR);
+            long long end = monotonicNs();
+            if (run < warmups)
+                continue;
+            launch_us[method].push_back((launched - start) / 1e3);
+            wall_us[method].push_back((end - start) / 1e3);
+        }
+    }
+
+    smash.getOutput() << "bench: spawn " << cmd_line << " (" << runs << " runs, " << warmups << " warmups)\n";
+    for (int method = 0; method < SPAWN_METHODS; method++)
+    {
+        smash.getOutput() << spawn_method_names[method] << ":\n";
+        if (launch_us[method].empty())
+        {
+            smash.getOutput() << "  not running (start smash with --zygote or SMASH_ZYGOTE=1)\n";
+            continue;
+        }
+        printSummary("launch", "us", summarize(launch_us[method]));
+        printSummary("wall", "us", summarize(wall_us[method]));
+    }
+}
+
+/*
+bench [-n runs] [-w warmups] <cmd> [--vs <cmd>]
+Runs the command line(s) through executeCommand and reports the latency distribution.
+With --vs the two commands run alternately, so drift affects both equally.
+bench [-n runs] [-w warmups] --spawn <external cmd>
+Launches the command by each spawn method in turn and compares them.
+*/
+void BenchCommand::execute()
+{
+    int runs = 10;
+    int warmups = 1;
+    int i = 1;
+    while (i + 1 < int(args_vec.size()) && (args_vec[i] == "-n" || args_vec[i] == "-w"))
+    {
+        int value = parseCount(args_vec[i + 1]);
+        if (value < 0)
+        {
+            InvaildArgument e("bench");
+            throw e;
+        }
+        (args_vec[i] == "-n" ? runs : warmups) = value;
+        i += 2;
+    }
+
+    if (i + 1 < int(args_vec.size()) && args_vec[i] == "--spawn")
+    {
+        string cmd_line;
+        for (i++; i < int(args_vec.size()); i++)
+            cmd_line += (cmd_line.empty() ? "" : " ") + args_vec[i];
+        if (runs == 0)
+        {
+            InvaildArgument e("bench");
+            throw e;
+        }
+        benchSpawn(cmd_line, runs, warmups);
+        return;
+    }
+
+    vector<BenchTarget> targets(1);
+    for (; i < int(args_vec.size()); i++)
+    {
+        if (args_vec[i] == "--vs" && targets.size() == 1)
+        {
+            targets.push_back(BenchTarget());
+            continue;
+        }
+        BenchTarget &target = targets.back();
+        target.cmd_line += (target.cmd_line.empty() ? "" : " ") + args_vec[i];
+    }
+    for (int t = 0; t < int(targets.size()); t++)
+    {
+        targets[t].user_ms = 0;
+        targets[t].sys_ms = 0;
+        if (targets[t].cmd_line.empty() || runs == 0)
+        {
+            InvaildArgument e("bench");
+            throw e;
+        }
+    }
+
+    for (int run = 0; run < warmups + runs; run++)
+        for (int t = 0; t < int(targets.size()); t++)
+            benchRun(targets[t], run >= warmups);
+
+    for (int t = 0; t < int(targets.size()); t++)
+        benchReport(targets[t], runs, warmups);
+    if (targets.size() == 2)
+    {
+        char line[128];
+        double base = summarize(targets[0].wall_ms).median;
+        double other = summarize(targets[1].wall_ms).median;
+        snprintf(line, sizeof(line), "bench: median ratio (second / first): %.3fx\n", base > 0 ? other / base : 0);
+        SmallShell::getInstance().getOutput() << line;
+    }
+}
+
+/*
+joblimit                          - prints the limits
+joblimit off                      - removes the limits
+joblimit [-c max] [-r rate] [-b burst] - at most max running background jobs, rate launches per second
+*/
+void JobLimitCommand::execute()
+{
+    AdmissionControl &admission = jobs->getAdmission();
+    int max_running = admission.getMaxRunning();
+    double rate = admission.getRate();
+    double burst = -1;
+
+    if (int(args_vec.size()) == 2 && args_vec[1] == "off")
+    {
+        max_running = 0;
+        rate = 0;
+    }
+    else if (int(args_vec.size()) > 1)
+    {
+        if (int(args_vec.size()) % 2 == 0)
+        {
+            InvaildArgument e("joblimit");
+            throw e;
+        }
+        for (int i = 1; i + 1 < int(args_vec.size()); i += 2)
+        {
+            double value = parseRate(args_vec[i + 1]);
+            if (value < 0 || (args_vec[i] != "-c" && args_vec[i] != "-r" && args_vec[i] != "-b") ||
+                (args_vec[i] == "-c" && (!isStringNumber(args_vec[i + 1]) || value > INT_MAX)))
+            {
+                InvaildArgument e("joblimit");
+                throw e;
+            }
+            if (args_vec[i] == "-c")
+                max_running = int(value);
+            else if (args_vec[i] == "-r")
+                rate = value;
+            else
+                burst = value;
+        }
+    }
+    else
+    {
+        char line[160];
+        snprintf(line, sizeof(line), "joblimit: max running %d, rate %.2f/sec, burst %.0f, running %d\n",
+                 max_running, rate, admission.getBurst(), jobs->getRunningCount());
+        SmallShell::getInstance().getOutput() << line;
+        return;
+    }
+
+    //  the burst defaults to one second's worth of launches
+    admission.setLimits(max_running, rate, burst < 0 ? rate : burst);
+    jobs->admitQueued();
+}
+
+void HistoryCommand::execute()
+{
+    //  no arguments - print the whole history
+    if (int(args_vec.size()) == 1)
+    {
+        int count = history->size();
+        for (int i = 1; i <= count; i++)
+            history->printEntry(i);
+        return;
+    }
+
+    //  "history -s <text>" - the text may contain spaces
+    if (args_vec[1] != "-s" || int(args_vec.size()) < 3)
+    {
+        InvaildArgument e("history");
+        throw e;
+    }
+    string text = args_vec[2];
+    for (int i = 3; i < int(args_vec.size()); i++)
+        text += " " + args_vec[i];
+
+    vector<int> found = history->search(text);
+    for (int i = 0; i < int(found.size()); i++)
+        history->printEntry(found[i]);
+}
+//<--------------------------- execute functions - end--------------------------->
+
+//<--------------------------- Jobs List functions--------------------------->
+
+// a schedule that has not launched its last instance yet - it owns no process of its own
+bool JobsList::JobEntry::isScheduled() const
+{
+    return command->isSchedule() && dynamic_pointer_cast<ScheduleCommand>(command)->isPending();
+}
+
+bool JobsList::isEmpty() const
+{
+    return int(this->jobs.size()) == 0;
+}
+
+void JobsList::JobEntry::printInfo(int queue_position, const string &waiting_for) const
+{
+    //  calculate the time passed
+    int current_time = time(NULL);
+    int time_diff = difftime(current_time, init_time);
+
+    // get status of job
+    string stopped_str = is_stopped ? " (stopped)" : "";
+    if (isScheduled())
+        stopped_str = " (" + dynamic_pointer_cast<ScheduleCommand>(command)->describe() + ")";
+    string cmd_l(command->getCmdL());
+
+    // get pid
+    int pid = command->getProcessId();
+
+    //  a queued job has neither a pid nor a running time yet
+    if (is_queued)
+    {
+        SmallShell::getInstance().getOutput() << "[" << command->getJobId() << "] " << cmd_l << " : (queued, position " << queue_position << ")\n";
+        return;
+    }
+    if (is_waiting)
+    {
+        SmallShell::getInstance().getOutput() << "[" << command->getJobId() << "] " << cmd_l << " : (" << waiting_for << ")\n";
+        return;
+    }
+
+    //  print info
+    SmallShell::getInstance().getOutput() << "[" << command->getJobId() << "] " << cmd_l << " : " << pid << " " << time_diff << " secs" << stopped_str << "\n";
+};
+
+//  returns the max id that is currently in the jobs list
+int JobsList::getMaxId() const
+{
+    int max_id = 0;
+    for (int i = 0; i < int(jobs.size()); i++)
+    {
+        if (jobs[i]->getJobId() > max_id)
+        {
+            max_id = jobs[i]->getJobId();
+        }
+    }
+    return max_id;
+}
+
+void JobsList::addJob(shared_ptr<Command> command, bool is_stopped)
+{
+    //  remove finished job before checking max id
+    this->removeFinishedJobs();
+    if (command->getJobId() == -1)
+    {
+        //<----------- command was Not in the jobs list before ----------->
+
+        // get job id for new command
+        int job_id = getMaxId() + 1;
+
+        //  update the command's job id
+        command->setJobId(job_id);
+        finished_logs.erase(job_id);
+        SmallShell::getInstance().getMetrics().add(METRIC_JOBS_STARTED);
+
+        //  add job
+        std::shared_ptr<JobEntry> new_job(new JobEntry(command, is_stopped));
+        jobs.push_back(new_job);
+    }
+    else
+    {
+        //<----------- command was in the jobs list before ----------->
+
+        //  find the job in the jobs list
+        for (int i = 0; i < int(jobs.size()); i++)
+        {
+            if (jobs[i]->getJobId() == command->getJobId())
+            {
+                //  reset time to current time
+                jobs[i]->setTime();
+                jobs[i]->setStopped(is_stopped);
+                break;
+            }
+        }
+    }
+}
+
+void JobsList::removeJobById(int jobId)
+{
+    removeFromQueue(jobId);
+    dependencies.erase(jobId);
+
+    //  the captured output stays readable by "joblog" after the job is gone
+    JobEntry *removed = findJob(jobId);
+    if (removed != nullptr && removed->getCommand()->getLog() != nullptr)
+        finished_logs[jobId] = removed->getCommand()->getLog();
+
+    //  find job and remove it from the jobs list's vector
+    for (int i = 0; i < int(jobs.size()); i++)
+    {
+        if (jobs[i]->getJobId() == jobId)
+        {
+            //  a job that goes away without a reaped exit counts as failed for its dependents
+            if (!jobs[i]->isFinished())
+                settleDependency(jobId, false);
+            if (jobs[i]->getCommand()->isTimeout())
+            {
+                shared_ptr<TimeoutCommand> cmd = dynamic_pointer_cast<TimeoutCommand>(jobs[i]->getCommand());
+                SmallShell &smash = SmallShell::getInstance();
+                smash.removeTimeOutCommand(cmd);
+            }
+            if (jobs[i]->getCommand()->isSchedule())
+            {
+                shared_ptr<ScheduleCommand> cmd = dynamic_pointer_cast<ScheduleCommand>(jobs[i]->getCommand());
+                SmallShell::getInstance().removeSchedule(cmd);
+            }
+            SmallShell::getInstance().getControl().jobRemoved(*jobs[i]);
+            jobs.erase(jobs.begin() + i);
+            SmallShell::getInstance().getMetrics().add(METRIC_JOBS_ENDED);
+            break;
+        }
+    }
+    if (!queue.empty())
+        this->admitQueued();
+}
+
+/*
+The job leaves with its own status if it is already gone, as killed by the signal if it is not -
+the event loop reaps its process later, when no job holds it any more.
+*/
+void JobsList::killJob(JobEntry *job, int signal_num)
+{
+    bool gone = job->isFinished() || (job->getCommand()->getTask() != nullptr ? markTaskFinished(job) : reapJob(job));
+    if (!gone)
+    {
+        job->mergeStatus(W_EXITCODE(0, signal_num));
+        finishJob(job);
+    }
+    removeJobById(job->getJobId());
+}
+
+JobsList::JobEntry *JobsList::getJobById(int jobId)
+{
+    this->removeFinishedJobs();
+    for (int i = 0; i < int(jobs.size()); i++)
+    {
+        if (jobs[i]->getJobId() == jobId)
+        {
+            return jobs[i].get();
+        }
+    }
+    return nullptr;
+}
+
+std::vector<std::shared_ptr<JobsList::JobEntry>> JobsList::selectJobs(const std::string &selector, const std::string &cmd)
+{
+    string spec = selector.substr(1);
+    bool by_id = false, by_regex = false;
+    int first = 0, last = 0;
+    regex_t pattern;
+    if (spec.size() >= 2 && spec[0] == '/' && spec.back() == '/')
+    {
+        if (regcomp(&pattern, spec.substr(1, spec.size() - 2).c_str(), REG_EXTENDED | REG_NOSUB) != 0)
+        {
+            InvaildArgument e(cmd);
+            throw e;
+        }
+        by_regex = true;
+    }
+    else if (spec != "running" && spec != "stopped" && spec != "all")
+    {
+        size_t dash = spec.find('-');
+        string from = spec.substr(0, dash);
+        string to = dash == string::npos ? from : spec.substr(dash + 1);
+        if (from.empty() || to.empty() || !isdigit(from[0]) || !isdigit(to[0]) || !isStringNumber(from) || !isStringNumber(to) ||
+            from.size() > 9 || to.size() > 9 || stoi(from) > stoi(to))
+        {
+            InvaildArgument e(cmd);
+            throw e;
+        }
+        first = stoi(from);
+        last = stoi(to);
+        by_id = true;
+    }
+
+    //  one pass over the table - the jobs are kept in job id order
+    this->removeFinishedJobs();
+    vector<shared_ptr<JobEntry>> selected;
+    for (int i = 0; i < int(jobs.size()); i++)
+    {
+        JobEntry &job = *jobs[i];
+        bool match;
+        if (by_id)
+            match = job.getJobId() >= first && job.getJobId() <= last;
+        else if (by_regex)
+            match = regexec(&pattern, job.getCommand()->getCmdL(), 0, nullptr, 0) == 0;
+        else if (spec == "stopped")
+            match = job.getStopped();
+        else if (spec == "running")
+            match = !job.getStopped() && !job.isQueued() && !job.isWaiting() && !job.isScheduled();
+        else
+            match = true;
+        if (match)
+            selected.push_back(jobs[i]);
+    }
+    if (by_regex)
+        regfree(&pattern);
+    if (selected.empty())
+    {
+        NoJobsMatch e(cmd, selector);
+        throw e;
+    }
+    return selected;
+}
+
+JobsList::JobEntry *JobsList::getLastJob(int *lastJobId)
+{
+    this->removeFinishedJobs();
+    if (int(jobs.size()) == 0)
+        return nullptr;
+    return jobs.back().get();
+}
+
+JobsList::JobEntry *JobsList::getLastStoppedJob(int *jobId)
+{
+    this->removeFinishedJobs();
+    int i = jobs.size() - 1;
+
+    //  goes from back to start in order to get the biggest one
+    while (i >= 0)
+    {
+        if (jobs[i]->getStopped())
+        {
+            return jobs[i].get();
+        }
+        i--;
+    }
+    return nullptr;
+}
+
+void JobsList::printJobsList()
+{
+    for (int i = 0; i < int(jobs.size()); i++)
+    {
+        int id = jobs[i]->getJobId();
+        jobs[i]->printInfo(jobs[i]->isQueued() ? getQueuePosition(id) : 0, jobs[i]->isWaiting() ? describeWaiting(id) : "");
+    }
+}
+
+// drops the jobs that never started - they leave without a signal
+static void dropUnstartedJobs(JobsList *jobs_list, std::vector<std::shared_ptr<JobsList::JobEntry>> &jobs)
+{
+    for (int i = int(jobs.size()) - 1; i >= 0; i--)
+    {
+        if (jobs[i]->isQueued() || jobs[i]->isWaiting())
+            jobs_list->removeJobById(jobs[i]->getJobId());
+    }
+}
+
+void JobsList::killAllJobs()
+{
+    // remove finished jobs in order to prevent a signal from sending
+    this->removeFinishedJobs();
+
+    // queued and waiting jobs never started - they are dropped without a signal
+    queue.clear();
+    dependencies.clear();
+    dropUnstartedJobs(this, jobs);
+
+    // print info according to assignment
+    SmallShell::getInstance().getOutput() << "smash: sending SIGKILL signal to " << jobs.size() << " jobs:\n";
+    for (int i = 0; i < int(jobs.size()); i++)
+    {
+        SmallShell::getInstance().getOutput() << jobs[i]->getCommand()->getProcessId() << ": " << jobs[i]->getCommand()->getCmdL() << "\n";
+    }
+
+    //  send kill signals to all processes
+
+    for (int i = int(jobs.size()) - 1; i >= 0; i--)
+    {
+
+        int pid = jobs[i]->getCommand()->getProcessId();
+        int job_id = jobs[i]->getJobId();
+
+        //  send kill signal
+        if (jobs[i]->isScheduled())
+            dynamic_pointer_cast<ScheduleCommand>(jobs[i]->getCommand())->cancel(SIGKILL);
+        else if (jobs[i]->getCommand()->getTask() != nullptr)
+            jobs[i]->getCommand()->getTask()->cancel();
+        else if (signalJob(pid, SIGKILL) == -1)
+            perror("smash error: kill failed");
+        else
+        {
+            //  reap it - smash leaves no zombies behind
+            vector<int> pids = jobs[i]->getCommand()->getMembers();
+            pids.push_back(pid);
+            for (int j = 0; j < int(pids.size()); j++)
+                waitpid(pids[j], nullptr, 0);
+        }
+
+        //  remove from jobs list
+        this->removeJobById(job_id);
+    }
+}
+
+// a job being shut down - the processes still to reap and how the job ended
+struct ShutdownEntry
+{
+    std::shared_ptr<JobsList::JobEntry> job;
+    std::vector<int> pids;
+    std::vector<int> pidfds;
+    int live;
+    int status;
+    // a process someone else reaped - its status is unknown
+    bool lost;
+    bool escalated;
+    double elapsed;
+};
+
+// reaps the process behind a ready pidfd, returns true when the whole job is gone
+static bool reapShutdownProcess(ShutdownEntry &entry, int index, long long start)
+{
+    int status;
+    int res = waitpid(entry.pids[index], &status, WNOHANG);
+    if (res == 0)
+        return false;
+    if (res == -1)
+        entry.lost = true;
+    else if (entry.status == 0)
+        entry.status = status;
+    if (entry.pidfds[index] >= 0)
+        close(entry.pidfds[index]);
+    entry.pidfds[index] = -1;
+    entry.pids[index] = -1;
+    entry.live--;
+    entry.elapsed = (monotonicNs() - start) / 1e9;
+    return entry.live == 0;
+}
+
+/*
+Sends SIGTERM to every job at once and waits for all of them together on their pidfds,
+so shutdown takes the grace period at most and not the sum of the jobs' exit times.
+The jobs still alive after grace seconds get SIGKILL. Every job's outcome is reported.
+*/
+void JobsList::shutdownJobs(double grace)
+{
+    this->removeFinishedJobs();
+    queue.clear();
+    dependencies.clear();
+    dropUnstartedJobs(this, jobs);
+
+    OutputBuffer &output = SmallShell::getInstance().getOutput();
+    char line[256];
+    snprintf(line, sizeof(line), "smash: sending SIGTERM signal to %d jobs, grace period %.2f secs:\n", int(jobs.size()), grace);
+    output << line;
+    output.flush();
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    long long start = monotonicNs();
+    vector<ShutdownEntry> entries;
+    for (int i = 0; i < int(jobs.size()); i++)
+    {
+        ShutdownEntry entry;
+        entry.job = jobs[i];
+        entry.live = 0;
+        entry.status = 0;
+        entry.lost = false;
+        entry.escalated = false;
+        entry.elapsed = 0;
+
+        //  a schedule has no process of its own - its running instance is terminated
+        int pid = jobs[i]->getCommand()->getProcessId();
+        if (jobs[i]->isScheduled())
+        {
+            dynamic_pointer_cast<ScheduleCommand>(jobs[i]->getCommand())->cancel(SIGTERM);
+            entries.push_back(entry);
+            continue;
+        }
+        if (jobs[i]->getCommand()->getTask() != nullptr)
+        {
+            jobs[i]->getCommand()->getTask()->cancel();
+            entries.push_back(entry);
+            continue;
+        }
+
+        entry.pids = jobs[i]->getCommand()->getMembers();
+        if (entry.pids.empty())
+            entry.pids.push_back(pid);
+        for (int j = 0; j < int(entry.pids.size()); j++)
+        {
+            int pidfd = -1;
+#ifdef SYS_pidfd_open
+            pidfd = syscall(SYS_pidfd_open, entry.pids[j], 0);
+#endif
+            entry.pidfds.push_back(pidfd);
+            entry.live++;
+        }
+
+        //  a stopped job gets SIGCONT as well, or it never sees the SIGTERM
+        signalJob(pid, SIGTERM);
+        signalJob(pid, SIGCONT);
+        entries.push_back(entry);
+    }
+
+    //  the pidfds are added once every job was signalled - a process without one is polled
+    int live_jobs = 0;
+    bool polled = false;
+    for (int i = 0; i < int(entries.size()); i++)
+    {
+        for (int j = 0; j < int(entries[i].pids.size()); j++)
+        {
+            //  exited already, or its pid was never a child of smash
+            if (reapShutdownProcess(entries[i], j, start) || entries[i].pids[j] == -1)
+                continue;
+            epoll_event event;
+            event.events = EPOLLIN;
+            event.data.u64 = ((unsigned long long)i << 32) | j;
+            if (entries[i].pidfds[j] >= 0 && (epoll_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, entries[i].pidfds[j], &event) == -1))
+            {
+                close(entries[i].pidfds[j]);
+                entries[i].pidfds[j] = -1;
+            }
+            if (entries[i].pidfds[j] < 0)
+                polled = true;
+        }
+        if (entries[i].live > 0)
+            live_jobs++;
+    }
+
+    //  wait for all of them together until the deadline - only the processes whose pidfd is ready are reaped
+    long long deadline = start + (long long)(grace * 1e9);
+    while (live_jobs > 0)
+    {
+        long long left_ms = (deadline - monotonicNs()) / 1000000;
+        if (left_ms <= 0)
+            break;
+        epoll_event events[32];
+        int ready = 0;
+        if (epoll_fd >= 0)
+            ready = epoll_wait(epoll_fd, events, 32, polled ? min(left_ms, 10LL) : min(left_ms, (long long)INT_MAX));
+        else
+            usleep(10 * 1000);
+        if (ready == -1 && errno != EINTR)
+            break;
+
+        for (int k = 0; k < ready; k++)
+        {
+            int i = int(events[k].data.u64 >> 32);
+            int j = int(events[k].data.u64 & 0xffffffff);
+            if (entries[i].pids[j] != -1 && reapShutdownProcess(entries[i], j, start))
+                live_jobs--;
+        }
+        for (int i = 0; polled && i < int(entries.size()); i++)
+        {
+            for (int j = 0; j < int(entries[i].pids.size()) && entries[i].live > 0; j++)
+            {
+                if (entries[i].pids[j] != -1 && entries[i].pidfds[j] < 0 && reapShutdownProcess(entries[i], j, start))
+                    live_jobs--;
+            }
+        }
+    }
+
+    //  escalate for the survivors only
+    for (int i = 0; i < int(entries.size()); i++)
+    {
+        if (entries[i].live == 0)
+            continue;
+        entries[i].escalated = true;
+        signalJob(entries[i].job->getCommand()->getProcessId(), SIGKILL);
+        for (int j = 0; j < int(entries[i].pids.size()); j++)
+        {
+            if (entries[i].pids[j] == -1)
+                continue;
+            waitpid(entries[i].pids[j], nullptr, 0);
+            if (entries[i].pidfds[j] >= 0)
+                close(entries[i].pidfds[j]);
+        }
+        entries[i].elapsed = (monotonicNs() - start) / 1e9;
+    }
+    if (epoll_fd >= 0)
+        close(epoll_fd);
+
+    //  the report - one line per job
+    for (int i = 0; i < int(entries.size()); i++)
+    {
+        JobEntry *job = entries[i].job.get();
+        string outcome;
+        int status = entries[i].status;
+        if (job->isScheduled())
+            outcome = "schedule cancelled";
+        else if (entries[i].escalated)
+            outcome = "ignored SIGTERM, killed by SIGKILL";
+        else if (entries[i].lost)
+            outcome = "exit status unknown";
+        else if (WIFSIGNALED(status))
+            outcome = "terminated by signal " + to_string(WTERMSIG(status));
+        else
+            outcome = "exited with status " + to_string(WEXITSTATUS(status));
+        snprintf(line, sizeof(line), " after %.2f secs", entries[i].elapsed);
+        output << "[" << job->getJobId() << "] " << job->getCommand()->getCmdL() << " : " << job->getCommand()->getProcessId()
+               << " " << outcome << (job->isScheduled() ? "" : line) << "\n";
+    }
+    while (!jobs.empty())
+        this->removeJobById(jobs.back()->getJobId());
+}
+void JobsList::removeFinishedJobs()
+{
+    std::vector<int> jobs_to_delete;
+    for (int i = 0; i < int(jobs.size()); i++)
+    {
+        //  check if a process is finished
+
+        if (jobs[i]->getCommand()->isTimeout())
+        {
+            shared_ptr<TimeoutCommand> cmd = dynamic_pointer_cast<TimeoutCommand>(jobs[i]->getCommand());
+            if (cmd->getTime() <= time(nullptr))
+                jobs_to_delete.push_back(jobs[i]->getJobId());
+            continue;
+        }
+
+        if (jobs[i]->getCommand()->isSchedule())
+        {
+            shared_ptr<ScheduleCommand> cmd = dynamic_pointer_cast<ScheduleCommand>(jobs[i]->getCommand());
+            if (cmd->isFinished())
+                jobs_to_delete.push_back(jobs[i]->getJobId());
+            continue;
+        }
+
+        // a queued or waiting job has no process yet
+        if (jobs[i]->isQueued() || jobs[i]->isWaiting())
+            continue;
+
+        // a cancelled job never ran - it is reported once as it leaves the list
+        if (jobs[i]->isCancelled())
+        {
+            SmallShell::getInstance().getOutput() << "smash: job " << jobs[i]->getJobId() << " was cancelled, a prerequisite failed\n";
+            jobs_to_delete.push_back(jobs[i]->getJobId());
+            continue;
+        }
+
+        // a background builtin has no process to reap
+        if (jobs[i]->getCommand()->getTask() != nullptr)
+        {
+            if (markTaskFinished(jobs[i].get()) || jobs[i]->isFinished())
+                jobs_to_delete.push_back(jobs[i]->getJobId());
+            continue;
+        }
+
+        // reaped by the event loop, or by us
+        if (jobs[i]->isFinished() || reapJob(jobs[i].get()))
+        {
+            jobs_to_delete.push_back(jobs[i]->getJobId());
+        }
+    }
+
+    //  remove the finished jobs
+    for (int i = 0; i < int(jobs_to_delete.size()); i++)
+    {
+        this->removeJobById(jobs_to_delete[i]);
+    }
+    if (!jobs_to_delete.empty())
+        this->admitQueued();
+}
+
+bool JobsList::JobEntry::isQueued() const
+{
+    return is_queued;
+}
+
+bool JobsList::JobEntry::isFinished() const
+{
+    return finished;
+}
+
+bool JobsList::JobEntry::isWaiting() const
+{
+    return is_waiting;
+}
+
+bool JobsList::JobEntry::isCancelled() const
+{
+    return cancelled;
+}
+
+void JobsList::JobEntry::setWaiting(bool is_waiting)
+{
+    this->is_waiting = is_waiting;
+}
+
+void JobsList::JobEntry::setCancelled()
+{
+    cancelled = true;
+    finished = true;
+}
+
+int JobsList::JobEntry::getExitStatus() const
+{
+    return exit_status;
+}
+
+int JobsList::JobEntry::getSeconds() const
+{
+    return difftime(time(NULL), init_time);
+}
+
+void JobsList::JobEntry::setQueued(bool is_queued)
+{
+    this->is_queued = is_queued;
+}
+
+void JobsList::JobEntry::setFinished(int status)
+{
+    finished = true;
+    exit_status = status;
+    SmallShell::getInstance().getRecorder().recordJob(getJobId(), status);
+}
+
+// keeps the first failure among the processes of a job
+void JobsList::JobEntry::mergeStatus(int status)
+{
+    if (exit_status == 0)
+        exit_status = status;
+}
+
+// finds a job without removing finished jobs first - while the event loop settles an exit
+JobsList::JobEntry *JobsList::findJob(int jobId)
+{
+    for (int i = 0; i < int(jobs.size()); i++)
+    {
+        if (jobs[i]->getJobId() == jobId)
+            return jobs[i].get();
+    }
+    return nullptr;
+}
+
+void JobsList::markFinished(int pid, int status)
+{
+    for (int i = 0; i < int(jobs.size()); i++)
+    {
+        //  a schedule outlives its instances - a fired "at" finishes with its only one
+        if (jobs[i]->getCommand()->isSchedule())
+        {
+            shared_ptr<ScheduleCommand> schedule = dynamic_pointer_cast<ScheduleCommand>(jobs[i]->getCommand());
+            if (!schedule->instanceExited(pid))
+                continue;
+            if (schedule->isFinished())
+            {
+                jobs[i]->setFinished(status);
+                settleDependency(jobs[i]->getJobId(), WIFEXITED(status) && WEXITSTATUS(status) == 0);
+            }
+            return;
+        }
+        if (jobs[i]->isQueued() || jobs[i]->isWaiting() || jobs[i]->isFinished())
+            continue;
+        const vector<int> &members = jobs[i]->getCommand()->getMembers();
+        if (jobs[i]->getCommand()->getProcessId() != pid && find(members.begin(), members.end(), pid) == members.end())
+            continue;
+
+        //  a group job finishes with its last process
+        jobs[i]->mergeStatus(status);
+        bool lost = false;
+        if (membersGone(jobs[i].get(), pid, &lost) && !lost)
+            finishJob(jobs[i].get());
+        return;
+    }
+}
+
+void JobsList::finishJob(JobEntry *job)
+{
+    job->setFinished(job->getExitStatus());
+    int job_status = job->getExitStatus();
+    settleDependency(job->getJobId(), WIFEXITED(job_status) && WEXITSTATUS(job_status) == 0);
+}
+
+/*
+Reaps a job the event loop did not settle yet - true once all its processes are gone.
+Its status is recorded like the event loop records it, so its dependents see how it exited.
+A process someone else reaped leaves the status unknown - the job goes away unfinished, as a failure.
+*/
+bool JobsList::reapJob(JobEntry *job)
+{
+    bool lost = false;
+    if (!job->getCommand()->getMembers().empty())
+    {
+        if (!membersGone(job, -1, &lost))
+            return false;
+    }
+    else
+    {
+        int status;
+        int res = waitpid(job->getCommand()->getProcessId(), &status, WNOHANG);
+        if (res == 0)
+            return false;
+        if (res > 0)
+            job->mergeStatus(status);
+        else
+            lost = true;
+    }
+    if (!lost)
+        finishJob(job);
+    return true;
+}
+
+bool JobsList::markTaskFinished(JobEntry *job)
+{
+    shared_ptr<AsyncTask> task = job->getCommand()->getTask();
+    if (task == nullptr || !task->isDone() || job->isFinished() || job->isQueued() || job->isWaiting())
+        return false;
+    job->setFinished(task->getStatus());
+    settleDependency(job->getJobId(), WIFEXITED(task->getStatus()) && WEXITSTATUS(task->getStatus()) == 0);
+    return true;
+}
+
+void JobsList::markTasksFinished()
+{
+    for (int i = 0; i < int(jobs.size()); i++)
+        markTaskFinished(jobs[i].get());
+}
+
+// true if no process of a group job but reaped_pid is still running - the ones that exited are reaped here.
+// lost is set for a member someone else reaped, its status is unknown
+bool JobsList::membersGone(JobEntry *job, int reaped_pid, bool *lost)
+{
+    const vector<int> &members = job->getCommand()->getMembers();
+    bool gone = true;
+    for (int i = 0; i < int(members.size()); i++)
+    {
+        if (members[i] == reaped_pid)
+            continue;
+        int status;
+        int res = waitpid(members[i], &status, WNOHANG);
+        if (res == 0)
+            gone = false;
+        else if (res > 0)
+            job->mergeStatus(status);
+        else
+            *lost = true;
+    }
+    return gone;
+}
+
+void JobsList::countByState(int *running, int *stopped, int *queued, int *waiting) const
+{
+    *running = *stopped = *queued = *waiting = 0;
+    for (int i = 0; i < int(jobs.size()); i++)
+    {
+        if (jobs[i]->isFinished())
+            continue;
+        if (jobs[i]->isQueued())
+            (*queued)++;
+        else if (jobs[i]->isWaiting())
+            (*waiting)++;
+        else if (jobs[i]->getStopped())
+            (*stopped)++;
+        else
+            (*running)++;
+    }
+}
+
+// jobs that hold an admission slot - running processes, not stopped ones
+int JobsList::getRunningCount() const
+{
+    int count = 0;
+    for (int i = 0; i < int(jobs.size()); i++)
+    {
+        if (!jobs[i]->isQueued() && !jobs[i]->isWaiting() && !jobs[i]->getStopped() && !jobs[i]->isFinished() && !jobs[i]->isScheduled())
+            count++;
+    }
+    return count;
+}
+
+void JobsList::launch(JobEntry *job)
+{
+    SmallShell::getInstance().spawn(job->getCommand(), true);
+    job->setQueued(false);
+    job->setTime();
+}
+
+void JobsList::submit(std::shared_ptr<Command> cmd)
+{
+    if (queue.empty() && admission.canLaunch(getRunningCount()))
+    {
+        admission.consume();
+        SmallShell::getInstance().spawn(cmd, true);
+        this->addJob(cmd, false);
+        return;
+    }
+
+    this->addJob(cmd, false);
+    JobEntry *job = findJob(cmd->getJobId());
+    job->setQueued(true);
+    queue.push_back(cmd->getJobId());
+    this->admitQueued();
+}
+
+// starts queued jobs while the limits allow it - called whenever a slot or a token may have freed up
+void JobsList::admitQueued()
+{
+    while (!queue.empty() && admission.canLaunch(getRunningCount()))
+    {
+        JobEntry *job = findJob(queue.front());
+        queue.pop_front();
+        if (job == nullptr)
+            continue;
+        admission.consume();
+        try
+        {
+            launch(job);
+        }
+        catch (SystemCallFailed &e)
+        {
+            perror(e.what());
+        }
+    }
+
+    //  only the launch rate holds the queue - come back when the next token is due
+    bool slot_free = admission.getMaxRunning() == 0 || getRunningCount() < admission.getMaxRunning();
+    if (!queue.empty() && slot_free && admission.getRate() > 0)
+        SmallShell::getInstance().requestWakeup(time(nullptr) + int(ceil(admission.secondsToToken())));
+}
+
+void JobsList::startNow(JobEntry *job)
+{
+    removeFromQueue(job->getJobId());
+    launch(job);
+}
+
+void JobsList::removeFromQueue(int jobId)
+{
+    for (auto it = queue.begin(); it != queue.end(); it++)
+    {
+        if (*it == jobId)
+        {
+            queue.erase(it);
+            return;
+        }
+    }
+}
+
+// 1-based position of the job in the admission queue
+int JobsList::getQueuePosition(int jobId) const
+{
+    for (int i = 0; i < int(queue.size()); i++)
+    {
+        if (queue[i] == jobId)
+            return i + 1;
+    }
+    return 0;
+}
+
+AdmissionControl &JobsList::getAdmission()
+{
+    return admission;
+}
+
+//<--------------------------- Dependency graph functions--------------------------->
+
+/*
+Adds a waiting job that starts once all of its prerequisites exit - with on_success, only if all of them exited with 0.
+Prerequisites that already finished are settled right away.
+*/
+void JobsList::addDependent(std::shared_ptr<Command> cmd, const std::vector<int> &prerequisites, bool on_success)
+{
+    //  a prerequisite that already finished is still listed until addJob removes it - its outcome is taken first
+    map<int, bool> finished;
+    for (int i = 0; i < int(prerequisites.size()); i++)
+    {
+        JobEntry *prerequisite = findJob(prerequisites[i]);
+        if (prerequisite == nullptr)
+        {
+            JobIdDoesntExist e("after", prerequisites[i]);
+            throw e;
+        }
+        if (prerequisite->isFinished())
+        {
+            int status = prerequisite->getExitStatus();
+            finished[prerequisites[i]] = !prerequisite->isCancelled() && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        }
+    }
+
+    this->addJob(cmd, false);
+    int job_id = cmd->getJobId();
+    findJob(job_id)->setWaiting(true);
+
+    DependencyNode &node = dependencies[job_id];
+    node.prerequisites = prerequisites;
+    node.remaining = set<int>(prerequisites.begin(), prerequisites.end());
+    node.on_success = on_success;
+    node.failed = false;
+
+    for (auto it = finished.begin(); it != finished.end(); it++)
+        settleDependency(it->first, it->second);
+    this->admitQueued();
+}
+
+/*
+Called once per prerequisite exit - from the event loop or when a job leaves the list.
+A job whose last prerequisite settled moves to the admission queue, or is cancelled if a required success failed.
+*/
+void JobsList::settleDependency(int jobId, bool succeeded)
+{
+    vector<int> cancelled_jobs;
+    for (auto it = dependencies.begin(); it != dependencies.end(); it++)
+    {
+        DependencyNode &node = it->second;
+        if (node.remaining.erase(jobId) == 0)
+            continue;
+        if (!succeeded && node.on_success)
+            node.failed = true;
+        if (!node.remaining.empty())
+            continue;
+
+        JobEntry *job = findJob(it->first);
+        if (job == nullptr || !job->isWaiting())
+            continue;
+        job->setWaiting(false);
+        if (node.failed)
+        {
+            job->setCancelled();
+            cancelled_jobs.push_back(it->first);
+        }
+        else
+        {
+            job->setQueued(true);
+            queue.push_back(it->first);
+        }
+    }
+
+    //  a cancelled job fails its own dependents in turn
+    for (int i = 0; i < int(cancelled_jobs.size()); i++)
+        settleDependency(cancelled_jobs[i], false);
+}
+
+std::string JobsList::describeWaiting(int jobId) const
+{
+    auto it = dependencies.find(jobId);
+    if (it == dependencies.end())
+        return "waiting";
+    string res = "waiting for ";
+    for (auto id = it->second.remaining.begin(); id != it->second.remaining.end(); id++)
+        res += (id == it->second.remaining.begin() ? "" : ",") + to_string(*id);
+    return res;
+}
+
+static std::string jobState(JobsList::JobEntry *job)
+{
+    if (job == nullptr)
+        return "done";
+    if (job->isCancelled())
+        return "cancelled";
+    if (job->isFinished())
+    {
+        int status = job->getExitStatus();
+        return WIFEXITED(status) ? "exited " + to_string(WEXITSTATUS(status)) : "killed";
+    }
+    if (job->isWaiting())
+        return "waiting";
+    if (job->isQueued())
+        return "queued";
+    return job->getStopped() ? "stopped" : "running";
+}
+
+/*
+Prints every "after" job with its state and the state of each prerequisite:
+[3] after 1,2 make test : waiting (on success)
+    <- [1] running
+    <- [2] exited 0
+*/
+void JobsList::printDependencyGraph()
+{
+    OutputBuffer &output = SmallShell::getInstance().getOutput();
+    for (auto it = dependencies.begin(); it != dependencies.end(); it++)
+    {
+        JobEntry *job = findJob(it->first);
+        if (job == nullptr)
+            continue;
+        output << "[" << it->first << "] " << job->getCommand()->getCmdL() << " : " << jobState(job)
+               << (it->second.on_success ? " (on success)" : "") << "\n";
+        for (int i = 0; i < int(it->second.prerequisites.size()); i++)
+        {
+            int prerequisite = it->second.prerequisites[i];
+            output << "    <- [" << prerequisite << "] " << jobState(findJob(prerequisite)) << "\n";
+        }
+    }
+}
+
+AfterCommand::AfterCommand(const char *cmd_line, JobsList *jobs) : BuiltInCommand(cmd_line, true), jobs(jobs), prerequisites(),
+                                                                   on_success(false), target_cmd(nullptr)
+{
+    int target_index = 2;
+    if (int(args_vec.size()) > 2 && args_vec[2] == "--on-success")
+    {
+        on_success = true;
+        target_index = 3;
+    }
+    if (int(args_vec.size()) <= target_index)
+    {
+        InvaildArgument e("after");
+        throw e;
+    }
+
+    //  "<id>[,<id>...]" - fan-in of any number of jobs
+    stringstream ids(args_vec[1]);
+    string id;
+    while (getline(ids, id, ','))
+    {
+        if (!isStringNumber(id) || stoi(id) <= 0)
+        {
+            InvaildArgument e("after");
+            throw e;
+        }
+        prerequisites.push_back(stoi(id));
+    }
+    if (prerequisites.empty())
+    {
+        InvaildArgument e("after");
+        throw e;
+    }
+
+    string target_cmd_str = "";
+    for (int i = target_index; i < int(args_vec.size()); i++)
+        target_cmd_str += args_vec[i] + " ";
+    target_cmd = SmallShell::getInstance().CreateCommand(target_cmd_str.c_str());
+    deferred = true;
+}
+
+void AfterCommand::registerJob(std::shared_ptr<Command> self)
+{
+    jobs->addDependent(self, prerequisites, on_success);
+}
+
+void AfterCommand::execute()
+{
+    if (target_cmd->isExternal())
+        target_cmd->execute();
+
+    // builtins, pipes and redirections run to completion in the child
+    try_catch(target_cmd.get());
+}
+
+//<--------------------------- Dependency graph functions - end--------------------------->
+
+//<--------------------------- Job output capture functions--------------------------->
+
+JobLog::JobLog(size_t capacity) : ring(capacity), start(0), length(0), written(0), dropped(0), closed(false)
+{
+}
+
+// drops the oldest bytes to make room - a full log never blocks the job
+void JobLog::append(const char *data, size_t size)
+{
+    size_t capacity = ring.size();
+    written += size;
+    if (size >= capacity)
+    {
+        dropped += length + (size - capacity);
+        memcpy(ring.data(), data + (size - capacity), capacity);
+        start = 0;
+        length = capacity;
+        return;
+    }
+    if (length + size > capacity)
+    {
+        size_t overflow = length + size - capacity;
+        start = (start + overflow) % capacity;
+        length -= overflow;
+        dropped += overflow;
+    }
+
+    //  the free space may wrap around the end of the ring
+    size_t end = (start + length) % capacity;
+    size_t first = min(size, capacity - end);
+    memcpy(ring.data() + end, data, first);
+    memcpy(ring.data(), data + first, size - first);
+    length += size;
+}
+
+unsigned long long JobLog::copyFrom(unsigned long long offset, std::string &out) const
+{
+    unsigned long long first_held = written - length;
+    if (offset < first_held)
+        offset = first_held;
+    for (size_t i = offset - first_held; i < length; i++)
+        out += ring[(start + i) % ring.size()];
+    return written;
+}
+
+unsigned long long JobLog::getDropped() const
+{
+    return dropped;
+}
+
+bool JobLog::isClosed() const
+{
+    return closed;
+}
+
+void JobLog::close()
+{
+    closed = true;
+}
+
+bool OutputCapture::isEnabled() const
+{
+    return enabled;
+}
+
+void OutputCapture::setEnabled(bool enabled)
+{
+    this->enabled = enabled;
+}
+
+size_t OutputCapture::getCapacity() const
+{
+    return capacity;
+}
+
+void OutputCapture::setCapacity(size_t capacity)
+{
+    this->capacity = capacity;
+}
+
+std::shared_ptr<JobLog> OutputCapture::open(int *write_fd)
+{
+    //  the drain thread starts with the first captured job
+    if (epoll_fd == -1)
+    {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd == -1)
+        {
+            SystemCallFailed e("epoll_create1");
+            throw e;
+        }
+
+        //  signals stay with the main thread
+        sigset_t all_signals, old_set;
+        sigfillset(&all_signals);
+        pthread_sigmask(SIG_SETMASK, &all_signals, &old_set);
+        std::thread(&OutputCapture::drain, this).detach();
+        pthread_sigmask(SIG_SETMASK, &old_set, nullptr);
+    }
+
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1)
+    {
+        SystemCallFailed e("pipe");
+        throw e;
+    }
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+    shared_ptr<JobLog> log(new JobLog(capacity));
+    std::lock_guard<std::mutex> guard(lock);
+    sources[fds[0]] = log;
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = fds[0];
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fds[0], &event);
+    *write_fd = fds[1];
+    return log;
+}
+
+// the drain thread - one read per ready pipe, so a chatty job can't starve the others
+void OutputCapture::drain()
+{
+    epoll_event events[16];
+    static char buffer[64 * 1024];
+    while (true)
+    {
+        int ready = epoll_wait(epoll_fd, events, 16, -1);
+        if (ready == -1 && errno == EINTR)
+            continue;
+        if (ready == -1)
+            return;
+
+        for (int i = 0; i < ready; i++)
+        {
+            int fd = events[i].data.fd;
+            std::lock_guard<std::mutex> guard(lock);
+            auto it = sources.find(fd);
+            if (it == sources.end())
+                continue;
+            ssize_t res = ::read(fd, buffer, sizeof(buffer));
+            if (res > 0)
+            {
+                it->second->append(buffer, res);
+            }
+            else if (res == 0 || (errno != EAGAIN && errno != EINTR))
+            {
+                //  every writer is gone
+                it->second->close();
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+                ::close(fd);
+                sources.erase(it);
+            }
+        }
+        if (followed)
+            SmallShell::getInstance().wake();
+    }
+}
+
+unsigned long long OutputCapture::read(const std::shared_ptr<JobLog> &log, unsigned long long offset, std::string &out,
+                                       bool *closed, unsigned long long *dropped)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    *closed = log->isClosed();
+    *dropped = log->getDropped();
+    return log->copyFrom(offset, out);
+}
+
+void OutputCapture::lockForFork()
+{
+    lock.lock();
+}
+
+void OutputCapture::unlockAfterFork()
+{
+    lock.unlock();
+}
+
+void OutputCapture::holdWriter(int write_fd)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    task_writers.insert(write_fd);
+}
+
+// closed under the lock, so a fork never copies a number that was already reused
+void OutputCapture::releaseWriter(int write_fd)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    task_writers.erase(write_fd);
+    ::close(write_fd);
+}
+
+// called in a forked child - its copies of the tasks' write ends must not keep their logs open
+void OutputCapture::closeWritersInChild()
+{
+    for (int write_fd : task_writers)
+        ::close(write_fd);
+    task_writers.clear();
+}
+
+void OutputCapture::setFollowed(bool followed)
+{
+    this->followed = followed;
+}
+
+std::shared_ptr<JobLog> JobsList::getLog(int jobId)
+{
+    JobEntry *job = findJob(jobId);
+    if (job != nullptr)
+        return job->getCommand()->getLog();
+    auto it = finished_logs.find(jobId);
+    return it == finished_logs.end() ? nullptr : it->second;
+}
+
+/*
+joblog <id> [-f]                  - prints the captured output of a background job, -f keeps following it
+joblog --capture on|off           - captures the output of background jobs launched from now on
+joblog --size <bytes>             - the ring size of jobs launched from now on
+joblog                            - prints the capture settings
+*/
+void JobLogCommand::execute()
+{
+    OutputCapture &capture = SmallShell::getInstance().getOutputCapture();
+    if (int(args_vec.size()) == 1)
+    {
+        SmallShell::getInstance().getOutput() << "joblog: capture " << (capture.isEnabled() ? "on" : "off") << ", "
+                                              << to_string(capture.getCapacity()) << " bytes per job\n";
+        return;
+    }
+    if (int(args_vec.size()) == 3 && args_vec[1] == "--capture" && (args_vec[2] == "on" || args_vec[2] == "off"))
+    {
+        capture.setEnabled(args_vec[2] == "on");
+        return;
+    }
+    if (int(args_vec.size()) == 3 && args_vec[1] == "--size" && parseCount(args_vec[2]) > 0)
+    {
+        capture.setCapacity(parseCount(args_vec[2]));
+        return;
+    }
+
+    bool follow_log = int(args_vec.size()) == 3 && args_vec[2] == "-f";
+    int job_id = parseCount(args_vec[1]);
+    if (job_id < 0 || (int(args_vec.size()) > 2 && !follow_log))
+    {
+        InvaildArgument e("joblog");
+        throw e;
+    }
+    shared_ptr<JobLog> log = jobs->getLog(job_id);
+    if (log == nullptr)
+    {
+        JobIdDoesntExist e("joblog", job_id);
+        throw e;
+    }
+
+    string out;
+    bool closed;
+    unsigned long long dropped;
+    unsigned long long offset = capture.read(log, 0, out, &closed, &dropped);
+    if (dropped > 0)
+        SmallShell::getInstance().getOutput() << "smash: joblog: " << to_string(dropped) << " older bytes were dropped\n";
+    SmallShell::getInstance().getOutput() << out;
+    if (follow_log && !closed)
+        follow(log, offset);
+}
+
+void JobLogCommand::follow(std::shared_ptr<JobLog> log, unsigned long long offset)
+{
+    SmallShell &smash = SmallShell::getInstance();
+    OutputCapture &capture = smash.getOutputCapture();
+    smash.takeInterrupt();
+
+    //  set before the first read, so a write after it always wakes the loop
+    capture.setFollowed(true);
+    while (true)
+    {
+        string out;
+        bool closed;
+        unsigned long long dropped;
+        unsigned long long next = capture.read(log, offset, out, &closed, &dropped);
+
+        //  the follower fell behind the ring
+        if (next - offset > out.size())
+            smash.getOutput() << "smash: joblog: " << to_string(next - offset - out.size()) << " bytes were dropped\n";
+        smash.getOutput() << out;
+        offset = next;
+        if (closed)
+            break;
+
+        smash.getOutput().flush();
+        smash.waitEvent();
+        smash.processEvents();
+        if (smash.takeInterrupt())
+            break;
+    }
+    capture.setFollowed(false);
+}
+
+//<--------------------------- Job output capture functions - end--------------------------->
+
+//<--------------------------- Admission control functions--------------------------->
+
+AdmissionControl::AdmissionControl() : max_running(0), rate(0), burst(0), tokens(0), refill_time(0)
+{
+}
+
+void AdmissionControl::setLimits(int max_running, double rate, double burst)
+{
+    this->max_running = max_running;
+    this->rate = rate;
+    this->burst = burst < 1 ? 1 : burst;
+
+    //  a new bucket starts full
+    tokens = this->burst;
+    refill_time = monotonicNs();
+}
+
+int AdmissionControl::getMaxRunning() const
+{
+    return max_running;
+}
+
+double AdmissionControl::getRate() const
+{
+    return rate;
+}
+
+double AdmissionControl::getBurst() const
+{
+    return burst;
+}
+
+void AdmissionControl::refill()
+{
+    long long now = monotonicNs();
+    tokens = min(burst, tokens + (now - refill_time) / 1e9 * rate);
+    refill_time = now;
+}
+
+bool AdmissionControl::canLaunch(int running)
+{
+    if (max_running > 0 && running >= max_running)
+        return false;
+    if (rate <= 0)
+        return true;
+    refill();
+    return tokens >= 1;
+}
+
+void AdmissionControl::consume()
+{
+    if (rate > 0)
+        tokens -= 1;
+}
+
+double AdmissionControl::secondsToToken()
+{
+    if (rate <= 0)
+        return 0;
+    refill();
+    return tokens >= 1 ? 0 : (1 - tokens) / rate;
+}
+
+//<--------------------------- Admission control functions - end--------------------------->
+
+//<--------------------------- Jobs List functions - end--------------------------->
+
+//<--------------------------- Output buffer functions--------------------------->
+
+OutputBuffer::OutputBuffer(int fd, bool hold) : fd(fd), ring(nullptr), hold(hold), blocks(), used_blocks(0), pending(0), owner("smash"), pending_owners(), counters()
+{
+}
+
+OutputBuffer::OutputBuffer(ByteRing *ring) : fd(-1), ring(ring), hold(false), blocks(), used_blocks(0), pending(0), owner("smash"), pending_owners(), counters()
+{
+}
+
+OutputBuffer &OutputBuffer::operator<<(const std::string &str)
+{
+    write(str.c_str(), str.size());
+    return *this;
+}
+
+OutputBuffer &OutputBuffer::operator<<(const char *str)
+{
+    write(str, strlen(str));
+    return *this;
+}
+
+OutputBuffer &OutputBuffer::operator<<(char c)
+{
+    write(&c, 1);
+    return *this;
+}
+
+OutputBuffer &OutputBuffer::operator<<(int num)
+{
+    return *this << (long long)num;
+}
+
+OutputBuffer &OutputBuffer::operator<<(long num)
+{
+    return *this << (long long)num;
+}
+
+OutputBuffer &OutputBuffer::operator<<(long long num)
+{
+    char str[32];
+    int len = snprintf(str, sizeof(str), "%lld", num);
+    write(str, len);
+    return *this;
+}
+
+OutputBuffer &OutputBuffer::operator<<(unsigned long num)
+{
+    char str[32];
+    int len = snprintf(str, sizeof(str), "%lu", num);
+    write(str, len);
+    return *this;
+}
+
+void OutputBuffer::write(const char *data, size_t len)
+{
+    if (len == 0)
+        return;
+
+    counters[owner].bytes += len;
+    bool owner_pending = false;
+    for (int i = 0; i < int(pending_owners.size()); i++)
+        owner_pending = owner_pending || pending_owners[i] == owner;
+    if (!owner_pending)
+        pending_owners.push_back(owner);
+
+    //  fill the last block and open new ones - blocks keep their capacity between flushes
+    while (len > 0)
+    {
+        if (used_blocks == 0 || blocks[used_blocks - 1].size() == OUTPUT_BLOCK_SIZE)
+        {
+            if (used_blocks == int(blocks.size()))
+            {
+                blocks.push_back(string());
+                blocks.back().reserve(OUTPUT_BLOCK_SIZE);
+            }
+            used_blocks++;
+        }
+        string &block = blocks[used_blocks - 1];
+        size_t chunk = min(len, size_t(OUTPUT_BLOCK_SIZE) - block.size());
+        block.append(data, chunk);
+        data += chunk;
+        len -= chunk;
+        pending += chunk;
+    }
+
+    if (!hold && pending >= OUTPUT_FLUSH_THRESHOLD)
+        flush();
+}
+
+void OutputBuffer::flush()
+{
+    if (pending == 0)
+        return;
+
+    // callers may flush right before reporting errno
+    int saved_errno = errno;
+
+    //  a reader that is gone drops the rest, like a closed pipe would
+    for (int i = 0; i < used_blocks && ring != nullptr; i++)
+    {
+        if (!ring->write(blocks[i].data(), blocks[i].size()))
+            break;
+    }
+
+    vector<struct iovec> iov(ring != nullptr ? 0 : used_blocks);
+    for (int i = 0; i < int(iov.size()); i++)
+    {
+        iov[i].iov_base = (void *)blocks[i].data();
+        iov[i].iov_len = blocks[i].size();
+    }
+
+    int first = 0;
+    while (first < int(iov.size()))
+    {
+        ssize_t res = writev(fd, &iov[first], min(int(iov.size()) - first, IOV_MAX));
+        for (int i = 0; i < int(pending_owners.size()); i++)
+            counters[pending_owners[i]].syscalls++;
+        if (res < 0)
+        {
+            if (errno == EINTR || (errno == EAGAIN && waitFd(fd, POLLOUT)))
+                continue;
+            break;
+        }
+
+        //  skip what was written - a partial write continues from the middle of a block
+        while (res > 0 && first < int(iov.size()))
+        {
+            if (size_t(res) >= iov[first].iov_len)
+            {
+                res -= iov[first].iov_len;
+                first++;
+            }
+            else
+            {
+                iov[first].iov_base = (char *)iov[first].iov_base + res;
+                iov[first].iov_len -= res;
+                res = 0;
+            }
+        }
+    }
+
+    for (int i = 0; i < used_blocks; i++)
+        blocks[i].clear();
+    used_blocks = 0;
+    pending = 0;
+    pending_owners.clear();
+    errno = saved_errno;
+}
+
+OutputOwner::OutputOwner(OutputBuffer &output, Command *cmd) : output(output), prev_owner()
+{
+    // only builtins are charged - pipes and redirections charge their builtin stages
+    if (dynamic_cast<BuiltInCommand *>(cmd) != nullptr)
+        prev_owner = output.setOwner(cmd->getName());
+    else
+        prev_owner = output.setOwner("smash");
+}
+
+OutputOwner::~OutputOwner()
+{
+    output.setOwner(prev_owner);
+}
+
+std::string OutputBuffer::setOwner(const std::string &name)
+{
+    string prev = owner;
+    owner = name;
+    return prev;
+}
+
+const std::map<std::string, OutputCounters> &OutputBuffer::getCounters() const
+{
+    return counters;
+}
+
+void OutputBuffer::addCounters(const std::map<std::string, OutputCounters> &other)
+{
+    for (auto it = other.begin(); it != other.end(); it++)
+    {
+        counters[it->first].bytes += it->second.bytes;
+        counters[it->first].syscalls += it->second.syscalls;
+    }
+}
+
+void OutputBuffer::redirect(int fd, ByteRing *ring)
+{
+    flush();
+    this->fd = fd;
+    this->ring = ring;
+}
+
+int OutputBuffer::getFd() const
+{
+    return fd;
+}
+
+ByteRing *OutputBuffer::getRing() const
+{
+    return ring;
+}
+
+//<--------------------------- Output buffer functions - end--------------------------->
+
+//<--------------------------- Byte ring functions--------------------------->
+
+static_assert(sizeof(std::atomic<int>) == sizeof(int), "the futex word must be a plain int");
+
+ByteRing::ByteRing(size_t capacity) : buf(capacity), mask(capacity - 1), head(0), head_pad(), tail(0), tail_pad(), seq(0), waiters(0),
+                                      write_closed(false), read_closed(false)
+{
+}
+
+// sleeps until the other side changed something since seq was seen
+void ByteRing::waitChange(int seen)
+{
+    waiters.fetch_add(1);
+    if (seq.load() == seen)
+        syscall(SYS_futex, reinterpret_cast<int *>(&seq), FUTEX_WAIT_PRIVATE, seen, nullptr, nullptr, 0);
+    waiters.fetch_sub(1);
+}
+
+// the futex is only entered when a side sleeps - a ring that keeps moving makes no syscalls
+void ByteRing::wake()
+{
+    seq.fetch_add(1);
+    if (waiters.load() > 0)
+        syscall(SYS_futex, reinterpret_cast<int *>(&seq), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+}
+
+bool ByteRing::write(const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        int seen = seq.load();
+        if (read_closed.load())
+            return false;
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t room = buf.size() - (h - tail.load(std::memory_order_acquire));
+        if (room == 0)
+        {
+            waitChange(seen);
+            continue;
+        }
+
+        //  the free space may wrap around the end of the buffer
+        size_t bytes = min(len, room);
+        size_t at = h & mask;
+        size_t first = min(bytes, buf.size() - at);
+        memcpy(&buf[at], data, first);
+        memcpy(&buf[0], data + first, bytes - first);
+        head.store(h + bytes, std::memory_order_release);
+        wake();
+        data += bytes;
+        len -= bytes;
+    }
+    return true;
+}
+
+size_t ByteRing::read(char *data, size_t len)
+{
+    while (true)
+    {
+        int seen = seq.load();
+        bool closed = write_closed.load();
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t h = head.load(std::memory_order_acquire);
+        if (h != t)
+        {
+            size_t bytes = min(len, h - t);
+            size_t at = t & mask;
+            size_t first = min(bytes, buf.size() - at);
+            memcpy(data, &buf[at], first);
+            memcpy(data + first, &buf[0], bytes - first);
+            tail.store(t + bytes, std::memory_order_release);
+            wake();
+            return bytes;
+        }
+
+        //  closed was read before head - nothing the writer wrote before closing is missed
+        if (closed || read_closed.load())
+            return 0;
+        waitChange(seen);
+    }
+}
+
+void ByteRing::closeWrite()
+{
+    write_closed.store(true);
+    wake();
+}
+
+void ByteRing::closeRead()
+{
+    read_closed.store(true);
+    wake();
+}
+
+//<--------------------------- Byte ring functions - end--------------------------->
+
+//<--------------------------- Parse cache functions--------------------------->
+
+ParseCache::ParseCache(size_t max_bytes) : lru(), index(), bytes(0), max_bytes(max_bytes), hits(0), misses(0), evictions(0)
+{
+}
+
+// approximate heap footprint of an entry - used for the memory bound
+size_t ParseCache::entrySize(const CacheEntry &entry)
+{
+    const ParsedCommand &parsed = *entry.second;
+    size_t size = sizeof(CacheEntry) + sizeof(ParsedCommand) + entry.first.capacity();
+    for (int i = 0; i < int(parsed.args.size()); i++)
+        size += sizeof(string) + parsed.args[i].capacity();
+    return size + parsed.sign.capacity() + parsed.left.capacity() + parsed.right.capacity();
+}
+
+void ParseCache::erase(std::list<CacheEntry>::iterator it)
+{
+    bytes -= entrySize(*it);
+    index.erase(std::hash<string>()(it->first));
+    lru.erase(it);
+}
+
+std::shared_ptr<const ParsedCommand> ParseCache::find(const std::string &line, bool count)
+{
+    auto it = index.find(std::hash<string>()(line));
+
+    // a hash collision counts as a miss
+    if (it == index.end() || it->second->first != line)
+    {
+        if (count)
+            misses++;
+        return nullptr;
+    }
+
+    //  move to the front of the LRU list
+    if (count)
+        hits++;
+    lru.splice(lru.begin(), lru, it->second);
+    return it->second->second;
+}
+
+void ParseCache::insert(const std::string &line, std::shared_ptr<const ParsedCommand> parsed)
+{
+    auto it = index.find(std::hash<string>()(line));
+    if (it != index.end())
+        erase(it->second);
+
+    lru.push_front(CacheEntry(line, parsed));
+    index[std::hash<string>()(line)] = lru.begin();
+    bytes += entrySize(lru.front());
+
+    //  evict least recently used lines - the new one always stays
+    while (bytes > max_bytes && int(lru.size()) > 1)
+    {
+        erase(--lru.end());
+        evictions++;
+    }
+}
+
+long long ParseCache::getHits() const
+{
+    return hits;
+}
+
+long long ParseCache::getMisses() const
+{
+    return misses;
+}
+
+long long ParseCache::getEvictions() const
+{
+    return evictions;
+}
+
+size_t ParseCache::getBytes() const
+{
+    return bytes;
+}
+
+int ParseCache::getSize() const
+{
+    return int(lru.size());
+}
+
+//<--------------------------- Parse cache functions - end--------------------------->
+
+//<--------------------------- History functions--------------------------->
+
+// entries deeper than this are found by the trie's deepest node and then compared directly
+#define HISTORY_TRIE_DEPTH (32)
+
+CommandHistory::CommandHistory() : path(), fd(-1), loaded(false), map_base(nullptr), map_size(0),
+                                   session_lines(), entries(), trie(), trigrams()
+{
+    const char *env_path = getenv("SMASH_HISTFILE");
+    const char *home = getenv("HOME");
+    if (env_path != nullptr)
+        path = env_path;
+    else if (home != nullptr)
+        path = string(home) + "/.smash_history";
+
+    // only open the log here - mapping and indexing are delayed to the first lookup,
+    // so startup does not depend on the size of the history
+    if (!path.empty())
+        fd = open(path.c_str(), O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+}
+
+CommandHistory::~CommandHistory()
+{
+    if (map_base != nullptr)
+        munmap(map_base, map_size);
+    if (fd >= 0)
+        close(fd);
+}
+
+void CommandHistory::add(const std::string &line)
+{
+    // the log holds one entry per line
+    if (line.empty() || line.find('\n') != string::npos)
+        return;
+
+    if (fd >= 0)
+    {
+        // a single write on an O_APPEND descriptor - lines of several shells never interleave
+        string record = line + "\n";
+        if (write(fd, record.c_str(), record.size()) != int(record.size()))
+            perror("smash error: write failed");
+    }
+
+    // without a log file, or once the log was mapped, the line is kept in memory
+    if (fd < 0 || loaded)
+    {
+        session_lines.push_back(line);
+        Entry entry = {session_lines.back().c_str(), int(line.size())};
+        entries.push_back(entry);
+        if (loaded)
+            indexEntry(int(entries.size()) - 1);
+    }
+}
+
+void CommandHistory::load()
+{
+    if (loaded)
+        return;
+    loaded = true;
+
+    if (fd >= 0)
+    {
+        struct stat stats;
+        if (fstat(fd, &stats) == 0 && stats.st_size > 0)
+        {
+            void *base = mmap(nullptr, stats.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (base == MAP_FAILED)
+            {
+                perror("smash error: mmap failed");
+            }
+            else
+            {
+                map_base = (char *)base;
+                map_size = stats.st_size;
+            }
+        }
+    }
+
+    // split the mapped log into entries - no line is copied
+    vector<Entry> mapped;
+    const char *start = map_base;
+    const char *end = map_base + map_size;
+    while (start < end)
+    {
+        const char *nl = (const char *)memchr(start, '\n', end - start);
+        if (nl == nullptr)
+            nl = end;
+        if (nl > start)
+        {
+            Entry entry = {start, int(nl - start)};
+            mapped.push_back(entry);
+        }
+        start = nl + 1;
+    }
+    entries.insert(entries.begin(), mapped.begin(), mapped.end());
+
+    TrieNode root;
+    root.last = -1;
+    trie.push_back(root);
+    for (int i = 0; i < int(entries.size()); i++)
+        indexEntry(i);
+}
+
+void CommandHistory::indexEntry(int index)
+{
+    const Entry &entry = entries[index];
+
+    //  prefix trie - every node on the path now points to this (most recent) entry
+    int node = 0;
+    trie[0].last = index;
+    for (int i = 0; i < entry.len && i < HISTORY_TRIE_DEPTH; i++)
+    {
+        int next = -1;
+        for (int j = 0; j < int(trie[node].children.size()); j++)
+        {
+            if (trie[node].children[j].first == entry.data[i])
+            {
+                next = trie[node].children[j].second;
+                break;
+            }
+        }
+        if (next == -1)
+        {
+            TrieNode child;
+            child.last = -1;
+            trie.push_back(child);
+            next = int(trie.size()) - 1;
+            trie[node].children.push_back(make_pair(entry.data[i], next));
+        }
+        node = next;
+        trie[node].last = index;
+    }
+
+    //  substring index - posting list of every 3-character window
+    for (int i = 0; i + 3 <= entry.len; i++)
+    {
+        unsigned int gram = ((unsigned char)entry.data[i] << 16) | ((unsigned char)entry.data[i + 1] << 8) |
+                            (unsigned char)entry.data[i + 2];
+        vector<int> &postings = trigrams[gram];
+        if (postings.empty() || postings.back() != index)
+            postings.push_back(index);
+    }
+}
+
+bool CommandHistory::matches(int index, const std::string &text) const
+{
+    const Entry &entry = entries[index];
+    return memmem(entry.data, entry.len, text.c_str(), text.size()) != nullptr;
+}
+
+int CommandHistory::size()
+{
+    load();
+    return int(entries.size());
+}
+
+// returns the entry by its 1-based number
+std::string CommandHistory::getEntry(int number)
+{
+    load();
+    if (number < 1 || number > int(entries.size()))
+        return "";
+    const Entry &entry = entries[number - 1];
+    return string(entry.data, entry.len);
+}
+
+// returns the number of the most recent entry that starts with prefix, or 0 if there is none
+int CommandHistory::findPrefix(const std::string &prefix)
+{
+    load();
+    int node = 0;
+    for (int i = 0; i < int(prefix.size()) && i < HISTORY_TRIE_DEPTH; i++)
+    {
+        int next = -1;
+        for (int j = 0; j < int(trie[node].children.size()); j++)
+        {
+            if (trie[node].children[j].first == prefix[i])
+            {
+                next = trie[node].children[j].second;
+                break;
+            }
+        }
+        if (next == -1)
+            return 0;
+        node = next;
+    }
+
+    if (int(prefix.size()) <= HISTORY_TRIE_DEPTH)
+        return trie[node].last + 1;
+
+    // prefix is longer than the trie - scan backwards from the deepest match
+    for (int i = trie[node].last; i >= 0; i--)
+    {
+        const Entry &entry = entries[i];
+        if (entry.len >= int(prefix.size()) && memcmp(entry.data, prefix.c_str(), prefix.size()) == 0)
+            return i + 1;
+    }
+    return 0;
+}
+
+// returns the numbers of all entries that contain text, oldest first
+std::vector<int> CommandHistory::search(const std::string &text)
+{
+    load();
+    vector<int> res;
+
+    //  too short for the trigram index
+    if (int(text.size()) < 3)
+    {
+        for (int i = 0; i < int(entries.size()); i++)
+            if (matches(i, text))
+                res.push_back(i + 1);
+        return res;
+    }
+
+    //  verify only the candidates of the rarest trigram of text
+    const vector<int> *candidates = nullptr;
+    for (int i = 0; i + 3 <= int(text.size()); i++)
+    {
+        unsigned int gram = ((unsigned char)text[i] << 16) | ((unsigned char)text[i + 1] << 8) | (unsigned char)text[i + 2];
+        auto it = trigrams.find(gram);
+        if (it == trigrams.end())
+            return res;
+        if (candidates == nullptr || it->second.size() < candidates->size())
+            candidates = &it->second;
+    }
+    for (int i = 0; i < int(candidates->size()); i++)
+        if (matches((*candidates)[i], text))
+            res.push_back((*candidates)[i] + 1);
+    return res;
+}
+
+void CommandHistory::printEntry(int number)
+{
+    char number_str[16];
+    snprintf(number_str, sizeof(number_str), "%5d  ", number);
+    SmallShell::getInstance().getOutput() << number_str << getEntry(number) << "\n";
+}
+
+//<--------------------------- History functions - end--------------------------->
+
+//<--------------------------- Smash List functions--------------------------->
+
+/**
+ * Creates and returns a pointer to Command class which matches the given command line (cmd_line)
+ */
+
+// builtins by their first word
+static const std::unordered_map<std::string, CommandKind> &builtinKinds()
+{
+    static const unordered_map<string, CommandKind> kinds = {
+        {"pwd", KIND_PWD},
+        {"showpid", KIND_SHOWPID},
+        {"cd", KIND_CD},
+        {"jobs", KIND_JOBS},
+        {"bg", KIND_BG},
+        {"fg", KIND_FG},
+        {"kill", KIND_KILL},
+        {"quit", KIND_QUIT},
+        {"setcore", KIND_SETCORE},
+        {"getfiletype", KIND_GETFILETYPE},
+        {"chmod", KIND_CHMOD},
+        {"timeout", KIND_TIMEOUT},
+        {"stats", KIND_STATS},
+        {"history", KIND_HISTORY},
+        {"bench", KIND_BENCH},
+        {"every", KIND_EVERY},
+        {"at", KIND_AT},
+        {"joblimit", KIND_JOBLIMIT},
+        {"after", KIND_AFTER},
+        {"joblog", KIND_JOBLOG},
+        {"export", KIND_EXPORT},
+        {"unset", KIND_UNSET},
+        {"tee", KIND_TEE}};
+    return kinds;
+}
+
+// a word or an operator of a command line, and where it is in the line
+struct LineToken
+{
+    bool is_op;
+    string text;
+    size_t start;
+    size_t end;
+};
+
+// longest first - "<<<" starts with "<<", which starts with "<"
+static const char *const line_operators[] = {"<<<", "&&", "||", "|&", ">>", "<<", ";", "&", "|", ">", "<"};
+
+static bool isRedirectOp(const string &op)
+{
+    return op == ">" || op == ">>" || op == "<" || op == "<<" || op == "<<<";
+}
+
+// the end of the word that starts at i - quotes and backslashes keep stop characters in it,
+// and an unterminated quote runs to the end of the line
+static size_t wordEnd(const string &line, size_t i, const string &stops)
+{
+    char quote = 0;
+    for (; i < line.size(); i++)
+    {
+        char c = line[i];
+        if (quote == '\'')
+            quote = c == quote ? 0 : quote;
+        else if (c == '\\' && i + 1 < line.size())
+            i++;
+        else if (quote == '"')
+            quote = c == quote ? 0 : quote;
+        else if (c == '\'' || c == '"')
+            quote = c;
+        else if (stops.find(c) != string::npos)
+            break;
+    }
+    return i;
+}
+
+// a word without its quotes and escaping backslashes - what a builtin or a redirection reads
+static string unquoteWord(const string &word)
+{
+    string res;
+    char quote = 0;
+    for (size_t i = 0; i < word.size(); i++)
+    {
+        char c = word[i];
+        if (quote == '\'')
+        {
+            if (c == quote)
+                quote = 0;
+            else
+                res += c;
+        }
+        else if (c == '\\' && i + 1 < word.size() && (quote == 0 || strchr("\\\"$`", word[i + 1]) != nullptr))
+            res += word[++i];
+        else if (c == '"' && quote == '"')
+            quote = 0;
+        else if (quote == 0 && (c == '\'' || c == '"'))
+            quote = c;
+        else
+            res += c;
+    }
+    return res;
+}
+
+// the words of a line, split at unquoted whitespace and unquoted
+static vector<string> splitQuoted(const string &line)
+{
+    vector<string> words;
+    size_t i = line.find_first_not_of(WHITESPACE);
+    while (i != string::npos)
+    {
+        size_t end = wordEnd(line, i, WHITESPACE);
+        words.push_back(unquoteWord(line.substr(i, end - i)));
+        i = line.find_first_not_of(WHITESPACE, end);
+    }
+    return words;
+}
+
+// splits a line into words and operators - quotes and backslashes keep operator characters in a word
+static vector<LineToken> tokenizeLine(const string &line)
+{
+    vector<LineToken> tokens;
+    size_t i = 0;
+    while (i < line.size())
+    {
+        if (WHITESPACE.find(line[i]) != string::npos)
+        {
+            i++;
+            continue;
+        }
+        bool is_op = false;
+        for (const char *op : line_operators)
+        {
+            size_t len = strlen(op);
+            if (line.compare(i, len, op) == 0)
+            {
+                tokens.push_back(LineToken{true, op, i, i + len});
+                i += len;
+                is_op = true;
+                break;
+            }
+        }
+        if (is_op)
+            continue;
+
+        size_t start = i;
+        i = wordEnd(line, i, WHITESPACE + ";&|<>");
+        tokens.push_back(LineToken{false, line.substr(start, i - start), start, i});
+    }
+    return tokens;
+}
+
+// characters the parser or bash would read as syntax in an expanded value
+static const string EXPANSION_SPECIAL = WHITESPACE + ";&|<>'\"\\$`*?[](){}#~!";
+
+// a value as it is put into a word - quoted if it has syntax in it, so it stays literal text of that word
+static string literalValue(const string &value, bool in_double_quotes)
+{
+    if (value.find_first_of(EXPANSION_SPECIAL) == string::npos)
+        return value;
+    string res = in_double_quotes ? "" : "'";
+    for (size_t i = 0; i < value.size(); i++)
+    {
+        if (in_double_quotes && strchr("\\\"$`", value[i]) != nullptr)
+            res += '\\';
+        if (!in_double_quotes && value[i] == '\'')
+            res += "'\\'";
+        res += value[i];
+    }
+    return in_double_quotes ? res : res + "'";
+}
+
+/*
+Expands "$NAME", "${NAME}" and "$?" word by word, after the line was split into words and operators.
+A value never becomes syntax: whatever it holds is quoted, so it stays inside the word it was expanded in.
+Nothing is expanded in single quotes or after a backslash.
+*/
+std::string SmallShell::expandVariables(const std::string &cmd_line) const
+{
+    string first_word = get_args_in_vec(cmd_line.c_str()).empty() ? "" : get_args_in_vec(cmd_line.c_str())[0];
+    if (cmd_line.find('$') == string::npos || first_word == "bench" || first_word == "every" || first_word == "at" || first_word == "after")
+        return cmd_line;
+
+    string expanded;
+    size_t copied = 0;
+    vector<LineToken> tokens = tokenizeLine(cmd_line);
+    for (size_t t = 0; t < tokens.size(); t++)
+    {
+        const string &word = tokens[t].text;
+        if (tokens[t].is_op || word.find('$') == string::npos)
+            continue;
+        expanded += cmd_line.substr(copied, tokens[t].start - copied);
+        copied = tokens[t].end;
+
+        char quote = 0;
+        for (size_t i = 0; i < word.size(); i++)
+        {
+            char c = word[i];
+            if (c == '\\' && quote != '\'' && i + 1 < word.size())
+            {
+                expanded += word.substr(i++, 2);
+                continue;
+            }
+            if (c == '\'' || c == '"')
+                quote = quote == 0 ? c : (quote == c ? 0 : quote);
+            if (c != '$' || quote == '\'' || i + 1 == word.size())
+            {
+                expanded += c;
+                continue;
+            }
+
+            string name;
+            size_t end = i + 1;
+            if (word[end] == '?')
+            {
+                expanded += to_string(last_status);
+                i = end;
+                continue;
+            }
+            if (word[end] == '{')
+            {
+                size_t close = word.find('}', end);
+                if (close != string::npos)
+                {
+                    name = word.substr(end + 1, close - end - 1);
+                    end = close + 1;
+                }
+            }
+            else
+            {
+                while (end < word.size() && (isalnum(word[end]) || word[end] == '_'))
+                    end++;
+                name = word.substr(i + 1, end - i - 1);
+            }
+
+            //  not a variable - the $ stays
+            if (!Environment::isValidName(name))
+            {
+                expanded += c;
+                continue;
+            }
+            string value;
+            if (environment.get(name, &value))
+                expanded += literalValue(value, quote == '"');
+            i = end - 1;
+        }
+    }
+    return expanded + cmd_line.substr(copied);
+}
+
+// a recursive-descent parser over the tokens of one line - see SyntaxNode for the grammar
+struct LineParser
+{
+    const string &line;
+    const vector<LineToken> &tokens;
+    size_t pos;
+
+    bool atOp(const char *op) const
+    {
+        return pos < tokens.size() && tokens[pos].is_op && tokens[pos].text == op;
+    }
+
+    void unexpected() const
+    {
+        SyntaxError e(pos < tokens.size() ? tokens[pos].text : "newline");
+        throw e;
+    }
+
+    string span(size_t start, size_t end) const
+    {
+        return line.substr(start, end - start);
+    }
+
+    shared_ptr<SyntaxNode> parseList()
+    {
+        shared_ptr<SyntaxNode> list(new SyntaxNode(SyntaxNode::NODE_LIST));
+        while (pos < tokens.size())
+        {
+            shared_ptr<SyntaxNode> item = parseAndOr();
+            if (atOp("&"))
+                item->background = true;
+            else if (!atOp(";") && pos < tokens.size())
+                unexpected();
+            pos++;
+            list->children.push_back(item);
+        }
+        list->text = line;
+        return list;
+    }
+
+    shared_ptr<SyntaxNode> parseAndOr()
+    {
+        size_t start = pos < tokens.size() ? tokens[pos].start : line.size();
+        shared_ptr<SyntaxNode> left = parsePipeline();
+        while (atOp("&&") || atOp("||"))
+        {
+            shared_ptr<SyntaxNode> chain(new SyntaxNode(atOp("&&") ? SyntaxNode::NODE_AND : SyntaxNode::NODE_OR));
+            chain->op = tokens[pos++].text;
+            chain->children.push_back(left);
+            chain->children.push_back(parsePipeline());
+            chain->text = span(start, tokens[pos - 1].end);
+            left = chain;
+        }
+        return left;
+    }
+
+    shared_ptr<SyntaxNode> parsePipeline()
+    {
+        size_t start = pos < tokens.size() ? tokens[pos].start : line.size();
+        shared_ptr<SyntaxNode> first = parseCommand();
+        if (!atOp("|") && !atOp("|&"))
+            return first;
+
+        //  right-nested, like PipeCommand runs it - the first command, then the rest of the pipeline
+        shared_ptr<SyntaxNode> pipe(new SyntaxNode(SyntaxNode::NODE_PIPE));
+        pipe->op = tokens[pos++].text;
+        if (pos >= tokens.size() || (tokens[pos].is_op && !isRedirectOp(tokens[pos].text)))
+        {
+            InvaildArgument e(pipe->op);
+            throw e;
+        }
+        pipe->children.push_back(first);
+        pipe->children.push_back(parsePipeline());
+        pipe->text = span(start, tokens[pos - 1].end);
+        return pipe;
+    }
+
+    shared_ptr<SyntaxNode> parseCommand()
+    {
+        size_t first = pos;
+        vector<size_t> words;
+        vector<pair<size_t, size_t>> redirects; // operator token, last target token
+        while (pos < tokens.size())
+        {
+            if (!tokens[pos].is_op)
+            {
+                words.push_back(pos++);
+                continue;
+            }
+            if (!isRedirectOp(tokens[pos].text))
+                break;
+            size_t op = pos++;
+            if (pos >= tokens.size() || tokens[pos].is_op)
+            {
+                InvaildArgument e(tokens[op].text);
+                throw e;
+            }
+
+            //  a here-string is the rest of the command's words
+            while (tokens[op].text == "<<<" && pos + 1 < tokens.size() && !tokens[pos + 1].is_op)
+                pos++;
+            redirects.push_back(make_pair(op, pos++));
+        }
+        if (pos == first && !atOp("|") && !atOp("|&"))
+            unexpected();
+        //  pipes and redirections with a missing side are invalid arguments, as they always were
+        if (words.empty())
+        {
+            InvaildArgument e(tokens[first].text);
+            throw e;
+        }
+        size_t start = tokens[first].start, end = tokens[pos - 1].end;
+
+        //  the output redirections wrap the input ones, the first of each outermost - so the last one gets the data
+        vector<pair<size_t, size_t>> order;
+        for (int input = 0; input < 2; input++)
+        {
+            for (size_t i = 0; i < redirects.size(); i++)
+            {
+                if ((tokens[redirects[i].first].text[0] == '<') == (input == 1))
+                    order.push_back(redirects[i]);
+            }
+        }
+
+        //  each level's text is the command's text without the redirections outside it
+        string text = span(start, end);
+        vector<string> texts(1, text);
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            size_t from = tokens[order[i].first].start - start, to = tokens[order[i].second].end - start;
+            text.replace(from, to - from, string(to - from, ' '));
+            texts.push_back(text);
+        }
+
+        shared_ptr<SyntaxNode> node(new SyntaxNode(SyntaxNode::NODE_SIMPLE));
+        node->text = _trim(texts.back());
+        for (int i = int(order.size()) - 1; i >= 0; i--)
+        {
+            shared_ptr<SyntaxNode> redirect(new SyntaxNode(SyntaxNode::NODE_REDIRECT));
+            redirect->op = tokens[order[i].first].text;
+            redirect->target = span(tokens[order[i].first + 1].start, tokens[order[i].second].end);
+            redirect->text = _trim(texts[i]);
+            redirect->children.push_back(node);
+            node = redirect;
+        }
+        return node;
+    }
+};
+
+// parses a line - a single command or pipeline is the root itself, anything else ("ls;" too) is a list
+static shared_ptr<const SyntaxNode> parseSyntax(const string &line)
+{
+    vector<LineToken> tokens = tokenizeLine(line);
+    if (tokens.empty())
+    {
+        shared_ptr<SyntaxNode> empty(new SyntaxNode(SyntaxNode::NODE_SIMPLE));
+        return empty;
+    }
+    LineParser parser = {line, tokens, 0};
+    shared_ptr<SyntaxNode> list = parser.parseList();
+    if (list->children.size() == 1 && !(tokens.back().is_op && tokens.back().text == ";"))
+        return list->children[0];
+    return list;
+}
+
+// classifies a line - tree is its syntax tree if the line is a node of one parsed already, null to parse it here
+static shared_ptr<const ParsedCommand> classifyLine(const string &line, shared_ptr<const SyntaxNode> tree)
+{
+    shared_ptr<ParsedCommand> parsed(new ParsedCommand());
+    parsed->args = splitQuoted(line);
+    parsed->raw_args = get_args_in_vec(line.c_str());
+
+    string firstWord = parsed->args.empty() ? "" : parsed->args[0];
+    if (!firstWord.empty() && _isBackgroundCommand(firstWord.c_str()))
+    {
+        removeBackgroundSignString(firstWord);
+    }
+
+    // these take a whole command line, pipes and redirections included
+    if (firstWord == "bench" || firstWord == "every" || firstWord == "at" || firstWord == "after")
+    {
+        parsed->kind = builtinKinds().at(firstWord);
+        return parsed;
+    }
+
+    //  the root of the tree decides the kind - the command classes split their text as it says
+    if (tree == nullptr)
+        tree = parseSyntax(line);
+    parsed->tree = tree;
+    if (tree->type == SyntaxNode::NODE_LIST || tree->type == SyntaxNode::NODE_AND || tree->type == SyntaxNode::NODE_OR)
+    {
+        parsed->kind = KIND_LIST;
+    }
+    else if (tree->type == SyntaxNode::NODE_PIPE)
+    {
+        parsed->kind = tree->op == "|&" ? KIND_PIPE_STDERR : KIND_PIPE;
+        parsed->sign = tree->op;
+        parsed->left = tree->children[0]->text;
+        parsed->right = tree->children[1]->text;
+    }
+    else if (tree->type == SyntaxNode::NODE_REDIRECT)
+    {
+        parsed->kind = tree->op == ">>" ? KIND_REDIRECT_APPEND : tree->op == ">" ? KIND_REDIRECT
+                                                                                : KIND_INPUT_REDIRECT;
+        parsed->sign = tree->op;
+        parsed->left = tree->children[0]->text;
+        parsed->right = unquoteWord(tree->target);
+    }
+    else
+    {
+        auto it = builtinKinds().find(firstWord);
+        parsed->kind = it == builtinKinds().end() ? KIND_EXTERNAL : it->second;
+    }
+    return parsed;
+}
+
+/**
+ * Classifies and tokenizes a command line. The result is immutable and kept in the parse cache,
+ * so repeated lines skip trimming, classification and tokenizing.
+ */
+shared_ptr<const ParsedCommand> SmallShell::parseLine(const char *cmd_line, bool count_lookup)
+{
+    string cmd_str(cmd_line);
+    shared_ptr<const ParsedCommand> cached = parse_cache.find(cmd_str, count_lookup);
+    if (cached != nullptr)
+        return cached;
+
+    shared_ptr<const ParsedCommand> parsed = classifyLine(cmd_str, nullptr);
+    parse_cache.insert(cmd_str, parsed);
+    return parsed;
+}
+
+// a command of a parsed list as a line of its own - its node is reused, the line is not parsed again
+shared_ptr<const ParsedCommand> SmallShell::parseNode(const std::string &line, shared_ptr<const SyntaxNode> node)
+{
+    shared_ptr<const ParsedCommand> cached = parse_cache.find(line, false);
+    if (cached != nullptr)
+        return cached;
+
+    shared_ptr<const ParsedCommand> parsed = classifyLine(line, node);
+    parse_cache.insert(line, parsed);
+    return parsed;
+}
+
+/**
+ * Creates and returns a pointer to Command class which matches the given command line (cmd_line)
+ */
+shared_ptr<Command> SmallShell::CreateCommand(const char *cmd_line)
+{
+    //  the line it is part of counted the lookup
+    CommandKind kind = parseLine(cmd_line, false)->kind;
+    metrics.countCommand(kind);
+    switch (kind)
+    {
+    case KIND_REDIRECT_APPEND:
+        return shared_ptr<Command>(new RedirectionAppendCommand(cmd_line));
+    case KIND_PIPE_STDERR:
+        return shared_ptr<Command>(new PipeSterrCommand(cmd_line));
+    case KIND_REDIRECT:
+        return shared_ptr<Command>(new RedirectionNormalCommand(cmd_line));
+    case KIND_PIPE:
+        return shared_ptr<Command>(new PipeNormalCommand(cmd_line));
+    case KIND_INPUT_REDIRECT:
+        return shared_ptr<Command>(new InputRedirectionCommand(cmd_line));
+    case KIND_PWD:
+        return shared_ptr<Command>(new GetCurrDirCommand(cmd_line));
+    case KIND_SHOWPID:
+        return shared_ptr<Command>(new ShowPidCommand(cmd_line));
+    case KIND_CD:
+        return shared_ptr<Command>(new ChangeDirCommand(cmd_line));
+    case KIND_JOBS:
+        return shared_ptr<Command>(new JobsCommand(cmd_line, this->jobs_list));
+    case KIND_BG:
+        return shared_ptr<Command>(new BackgroundCommand(cmd_line, this->jobs_list));
+    case KIND_FG:
+        return shared_ptr<Command>(new ForegroundCommand(cmd_line, this->jobs_list));
+    case KIND_KILL:
+        return shared_ptr<Command>(new KillCommand(cmd_line, this->jobs_list));
+    case KIND_QUIT:
+        return shared_ptr<Command>(new QuitCommand(cmd_line, this->jobs_list));
+    case KIND_SETCORE:
+        return shared_ptr<Command>(new SetcoreCommand(cmd_line, this->jobs_list));
+    case KIND_GETFILETYPE:
+        return shared_ptr<Command>(new GetFileTypeCommand(cmd_line));
+    case KIND_CHMOD:
+        return shared_ptr<Command>(new ChmodCommand(cmd_line));
+    case KIND_TIMEOUT:
+        return shared_ptr<Command>(new TimeoutCommand(cmd_line));
+    case KIND_STATS:
+        return shared_ptr<Command>(new StatsCommand(cmd_line));
+    case KIND_HISTORY:
+        return shared_ptr<Command>(new HistoryCommand(cmd_line, this->history));
+    case KIND_BENCH:
+        return shared_ptr<Command>(new BenchCommand(cmd_line));
+    case KIND_EVERY:
+        return shared_ptr<Command>(new ScheduleCommand(cmd_line, true));
+    case KIND_AT:
+        return shared_ptr<Command>(new ScheduleCommand(cmd_line, false));
+    case KIND_JOBLIMIT:
+        return shared_ptr<Command>(new JobLimitCommand(cmd_line, this->jobs_list));
+    case KIND_AFTER:
+        return shared_ptr<Command>(new AfterCommand(cmd_line, this->jobs_list));
+    case KIND_JOBLOG:
+        return shared_ptr<Command>(new JobLogCommand(cmd_line, this->jobs_list));
+    case KIND_EXPORT:
+        return shared_ptr<Command>(new ExportCommand(cmd_line));
+    case KIND_UNSET:
+        return shared_ptr<Command>(new UnsetCommand(cmd_line));
+    case KIND_TEE:
+        return shared_ptr<Command>(new TeeCommand(cmd_line));
+    case KIND_LIST:
+        return shared_ptr<Command>(new ListCommand(cmd_line));
+    case KIND_EXTERNAL:
+        return shared_ptr<Command>(new ExternalCommand(cmd_line));
+    case KIND_COUNT:
+        break;
+    }
+
+    return nullptr;
+}
+
+const ParseCache &SmallShell::getParseCache() const
+{
+    return parse_cache;
+}
+
+void SmallShell::changeChprompt(const char *cmd_line)
+{
+    std::string cmd_line_string(cmd_line);
+    if (_isBackgroundCommand(cmd_line))
+    {
+        removeBackgroundSignString(cmd_line_string);
+    }
+
+    vector<string> args = get_args_in_vec(cmd_line_string.c_str());
+    string new_prompt = int(args.size()) == 1 ? "smash> " : (args[1] + "> ");
+    prompt = new_prompt;
+}
+
+// the prompt is the flush point before reading the next line
+void SmallShell::printPrompt()
+{
+    output << prompt;
+    output.flush();
+}
+
+OutputBuffer &SmallShell::getOutput()
+{
+    return task_output != nullptr ? *task_output : output;
+}
+
+// every fork of the shell goes through here - pending output must not be inherited by the child
+int SmallShell::forkChild()
+{
+    output.flush();
+    long long start = monotonicNs();
+    int pid;
+    {
+        //  the drain thread's lock must not be inherited held
+        output_capture.lockForFork();
+        pid = fork();
+        if (pid == 0)
+            output_capture.closeWritersInChild();
+        output_capture.unlockAfterFork();
+    }
+    if (pid > 0)
+        metrics.observe(METRIC_FORK_LATENCY, monotonicNs() - start);
+    if (pid > 0 && fork_samples != nullptr)
+        fork_samples->push_back(monotonicNs() - start);
+
+    // the fork may happen while the shell blocks signals - the child starts clean
+    if (pid == 0)
+    {
+        sigset_t empty_set;
+        sigemptyset(&empty_set);
+        sigprocmask(SIG_SETMASK, &empty_set, nullptr);
+    }
+    return pid;
+}
+
+void SmallShell::setForkSamples(std::vector<long long> *samples)
+{
+    fork_samples = samples;
+}
+
+void SmallShell::addJob(shared_ptr<Command> cmd, bool is_stopped)
+{
+    jobs_list->addJob(cmd, is_stopped);
+};
+
+void SmallShell::removeJob(int job_id)
+{
+    jobs_list->removeJobById(job_id);
+};
+
+/*
+Replaces a leading history designator (!N, !-N, !! or !prefix) with the matching history entry.
+returns: true if the line was changed
+*/
+bool SmallShell::expandHistory(std::string &cmd_line)
+{
+    string cmd_s = _ltrim(cmd_line);
+    if (cmd_s.size() < 2 || cmd_s[0] != '!')
+        return false;
+
+    // the designator ends at the first whitespace - the rest of the line is kept
+    size_t end = cmd_s.find_first_of(WHITESPACE);
+    string event = cmd_s.substr(0, end);
+    string rest = end == string::npos ? "" : cmd_s.substr(end);
+    string designator = event.substr(1);
+
+    // a number out of range saturates in strtoll, and is not found like any other
+    long long number = 0;
+    int count = history->size();
+    if (designator == "!")
+        number = count;
+    else if (isStringNumber(designator))
+    {
+        number = strtoll(designator.c_str(), nullptr, 10);
+        number = number < 0 ? count + 1 + number : number;
+    }
+    else
+        number = history->findPrefix(designator);
+
+    if (number < 1 || number > count)
+    {
+        HistoryEventNotFound e(event);
+        throw e;
+    }
+    cmd_line = history->getEntry(number) + rest;
+    return true;
+}
+
+void SmallShell::addToHistory(const std::string &cmd_line)
+{
+    history->add(_trim(cmd_line));
+}
+
+//<--------------------------- Smash functions - end--------------------------->
+
+//// bonus
+
+void SmallShell::addTimeOutCommand(std::shared_ptr<TimeoutCommand> cmd)
+{
+    timeOutList->addToList(cmd);
+}
+
+void SmallShell::removeTimeOutCommand(std::shared_ptr<TimeoutCommand> cmd)
+{
+    timeOutList->removeCommand(cmd);
+}
+
+void SmallShell::handleAlarm()
+{
+    // the alarm is shared with "every" / "at" - only timeouts announce it
+    if (timeOutList->isTimeoutDue())
+        output << "smash: got an alarm\n";
+    timeOutList->handleSignal();
+    jobs_list->admitQueued();
+}
+
+// ctrl-C kills the foreground command, ctrl-Z stops it and makes it a job
+void SmallShell::signalForeground(int signal_num)
+{
+    if (current_command == nullptr)
+        return;
+
+    //  a pipe or a redirection has a process group once its first stage was forked
+    int pid = current_command->getProcessId();
+    if (pid <= 0 || pid == getpid())
+        return;
+    if (signalJob(pid, signal_num == SIGINT ? SIGKILL : SIGSTOP) == -1)
+    {
+        perror("smash error: kill failed");
+        return;
+    }
+
+    if (signal_num == SIGINT)
+    {
+        //  if the job was in the job list once, remove it
+        if (current_command->getJobId() != -1)
+            removeJob(current_command->getJobId());
+        output << "smash: process " << pid << " was killed\n";
+    }
+    else
+    {
+        addJob(current_command, true);
+        output << "smash: process " << pid << " was stopped\n";
+    }
+    setCurrentCommand(nullptr);
+}
+
+// reaps every exited child - jobs are marked finished and their slots go to queued jobs
+void SmallShell::handleChildExit()
+{
+    int status;
+    int pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+    {
+        if (awaited.erase(pid) != 0)
+            reaped[pid] = status;
+        else
+            jobs_list->markFinished(pid, status);
+    }
+    jobs_list->markTasksFinished();
+    jobs_list->admitQueued();
+}
+
+void SmallShell::postSignal(int signal_num)
+{
+    if (getpid() != shell_pid)
+        return;
+    if (signal_num == SIGCHLD)
+        child_event = 1;
+    else if (signal_num == SIGALRM)
+        alarm_event = 1;
+    else
+        foreground_signal = signal_num;
+    wake();
+    control.wake();
+}
+
+void SmallShell::wake()
+{
+    int saved_errno = errno;
+    char byte = 0;
+    ssize_t res = write(event_fd[1], &byte, 1);
+    (void)res;
+    errno = saved_errno;
+}
+
+// runs what the signal handlers noted - the flags are read after the pipe is drained, so no wakeup is lost
+void SmallShell::processEvents()
+{
+    char buf[256];
+    while (read(event_fd[0], buf, sizeof(buf)) > 0)
+        ;
+    if (foreground_signal)
+    {
+        int signal_num = foreground_signal;
+        foreground_signal = 0;
+        signalForeground(signal_num);
+        output.flush();
+    }
+    if (child_event)
+    {
+        child_event = 0;
+        handleChildExit();
+        output.flush();
+    }
+    if (alarm_event)
+    {
+        alarm_event = 0;
+        handleAlarm();
+        output.flush();
+    }
+
+    //  the export is due on the alarm requestWakeup set - it is written here, never in a handler
+    if (!metrics_path.empty() && time(nullptr) >= next_metrics_export)
+        exportMetrics();
+}
+
+// sleeps until a signal handler writes to the event pipe
+void SmallShell::waitEvent()
+{
+    struct pollfd fd = {event_fd[0], POLLIN, 0};
+    poll(&fd, 1, -1);
+}
+
+void SmallShell::awaitChild(int pid)
+{
+    if (getpid() == shell_pid)
+        awaited.insert(pid);
+}
+
+int SmallShell::waitForeground(int pid, int *status)
+{
+    if (getpid() != shell_pid)
+        return waitpid(pid, status, WUNTRACED);
+    awaited.insert(pid);
+    while (true)
+    {
+        int res = waitpid(pid, status, WUNTRACED | WNOHANG);
+        if (res == pid)
+        {
+            //  a stopped one is a job now - its exit is the event loop's
+            awaited.erase(pid);
+            return pid;
+        }
+        if (res == -1 && errno != EINTR)
+        {
+            auto it = reaped.find(pid);
+            awaited.erase(pid);
+            if (it == reaped.end())
+                return -1;
+            *status = it->second;
+            reaped.erase(it);
+            return pid;
+        }
+        processEvents();
+        if (reaped.count(pid) == 0)
+            waitEvent();
+    }
+}
+
+void SmallShell::requestWakeup(int when)
+{
+    timeOutList->setWakeup(when);
+}
+
+void SmallShell::addSchedule(std::shared_ptr<ScheduleCommand> cmd)
+{
+    timeOutList->addSchedule(cmd);
+}
+
+void SmallShell::removeSchedule(std::shared_ptr<ScheduleCommand> cmd)
+{
+    timeOutList->removeSchedule(cmd);
+}
+
+TimeoutCommand::TimeoutCommand(const char *cmd_line) : BuiltInCommand(cmd_line, true)
+{
+
+    // check if time given is a positive number
+    if (args_vec.size() < 3 || !isStringNumber(args_vec[1]) || stoi(args_vec[1]) < 0)
+    {
+        InvaildArgument e("timeout");
+        throw e;
+    }
+
+    SmallShell &smash = SmallShell::getInstance();
+
+    // in BuiltInCommand C'tor we delete the '&' from the args vec so we need to return it here
+    if (_isBackgroundCommand(cmd_line))
+        args_vec = get_args_in_vec(cmd_line);
+
+    string target_cmd_str = "";
+    for (int i = 2; i < int(args_vec.size()); i++)
+        target_cmd_str += args_vec[i] += " ";
+
+    target_cmd = smash.CreateCommand(target_cmd_str.c_str());
+
+    int time_to_alarm = stoi(args_vec[1]);
+    dest_time = time(nullptr) + time_to_alarm;
+    m_pid = getProcessId();
+    time_out = true;
+};
+
+void TimeoutCommand::execute()
+{
+    SmallShell &smash = SmallShell::getInstance();
+
+    // we assume all the commands are External, because a built-in command will end very quick...
+    if (!target_cmd->isExternal())
+    {
+        target_cmd->execute();
+        return;
+    }
+
+    int pid = smash.forkChild();
+
+    if (pid == -1)
+    {
+        SystemCallFailed e("fork");
+        throw e;
+    }
+    // ------------------------------child-------------------------//
+    else if (pid == 0)
+    {
+        int res = setpgrp();
+        if (res < 0)
+            perror("smash error: setpgrp failed");
+        target_cmd->execute();
+    }
+
+    //------------------------ father--------------------//
+    else
+    {
+
+        // store the pid of the child in the list
+        m_pid = pid;
+        process_id = pid;
+        target_cmd->setProcessId(pid);
+        if (!(_isBackgroundCommand(target_cmd->getCmdL())))
+        {
+            // smash.setCurrentCommand(target_cmd);
+            int status;
+            smash.waitForeground(pid, &status);
+            smash.setCurrentCommand(nullptr);
+        }
+    }
+}
+
+void TimeOutList::removeNext()
+{
+    time_out_list.pop_front();
+    next_cmd = time_out_list.empty() ? nullptr : time_out_list.front();
+    makeAlarm();
+}
+
+void TimeOutList::removedFinished()
+{
+    auto it = time_out_list.begin();
+    while (it != time_out_list.end())
+    {
+        //  check if a process is finished
+        int pid = (*it)->getTimeoutTargetPid();
+        int res = waitpid(pid, nullptr, WNOHANG);
+        if (res > 0)
+        {
+            it = time_out_list.erase(it);
+        }
+        else
+            it++;
+    }
+}
+
+// arms the alarm for the earliest of the next timeout and the next scheduled firing
+void TimeOutList::makeAlarm()
+{
+    int next_time = next_cmd != nullptr ? next_cmd->getTime() : -1;
+    if (wakeup_time != -1 && (next_time == -1 || wakeup_time < next_time))
+        next_time = wakeup_time;
+    for (auto it = schedules.begin(); it != schedules.end(); it++)
+    {
+        if (next_time == -1 || (*it)->getNextTime() < next_time)
+            next_time = (*it)->getNextTime();
+    }
+    if (next_time == -1)
+    {
+        alarm(0);
+        return;
+    }
+
+    // alarm(0) would cancel the alarm - an overdue entry fires in a second
+    time_to_next = next_time - time(nullptr);
+    alarm(time_to_next > 0 ? time_to_next : 1);
+}
+
+int TimeoutCommand::getTimeoutTargetPid()
+{
+    return m_pid;
+}
+
+bool TimeOutList::isTimeoutDue() const
+{
+    return next_cmd != nullptr && next_cmd->getTime() <= time(nullptr);
+}
+
+void TimeOutList::handleSignal()
+{
+    while (isTimeoutDue())
+    {
+        int target_pid = next_cmd->getTimeoutTargetPid();
+        // check if the command already stopped before killing it - without reaping it, its status is the event loop's
+        siginfo_t info;
+        info.si_pid = 0;
+        bool is_running = target_pid > 0 && waitid(P_PID, target_pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0 && info.si_pid == 0;
+
+        if (is_running && target_pid != getpid())
+        {
+            if (kill(target_pid, SIGKILL) == -1)
+            {
+                SystemCallFailed e("kill");
+                throw e;
+            }
+            SmallShell::getInstance().getOutput() << "smash: " << next_cmd->getCmdL() << " timed out!\n";
+            SmallShell::getInstance().getMetrics().add(METRIC_TIMEOUTS_FIRED);
+        }
+        removeNext();
+    }
+
+    //  launch the due schedules - a one-shot "at" leaves the timer after its firing
+    int now = time(nullptr);
+    if (wakeup_time != -1 && wakeup_time <= now)
+        wakeup_time = -1;
+    auto it = schedules.begin();
+    while (it != schedules.end())
+    {
+        shared_ptr<ScheduleCommand> cmd = *it;
+        if (cmd->getNextTime() > now)
+        {
+            it++;
+            continue;
+        }
+        try
+        {
+            cmd->execute();
+        }
+        catch (std::exception &e)
+        {
+            SmallShell::getInstance().getOutput().flush();
+            perror(e.what());
+        }
+        cmd->advance();
+        if (cmd->isPending())
+            it++;
+        else
+            it = schedules.erase(it);
+    }
+    makeAlarm();
+}
+
+void TimeOutList::removeCommand(std::shared_ptr<TimeoutCommand> cmd_to_del)
+{
+    if (cmd_to_del == next_cmd)
+    {
+        removeNext();
+        return;
+    }
+    for (auto it = time_out_list.begin(); it != time_out_list.end(); it++)
+    {
+        if ((*it) == cmd_to_del)
+        {
+            time_out_list.erase(it);
+            return;
+        }
+    }
+}
+
+void TimeOutList::addToList(std::shared_ptr<TimeoutCommand> new_cmd)
+{
+    // keep the list sorted by deadline - its front is the next timeout
+    int new_cmd_time = new_cmd->getTime();
+    auto it = time_out_list.begin();
+    while (it != time_out_list.end() && (*it)->getTime() <= new_cmd_time)
+        it++;
+    time_out_list.insert(it, new_cmd);
+    next_cmd = time_out_list.front();
+    makeAlarm();
+};
+
+void TimeOutList::setWakeup(int when)
+{
+    if (wakeup_time == -1 || when < wakeup_time || wakeup_time <= time(nullptr))
+        wakeup_time = when;
+    makeAlarm();
+}
+
+void TimeOutList::addSchedule(std::shared_ptr<ScheduleCommand> cmd)
+{
+    schedules.push_back(cmd);
+    makeAlarm();
+}
+
+void TimeOutList::removeSchedule(std::shared_ptr<ScheduleCommand> cmd)
+{
+    for (auto it = schedules.begin(); it != schedules.end(); it++)
+    {
+        if ((*it) == cmd)
+        {
+            schedules.erase(it);
+            break;
+        }
+    }
+    makeAlarm();
+}
+
+//<--------------------------- Schedule functions--------------------------->
+
+ScheduleCommand::ScheduleCommand(const char *cmd_line, bool repeat) : BuiltInCommand(cmd_line, true), interval(-1), repeat(repeat),
+                                                                      next_time(0), last_pid(-1), fired(0), skipped(0), target_cmd(nullptr)
+{
+    string name = repeat ? "every" : "at";
+    if (args_vec.size() >= 3)
+        interval = parseInterval(args_vec[1]);
+
+    // "every 0" would fire in a busy loop
+    if (interval < 0 || (repeat && interval == 0))
+    {
+        InvaildArgument e(name);
+        throw e;
+    }
+
+    string target_cmd_str = "";
+    for (int i = 2; i < int(args_vec.size()); i++)
+        target_cmd_str += args_vec[i] + " ";
+
+    // built once - every firing runs a forked copy of it
+    target_cmd = SmallShell::getInstance().CreateCommand(target_cmd_str.c_str());
+    next_time = time(nullptr) + interval;
+    schedule = true;
+}
+
+void ScheduleCommand::execute()
+{
+    SmallShell &smash = SmallShell::getInstance();
+
+    //  skip-if-still-running - firings of the same schedule never overlap
+    if (last_pid > 0)
+    {
+        skipped++;
+        return;
+    }
+
+    int pid = smash.forkChild();
+    if (pid == -1)
+    {
+        SystemCallFailed e("fork");
+        throw e;
+    }
+    // ------------------------------child-------------------------//
+    else if (pid == 0)
+    {
+        int res = setpgrp();
+        if (res < 0)
+            perror("smash error: setpgrp failed");
+        smash.leadGroup();
+        if (target_cmd->isExternal())
+            target_cmd->execute();
+
+        // builtins, pipes and redirections run to completion in the child
+        try_catch(target_cmd.get());
+        smash.getOutput().flush();
+        exit(0);
+    }
+
+    //------------------------ father--------------------//
+    last_pid = pid;
+    process_id = pid;
+    fired++;
+}
+
+int ScheduleCommand::getNextTime() const
+{
+    return next_time;
+}
+
+// moves to the next firing time, skipping the ones that were missed
+void ScheduleCommand::advance()
+{
+    int now = time(nullptr);
+    if (!repeat)
+        return;
+    while (next_time <= now)
+        next_time += interval;
+}
+
+bool ScheduleCommand::isPending() const
+{
+    return repeat || fired == 0;
+}
+
+// a fired "at" finishes with its instance - a repeating schedule only reaps its instances
+bool ScheduleCommand::isFinished()
+{
+    return !isPending() && last_pid == -1;
+}
+
+// the event loop reaped pid - true if it was the running instance
+bool ScheduleCommand::instanceExited(int pid)
+{
+    if (last_pid <= 0 || pid != last_pid)
+        return false;
+    last_pid = -1;
+    return true;
+}
+
+void ScheduleCommand::cancel(int signal_num)
+{
+    if (last_pid > 0)
+        kill(last_pid, signal_num);
+}
+
+std::string ScheduleCommand::describe() const
+{
+    int next_in = next_time - time(nullptr);
+    return string(repeat ? "every " : "at ") + to_string(interval) + " secs, next in " + to_string(next_in > 0 ? next_in : 0) +
+           " secs, fired " + to_string(fired) + ", skipped " + to_string(skipped);
+}
+
+//<--------------------------- Schedule functions - end--------------------------->
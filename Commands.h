@@ -1,382 +1,1646 @@
-#ifndef SMASH_COMMAND_H_
-#define SMASH_COMMAND_H_
-
-#include <vector>
-#include <ctime>
-#include <string>
-#include <list>
-#include <memory>
-#include <fcntl.h>
-#include <sys/wait.h>
-#include <sys/stat.h>
-#include <iomanip>
-#include <sys/types.h>
-#include "Exceptions.h"
-
-#define COMMAND_ARGS_MAX_LENGTH (200)
-#define COMMAND_MAX_ARGS (20)
-
-class Command
-{
-protected:
-  int job_id;
-  int process_id;
-  char *cmd_l;
-  bool external;
-  bool time_out;
-  std::vector<std::string> args_vec;
-
-public:
-  Command(const char *cmd_line);
-  virtual ~Command();
-  virtual void execute() = 0;
-  bool isExternal() { return external; }
-  bool isTimeout() { return time_out; }
-  void setShared(std::shared_ptr<Command>);
-  std::shared_ptr<Command> getShared();
-
-  // getters
-  const char *getCmdL() const;
-  int getJobId() const;
-  int getProcessId() const;
-
-  // setters
-  void setJobId(int id);
-  void setProcessId(int id);
-
-};
-
-class BuiltInCommand : public Command
-{
-public:
-  BuiltInCommand(const char *cmd_line);
-  virtual ~BuiltInCommand() = default;
-};
-
-class ExternalCommand : public Command
-{
-
-public:
-  ExternalCommand(const char *cmd_line) : Command(cmd_line) { external = true; }
-  virtual ~ExternalCommand() = default;
-  void execute() override;
-};
-
-class PipeCommand : public Command
-{
-protected:
-  std::shared_ptr<Command> write_command;
-  std::shared_ptr<Command> read_command;
-  int standard_in_pd;
-  int standard_out_pd;
-  int standard_error_pd;
-  int fd[2];
-
-public:
-  PipeCommand(const char *cmd_line, std::string);
-  virtual ~PipeCommand() = default;
-  void execute() override{};
-  void execute(int);
-  void prepareWrite(int);
-  void prepareRead();
-  void cleanUp();
-};
-
-class PipeNormalCommand : public PipeCommand
-{
-public:
-  PipeNormalCommand(const char *cmd_line) : PipeCommand(cmd_line, "|") {}
-  void execute() override;
-};
-
-class PipeSterrCommand : public PipeCommand
-{
-public:
-  PipeSterrCommand(const char *cmd_line) : PipeCommand(cmd_line, "|&") {}
-  void execute() override;
-};
-
-class RedirectionCommand : public Command
-{
-protected:
-  // command to be redirect
-  std::shared_ptr<Command> base_command;
-
-  // the destination file
-  std::string dest;
-
-  // index of a new FD that points to the standard output
-  int out_pd;
-
-public:
-  explicit RedirectionCommand(const char *cmd_line, std::string); // Command::Command(cmd_line)
-  virtual ~RedirectionCommand() = default;
-  void execute() override;
-  void prepareGeneral(bool);
-  virtual void prepare() = 0;
-  void cleanup();
-};
-
-class RedirectionAppendCommand : public RedirectionCommand
-{
-public:
-  explicit RedirectionAppendCommand(const char *cmd_line) : RedirectionCommand(cmd_line, ">>"){};
-  void prepare() override;
-};
-
-class RedirectionNormalCommand : public RedirectionCommand
-{
-public:
-  explicit RedirectionNormalCommand(const char *cmd_line) : RedirectionCommand(cmd_line, ">"){};
-  void prepare() override;
-};
-
-class ChangeDirCommand : public BuiltInCommand
-{
-public:
-  ChangeDirCommand(const char *cmd_line) : BuiltInCommand(cmd_line){};
-  virtual ~ChangeDirCommand() = default;
-  void execute() override;
-};
-
-class GetCurrDirCommand : public BuiltInCommand
-{
-public:
-  GetCurrDirCommand(const char *cmd_line) : BuiltInCommand(cmd_line){};
-  virtual ~GetCurrDirCommand() = default;
-  void execute() override;
-};
-
-class ShowPidCommand : public BuiltInCommand
-{
-private:
-public:
-  ShowPidCommand(const char *cmd_line) : BuiltInCommand(cmd_line){};
-  virtual ~ShowPidCommand() = default;
-  void execute() override;
-};
-
-class JobsList;
-class QuitCommand : public BuiltInCommand
-{
-  // A pointer to the JobsList variable in the Smash object
-  JobsList *jobs;
-
-public:
-  QuitCommand(const char *cmd_line, JobsList *jobs) : BuiltInCommand(cmd_line), jobs(jobs){};
-  virtual ~QuitCommand() = default;
-  void execute() override;
-};
-
-class JobsList
-{
-public:
-  class JobEntry
-  {
-  private:
-    // pointer the the command object
-    std::shared_ptr<Command> command;
-
-    // initial time
-    int init_time;
-
-    // boolean that holdes the command Status (stopped/not stopped)
-    bool is_stopped;
-
-  public:
-    // C'TOR & D'TOR
-    JobEntry(std::shared_ptr<Command> command, bool is_stopped) : command(command), init_time(time(NULL)), is_stopped(is_stopped){};
-    ~JobEntry() = default;
-
-    //  getters
-    bool getStopped() const;
-    std::shared_ptr<Command> getCommand() const;
-    int getJobId() const;
-
-    //  setters
-    void setTime();
-    void setStopped(bool is_stopped);
-
-    //  aux
-    // prints the info of the job according to the format in jobs command
-    void printInfo() const;
-  };
-
-  std::vector<std::shared_ptr<JobEntry>> jobs;
-
-public:
-  JobsList() : jobs(){};
-  ~JobsList() = default;
-
-  //  getters
-  JobEntry *getJobById(int jobId);
-  JobEntry *getLastJob(int *lastJobId);
-  JobEntry *getLastStoppedJob(int *jobId);
-  int getMaxId() const;
-  bool isEmpty() const;
-
-  //  aux
-  void addJob(std::shared_ptr<Command> cmd, bool isStopped = false);
-  void removeJobById(int jobId);
-  void printJobsList();
-  void killAllJobs();
-  void removeFinishedJobs();
-};
-
-class JobsCommand : public BuiltInCommand
-{
-  // A pointer to the JobsList variable in the Smash object
-  JobsList *jobs;
-
-public:
-  JobsCommand(const char *cmd_line, JobsList *jobs) : BuiltInCommand(cmd_line), jobs(jobs){};
-  virtual ~JobsCommand() = default;
-  void execute() override;
-};
-
-class ForegroundCommand : public BuiltInCommand
-{
-  // A pointer to the JobsList variable in the Smash object
-  JobsList *jobs;
-
-public:
-  ForegroundCommand(const char *cmd_line, JobsList *jobs) : BuiltInCommand(cmd_line), jobs(jobs){};
-  virtual ~ForegroundCommand() = default;
-  void execute() override;
-};
-
-class BackgroundCommand : public BuiltInCommand
-{
-  // A pointer to the JobsList variable in the Smash object
-  JobsList *jobs;
-
-public:
-  BackgroundCommand(const char *cmd_line, JobsList *jobs) : BuiltInCommand(cmd_line), jobs(jobs){};
-  virtual ~BackgroundCommand() = default;
-  void execute() override;
-};
-
-class ChmodCommand : public BuiltInCommand
-{
-public:
-  ChmodCommand(const char *cmd_line) : BuiltInCommand(cmd_line){};
-  virtual ~ChmodCommand() = default;
-  void execute() override;
-};
-
-class GetFileTypeCommand : public BuiltInCommand
-{
-public:
-  GetFileTypeCommand(const char *cmd_line) : BuiltInCommand(cmd_line){};
-  virtual ~GetFileTypeCommand() = default;
-  void execute() override;
-};
-
-class SetcoreCommand : public BuiltInCommand
-{
-  // A pointer to the JobsList variable in the Smash object
-  JobsList *jobs;
-
-public:
-  SetcoreCommand(const char *cmd_line, JobsList *jobs) : BuiltInCommand(cmd_line), jobs(jobs){};
-  virtual ~SetcoreCommand() = default;
-  void execute() override;
-};
-
-class KillCommand : public BuiltInCommand
-{
-  // A pointer to the JobsList variable in the Smash object
-  JobsList *jobs;
-
-public:
-  KillCommand(const char *cmd_line, JobsList *jobs) : BuiltInCommand(cmd_line), jobs(jobs){};
-  virtual ~KillCommand() = default;
-  void execute() override;
-};
-
-///------------------------------------- Bonus start---------------------------------------------
-
-class TimeoutCommand : public BuiltInCommand
-{
-  int dest_time;
-  int m_pid;
-  std::shared_ptr<Command> target_cmd;
-
-public:
-  explicit TimeoutCommand(const char *cmd_line);
-  virtual ~TimeoutCommand() = default;
-  void execute() override;
-  int getTime() const;
-  int getTimeoutTargetPid();
-};
-
-class TimeOutList
-{
-private:
-  int time_to_next;
-  std::shared_ptr<TimeoutCommand> next_cmd;
-  std::list<std::shared_ptr<TimeoutCommand>> time_out_list;
-
-public:
-  void addToList(std::shared_ptr<TimeoutCommand>);
-  void removeNext();
-  void makeAlarm();
-  void handleSignal();
-  void removedFinished();
-  void removeCommand(std::shared_ptr<TimeoutCommand>);
-};
-
-/// ---------------------------------------Bonus end-----------------------------------------
-
-//  Implemented as a Singleton design pattern
-class SmallShell
-{
-private:
-  std::string prompt;
-  std::string last_wd;
-  std::shared_ptr<Command> current_command;
-  JobsList *jobs_list;
-  TimeOutList *timeOutList;
-
-  SmallShell();
-
-public:
-  std::shared_ptr<Command> CreateCommand(const char *cmd_line);
-  SmallShell(SmallShell const &) = delete;     // disable copy ctor
-  void operator=(SmallShell const &) = delete; // disable = operator
-  static SmallShell &getInstance()             // make SmallShell singleton
-  {
-    static SmallShell instance; // Guaranteed to be destroyed.
-    // Instantiated on first use.
-    return instance;
-  }
-  ~SmallShell();
-
-  //  aux
-  void executeCommand(const char *cmd_line);
-  std::string get_last_wd() const;
-  void set_last_wd(std::string);
-  void setCurrentCommand(std::shared_ptr<Command>);
-
-  std::shared_ptr<Command> getCurrentCommand() const;
-  void printPrompt() const;
-  void changeChprompt(const char *cmd_line);
-
-  void addJob(std::shared_ptr<Command> cmd, bool is_stopped = false);
-  void addTimeOutCommand(std::shared_ptr<TimeoutCommand>);
-  void removeTimeOutCommand(std::shared_ptr<TimeoutCommand>);
-
-  void handleAlarm();
-
-  void removeJob(int job_id);
-};
-
-// declaration for signals.cpp
-bool isAppendRedirect(std::string cmd_str);
-bool isSterrPipe(std::string cmd_str);
-bool isRedirect(std::string cmd_str);
-bool isPipe(std::string cmd_str);
-
-
-
-#endif // SMASH_COMMAND_H_
+#ifndef SMASH_COMMAND_H_
+#define SMASH_COMMAND_H_
+
+#include <vector>
+#include <ctime>
+#include <string>
+#include <list>
+#include <deque>
+#include <unordered_map>
+#include <map>
+#include <set>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <iomanip>
+#include <sys/types.h>
+#include <signal.h>
+#include "Exceptions.h"
+
+#define COMMAND_ARGS_MAX_LENGTH (200)
+#define COMMAND_MAX_ARGS (20)
+
+// output is collected in blocks of this size and flushed with a single writev
+#define OUTPUT_BLOCK_SIZE (4096)
+#define OUTPUT_FLUSH_THRESHOLD (64 * 1024)
+
+// the bytes a ring between two builtin stages of a pipeline holds - a pipe's default capacity
+#define PIPE_RING_SIZE (64 * 1024)
+
+// A lock-free single-producer single-consumer byte queue between two builtins of a pipeline that
+// run in smash. A side that finds it full or empty sleeps on a futex until the other side moves.
+class ByteRing
+{
+  std::vector<char> buf;
+  size_t mask;
+
+  // apart, so the producer and the consumer do not share a cache line
+  std::atomic<size_t> head;
+  char head_pad[64];
+  std::atomic<size_t> tail;
+  char tail_pad[64];
+
+  // bumped by every change - the futex word
+  std::atomic<int> seq;
+  std::atomic<int> waiters;
+  std::atomic<bool> write_closed;
+  std::atomic<bool> read_closed;
+
+  void waitChange(int seen);
+  void wake();
+
+public:
+  // capacity is a power of 2
+  explicit ByteRing(size_t capacity);
+
+  // returns: false once the reader closed the ring - the rest of data is dropped
+  bool write(const char *data, size_t len);
+
+  // returns: the bytes read, 0 once the writer closed the ring and it is empty
+  size_t read(char *data, size_t len);
+  void closeWrite();
+  void closeRead();
+};
+
+struct OutputCounters
+{
+  long long bytes;
+  long long syscalls;
+};
+
+// Shell-owned stdout buffer. Flushed explicitly before fork, before reading a line
+// and before stdout is swapped back by a redirection or a pipe.
+class OutputBuffer
+{
+private:
+  int fd;
+  ByteRing *ring;
+  bool hold;
+  std::vector<std::string> blocks;
+  int used_blocks;
+  size_t pending;
+
+  // the builtin that bytes are currently charged to, and the ones waiting in the buffer
+  std::string owner;
+  std::vector<std::string> pending_owners;
+  std::map<std::string, OutputCounters> counters;
+
+public:
+  // a held buffer is written only by flush() - a background builtin's output goes out at once
+  explicit OutputBuffer(int fd, bool hold = false);
+
+  // a builtin stage of a pipeline writes into the ring to the next one
+  explicit OutputBuffer(ByteRing *ring);
+  ~OutputBuffer() = default;
+
+  OutputBuffer &operator<<(const std::string &str);
+  OutputBuffer &operator<<(const char *str);
+  OutputBuffer &operator<<(char c);
+  OutputBuffer &operator<<(int num);
+  OutputBuffer &operator<<(long num);
+  OutputBuffer &operator<<(long long num);
+  OutputBuffer &operator<<(unsigned long num);
+
+  void write(const char *data, size_t len);
+  void flush();
+
+  // returns the previous owner
+  std::string setOwner(const std::string &name);
+  const std::map<std::string, OutputCounters> &getCounters() const;
+
+  // charges the bytes and syscalls of another buffer here
+  void addCounters(const std::map<std::string, OutputCounters> &other);
+
+  // flushes, then writes to fd, or to ring if it is not nullptr
+  void redirect(int fd, ByteRing *ring);
+  int getFd() const;
+  ByteRing *getRing() const;
+};
+
+// every command type CreateCommand can build
+enum CommandKind
+{
+  KIND_EXTERNAL,
+  KIND_PIPE,
+  KIND_PIPE_STDERR,
+  KIND_REDIRECT,
+  KIND_REDIRECT_APPEND,
+  KIND_INPUT_REDIRECT,
+  KIND_PWD,
+  KIND_SHOWPID,
+  KIND_CD,
+  KIND_JOBS,
+  KIND_BG,
+  KIND_FG,
+  KIND_KILL,
+  KIND_QUIT,
+  KIND_SETCORE,
+  KIND_GETFILETYPE,
+  KIND_CHMOD,
+  KIND_TIMEOUT,
+  KIND_STATS,
+  KIND_HISTORY,
+  KIND_BENCH,
+  KIND_EVERY,
+  KIND_AT,
+  KIND_JOBLIMIT,
+  KIND_AFTER,
+  KIND_JOBLOG,
+  KIND_EXPORT,
+  KIND_UNSET,
+  KIND_TEE,
+  KIND_LIST,
+
+  // keep last - the number of kinds
+  KIND_COUNT
+};
+
+//<--------------------------- Metrics--------------------------->
+
+enum MetricCounter
+{
+  METRIC_EXEC_FAILURES,
+  METRIC_TIMEOUTS_FIRED,
+  METRIC_JOBS_STARTED,
+  METRIC_JOBS_ENDED,
+  METRIC_SIGNALS_SENT,
+  METRIC_COUNTER_COUNT
+};
+
+enum MetricHistogram
+{
+  // fork() itself, fork until a successful exec, and the shell waiting for a foreground job
+  METRIC_FORK_LATENCY,
+  METRIC_EXEC_LATENCY,
+  METRIC_WAIT_LATENCY,
+  METRIC_HISTOGRAM_COUNT
+};
+
+// log-linear buckets of nanoseconds - 4 per power of two, so any value is within 25% of its bucket
+#define HISTOGRAM_SUB_BUCKETS 4
+#define HISTOGRAM_BUCKETS 256
+#define METRIC_SIGNALS 65
+#define METRIC_MAX_SHARDS 64
+
+// one thread's metrics - only its own thread writes, readers sum all shards
+struct MetricsShard
+{
+  std::atomic<unsigned long long> counters[METRIC_COUNTER_COUNT];
+  std::atomic<unsigned long long> commands[KIND_COUNT];
+  std::atomic<unsigned long long> signals[METRIC_SIGNALS];
+  std::atomic<unsigned long long> buckets[METRIC_HISTOGRAM_COUNT][HISTOGRAM_BUCKETS];
+  std::atomic<unsigned long long> sums[METRIC_HISTOGRAM_COUNT];
+};
+
+// the sum of every shard's histogram
+struct HistogramSnapshot
+{
+  std::vector<unsigned long long> buckets;
+  unsigned long long count;
+  unsigned long long sum;
+
+  // the upper bound of the bucket holding the q quantile, in ns
+  unsigned long long quantile(double q) const;
+};
+
+// Low-overhead metrics: a recording is a relaxed atomic add on the calling thread's own shard,
+// the lock is taken only when a thread records for the first time. Readers never lock,
+// so the signal handlers may read and record too.
+class Metrics
+{
+  std::mutex lock;
+  MetricsShard *shards[METRIC_MAX_SHARDS];
+  std::atomic<int> shard_count;
+
+  MetricsShard &shard();
+
+public:
+  Metrics() : lock(), shards(), shard_count(0){};
+  void add(MetricCounter counter, unsigned long long value = 1);
+  void countCommand(CommandKind kind);
+  void countSignal(int signal_num);
+  void observe(MetricHistogram histogram, long long ns);
+
+  unsigned long long getCounter(MetricCounter counter);
+  unsigned long long getCommands(CommandKind kind);
+  unsigned long long getSignals(int signal_num);
+  HistogramSnapshot getHistogram(MetricHistogram histogram);
+
+  static int bucketOf(unsigned long long ns);
+  static unsigned long long bucketUpperBound(int bucket);
+};
+
+//<--------------------------- Metrics - end--------------------------->
+
+// A node of the syntax tree of a command line:
+//   list      := and_or { (';' | '&') and_or } [';' | '&']
+//   and_or    := pipeline { ('&&' | '||') pipeline }
+//   pipeline  := command { ('|' | '|&') command }
+//   command   := { word | ('>' | '>>' | '<' | '<<' | '<<<') word }
+// Operators inside quotes are words. Every node keeps its source text, since the
+// command classes are built from text - a redirection's child is its text without it.
+struct SyntaxNode
+{
+  enum Type
+  {
+    NODE_LIST,     // the children run one after the other
+    NODE_AND,      // the second child runs if the first one succeeded
+    NODE_OR,       // the second child runs if the first one failed
+    NODE_PIPE,     // the first command, and the rest of the pipeline
+    NODE_REDIRECT, // a command and one of its redirections
+    NODE_SIMPLE    // a command with its arguments
+  };
+
+  Type type;
+  std::string text;
+
+  // a pipe's or a redirection's operator, and a redirection's target
+  std::string op;
+  std::string target;
+
+  // followed by '&' - it runs as a background job
+  bool background;
+  std::vector<std::shared_ptr<const SyntaxNode>> children;
+
+  SyntaxNode(Type type) : type(type), text(), op(), target(), background(false), children(){};
+};
+
+// The immutable result of parsing a command line. Commands are still built per run
+// since they hold the run's state (pids, job ids), but from this instead of the raw line.
+struct ParsedCommand
+{
+  CommandKind kind;
+
+  // the words without their quotes, and as they were typed
+  std::vector<std::string> args;
+  std::vector<std::string> raw_args;
+
+  // pipes and redirections: the sign, the text before it and the text after it - a redirection's target unquoted
+  std::string sign;
+  std::string left;
+  std::string right;
+
+  // the syntax tree - lists and and/or chains are run by walking it
+  std::shared_ptr<const SyntaxNode> tree;
+};
+
+#define PARSE_CACHE_MAX_BYTES (1024 * 1024)
+
+// LRU cache of parse results keyed by the hash of the command line
+class ParseCache
+{
+private:
+  typedef std::pair<std::string, std::shared_ptr<const ParsedCommand>> CacheEntry;
+
+  // most recently used first
+  std::list<CacheEntry> lru;
+  std::unordered_map<size_t, std::list<CacheEntry>::iterator> index;
+
+  size_t bytes;
+  size_t max_bytes;
+  long long hits;
+  long long misses;
+  long long evictions;
+
+  static size_t entrySize(const CacheEntry &entry);
+  void erase(std::list<CacheEntry>::iterator it);
+
+public:
+  explicit ParseCache(size_t max_bytes);
+  ~ParseCache() = default;
+
+  // lookups made while building an already parsed line pass count = false
+  std::shared_ptr<const ParsedCommand> find(const std::string &line, bool count = true);
+  void insert(const std::string &line, std::shared_ptr<const ParsedCommand> parsed);
+
+  // getters
+  long long getHits() const;
+  long long getMisses() const;
+  long long getEvictions() const;
+  size_t getBytes() const;
+  int getSize() const;
+};
+
+// default ring size of a captured job's output
+#define JOB_LOG_CAPACITY (64 * 1024)
+
+// the last bytes a captured background job wrote - older bytes are dropped, never blocking the job
+class JobLog
+{
+  std::vector<char> ring;
+  size_t start;
+  size_t length;
+
+  // bytes ever appended and bytes dropped to make room
+  unsigned long long written;
+  unsigned long long dropped;
+
+  // the job closed its end of the pipe
+  bool closed;
+
+public:
+  explicit JobLog(size_t capacity);
+  void append(const char *data, size_t size);
+
+  // appends what is still held from the absolute offset on, returns the offset to continue from
+  unsigned long long copyFrom(unsigned long long offset, std::string &out) const;
+  unsigned long long getDropped() const;
+  bool isClosed() const;
+  void close();
+};
+
+// Drains the stdout and stderr pipes of captured background jobs on its own thread.
+// The lock is held only for short appends and copies, and across fork so no child inherits it held.
+class OutputCapture
+{
+  int epoll_fd;
+  bool enabled;
+  size_t capacity;
+  std::mutex lock;
+
+  // read end of a job's pipe to its log
+  std::map<int, std::shared_ptr<JobLog>> sources;
+
+  // write ends held by builtins on the worker pool - a forked child closes them, or the log would see EOF only when it exits
+  std::set<int> task_writers;
+
+  // a joblog -f waits in the event loop - the drain thread wakes it after each read
+  std::atomic<bool> followed;
+
+  void drain();
+
+public:
+  OutputCapture() : epoll_fd(-1), enabled(false), capacity(JOB_LOG_CAPACITY), lock(), sources(), task_writers(), followed(false){};
+  bool isEnabled() const;
+  void setEnabled(bool enabled);
+  size_t getCapacity() const;
+  void setCapacity(size_t capacity);
+
+  // opens the pipe of a new job - the child sends its stdout and stderr to write_fd
+  std::shared_ptr<JobLog> open(int *write_fd);
+  unsigned long long read(const std::shared_ptr<JobLog> &log, unsigned long long offset, std::string &out, bool *closed,
+                          unsigned long long *dropped);
+  void lockForFork();
+  void unlockAfterFork();
+
+  // a write end handed to a worker task, and its close once the task is done
+  void holdWriter(int write_fd);
+  void releaseWriter(int write_fd);
+  void closeWritersInChild();
+  void setFollowed(bool followed);
+};
+
+// the largest spawn request (argv and environment) the zygote accepts - a bigger one is forked by the shell
+#define ZYGOTE_MAX_REQUEST (64 * 1024)
+
+// A small helper forked at startup, before the shell grows, that forks commands from its own small image.
+// Its children are made the shell's (CLONE_PARENT), so the shell waits for them and controls them as jobs.
+class Zygote
+{
+  int sock;
+  int pid;
+
+  static void serve(int sock);
+
+public:
+  Zygote() : sock(-1), pid(-1){};
+  bool start();
+  bool isRunning() const;
+  int getPid() const;
+
+  // launches args in process group pgid (0 - a new one) with fds as its stdin, stdout and stderr
+  // returns: the pid, *exec_error is errno of a failed exec - -1 if the zygote could not launch it
+  int launch(const std::vector<std::string> &args, bool simple, int pgid, const int fds[3], int *exec_error);
+};
+
+// A builtin running on the worker pool as a background job. It is cancelled by a flag that the
+// builtin may poll, never by a signal - a thread cannot be stopped or killed like a process.
+class AsyncTask
+{
+  std::atomic<bool> cancelled;
+  std::atomic<bool> done;
+  std::atomic<int> status;
+  std::mutex lock;
+  std::condition_variable finished;
+
+public:
+  AsyncTask() : cancelled(false), done(false), status(0), lock(), finished(){};
+  void cancel();
+  bool isCancelled() const;
+  bool isDone() const;
+
+  // a wait status, as waitpid reports it
+  int getStatus() const;
+  void finish(int status);
+
+  // returns: true once the task is done - waits ms at most
+  bool waitFor(int ms);
+
+  // the task run by the calling worker thread, nullptr on the main thread
+  static AsyncTask *current();
+  static void setCurrent(AsyncTask *task);
+};
+
+// Runs background builtins on a few threads. Every worker has its own deque: it takes its newest task
+// and, once its deque is empty, steals the oldest task of another worker. A task submitted by a
+// worker goes to that worker's deque.
+class WorkerPool
+{
+  struct Worker
+  {
+    std::mutex lock;
+    // every task with the group it was submitted in
+    std::deque<std::pair<const void *, std::function<void()>>> tasks;
+  };
+  std::vector<std::unique_ptr<Worker>> workers;
+
+  // tasks submitted and not taken yet - idle workers sleep until there are some
+  std::mutex idle_lock;
+  std::condition_variable idle;
+  int pending;
+  unsigned next;
+
+  bool take(int index, std::function<void()> &task, const void *group);
+  void run(int index);
+
+public:
+  WorkerPool() : workers(), idle_lock(), idle(), pending(0), next(0){};
+  void start();
+  void submit(std::function<void()> task, const void *group = nullptr);
+  int getSize();
+
+  // 0 off the pool, 1 + the worker's index on it - a per-thread slot for results merged later
+  static int currentSlot();
+
+  // runs tasks of group on the calling thread until done() - a thread waiting for its subtasks helps with them.
+  // Only with them: another job's task would run under the caller's job, past its cancellation
+  void helpUntil(const void *group, const std::function<bool()> &done);
+};
+
+// Walks a directory tree in parallel on the worker pool. Every directory is a task that reads its
+// entries with getdents64 and statx relative to the directory's fd, so no path is resolved twice.
+// Symlinks are not followed.
+class DirWalker
+{
+public:
+  // called for every entry, on any thread - top is the root's subdirectory the entry is in (-1 - none)
+  typedef std::function<void(int dir_fd, const char *name, const struct statx &stx, int top)> Visitor;
+
+private:
+  // a directory's fd, closed once its last subdirectory was opened
+  struct DirHandle
+  {
+    int fd;
+    explicit DirHandle(int fd) : fd(fd){};
+    ~DirHandle();
+  };
+
+  Visitor visitor;
+  unsigned int statx_mask;
+  std::vector<std::string> tops;
+  std::atomic<int> outstanding;
+  std::atomic<bool> stop;
+  std::atomic<unsigned long long> visited;
+  std::atomic<unsigned long long> errors;
+
+  void walkDir(std::shared_ptr<DirHandle> parent, std::string name, int top);
+  void readDir(int dir_fd, int top);
+
+public:
+  DirWalker(Visitor visitor, unsigned int statx_mask) : visitor(visitor), statx_mask(statx_mask), tops(), outstanding(0),
+                                                       stop(false), visited(0), errors(0){};
+
+  // visits root and everything below it - ctrl-C, or cancelling the background job, stops the walk
+  // returns: false if root could not be read
+  bool walk(const std::string &root);
+
+  // the root's subdirectories, by top
+  const std::vector<std::string> &getTops() const;
+  unsigned long long getVisited() const;
+  unsigned long long getErrors() const;
+  bool isStopped() const;
+};
+
+class Command;
+
+// charges the output written during a command's lifetime to the command's builtin name
+class OutputOwner
+{
+  OutputBuffer &output;
+  std::string prev_owner;
+
+public:
+  OutputOwner(OutputBuffer &output, Command *cmd);
+  ~OutputOwner();
+};
+
+class Command
+{
+protected:
+  int job_id;
+  int process_id;
+  char *cmd_l;
+  bool external;
+  bool time_out;
+  bool schedule;
+  bool deferred;
+
+  // pipes and redirections - their processes share one process group
+  bool group;
+
+  // every process forked for a foreground group, the first pid is the process group id
+  std::vector<int> members;
+  std::vector<std::string> args_vec;
+
+  // the captured output of a background job
+  std::shared_ptr<JobLog> log;
+
+  // set for a background builtin that runs on the worker pool
+  std::shared_ptr<AsyncTask> task;
+
+public:
+  // keep_quotes - args_vec holds the words as typed, for a builtin that runs the rest of its line as a command
+  Command(const char *cmd_line, bool keep_quotes = false);
+  virtual ~Command();
+  virtual void execute() = 0;
+  bool isExternal() { return external; }
+  bool isTimeout() { return time_out; }
+  bool isSchedule() { return schedule; }
+  bool isDeferred() { return deferred; }
+  bool isGroup() { return group; }
+
+  // reads its stdin - as the read side of a pipe it must run in a stage of its own
+  virtual bool readsInput() const { return false; }
+
+  // reads its here-documents from the shell's input - on the shell's thread, before any of it forks
+  virtual void readHereDocs() {}
+  void setShared(std::shared_ptr<Command>);
+  std::shared_ptr<Command> getShared();
+
+  // getters
+  const char *getCmdL() const;
+  std::string getName() const;
+  int getJobId() const;
+  int getProcessId() const;
+
+  // setters
+  void setJobId(int id);
+  void setProcessId(int id);
+  void setLog(std::shared_ptr<JobLog> log);
+  std::shared_ptr<JobLog> getLog() const;
+  void setTask(std::shared_ptr<AsyncTask> task);
+  std::shared_ptr<AsyncTask> getTask() const;
+  void addMember(int pid);
+  const std::vector<int> &getMembers() const;
+
+};
+
+class BuiltInCommand : public Command
+{
+public:
+  BuiltInCommand(const char *cmd_line, bool keep_quotes = false);
+  virtual ~BuiltInCommand() = default;
+
+  // safe to run on a worker thread as a background job - it touches no shell state
+  virtual bool isAsyncSafe() const { return false; }
+};
+
+class ExternalCommand : public Command
+{
+
+public:
+  ExternalCommand(const char *cmd_line) : Command(cmd_line) { external = true; }
+  virtual ~ExternalCommand() = default;
+  void execute() override;
+
+  // the argv it is executed with - a complex command runs under bash -c
+  std::vector<std::string> getExecArgs(bool *simple) const;
+};
+
+// A command of a pipeline and where its stdin, stdout and stderr go. Two builtins next to each
+// other are connected by a ring, anything else by a pipe.
+struct PipeStage
+{
+  Command *cmd;
+
+  // a builtin that reads its input or touches no shell state runs on a thread of its own,
+  // the other builtins on the shell's thread, and the rest are forked
+  bool in_smash;
+  bool on_thread;
+  int in_fd;
+  int out_fd;
+  int err_fd;
+  std::shared_ptr<ByteRing> in;
+  std::shared_ptr<ByteRing> out;
+  std::shared_ptr<ByteRing> err;
+  std::shared_ptr<AsyncTask> task;
+  int pid;
+  bool failed;
+
+  // what a thread's stage wrote - merged into the shell's counters
+  std::map<std::string, OutputCounters> counters;
+
+  PipeStage(Command *cmd) : cmd(cmd), in_smash(false), on_thread(false), in_fd(0), out_fd(1), err_fd(2), in(), out(), err(),
+                            task(), pid(-1), failed(false), counters(){};
+};
+
+class PipeCommand : public Command
+{
+protected:
+  std::shared_ptr<Command> write_command;
+  std::shared_ptr<Command> read_command;
+
+  // stdout (1) or stderr (2) - what the write command sends through the pipe
+  int out_num;
+
+public:
+  PipeCommand(const char *cmd_line, std::string);
+  virtual ~PipeCommand() = default;
+  bool readsInput() const override { return true; }
+  void readHereDocs() override
+  {
+    write_command->readHereDocs();
+    read_command->readHereDocs();
+  }
+
+  // runs every command of the pipeline - a nested pipe on the read side is flattened into it
+  void execute() override;
+};
+
+// a line of ';', '&&' and '||' - the shell walks a foreground one, this runs a background and/or chain as one job
+class ListCommand : public Command
+{
+  std::shared_ptr<const SyntaxNode> tree;
+
+public:
+  ListCommand(const char *cmd_line);
+  virtual ~ListCommand() = default;
+  void execute() override;
+  bool readsInput() const override { return true; }
+};
+
+class PipeNormalCommand : public PipeCommand
+{
+public:
+  PipeNormalCommand(const char *cmd_line) : PipeCommand(cmd_line, "|") {}
+};
+
+class PipeSterrCommand : public PipeCommand
+{
+public:
+  PipeSterrCommand(const char *cmd_line) : PipeCommand(cmd_line, "|&") {}
+};
+
+class RedirectionCommand : public Command
+{
+protected:
+  // command to be redirect
+  std::shared_ptr<Command> base_command;
+
+  // the destination file
+  std::string dest;
+
+  // index of a new FD that points to the standard output
+  int out_pd;
+
+public:
+  explicit RedirectionCommand(const char *cmd_line, std::string); // Command::Command(cmd_line)
+  virtual ~RedirectionCommand() = default;
+  bool readsInput() const override { return base_command->isExternal() || base_command->readsInput(); }
+  void readHereDocs() override { base_command->readHereDocs(); }
+  void execute() override;
+  void prepareGeneral(bool);
+  virtual void prepare() = 0;
+  void cleanup();
+};
+
+class RedirectionAppendCommand : public RedirectionCommand
+{
+public:
+  explicit RedirectionAppendCommand(const char *cmd_line) : RedirectionCommand(cmd_line, ">>"){};
+  void prepare() override;
+};
+
+class RedirectionNormalCommand : public RedirectionCommand
+{
+public:
+  explicit RedirectionNormalCommand(const char *cmd_line) : RedirectionCommand(cmd_line, ">"){};
+  void prepare() override;
+};
+
+// the input of a "<", "<<" or "<<<" mapped into memory - a builtin reads it in place, without copying it
+struct InputSpan
+{
+  const char *data;
+  size_t size;
+};
+
+class InputRedirectionCommand : public Command
+{
+protected:
+  // command that reads the input
+  std::shared_ptr<Command> base_command;
+
+  // "<" reads the file in source, "<<" and "<<<" read inline data kept in a sealed memfd
+  std::string sign;
+  std::string source;
+  int mem_fd;
+
+  // the line that ends a here-document
+  std::string delimiter;
+
+  void createMemfd(const std::string &data);
+  int openInput();
+
+public:
+  explicit InputRedirectionCommand(const char *cmd_line);
+  virtual ~InputRedirectionCommand();
+  void readHereDocs() override;
+  void execute() override;
+};
+
+class ChangeDirCommand : public BuiltInCommand
+{
+public:
+  ChangeDirCommand(const char *cmd_line) : BuiltInCommand(cmd_line){};
+  virtual ~ChangeDirCommand() = default;
+  void execute() override;
+};
+
+class GetCurrDirCommand : public BuiltInCommand
+{
+public:
+  GetCurrDirCommand(const char *cmd_line) : BuiltInCommand(cmd_line){};
+  virtual ~GetCurrDirCommand() = default;
+  void execute() override;
+  bool isAsyncSafe() const override { return true; }
+};
+
+class ShowPidCommand : public BuiltInCommand
+{
+private:
+public:
+  ShowPidCommand(const char *cmd_line) : BuiltInCommand(cmd_line){};
+  virtual ~ShowPidCommand() = default;
+  void execute() override;
+  bool isAsyncSafe() const override { return true; }
+};
+
+// Limits for background launches: a cap on running jobs and a token bucket on the launch rate
+class AdmissionControl
+{
+private:
+  // 0 - no limit
+  int max_running;
+  double rate;
+  double burst;
+
+  double tokens;
+  long long refill_time;
+
+  void refill();
+
+public:
+  AdmissionControl();
+  ~AdmissionControl() = default;
+
+  void setLimits(int max_running, double rate, double burst);
+  int getMaxRunning() const;
+  double getRate() const;
+  double getBurst() const;
+
+  bool canLaunch(int running);
+  void consume();
+  // seconds until the bucket holds a launch token again
+  double secondsToToken();
+};
+
+class JobsList;
+class QuitCommand : public BuiltInCommand
+{
+  // A pointer to the JobsList variable in the Smash object
+  JobsList *jobs;
+
+public:
+  QuitCommand(const char *cmd_line, JobsList *jobs) : BuiltInCommand(cmd_line), jobs(jobs){};
+  virtual ~QuitCommand() = default;
+  void execute() override;
+};
+
+class JobsList
+{
+public:
+  class JobEntry
+  {
+  private:
+    // pointer the the command object
+    std::shared_ptr<Command> command;
+
+    // initial time
+    int init_time;
+
+    // boolean that holdes the command Status (stopped/not stopped)
+    bool is_stopped;
+
+    // waiting in the admission queue - no process was launched yet
+    bool is_queued;
+
+    // waiting in the dependency graph for other jobs to finish
+    bool is_waiting;
+
+    // a prerequisite failed - the job never runs
+    bool cancelled;
+
+    // set when the event loop reaped the process
+    bool finished;
+    int exit_status;
+
+  public:
+    // C'TOR & D'TOR
+    JobEntry(std::shared_ptr<Command> command, bool is_stopped) : command(command), init_time(time(NULL)), is_stopped(is_stopped),
+                                                                  is_queued(false), is_waiting(false), cancelled(false), finished(false), exit_status(0){};
+    ~JobEntry() = default;
+
+    //  getters
+    bool getStopped() const;
+    bool isScheduled() const;
+    bool isQueued() const;
+    bool isWaiting() const;
+    bool isCancelled() const;
+    bool isFinished() const;
+    int getExitStatus() const;
+    int getSeconds() const;
+    std::shared_ptr<Command> getCommand() const;
+    int getJobId() const;
+
+    //  setters
+    void setTime();
+    void setStopped(bool is_stopped);
+    void setQueued(bool is_queued);
+    void setWaiting(bool is_waiting);
+    void setCancelled();
+    void setFinished(int status);
+    void mergeStatus(int status);
+
+    //  aux
+    // prints the info of the job according to the format in jobs command
+    void printInfo(int queue_position = 0, const std::string &waiting_for = "") const;
+  };
+
+  // a job started by "after" and the jobs it waits for
+  struct DependencyNode
+  {
+    std::vector<int> prerequisites;
+    std::set<int> remaining;
+    bool on_success;
+    bool failed;
+  };
+
+  std::vector<std::shared_ptr<JobEntry>> jobs;
+
+private:
+  // background launches beyond the limits wait here, by job id
+  AdmissionControl admission;
+  std::deque<int> queue;
+
+  // the dependency graph - waiting and launched "after" jobs by their job id
+  std::map<int, DependencyNode> dependencies;
+
+  // captured output of jobs that left the list, until their job id is reused
+  std::map<int, std::shared_ptr<JobLog>> finished_logs;
+
+  JobEntry *findJob(int jobId);
+  void launch(JobEntry *job);
+  bool membersGone(JobEntry *job, int reaped_pid, bool *lost);
+  bool reapJob(JobEntry *job);
+  void finishJob(JobEntry *job);
+  void settleDependency(int jobId, bool succeeded);
+
+public:
+  JobsList() : jobs(), admission(), queue(), dependencies(), finished_logs(){};
+  ~JobsList() = default;
+
+  //  getters
+  JobEntry *getJobById(int jobId);
+
+  // the jobs a selector ("%3-7", "%running", "%stopped", "%all", "%/regex/") picks, by job id - resolved once
+  // throws: InvaildArgument(cmd) for a malformed selector, NoJobsMatch if it picks no job
+  std::vector<std::shared_ptr<JobEntry>> selectJobs(const std::string &selector, const std::string &cmd);
+  JobEntry *getLastJob(int *lastJobId);
+  JobEntry *getLastStoppedJob(int *jobId);
+  int getMaxId() const;
+  bool isEmpty() const;
+
+  //  aux
+  void addJob(std::shared_ptr<Command> cmd, bool isStopped = false);
+  void removeJobById(int jobId);
+
+  // removes a job a kill signal was sent to - as finished, so its dependents and subscribers see how it ended
+  void killJob(JobEntry *job, int signal_num);
+  void printJobsList();
+  void printDependencyGraph();
+  void killAllJobs();
+
+  // "quit kill --grace N" - SIGTERM to every job at once, SIGKILL to the ones still alive after grace seconds
+  void shutdownJobs(double grace);
+  void removeFinishedJobs();
+
+  //  admission control
+  void submit(std::shared_ptr<Command> cmd);
+  void admitQueued();
+  void removeFromQueue(int jobId);
+  int getQueuePosition(int jobId) const;
+  int getRunningCount() const;
+
+  // jobs by state - running, stopped, queued and waiting
+  void countByState(int *running, int *stopped, int *queued, int *waiting) const;
+  void startNow(JobEntry *job);
+  AdmissionControl &getAdmission();
+
+  //  dependency graph
+  void addDependent(std::shared_ptr<Command> cmd, const std::vector<int> &prerequisites, bool on_success);
+  std::string describeWaiting(int jobId) const;
+
+  // the captured output of a listed or removed job, nullptr if it was not captured
+  std::shared_ptr<JobLog> getLog(int jobId);
+
+  // called from the event loop
+  void markFinished(int pid, int status);
+
+  // marks the background builtins that are done - returns true if job is one of them
+  bool markTaskFinished(JobEntry *job);
+  void markTasksFinished();
+};
+
+// "after <id>[,<id>...] [--on-success] <cmd>" - a background job that starts once the given jobs exit
+class AfterCommand : public BuiltInCommand
+{
+  // A pointer to the JobsList variable in the Smash object
+  JobsList *jobs;
+  std::vector<int> prerequisites;
+  bool on_success;
+  std::shared_ptr<Command> target_cmd;
+
+public:
+  AfterCommand(const char *cmd_line, JobsList *jobs);
+  virtual ~AfterCommand() = default;
+
+  // registers the job in the dependency graph
+  void registerJob(std::shared_ptr<Command> self);
+  void readHereDocs() override { target_cmd->readHereDocs(); }
+
+  // runs the target - called in the forked child
+  void execute() override;
+};
+
+class JobLimitCommand : public BuiltInCommand
+{
+  // A pointer to the JobsList variable in the Smash object
+  JobsList *jobs;
+
+public:
+  JobLimitCommand(const char *cmd_line, JobsList *jobs) : BuiltInCommand(cmd_line), jobs(jobs){};
+  virtual ~JobLimitCommand() = default;
+  void execute() override;
+};
+
+class JobLogCommand : public BuiltInCommand
+{
+  // A pointer to the JobsList variable in the Smash object
+  JobsList *jobs;
+
+  // prints the log until the job closes it or ctrl-C is pressed
+  void follow(std::shared_ptr<JobLog> log, unsigned long long offset);
+
+public:
+  JobLogCommand(const char *cmd_line, JobsList *jobs) : BuiltInCommand(cmd_line), jobs(jobs){};
+  virtual ~JobLogCommand() = default;
+  void execute() override;
+};
+
+class ExportCommand : public BuiltInCommand
+{
+public:
+  ExportCommand(const char *cmd_line) : BuiltInCommand(cmd_line){};
+  virtual ~ExportCommand() = default;
+  void execute() override;
+};
+
+class UnsetCommand : public BuiltInCommand
+{
+public:
+  UnsetCommand(const char *cmd_line) : BuiltInCommand(cmd_line){};
+  virtual ~UnsetCommand() = default;
+  void execute() override;
+};
+
+class JobsCommand : public BuiltInCommand
+{
+  // A pointer to the JobsList variable in the Smash object
+  JobsList *jobs;
+
+public:
+  JobsCommand(const char *cmd_line, JobsList *jobs) : BuiltInCommand(cmd_line), jobs(jobs){};
+  virtual ~JobsCommand() = default;
+  void execute() override;
+};
+
+class ForegroundCommand : public BuiltInCommand
+{
+  // A pointer to the JobsList variable in the Smash object
+  JobsList *jobs;
+
+public:
+  ForegroundCommand(const char *cmd_line, JobsList *jobs) : BuiltInCommand(cmd_line), jobs(jobs){};
+  virtual ~ForegroundCommand() = default;
+  void execute() override;
+};
+
+class BackgroundCommand : public BuiltInCommand
+{
+  // A pointer to the JobsList variable in the Smash object
+  JobsList *jobs;
+
+public:
+  BackgroundCommand(const char *cmd_line, JobsList *jobs) : BuiltInCommand(cmd_line), jobs(jobs){};
+  virtual ~BackgroundCommand() = default;
+  void execute() override;
+};
+
+class ChmodCommand : public BuiltInCommand
+{
+public:
+  ChmodCommand(const char *cmd_line) : BuiltInCommand(cmd_line){};
+  virtual ~ChmodCommand() = default;
+  void execute() override;
+  bool isAsyncSafe() const override { return true; }
+};
+
+class TeeCommand : public BuiltInCommand
+{
+public:
+  TeeCommand(const char *cmd_line) : BuiltInCommand(cmd_line){};
+  virtual ~TeeCommand() = default;
+  void execute() override;
+  bool readsInput() const override { return true; }
+};
+
+class GetFileTypeCommand : public BuiltInCommand
+{
+public:
+  GetFileTypeCommand(const char *cmd_line) : BuiltInCommand(cmd_line){};
+  virtual ~GetFileTypeCommand() = default;
+  void execute() override;
+
+  // getfiletype -r - sizes and counts over a tree
+  void executeRecursive();
+  bool isAsyncSafe() const override { return true; }
+};
+
+class SetcoreCommand : public BuiltInCommand
+{
+  // A pointer to the JobsList variable in the Smash object
+  JobsList *jobs;
+
+public:
+  SetcoreCommand(const char *cmd_line, JobsList *jobs) : BuiltInCommand(cmd_line), jobs(jobs){};
+  virtual ~SetcoreCommand() = default;
+  void execute() override;
+};
+
+class KillCommand : public BuiltInCommand
+{
+  // A pointer to the JobsList variable in the Smash object
+  JobsList *jobs;
+
+public:
+  KillCommand(const char *cmd_line, JobsList *jobs) : BuiltInCommand(cmd_line), jobs(jobs){};
+  virtual ~KillCommand() = default;
+  void execute() override;
+};
+
+class CommandHistory
+{
+private:
+  // a single history line - points either into the mapped log or into session_lines
+  struct Entry
+  {
+    const char *data;
+    int len;
+  };
+
+  // prefix index node - remembers the most recent entry that passes through it
+  struct TrieNode
+  {
+    std::vector<std::pair<char, int>> children;
+    int last;
+  };
+
+  // path of the log file and its append-only descriptor (-1 if history is not persisted)
+  std::string path;
+  int fd;
+
+  // the log is mapped and indexed only on the first lookup
+  bool loaded;
+  char *map_base;
+  size_t map_size;
+
+  // lines added after the log was mapped (a deque never moves its elements)
+  std::deque<std::string> session_lines;
+  std::vector<Entry> entries;
+
+  std::vector<TrieNode> trie;
+  std::unordered_map<unsigned int, std::vector<int>> trigrams;
+
+  void load();
+  void indexEntry(int index);
+  bool matches(int index, const std::string &text) const;
+
+public:
+  CommandHistory();
+  ~CommandHistory();
+
+  void add(const std::string &line);
+  int size();
+  std::string getEntry(int number);
+  int findPrefix(const std::string &prefix);
+  std::vector<int> search(const std::string &text);
+  void printEntry(int number);
+};
+
+class StatsCommand : public BuiltInCommand
+{
+public:
+  StatsCommand(const char *cmd_line) : BuiltInCommand(cmd_line){};
+  virtual ~StatsCommand() = default;
+  void execute() override;
+};
+
+class BenchCommand : public BuiltInCommand
+{
+public:
+  BenchCommand(const char *cmd_line) : BuiltInCommand(cmd_line, true){};
+  virtual ~BenchCommand() = default;
+  void execute() override;
+};
+
+class HistoryCommand : public BuiltInCommand
+{
+  // A pointer to the CommandHistory variable in the Smash object
+  CommandHistory *history;
+
+public:
+  HistoryCommand(const char *cmd_line, CommandHistory *history) : BuiltInCommand(cmd_line, true), history(history){};
+  virtual ~HistoryCommand() = default;
+  void execute() override;
+};
+
+///------------------------------------- Bonus start---------------------------------------------
+
+class TimeoutCommand : public BuiltInCommand
+{
+  int dest_time;
+  int m_pid;
+  std::shared_ptr<Command> target_cmd;
+
+public:
+  explicit TimeoutCommand(const char *cmd_line);
+  virtual ~TimeoutCommand() = default;
+  void readHereDocs() override { target_cmd->readHereDocs(); }
+  void execute() override;
+  int getTime() const;
+  int getTimeoutTargetPid();
+};
+
+// "every <interval> <cmd>" and "at <delay> <cmd>" - launches cmd from the shell's timer
+class ScheduleCommand : public BuiltInCommand
+{
+  // seconds between firings, or before the single firing of "at"
+  int interval;
+  bool repeat;
+  int next_time;
+
+  // the last launched instance and the firing counters
+  int last_pid;
+  int fired;
+  int skipped;
+  std::shared_ptr<Command> target_cmd;
+
+public:
+  ScheduleCommand(const char *cmd_line, bool repeat);
+  virtual ~ScheduleCommand() = default;
+
+  // read once - every firing gets the same here-document
+  void readHereDocs() override { target_cmd->readHereDocs(); }
+
+  // fires the target once, unless its previous instance is still running
+  void execute() override;
+
+  int getNextTime() const;
+  void advance();
+  bool isPending() const;
+  bool isFinished();
+  bool instanceExited(int pid);
+  void cancel(int signal_num);
+  std::string describe() const;
+};
+
+class TimeOutList
+{
+private:
+  int time_to_next;
+  std::shared_ptr<TimeoutCommand> next_cmd;
+  std::list<std::shared_ptr<TimeoutCommand>> time_out_list;
+
+  // "every" / "at" entries share the alarm with the timeouts
+  std::list<std::shared_ptr<ScheduleCommand>> schedules;
+
+  // when the admission queue should be looked at again (-1 - never)
+  int wakeup_time;
+
+public:
+  TimeOutList() : time_to_next(0), next_cmd(nullptr), time_out_list(), schedules(), wakeup_time(-1){};
+  void addToList(std::shared_ptr<TimeoutCommand>);
+  void removeNext();
+  void makeAlarm();
+  void handleSignal();
+  bool isTimeoutDue() const;
+  void removedFinished();
+  void removeCommand(std::shared_ptr<TimeoutCommand>);
+  void addSchedule(std::shared_ptr<ScheduleCommand>);
+  void removeSchedule(std::shared_ptr<ScheduleCommand>);
+  void setWakeup(int when);
+};
+
+/// ---------------------------------------Bonus end-----------------------------------------
+
+//  Implemented as a Singleton design pattern
+// The variables smash exports to the commands it runs, and the envp array execve gets.
+// The array is rebuilt only after a change, so a launch never copies the environment.
+class Environment
+{
+  std::map<std::string, std::string> vars;
+  std::vector<std::string> entries;
+  std::vector<char *> envp;
+  bool dirty;
+
+  void rebuild();
+
+public:
+  // starts from the environment smash was started with
+  Environment();
+  bool get(const std::string &name, std::string *value) const;
+  void set(const std::string &name, const std::string &value);
+  void unset(const std::string &name);
+  const std::map<std::string, std::string> &getAll() const;
+
+  // NAME=value strings, NULL terminated - valid until the next change
+  char **getEnvp();
+
+  static bool isValidName(const std::string &name);
+};
+
+// the longest request line a control client may send, and how much output may wait for a slow one
+#define CONTROL_MAX_LINE (64 * 1024)
+#define CONTROL_MAX_PENDING (1024 * 1024)
+
+// "smash --control <path>" - a unix socket that takes JSON lines, one request and one reply per line:
+//   {"op":"run","line":"sleep 5","background":true}  -> {"ok":true,"status":0,"job":1}
+//   {"op":"jobs"}                                    -> {"ok":true,"jobs":[{"id":1,"pid":...,"cmd":...,"state":...,"seconds":...}]}
+//   {"op":"kill","job":1,"signal":9}                 -> {"ok":true}
+//   {"op":"subscribe"}                               -> {"ok":true}, then {"event":"exit","job":1,...} as jobs leave the list
+// Clients are served from the loop that reads the shell's input, so a foreground command holds them like the terminal.
+class ControlServer
+{
+  struct Client
+  {
+    int fd;
+    std::string input;
+    std::string output;
+    bool subscribed;
+    bool closed;
+  };
+
+  std::string path;
+  int listen_fd;
+  int epoll_fd;
+  int wake_fd[2];
+  int owner_pid;
+  std::map<int, Client> clients;
+
+  // the shell's input - read here instead of by std::cin while the socket is served.
+  // A regular file cannot be watched by epoll, it is always ready.
+  std::string stdin_input;
+  bool stdin_open;
+  bool stdin_polled;
+
+  void accept();
+  void readClient(Client &client);
+  void writeClient(Client &client);
+  void handleRequest(Client &client, const std::string &line);
+
+public:
+  ControlServer() : path(), listen_fd(-1), epoll_fd(-1), wake_fd{-1, -1}, owner_pid(-1), clients(), stdin_input(), stdin_open(true), stdin_polled(false){};
+  ~ControlServer();
+  bool start(const std::string &path);
+  bool isRunning() const;
+
+  // the next line of the shell's input, serving the clients while waiting for it.
+  // At the end of the input it keeps serving them, so smash can run detached with </dev/null.
+  void readLine(std::string *line);
+
+  // async-signal-safe - wakes readLine so that it reports job events
+  void wake();
+
+  // reports a job leaving the list to the subscribed clients - runs on the shell's thread
+  void jobRemoved(const JobsList::JobEntry &job);
+};
+
+// the first bytes of a recording
+#define RECORD_MAGIC "SMREC1\n"
+
+// a replayed line diverges when its latency is off by both this factor and this margin
+#define REPLAY_LATENCY_RATIO (2)
+#define REPLAY_LATENCY_SLACK_MS (50)
+
+// how long the replay waits past the end of the recording for the jobs it saw exit
+#define REPLAY_GRACE_MS (1000)
+
+// Records the lines the shell runs, the signals it gets and the exits of its jobs into a compact
+// binary file, and replays such a file. A record is a type byte followed by LEB128 numbers, the
+// time first (ns since the recording started), and is appended with one write(2) - so the signal
+// handlers record too, without a lock.
+class Recorder
+{
+public:
+  enum RecordType
+  {
+    RECORD_LINE = 1,   // time, length, text
+    RECORD_DONE = 2,   // time, duration, status, the job the line started (0 - none)
+    RECORD_SIGNAL = 3, // time, signal number
+    RECORD_JOB = 4     // time, job id, status
+  };
+
+  struct Record
+  {
+    int type;
+    long long time;
+    long long duration;
+    int status;
+    int job_id;
+    int signal_num;
+    std::string text;
+  };
+
+private:
+  int fd;
+  int owner_pid;
+  long long start_ns;
+
+  // only a line read by the shell is recorded - not the commands of a list or of bench
+  int depth;
+  long long line_start;
+  int line_max_job;
+
+  // while replaying, the exit statuses of the jobs by job id (-1 - not finished), set by the event loop
+  std::vector<int> replay_jobs;
+  bool replaying;
+
+  void append(const char *data, size_t len);
+
+public:
+  Recorder() : fd(-1), owner_pid(-1), start_ns(0), depth(0), line_start(0), line_max_job(0), replay_jobs(), replaying(false){};
+  ~Recorder();
+  bool start(const std::string &path);
+  bool isRecording() const;
+
+  // around SmallShell::executeCommand - the nested calls are not recorded
+  void beginLine(const char *cmd_line);
+  void endLine(int status);
+
+  // async-signal-safe
+  void recordSignal(int signal_num);
+  void recordJob(int job_id, int status);
+
+  static std::vector<Record> load(const std::string &path);
+
+  // runs the lines of a recording, paced by its timestamps (speed 2 - twice as fast, 0 - no pauses),
+  // and reports where the outcomes and the latencies diverge. returns: 0 if nothing diverged, 1 otherwise
+  int replay(const std::string &path, double speed);
+};
+
+// The shell's current and previous directories as O_PATH fds, and the current one's path.
+// pwd reads the cached path, "cd -" is an fchdir, and builtins resolve relative paths against the fd.
+class WorkingDir
+{
+  int current_fd;
+  int previous_fd;
+  std::string current_path;
+  std::string previous_path;
+
+  // guards the paths - a background pwd reads them on a worker thread
+  mutable std::mutex lock;
+
+  void moveTo(int fd, const std::string &path);
+
+public:
+  WorkingDir();
+  ~WorkingDir();
+
+  // an fd of the current directory, for the *at() syscalls
+  int getFd() const;
+  std::string getPath() const;
+  bool hasPrevious() const;
+
+  // throws: SystemCallFailed("chdir")
+  void change(const std::string &dir);
+  void changeToPrevious();
+};
+
+class SmallShell
+{
+private:
+  std::string prompt;
+  WorkingDir working_dir;
+  std::shared_ptr<Command> current_command;
+  JobsList *jobs_list;
+  TimeOutList *timeOutList;
+  CommandHistory *history;
+  OutputBuffer output;
+  ParseCache parse_cache;
+  OutputCapture output_capture;
+  Metrics metrics;
+  Zygote zygote;
+  WorkerPool *worker_pool;
+  Environment environment;
+  ControlServer control;
+  Recorder recorder;
+
+  // the exit status of the last foreground command, for $?
+  int last_status;
+
+  // periodic Prometheus textfile export - no path, no export
+  std::string metrics_path;
+  int metrics_interval;
+  int next_metrics_export;
+
+  // set in a spawned child until its exec - a failed exec writes errno here
+  int exec_report_fd;
+
+  // while not null, the duration (ns) of every fork is appended here (used by bench)
+  std::vector<long long> *fork_samples;
+
+  // set by ctrl-C, polled by builtins that loop
+  volatile sig_atomic_t interrupted;
+
+  // The signal handlers only record what they got and write a byte to this pipe. The work runs
+  // on the shell's thread in processEvents - while it waits for a line or for a foreground command.
+  int event_fd[2];
+  volatile sig_atomic_t child_event;
+  volatile sig_atomic_t alarm_event;
+  // SIGINT or SIGTSTP - for the foreground command
+  volatile sig_atomic_t foreground_signal;
+
+  // a forked copy of smash has no event loop
+  int shell_pid;
+
+  // children the shell waits for itself - a status the event loop reaped first is kept for the wait
+  std::set<int> awaited;
+  std::map<int, int> reaped;
+
+  // the input read ahead of the current line
+  std::string input;
+  bool input_open;
+
+  // the process group the stages forked now join (0 - the next stage starts one),
+  // and the foreground group command that collects their pids
+  int group_pgid;
+  Command *group_cmd;
+
+  // this process is a forked job that runs a pipe or a redirection for the shell
+  bool group_leader;
+  bool group_failed;
+
+  SmallShell();
+
+public:
+  std::shared_ptr<Command> CreateCommand(const char *cmd_line);
+  std::shared_ptr<const ParsedCommand> parseLine(const char *cmd_line, bool count_lookup = true);
+  std::shared_ptr<const ParsedCommand> parseNode(const std::string &line, std::shared_ptr<const SyntaxNode> node);
+  const ParseCache &getParseCache() const;
+  SmallShell(SmallShell const &) = delete;     // disable copy ctor
+  void operator=(SmallShell const &) = delete; // disable = operator
+  static SmallShell &getInstance()             // make SmallShell singleton
+  {
+    static SmallShell instance; // Guaranteed to be destroyed.
+    // Instantiated on first use.
+    return instance;
+  }
+  ~SmallShell();
+
+  //  aux
+  void executeCommand(const char *cmd_line, bool expand = true);
+  WorkingDir &getWorkingDir();
+
+  // the directory relative paths are resolved against - a background builtin's is the one it was started in
+  int getCwdFd() const;
+  std::string getCwdPath() const;
+  void setCurrentCommand(std::shared_ptr<Command>);
+
+  std::shared_ptr<Command> getCurrentCommand() const;
+  void printPrompt();
+  OutputBuffer &getOutput();
+
+  int forkChild();
+  void setForkSamples(std::vector<long long> *samples);
+  void changeChprompt(const char *cmd_line);
+
+  void addJob(std::shared_ptr<Command> cmd, bool is_stopped = false);
+  void addTimeOutCommand(std::shared_ptr<TimeoutCommand>);
+  void removeTimeOutCommand(std::shared_ptr<TimeoutCommand>);
+
+  void handleAlarm();
+  void handleChildExit();
+  void signalForeground(int signal_num);
+
+  // async-signal-safe - notes a signal for processEvents and wakes the loop that waits
+  void postSignal(int signal_num);
+  void processEvents();
+  void waitEvent();
+
+  // wakes the loop that waits from another thread
+  void wake();
+
+  // waitpid(pid, status, WUNTRACED), handling the events of the background jobs meanwhile
+  int waitForeground(int pid, int *status);
+  void awaitChild(int pid);
+  void requestWakeup(int when);
+  int spawn(std::shared_ptr<Command> cmd, bool background = false);
+  OutputCapture &getOutputCapture();
+  Zygote &getZygote();
+  WorkerPool &getWorkerPool();
+  Environment &getEnvironment();
+  ControlServer &getControl();
+  Recorder &getRecorder();
+  JobsList &getJobsList();
+  int getLastStatus() const;
+
+  // the next input line - from the control server's loop when it runs.
+  // returns: false once the input ended, the line is empty then
+  bool readLine(std::string *line);
+  void setLastStatus(int status);
+
+  // replaces $VAR, ${VAR} and $? outside single quotes - the lines of bench, every, at and after are expanded when they run
+  std::string expandVariables(const std::string &cmd_line) const;
+
+  // runs a background builtin on the worker pool - returns the shell's pid, the job has no process
+  int runTask(std::shared_ptr<Command> cmd, std::shared_ptr<JobLog> log, int write_fd);
+  Metrics &getMetrics();
+  void reportExecFailure(int error);
+
+  //  metrics export
+  std::string formatMetrics();
+  void setMetricsExport(const std::string &path, int interval);
+  const std::string &getMetricsPath() const;
+  int getMetricsInterval() const;
+  void exportMetrics();
+
+  //  process groups of pipes and redirections
+  void runGroup(std::shared_ptr<Command> cmd);
+
+  // runs a foreground list node by node, each command as if it was a line of its own
+  void runList(std::shared_ptr<const SyntaxNode> node, bool expand);
+  void runLine(const char *raw_line, std::shared_ptr<const ParsedCommand> parsed, bool expand);
+
+  // runs an and/or chain inside a forked job, its commands as stages of the job's group - returns its status
+  int runChain(const SyntaxNode &node);
+  void leadGroup();
+  void joinGroup();
+  void runStage(Command *cmd);
+  void addGroupMember(int pid);
+  int waitStage(int pid);
+  void requestInterrupt();
+  bool takeInterrupt();
+
+  // whether ctrl-C was pressed since the last takeInterrupt(), without clearing it
+  bool isInterrupted() const;
+  void addSchedule(std::shared_ptr<ScheduleCommand>);
+  void removeSchedule(std::shared_ptr<ScheduleCommand>);
+
+  void removeJob(int job_id);
+
+  bool expandHistory(std::string &cmd_line);
+  void addToHistory(const std::string &cmd_line);
+};
+
+// declaration for signals.cpp
+int signalJob(int pid, int signal_num);
+
+
+
+#endif // SMASH_COMMAND_H_
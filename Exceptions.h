@@ -125,6 +125,102 @@ public:
   }
 };
 
+struct JobIsScheduled : public std::exception
+{
+  std::string error_str;
+
+public:
+  JobIsScheduled(std::string error_type, int job_id) : error_str("smash error: " + error_type + ": job-id " + std::to_string(job_id) + " is a scheduled command") {}
+  const char *what() const noexcept
+  {
+    return error_str.c_str();
+  }
+};
+
+struct JobIsQueued : public std::exception
+{
+  std::string error_str;
+
+public:
+  JobIsQueued(std::string error_type, int job_id) : error_str("smash error: " + error_type + ": job-id " + std::to_string(job_id) + " is queued") {}
+  const char *what() const noexcept
+  {
+    return error_str.c_str();
+  }
+};
+
+struct JobIsWaiting : public std::exception
+{
+  std::string error_str;
+
+public:
+  JobIsWaiting(std::string error_type, int job_id) : error_str("smash error: " + error_type + ": job-id " + std::to_string(job_id) + " is waiting for other jobs") {}
+  const char *what() const noexcept
+  {
+    return error_str.c_str();
+  }
+};
+
+struct JobIsBuiltin : public std::exception
+{
+  std::string error_str;
+
+public:
+  JobIsBuiltin(std::string error_type, int job_id) : error_str("smash error: " + error_type + ": job-id " + std::to_string(job_id) + " is a builtin and cannot be stopped") {}
+  const char *what() const noexcept
+  {
+    return error_str.c_str();
+  }
+};
+
+struct NoJobsMatch : public std::exception
+{
+  std::string error_str;
+
+public:
+  NoJobsMatch(std::string error_type, std::string selector) : error_str("smash error: " + error_type + ": no job matches " + selector) {}
+  const char *what() const noexcept
+  {
+    return error_str.c_str();
+  }
+};
+
+struct SyntaxError : public std::exception
+{
+  std::string error_str;
+
+public:
+  SyntaxError(std::string token) : error_str("smash error: syntax error near unexpected token `" + token + "'") {}
+  const char *what() const noexcept
+  {
+    return error_str.c_str();
+  }
+};
+
+struct HistoryEventNotFound : public std::exception
+{
+  std::string error_str;
+
+public:
+  HistoryEventNotFound(std::string event) : error_str("smash error: " + event + ": event not found") {}
+  const char *what() const noexcept
+  {
+    return error_str.c_str();
+  }
+};
+
+struct BadRecording : public std::exception
+{
+  std::string error_str;
+
+public:
+  BadRecording(std::string path) : error_str("smash error: replay: " + path + ": not a smash recording") {}
+  const char *what() const noexcept
+  {
+    return error_str.c_str();
+  }
+};
+
 struct DefaultError : public std::exception
 {
   std::string error_str;
@@ -0,0 +1,545 @@
+// loadgen - drives smash (and optionally bash and dash) through a pty and measures how it scales:
+// prompt latency, jobs/fg/kill latency and memory with many background jobs, many timeouts,
+// deep pipelines and bursts of ctrl-C / ctrl-Z. The results are printed as CSV.
+//
+//  make load LOADGEN_FLAGS=--compare, or ./bench/loadgen -s ./smash --compare -o load.csv
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <ctime>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <dirent.h>
+#include <signal.h>
+#include <termios.h>
+#include <sys/wait.h>
+
+using namespace std;
+
+// every shell is given the same prompt, so one reader works for all of them
+static const string PROMPT = "smash> ";
+
+static long long monotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static double msSince(long long start)
+{
+    return (monotonicNs() - start) / 1e6;
+}
+
+// how a shell names a job in kill and fg - smash takes the bare id, POSIX shells take %id
+struct Dialect
+{
+    string name;
+    string path;
+    vector<string> argv;
+    bool percent_jobs;
+
+    string job(int id) const
+    {
+        return (percent_jobs ? "%" : "") + to_string(id);
+    }
+};
+
+//<--------------------------- Pty functions--------------------------->
+
+class Session
+{
+    const Dialect &dialect;
+    pid_t pid;
+    int master;
+    string buf;
+    double timeout_ms;
+
+    // reads until the output ends with the prompt, or contains want when it is given
+    bool readUntil(const string &want)
+    {
+        long long start = monotonicNs();
+        while (true)
+        {
+            if (want.empty() ? (buf.size() >= PROMPT.size() && buf.compare(buf.size() - PROMPT.size(), PROMPT.size(), PROMPT) == 0)
+                             : buf.find(want) != string::npos)
+                return true;
+            int left = int(timeout_ms - msSince(start));
+            if (left <= 0)
+                return false;
+            struct pollfd pfd = {master, POLLIN, 0};
+            if (poll(&pfd, 1, left) <= 0)
+                continue;
+            char chunk[65536];
+            ssize_t n = read(master, chunk, sizeof(chunk));
+            if (n <= 0)
+                return false;
+            buf.append(chunk, n);
+        }
+    }
+
+public:
+    Session(const Dialect &dialect, double timeout_ms) : dialect(dialect), pid(-1), master(-1), buf(), timeout_ms(timeout_ms) {}
+
+    ~Session()
+    {
+        stop();
+    }
+
+    bool start()
+    {
+        struct winsize ws;
+        memset(&ws, 0, sizeof(ws));
+        ws.ws_row = 50;
+        ws.ws_col = 200;
+        pid = forkpty(&master, nullptr, nullptr, &ws);
+        if (pid == -1)
+            return false;
+        if (pid == 0)
+        {
+            //  no echo - the output read back is only what the shell printed
+            struct termios tio;
+            tcgetattr(0, &tio);
+            tio.c_lflag &= ~(ECHO | ECHONL);
+            tcsetattr(0, TCSANOW, &tio);
+            setenv("PS1", PROMPT.c_str(), 1);
+            vector<char *> args;
+            for (int i = 0; i < int(dialect.argv.size()); i++)
+                args.push_back(const_cast<char *>(dialect.argv[i].c_str()));
+            args.push_back(nullptr);
+            execv(dialect.path.c_str(), args.data());
+            _exit(127);
+        }
+        return readUntil("");
+    }
+
+    // sends a line and returns the ms until the next prompt, -1 on a timeout
+    double run(const string &line)
+    {
+        buf.clear();
+        long long start = monotonicNs();
+        string with_newline = line + "\n";
+        if (write(master, with_newline.c_str(), with_newline.size()) != ssize_t(with_newline.size()))
+            return -1;
+        return readUntil("") ? msSince(start) : -1;
+    }
+
+    // sends a line and returns the ms until the output contains want, without waiting for a prompt
+    double runUntil(const string &line, const string &want)
+    {
+        buf.clear();
+        long long start = monotonicNs();
+        string with_newline = line + "\n";
+        if (write(master, with_newline.c_str(), with_newline.size()) != ssize_t(with_newline.size()))
+            return -1;
+        return readUntil(want) ? msSince(start) : -1;
+    }
+
+    // sends a line without waiting for anything
+    bool send(const string &line)
+    {
+        buf.clear();
+        string with_newline = line + "\n";
+        return write(master, with_newline.c_str(), with_newline.size()) == ssize_t(with_newline.size());
+    }
+
+    // sends a control character (the terminal turns it into a signal) and returns the ms until the prompt
+    double control(char c)
+    {
+        buf.clear();
+        long long start = monotonicNs();
+        if (write(master, &c, 1) != 1)
+            return -1;
+        return readUntil("") ? msSince(start) : -1;
+    }
+
+    // a field of the shell's /proc status, in kB
+    long statusKb(const string &field) const
+    {
+        ifstream status("/proc/" + to_string(pid) + "/status");
+        string line;
+        while (getline(status, line))
+        {
+            if (line.compare(0, field.size() + 1, field + ":") == 0)
+                return atol(line.c_str() + field.size() + 1);
+        }
+        return -1;
+    }
+
+    // the processes the shell started (they share the session forkpty made), with their names and states
+    vector<pair<pid_t, string> > children(vector<char> *states = nullptr) const
+    {
+        vector<pair<pid_t, string> > found;
+        DIR *proc = opendir("/proc");
+        struct dirent *entry;
+        while (proc != nullptr && (entry = readdir(proc)) != nullptr)
+        {
+            pid_t other = atoi(entry->d_name);
+            if (other <= 0 || other == pid)
+                continue;
+            ifstream stat("/proc/" + string(entry->d_name) + "/stat");
+            string line;
+            getline(stat, line);
+            //  the command name is in parentheses, the fields after it are plain
+            size_t open = line.find('('), close = line.rfind(')');
+            if (open == string::npos || close == string::npos)
+                continue;
+            istringstream fields(line.substr(close + 2));
+            char state;
+            long ppid, pgrp, sid;
+            fields >> state >> ppid >> pgrp >> sid;
+            if (sid != pid)
+                continue;
+            found.push_back(make_pair(other, line.substr(open + 1, close - open - 1)));
+            if (states != nullptr)
+                states->push_back(state);
+        }
+        if (proc != nullptr)
+            closedir(proc);
+        return found;
+    }
+
+    // waits until a process named name runs (is not stopped) in the shell's session
+    bool waitRunning(const string &name)
+    {
+        long long start = monotonicNs();
+        while (msSince(start) < timeout_ms)
+        {
+            vector<char> states;
+            vector<pair<pid_t, string> > found = children(&states);
+            for (int i = 0; i < int(found.size()); i++)
+            {
+                if (found[i].second == name && states[i] != 'T')
+                    return true;
+            }
+            usleep(200);
+        }
+        return false;
+    }
+
+    void stop()
+    {
+        if (pid <= 0)
+            return;
+        vector<pair<pid_t, string> > found = children();
+        for (int i = 0; i < int(found.size()); i++)
+            kill(found[i].first, SIGKILL);
+        kill(pid, SIGKILL);
+        close(master);
+        waitpid(pid, nullptr, 0);
+        pid = -1;
+    }
+};
+
+//<--------------------------- Pty functions - end--------------------------->
+
+//<--------------------------- Report functions--------------------------->
+
+class Report
+{
+    ostream &out;
+
+public:
+    Report(ostream &out) : out(out)
+    {
+        out << "shell,scenario,n,metric,samples,min,median,p95,p99,max,unit\n";
+    }
+
+    void samples(const string &shell, const string &scenario, long n, const string &metric, vector<double> values)
+    {
+        if (values.empty())
+            return;
+        sort(values.begin(), values.end());
+        int count = values.size();
+        out << shell << "," << scenario << "," << n << "," << metric << "," << count << ","
+            << values[0] << "," << values[count / 2] << "," << values[count * 95 / 100] << ","
+            << values[count * 99 / 100] << "," << values[count - 1] << ",ms\n";
+        out.flush();
+    }
+
+    void value(const string &shell, const string &scenario, long n, const string &metric, long value, const string &unit)
+    {
+        out << shell << "," << scenario << "," << n << "," << metric << ",1,"
+            << value << "," << value << "," << value << "," << value << "," << value << "," << unit << "\n";
+        out.flush();
+    }
+
+    void failed(const string &shell, const string &scenario, long n, const string &metric)
+    {
+        out << shell << "," << scenario << "," << n << "," << metric << ",0,,,,,,timeout\n";
+        out.flush();
+    }
+};
+
+//<--------------------------- Report functions - end--------------------------->
+
+//<--------------------------- Scenario functions--------------------------->
+
+struct Options
+{
+    vector<long> jobs;
+    long timeouts;
+    vector<long> pipes;
+    long bursts;
+    int repeats;
+    double timeout_ms;
+    string only;
+};
+
+// runs line count times, false if any of them timed out
+static bool sample(Session &session, Report &report, const Dialect &dialect, const string &scenario, long n,
+                   const string &metric, const string &line, long count)
+{
+    vector<double> values;
+    for (long i = 0; i < count; i++)
+    {
+        double ms = session.run(line);
+        if (ms < 0)
+        {
+            report.failed(dialect.name, scenario, n, metric);
+            return false;
+        }
+        values.push_back(ms);
+    }
+    report.samples(dialect.name, scenario, n, metric, values);
+    return true;
+}
+
+static void memory(Session &session, Report &report, const Dialect &dialect, const string &scenario, long n)
+{
+    report.value(dialect.name, scenario, n, "rss", session.statusKb("VmRSS"), "kB");
+    report.value(dialect.name, scenario, n, "rss_peak", session.statusKb("VmHWM"), "kB");
+}
+
+// fg brings a job back, ctrl-C ends it - fg is timed until the shell prints the job's command
+static void foreground(Session &session, Report &report, const Dialect &dialect, const string &scenario, long n, long repeats, long first_job)
+{
+    vector<double> fg_values, interrupt_values;
+    for (long i = 0; i < repeats; i++)
+    {
+        double fg_ms = session.runUntil("fg " + dialect.job(first_job + i), "sleep");
+        //  lets the shell hand the job the terminal before the signal arrives
+        usleep(2000);
+        double interrupt_ms = fg_ms < 0 ? -1 : session.control('\x03');
+        if (fg_ms < 0 || interrupt_ms < 0)
+        {
+            report.failed(dialect.name, scenario, n, "fg");
+            return;
+        }
+        fg_values.push_back(fg_ms);
+        interrupt_values.push_back(interrupt_ms);
+    }
+    report.samples(dialect.name, scenario, n, "fg", fg_values);
+    report.samples(dialect.name, scenario, n, "fg_ctrl_c", interrupt_values);
+}
+
+// n concurrent background jobs, then the latency of the prompt, jobs, kill and fg among them
+static void jobsScenario(const Dialect &dialect, Report &report, const Options &options, long n)
+{
+    Session session(dialect, options.timeout_ms);
+    if (!session.start())
+    {
+        report.failed(dialect.name, "jobs", n, "start");
+        return;
+    }
+    if (!sample(session, report, dialect, "jobs", n, "launch", "sleep 1000&", n))
+        return;
+    sample(session, report, dialect, "jobs", n, "prompt", "", options.repeats);
+    sample(session, report, dialect, "jobs", n, "jobs", "jobs", options.repeats);
+    //  half of the jobs at most are killed, the next ones are brought to the foreground
+    long kills = min<long>(options.repeats, n / 2);
+    vector<double> kill_values;
+    for (long i = 1; i <= kills; i++)
+        kill_values.push_back(session.run("kill -9 " + dialect.job(i)));
+    if (find(kill_values.begin(), kill_values.end(), -1) != kill_values.end())
+        report.failed(dialect.name, "jobs", n, "kill");
+    else
+        report.samples(dialect.name, "jobs", n, "kill", kill_values);
+    foreground(session, report, dialect, "jobs", n, min<long>(options.repeats, n - kills), kills + 1);
+    memory(session, report, dialect, "jobs", n);
+}
+
+// many commands waiting on a timeout at once
+static void timeoutsScenario(const Dialect &dialect, Report &report, const Options &options)
+{
+    long n = options.timeouts;
+    Session session(dialect, options.timeout_ms);
+    if (!session.start())
+    {
+        report.failed(dialect.name, "timeouts", n, "start");
+        return;
+    }
+    if (!sample(session, report, dialect, "timeouts", n, "launch", "timeout 1000 sleep 1000&", n))
+        return;
+    sample(session, report, dialect, "timeouts", n, "prompt", "", options.repeats);
+    sample(session, report, dialect, "timeouts", n, "jobs", "jobs", options.repeats);
+    memory(session, report, dialect, "timeouts", n);
+}
+
+// echo x | cat | cat ... with depth stages
+static void pipesScenario(const Dialect &dialect, Report &report, const Options &options, long depth)
+{
+    Session session(dialect, options.timeout_ms);
+    if (!session.start())
+    {
+        report.failed(dialect.name, "pipes", depth, "start");
+        return;
+    }
+    string line = "echo x";
+    for (long i = 1; i < depth; i++)
+        line += " | cat";
+    sample(session, report, dialect, "pipes", depth, "pipeline", line, options.repeats);
+    memory(session, report, dialect, "pipes", depth);
+}
+
+// back to back ctrl-C and ctrl-Z of a foreground command, timed from the key to the prompt
+static void signalsScenario(const Dialect &dialect, Report &report, const Options &options)
+{
+    long n = options.bursts;
+    Session session(dialect, options.timeout_ms);
+    if (!session.start())
+    {
+        report.failed(dialect.name, "signals", n, "start");
+        return;
+    }
+    const char keys[] = {'\x03', '\x1a'};
+    const char *metrics[] = {"ctrl_c", "ctrl_z"};
+    for (int k = 0; k < 2; k++)
+    {
+        vector<double> values;
+        for (long i = 0; i < n; i++)
+        {
+            //  sleep 1000 without & prints nothing - it is seen in /proc instead
+            session.send("sleep 1000");
+            double ms = session.waitRunning("sleep") ? (usleep(1000), session.control(keys[k])) : -1;
+            if (ms < 0)
+            {
+                report.failed(dialect.name, "signals", n, metrics[k]);
+                return;
+            }
+            values.push_back(ms);
+        }
+        report.samples(dialect.name, "signals", n, metrics[k], values);
+    }
+    sample(session, report, dialect, "signals", n, "jobs", "jobs", options.repeats);
+    memory(session, report, dialect, "signals", n);
+}
+
+//<--------------------------- Scenario functions - end--------------------------->
+
+static vector<long> parseList(const string &list)
+{
+    vector<long> values;
+    stringstream in(list);
+    string item;
+    while (getline(in, item, ','))
+        values.push_back(atol(item.c_str()));
+    return values;
+}
+
+static void usage()
+{
+    cerr << "usage: loadgen [-s <smash>] [--compare] [-o <csv>] [--only jobs|timeouts|pipes|signals]\n"
+            "               [--jobs 10,100,1000,10000] [--timeouts 2000] [--pipes 4,16,64] [--bursts 50]\n"
+            "               [--repeats 20] [--timeout <secs per command>]\n";
+}
+
+int main(int argc, char *argv[])
+{
+    //  the shells are run with job control on a pty of our own
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGTTOU, SIG_IGN);
+
+    string smash_path = "./smash", out_path;
+    bool compare = false;
+    Options options;
+    options.jobs = parseList("10,100,1000,10000");
+    options.timeouts = 2000;
+    options.pipes = parseList("4,16,64");
+    options.bursts = 50;
+    options.repeats = 20;
+    options.timeout_ms = 30000;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--compare")
+            compare = true;
+        else if (arg == "-s" && has_value)
+            smash_path = argv[++i];
+        else if (arg == "-o" && has_value)
+            out_path = argv[++i];
+        else if (arg == "--only" && has_value)
+            options.only = argv[++i];
+        else if (arg == "--jobs" && has_value)
+            options.jobs = parseList(argv[++i]);
+        else if (arg == "--timeouts" && has_value)
+            options.timeouts = atol(argv[++i]);
+        else if (arg == "--pipes" && has_value)
+            options.pipes = parseList(argv[++i]);
+        else if (arg == "--bursts" && has_value)
+            options.bursts = atol(argv[++i]);
+        else if (arg == "--repeats" && has_value)
+            options.repeats = max(1, atoi(argv[++i]));
+        else if (arg == "--timeout" && has_value)
+            options.timeout_ms = atof(argv[++i]) * 1000;
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+
+    vector<Dialect> shells;
+    Dialect smash = {"smash", smash_path, {smash_path}, false};
+    shells.push_back(smash);
+    if (compare)
+    {
+        //  the same script against the shells that are installed
+        Dialect bash = {"bash", "/bin/bash", {"bash", "--norc", "--noprofile", "--noediting", "-i"}, true};
+        Dialect dash = {"dash", "/bin/dash", {"dash", "-i"}, true};
+        if (access(bash.path.c_str(), X_OK) == 0)
+            shells.push_back(bash);
+        if (access(dash.path.c_str(), X_OK) == 0)
+            shells.push_back(dash);
+    }
+
+    ofstream file;
+    if (!out_path.empty())
+    {
+        file.open(out_path);
+        if (!file)
+        {
+            perror(out_path.c_str());
+            return 1;
+        }
+    }
+    Report report(out_path.empty() ? cout : file);
+    for (int s = 0; s < int(shells.size()); s++)
+    {
+        const Dialect &dialect = shells[s];
+        if (options.only.empty() || options.only == "jobs")
+        {
+            for (int i = 0; i < int(options.jobs.size()); i++)
+                jobsScenario(dialect, report, options, options.jobs[i]);
+        }
+        if (options.only.empty() || options.only == "timeouts")
+            timeoutsScenario(dialect, report, options);
+        if (options.only.empty() || options.only == "pipes")
+        {
+            for (int i = 0; i < int(options.pipes.size()); i++)
+                pipesScenario(dialect, report, options, options.pipes[i]);
+        }
+        if (options.only.empty() || options.only == "signals")
+            signalsScenario(dialect, report, options);
+    }
+    return 0;
+}
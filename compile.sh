@@ -2,4 +2,4 @@
 
 #compiling files into executable
 echo "Compiling files..."
-g++ -std=c++11 -Wall *.cpp -o smash
+g++ -std=c++11 -Wall -pthread *.cpp -o smash
@@ -1,8 +1,9 @@
-#ifndef SMASH__SIGNALS_H_
-#define SMASH__SIGNALS_H_
-
-void ctrlZHandler(int sig_num);
-void ctrlCHandler(int sig_num);
-void alarmHandler(int sig_num);
-
-#endif //SMASH__SIGNALS_H_
+#ifndef SMASH__SIGNALS_H_
+#define SMASH__SIGNALS_H_
+
+void ctrlZHandler(int sig_num);
+void ctrlCHandler(int sig_num);
+void alarmHandler(int sig_num);
+void childHandler(int sig_num);
+
+#endif //SMASH__SIGNALS_H_
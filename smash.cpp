@@ -1,53 +1,132 @@
-#include <iostream>
-#include <unistd.h>
-#include <sys/wait.h>
-#include <signal.h>
-#include "Commands.h"
-#include "signals.h"
-// #include "Exeptions.h"
-
-extern char *strsignal(int sig);
-
-int main(int argc, char *argv[])
-{
-    if (signal(SIGTSTP, ctrlZHandler) == SIG_ERR)
-    {
-        perror("smash error: failed to set ctrl-Z handler");
-    }
-    if (signal(SIGINT, ctrlCHandler) == SIG_ERR)
-    {
-        perror("smash error: failed to set ctrl-C handler");
-    }
-
-    struct sigaction new_action;
-    new_action.sa_handler = &alarmHandler;
-    new_action.sa_flags = SA_RESTART;
-    // sigemptyset(&new_action.sa_mask); // שני השורות האלה פותרים בעיה שיש בvalgrind
-    // sigaddset(&new_action.sa_mask, SIGINT);
-    if (sigaction(SIGALRM, &new_action, NULL) < 0)
-        perror("smash error: failed to set alarm");
-
-    // TODO: setup sig alarm handler
-
-    SmallShell &smash = SmallShell::getInstance();
-    while (true)
-    {
-        smash.printPrompt();
-        std::string cmd_line;
-        std::getline(std::cin, cmd_line);
-        try
-        {
-            smash.executeCommand(cmd_line.c_str());
-        }
-        catch (SystemCallFailed &e)
-        {
-            perror(e.what());
-        }
-        catch (std::exception &e)
-        {
-            std::cerr << e.what()<<std::endl;
-        }
-    }
-
-    return 0;
-}
+#include <iostream>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include "Commands.h"
+#include "signals.h"
+// #include "Exeptions.h"
+
+extern char *strsignal(int sig);
+
+int main(int argc, char *argv[])
+{
+    // the zygote is forked first, while the shell's image is still small
+    SmallShell &smash = SmallShell::getInstance();
+    const char *zygote_env = getenv("SMASH_ZYGOTE");
+    bool use_zygote = zygote_env != nullptr && std::string(zygote_env) == "1";
+    for (int i = 1; i < argc; i++)
+        use_zygote = use_zygote || std::string(argv[i]) == "--zygote";
+    if (use_zygote && !smash.getZygote().start())
+        perror("smash error: failed to start the zygote");
+
+    // "--control <path>" or SMASH_CONTROL=<path> - serve the control socket from the input loop
+    const char *control_env = getenv("SMASH_CONTROL");
+    std::string control_path = control_env != nullptr ? control_env : "";
+    for (int i = 1; i + 1 < argc; i++)
+    {
+        if (std::string(argv[i]) == "--control")
+            control_path = argv[i + 1];
+    }
+    if (!control_path.empty() && !smash.getControl().start(control_path))
+        perror("smash error: failed to start the control socket");
+
+    // "--record <path>" or SMASH_RECORD=<path> - the lines, signals and job exits go to a recording.
+    // "--replay <path> [--speed N]" runs a recording instead of the input and reports the divergences
+    const char *record_env = getenv("SMASH_RECORD");
+    std::string record_path = record_env != nullptr ? record_env : "";
+    std::string replay_path;
+    double speed = 1;
+    for (int i = 1; i + 1 < argc; i++)
+    {
+        if (std::string(argv[i]) == "--record")
+            record_path = argv[i + 1];
+        else if (std::string(argv[i]) == "--replay")
+            replay_path = argv[i + 1];
+        else if (std::string(argv[i]) == "--speed")
+        {
+            char *end = nullptr;
+            speed = strtod(argv[i + 1], &end);
+            if (*end != 0 || speed < 0)
+            {
+                std::cerr << "smash error: --speed: invalid arguments" << std::endl;
+                return 1;
+            }
+        }
+    }
+    if (!record_path.empty() && !smash.getRecorder().start(record_path))
+        perror("smash error: failed to start the recording");
+
+    if (signal(SIGTSTP, ctrlZHandler) == SIG_ERR)
+    {
+        perror("smash error: failed to set ctrl-Z handler");
+    }
+    if (signal(SIGINT, ctrlCHandler) == SIG_ERR)
+    {
+        perror("smash error: failed to set ctrl-C handler");
+    }
+
+    struct sigaction new_action;
+    new_action.sa_handler = &alarmHandler;
+    new_action.sa_flags = SA_RESTART;
+    // sigemptyset(&new_action.sa_mask); // שני השורות האלה פותרים בעיה שיש בvalgrind
+    // sigaddset(&new_action.sa_mask, SIGINT);
+    if (sigaction(SIGALRM, &new_action, NULL) < 0)
+        perror("smash error: failed to set alarm");
+
+    // wakes the event loop, which reaps background jobs and starts queued ones.
+    // A stop wakes it too - a foreground wait sees ctrl-Z stop its command
+    struct sigaction child_action;
+    child_action.sa_handler = &childHandler;
+    child_action.sa_flags = SA_RESTART;
+    sigemptyset(&child_action.sa_mask);
+    sigaddset(&child_action.sa_mask, SIGALRM);
+    if (sigaction(SIGCHLD, &child_action, NULL) < 0)
+        perror("smash error: failed to set child handler");
+
+    if (!replay_path.empty())
+    {
+        try
+        {
+            exit(smash.getRecorder().replay(replay_path, speed));
+        }
+        catch (SystemCallFailed &e)
+        {
+            perror(e.what());
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << e.what() << std::endl;
+        }
+        exit(1);
+    }
+
+    while (true)
+    {
+        smash.printPrompt();
+        std::string cmd_line;
+        smash.readLine(&cmd_line);
+        try
+        {
+            // echo the line a history designator expanded to, like bash does
+            if (smash.expandHistory(cmd_line))
+                smash.getOutput() << cmd_line << "\n";
+            smash.addToHistory(cmd_line);
+            smash.executeCommand(cmd_line.c_str());
+        }
+        catch (SystemCallFailed &e)
+        {
+            smash.setLastStatus(W_EXITCODE(1, 0));
+            smash.getOutput().flush();
+            perror(e.what());
+        }
+        catch (std::exception &e)
+        {
+            smash.setLastStatus(W_EXITCODE(1, 0));
+            smash.getOutput().flush();
+            std::cerr << e.what()<<std::endl;
+        }
+    }
+
+    return 0;
+}